@@ -2,6 +2,7 @@
 @ stdcall InitOnceExecuteOnce(ptr ptr ptr ptr)
 @ stdcall GetFileInformationByHandleEx(long long ptr long)
 @ stdcall -ret64 GetTickCount64()
+@ stdcall GetQueuedCompletionStatusEx(ptr ptr long ptr long long)
 
 @ stdcall InitializeSRWLock(ptr)
 @ stdcall AcquireSRWLockExclusive(ptr)
@@ -914,6 +914,244 @@ WSPSendTo(SOCKET Handle,
     return MsafdReturnWithErrno(Status, lpErrno, IOSB->Information, lpNumberOfBytesSent);
 }
 
+/* WSAMMSG arrays are handed to AFD as they are */
+C_ASSERT(sizeof(WSAMMSG) == sizeof(AFD_DATAGRAM_MSG));
+C_ASSERT(FIELD_OFFSET(WSAMMSG, name) == FIELD_OFFSET(AFD_DATAGRAM_MSG, Address));
+C_ASSERT(FIELD_OFFSET(WSAMMSG, namelen) == FIELD_OFFSET(AFD_DATAGRAM_MSG, AddressLength));
+C_ASSERT(FIELD_OFFSET(WSAMMSG, dwBytes) == FIELD_OFFSET(AFD_DATAGRAM_MSG, Length));
+C_ASSERT(FIELD_OFFSET(WSAMMSG, dwFlags) == FIELD_OFFSET(AFD_DATAGRAM_MSG, Flags));
+
+static
+NTSTATUS
+SockTransferDatagrams(IN PSOCKET_INFORMATION Socket,
+                      IN ULONG IoControlCode,
+                      IN LPWSAMMSG lpMessages,
+                      IN DWORD dwMessageCount,
+                      IN ULONG TdiFlags,
+                      OUT LPDWORD lpTransferred)
+{
+    AFD_DATAGRAMS_INFO DatagramsInfo;
+    IO_STATUS_BLOCK IOSB;
+    NTSTATUS Status = STATUS_SUCCESS;
+    DWORD Count;
+
+    *lpTransferred = 0;
+
+    while (*lpTransferred < dwMessageCount)
+    {
+        Count = min(dwMessageCount - *lpTransferred, AFD_MAX_DATAGRAM_BATCH);
+
+        DatagramsInfo.Messages = (PAFD_DATAGRAM_MSG)&lpMessages[*lpTransferred];
+        DatagramsInfo.MessageCount = Count;
+        DatagramsInfo.AfdFlags = AFD_IMMEDIATE;
+        DatagramsInfo.TdiFlags = TdiFlags;
+
+        /* AFD completes batches inline, so no event is needed */
+        Status = NtDeviceIoControlFile((HANDLE)Socket->Handle,
+                                       NULL,
+                                       NULL,
+                                       NULL,
+                                       &IOSB,
+                                       IoControlCode,
+                                       &DatagramsInfo,
+                                       sizeof(DatagramsInfo),
+                                       NULL,
+                                       0);
+        if (Status == STATUS_PENDING)
+        {
+            NtWaitForSingleObject((HANDLE)Socket->Handle, FALSE, NULL);
+            Status = IOSB.Status;
+        }
+
+        if (!NT_SUCCESS(Status))
+            break;
+
+        *lpTransferred += (DWORD)IOSB.Information;
+
+        /* A short batch means the receive queue ran dry or a send failed */
+        if (IOSB.Information < Count || (TdiFlags & TDI_RECEIVE_PEEK))
+            break;
+    }
+
+    return Status;
+}
+
+INT
+WSPAPI
+WSPRecvMMsg(IN SOCKET Handle,
+            IN OUT LPWSAMMSG lpMessages,
+            IN DWORD dwMessageCount,
+            IN DWORD dwFlags)
+{
+    PSOCKET_INFORMATION Socket;
+    NTSTATUS Status;
+    DWORD Received = 0, Batch = 0, BytesRead, ReceiveFlags;
+    ULONG TdiFlags;
+    INT Errno;
+
+    /* Get the Socket Structure associate to this Socket */
+    Socket = GetSocketStructure(Handle);
+    if (!Socket)
+    {
+        SetLastError(WSAENOTSOCK);
+        return SOCKET_ERROR;
+    }
+    if (!lpMessages || dwMessageCount == 0)
+    {
+        SetLastError(WSAEFAULT);
+        return SOCKET_ERROR;
+    }
+    if (!(Socket->SharedData->ServiceFlags1 & XP1_CONNECTIONLESS) ||
+        (dwFlags & ~MSG_PEEK))
+    {
+        SetLastError(WSAEOPNOTSUPP);
+        return SOCKET_ERROR;
+    }
+    if (Socket->SharedData->State == SocketOpen)
+    {
+        SetLastError(WSAEINVAL);
+        return SOCKET_ERROR;
+    }
+
+    TdiFlags = (dwFlags & MSG_PEEK) ? TDI_RECEIVE_PEEK : TDI_RECEIVE_NORMAL;
+
+    Status = SockTransferDatagrams(Socket,
+                                   IOCTL_AFD_RECV_DATAGRAMS,
+                                   lpMessages,
+                                   dwMessageCount,
+                                   TdiFlags,
+                                   &Received);
+
+    if (Status == STATUS_CANT_WAIT && Received == 0 &&
+        !Socket->SharedData->NonBlocking)
+    {
+        /* Blocking sockets wait for the first datagram only, then
+         * collect whatever else is already queued */
+        ReceiveFlags = dwFlags;
+        if (WSPRecvFrom(Handle,
+                        &lpMessages[0].buf,
+                        1,
+                        &BytesRead,
+                        &ReceiveFlags,
+                        lpMessages[0].name,
+                        lpMessages[0].name ? &lpMessages[0].namelen : NULL,
+                        NULL,
+                        NULL,
+                        NULL,
+                        &Errno) == SOCKET_ERROR)
+        {
+            if (Errno != WSAEMSGSIZE)
+            {
+                SetLastError(Errno);
+                return SOCKET_ERROR;
+            }
+            BytesRead = lpMessages[0].buf.len;
+            ReceiveFlags = MSG_PARTIAL;
+        }
+
+        lpMessages[0].dwBytes = BytesRead;
+        lpMessages[0].dwFlags = ReceiveFlags & MSG_PARTIAL;
+        Received = 1;
+
+        if (dwMessageCount > 1 && !(dwFlags & MSG_PEEK))
+        {
+            SockTransferDatagrams(Socket,
+                                  IOCTL_AFD_RECV_DATAGRAMS,
+                                  &lpMessages[1],
+                                  dwMessageCount - 1,
+                                  TdiFlags,
+                                  &Batch);
+            Received += Batch;
+        }
+        Status = STATUS_SUCCESS;
+    }
+
+    SockReenableAsyncSelectEvent(Socket, FD_READ);
+
+    if (Received == 0)
+    {
+        SetLastError(TranslateNtStatusError(Status));
+        return SOCKET_ERROR;
+    }
+
+    return (INT)Received;
+}
+
+INT
+WSPAPI
+WSPSendMMsg(IN SOCKET Handle,
+            IN OUT LPWSAMMSG lpMessages,
+            IN DWORD dwMessageCount,
+            IN DWORD dwFlags)
+{
+    PSOCKET_INFORMATION Socket;
+    NTSTATUS Status;
+    DWORD Sent = 0;
+    PSOCKADDR BindAddress;
+    INT BindAddressLength;
+    INT Errno;
+
+    /* Get the Socket Structure associate to this Socket */
+    Socket = GetSocketStructure(Handle);
+    if (!Socket)
+    {
+        SetLastError(WSAENOTSOCK);
+        return SOCKET_ERROR;
+    }
+    if (!lpMessages || dwMessageCount == 0)
+    {
+        SetLastError(WSAEFAULT);
+        return SOCKET_ERROR;
+    }
+    if (!(Socket->SharedData->ServiceFlags1 & XP1_CONNECTIONLESS) || dwFlags)
+    {
+        SetLastError(WSAEOPNOTSUPP);
+        return SOCKET_ERROR;
+    }
+
+    /* Bind us First */
+    if (Socket->SharedData->State == SocketOpen)
+    {
+        /* Get the Wildcard Address */
+        BindAddressLength = Socket->HelperData->MaxWSAddressLength;
+        BindAddress = HeapAlloc(GlobalHeap, 0, BindAddressLength);
+        if (!BindAddress)
+        {
+            SetLastError(WSAENOBUFS);
+            return SOCKET_ERROR;
+        }
+
+        Socket->HelperData->WSHGetWildcardSockaddr(Socket->HelperContext,
+                                                   BindAddress,
+                                                   &BindAddressLength);
+        /* Bind it */
+        if (WSPBind(Handle, BindAddress, BindAddressLength, &Errno) == SOCKET_ERROR)
+        {
+            HeapFree(GlobalHeap, 0, BindAddress);
+            SetLastError(Errno);
+            return SOCKET_ERROR;
+        }
+        HeapFree(GlobalHeap, 0, BindAddress);
+    }
+
+    Status = SockTransferDatagrams(Socket,
+                                   IOCTL_AFD_SEND_DATAGRAMS,
+                                   lpMessages,
+                                   dwMessageCount,
+                                   0,
+                                   &Sent);
+
+    SockReenableAsyncSelectEvent(Socket, FD_WRITE);
+
+    if (Sent == 0)
+    {
+        SetLastError(TranslateNtStatusError(Status));
+        return SOCKET_ERROR;
+    }
+
+    return (INT)Sent;
+}
+
 INT
 WSPAPI
 WSPRecvDisconnect(IN  SOCKET s,
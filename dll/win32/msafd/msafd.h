@@ -28,6 +28,7 @@
 #include <tdi.h>
 #include <afd/shared.h>
 #include <mswsock.h>
+#include <reactos/winsock/mswinsock.h>
 
 #include <wine/debug.h>
 WINE_DEFAULT_DEBUG_CHANNEL(msafd);
@@ -469,6 +470,22 @@ WSPGetAcceptExSockaddrs(
     OUT struct sockaddr **RemoteSockaddr,
     OUT LPINT RemoteSockaddrLength);
 
+INT
+WSPAPI
+WSPRecvMMsg(
+    IN SOCKET Handle,
+    IN OUT LPWSAMMSG lpMessages,
+    IN DWORD dwMessageCount,
+    IN DWORD dwFlags);
+
+INT
+WSPAPI
+WSPSendMMsg(
+    IN SOCKET Handle,
+    IN OUT LPWSAMMSG lpMessages,
+    IN DWORD dwMessageCount,
+    IN DWORD dwFlags);
+
 PSOCKET_INFORMATION GetSocketStructure(
 	SOCKET Handle
 );
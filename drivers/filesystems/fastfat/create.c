@@ -176,6 +176,28 @@ FindFile(
             ExFreePoolWithTag(PathNameBuffer, TAG_NAME);
             return Status;
         }
+
+        /* Names are unique: if the directory index has it, it is the only match */
+        if (!IsFatX)
+        {
+            ULONG FirstIndex = DirContext->DirIndex;
+
+            Status = vfatDirIndexLookup(DeviceExt, Parent, FileToFindU, DirContext);
+            if (Status == STATUS_SUCCESS || Status == STATUS_OBJECT_NAME_NOT_FOUND)
+            {
+                if (Status != STATUS_SUCCESS || DirContext->DirIndex < FirstIndex)
+                {
+                    Status = STATUS_NO_MORE_ENTRIES;
+                }
+                ExFreePoolWithTag(PathNameBuffer, TAG_NAME);
+                return Status;
+            }
+
+            /* No index, scan the directory */
+            DirContext->DirIndex = FirstIndex;
+            DirContext->LongNameU.Length = 0;
+            DirContext->ShortNameU.Length = 0;
+        }
     }
 
     /* FsRtlIsNameInExpression need the searched string to be upcase,
@@ -264,7 +264,7 @@ vfatFindDirSpace(
     OUT PULONG start)
 {
     LARGE_INTEGER FileOffset;
-    ULONG i, count, size, nbFree = 0;
+    ULONG i, count, size, nbFree = 0, firstFree = MAXULONG;
     PDIR_ENTRY pFatEntry = NULL;
     PVOID Context = NULL;
     NTSTATUS Status;
@@ -285,7 +285,16 @@ vfatFindDirSpace(
 
     count = pDirFcb->RFCB.FileSize.u.LowPart / SizeDirEntry;
     size = DeviceExt->FatInfo.BytesPerCluster / SizeDirEntry;
-    for (i = 0; i < count; i++, pFatEntry = (PDIR_ENTRY)((ULONG_PTR)pFatEntry + SizeDirEntry))
+
+    /* The name index knows where the in-use entries at the start of the directory end */
+    i = 0;
+    if (pDirFcb->NameIndex != NULL)
+    {
+        i = min(pDirFcb->NameIndex->FreeHint, count);
+        FileOffset.u.LowPart = (i / size) * DeviceExt->FatInfo.BytesPerCluster;
+    }
+
+    for (; i < count; i++, pFatEntry = (PDIR_ENTRY)((ULONG_PTR)pFatEntry + SizeDirEntry))
     {
         if (Context == NULL || (i % size) == 0)
         {
@@ -303,14 +312,17 @@ vfatFindDirSpace(
             }
             _SEH2_END;
 
+            pFatEntry = (PDIR_ENTRY)((ULONG_PTR)pFatEntry + (i % size) * SizeDirEntry);
             FileOffset.u.LowPart += DeviceExt->FatInfo.BytesPerCluster;
         }
         if (ENTRY_END(IsFatX, pFatEntry))
         {
+            firstFree = min(firstFree, i);
             break;
         }
         if (ENTRY_DELETED(IsFatX, pFatEntry))
         {
+            firstFree = min(firstFree, i);
             nbFree++;
         }
         else
@@ -394,6 +406,18 @@ vfatFindDirSpace(
             CcUnpinData(Context);
         }
     }
+    if (pDirFcb->NameIndex != NULL)
+    {
+        /* Skip the new entries if there was no hole in front of them */
+        if (firstFree == MAXULONG || firstFree >= *start)
+        {
+            pDirFcb->NameIndex->FreeHint = *start + nbSlots;
+        }
+        else
+        {
+            pDirFcb->NameIndex->FreeHint = firstFree;
+        }
+    }
     DPRINT("nbSlots %u nbFree %u, entry number %u\n", nbSlots, nbFree, *start);
     return TRUE;
 }
@@ -763,6 +787,8 @@ FATAddEntry(
     CcSetDirtyPinnedData(Context, NULL);
     CcUnpinData(Context);
 
+    vfatDirIndexAdd(ParentFcb, &DirContext);
+
     if (MoveContext != NULL)
     {
         /* We're modifying an existing FCB - likely rename/move */
@@ -977,6 +1003,7 @@ FATDelEntry(
 
     DPRINT("delEntry PathName \'%wZ\'\n", &pFcb->PathNameU);
     DPRINT("delete entry: %u to %u\n", pFcb->startIndex, pFcb->dirIndex);
+    vfatDirIndexRemove(pFcb->parentFcb, pFcb);
     Offset.u.HighPart = 0;
     for (i = pFcb->startIndex; i <= pFcb->dirIndex; i++)
     {
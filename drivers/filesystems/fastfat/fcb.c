@@ -151,7 +151,8 @@ vfatNewFCB(
     ExInitializeResourceLite(&rcFCB->PagingIoResource);
     ExInitializeResourceLite(&rcFCB->MainResource);
     FsRtlInitializeFileLock(&rcFCB->FileLock, NULL, NULL);
-    ExInitializeFastMutex(&rcFCB->LastMutex);
+    ExInitializeFastMutex(&rcFCB->McbMutex);
+    FsRtlInitializeLargeMcb(&rcFCB->Mcb, PagedPool);
     rcFCB->RFCB.PagingIoResource = &rcFCB->PagingIoResource;
     rcFCB->RFCB.Resource = &rcFCB->MainResource;
     rcFCB->RFCB.IsFastIoPossible = FastIoIsNotPossible;
@@ -277,12 +278,14 @@ vfatDestroyFCB(
 #endif
 
     FsRtlUninitializeFileLock(&pFCB->FileLock);
+    FsRtlUninitializeLargeMcb(&pFCB->Mcb);
 
     if (!vfatFCBIsRoot(pFCB) &&
         !BooleanFlagOn(pFCB->Flags, FCB_IS_FAT) && !BooleanFlagOn(pFCB->Flags, FCB_IS_VOLUME))
     {
         RemoveEntryList(&pFCB->ParentListEntry);
     }
+    vfatFreeDirIndex(pFCB);
     ExFreePool(pFCB->PathNameBuffer);
     ExDeleteResourceLite(&pFCB->PagingIoResource);
     ExDeleteResourceLite(&pFCB->MainResource);
@@ -787,6 +790,382 @@ vfatAttachFCBToFileObject(
     return STATUS_SUCCESS;
 }
 
+/*
+ * Directory name index
+ *
+ * Opening a name that has no FCB yet means reading the whole directory and
+ * assembling the long name of each entry, so that creating n files in one
+ * directory costs O(n^2). Once a directory has been searched, the long and
+ * short names it contains are hashed to the index of their short entry, and
+ * a lookup only reads back the entries whose hash matches. The index is built
+ * lazily, kept up to date by dirwr.c, and simply dropped (to be rebuilt by
+ * the next lookup) whenever it can't be. Like the directory itself, it is
+ * protected by the DirResource.
+ */
+
+#define VFAT_DIR_INDEX_MIN_BUCKETS 64
+
+static
+ULONG
+vfatDirIndexHash(
+    PUNICODE_STRING NameU)
+{
+    PWCHAR last;
+    PWCHAR curr;
+    register WCHAR c;
+    ULONG hash = 0;
+
+    /* Must agree with RtlEqualUnicodeString(..., TRUE) */
+    curr = NameU->Buffer;
+    last = NameU->Buffer + NameU->Length / sizeof(WCHAR);
+
+    while(curr < last)
+    {
+        c = RtlUpcaseUnicodeChar(*curr++);
+        hash = (hash + (c << 4) + (c >> 4)) * 11;
+    }
+    return hash;
+}
+
+VOID
+vfatFreeDirIndex(
+    PVFATFCB pDirFcb)
+{
+    PVFAT_DIR_INDEX Index = pDirFcb->NameIndex;
+    PVFAT_DIR_INDEX_ENTRY Entry, Next;
+    ULONG i;
+
+    if (Index == NULL)
+    {
+        return;
+    }
+
+    for (i = 0; i < Index->BucketCount; i++)
+    {
+        for (Entry = Index->Buckets[i]; Entry != NULL; Entry = Next)
+        {
+            Next = Entry->Next;
+            ExFreeToPagedLookasideList(&VfatGlobalData->DirIndexLookasideList, Entry);
+        }
+    }
+
+    ExFreePoolWithTag(Index->Buckets, TAG_DIR_INDEX);
+    ExFreePoolWithTag(Index, TAG_DIR_INDEX);
+    pDirFcb->NameIndex = NULL;
+}
+
+static
+VOID
+vfatDirIndexGrow(
+    PVFAT_DIR_INDEX Index)
+{
+    PVFAT_DIR_INDEX_ENTRY *Buckets;
+    PVFAT_DIR_INDEX_ENTRY Entry, Next;
+    ULONG BucketCount, i;
+
+    BucketCount = Index->BucketCount * 4;
+    Buckets = ExAllocatePoolWithTag(PagedPool, BucketCount * sizeof(PVFAT_DIR_INDEX_ENTRY), TAG_DIR_INDEX);
+    if (Buckets == NULL)
+    {
+        /* Longer chains, but still correct */
+        return;
+    }
+    RtlZeroMemory(Buckets, BucketCount * sizeof(PVFAT_DIR_INDEX_ENTRY));
+
+    for (i = 0; i < Index->BucketCount; i++)
+    {
+        for (Entry = Index->Buckets[i]; Entry != NULL; Entry = Next)
+        {
+            Next = Entry->Next;
+            Entry->Next = Buckets[Entry->Hash % BucketCount];
+            Buckets[Entry->Hash % BucketCount] = Entry;
+        }
+    }
+
+    ExFreePoolWithTag(Index->Buckets, TAG_DIR_INDEX);
+    Index->Buckets = Buckets;
+    Index->BucketCount = BucketCount;
+}
+
+static
+BOOLEAN
+vfatDirIndexInsert(
+    PVFAT_DIR_INDEX Index,
+    PUNICODE_STRING NameU,
+    ULONG DirIndex)
+{
+    PVFAT_DIR_INDEX_ENTRY Entry;
+
+    Entry = ExAllocateFromPagedLookasideList(&VfatGlobalData->DirIndexLookasideList);
+    if (Entry == NULL)
+    {
+        return FALSE;
+    }
+
+    if (Index->EntryCount >= Index->BucketCount * 2)
+    {
+        vfatDirIndexGrow(Index);
+    }
+
+    Entry->Hash = vfatDirIndexHash(NameU);
+    Entry->DirIndex = DirIndex;
+    Entry->Next = Index->Buckets[Entry->Hash % Index->BucketCount];
+    Index->Buckets[Entry->Hash % Index->BucketCount] = Entry;
+    Index->EntryCount++;
+
+    return TRUE;
+}
+
+/* Long names are always there, short ones only when they differ */
+static
+BOOLEAN
+vfatDirIndexInsertNames(
+    PVFAT_DIR_INDEX Index,
+    PVFAT_DIRENTRY_CONTEXT DirContext)
+{
+    if (!vfatDirIndexInsert(Index, &DirContext->LongNameU, DirContext->DirIndex))
+    {
+        return FALSE;
+    }
+
+    if (DirContext->ShortNameU.Length != 0 &&
+        !RtlEqualUnicodeString(&DirContext->LongNameU, &DirContext->ShortNameU, TRUE))
+    {
+        return vfatDirIndexInsert(Index, &DirContext->ShortNameU, DirContext->DirIndex);
+    }
+
+    return TRUE;
+}
+
+static
+NTSTATUS
+vfatBuildDirIndex(
+    PDEVICE_EXTENSION pDeviceExt,
+    PVFATFCB pDirFcb)
+{
+    NTSTATUS Status;
+    PVOID Context = NULL;
+    PVOID Page = NULL;
+    BOOLEAN First = TRUE;
+    PVFAT_DIR_INDEX Index;
+    VFAT_DIRENTRY_CONTEXT DirContext;
+    WCHAR LongNameBuffer[260];
+    WCHAR ShortNameBuffer[13];
+    ULONG NextIndex = 0;
+
+    Index = ExAllocatePoolWithTag(PagedPool, sizeof(VFAT_DIR_INDEX), TAG_DIR_INDEX);
+    if (Index == NULL)
+    {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    /* Start with about one bucket per 8.3 entry of the directory */
+    Index->BucketCount = max(pDirFcb->RFCB.FileSize.u.LowPart / sizeof(FAT_DIR_ENTRY), VFAT_DIR_INDEX_MIN_BUCKETS);
+    Index->EntryCount = 0;
+    Index->FreeHint = MAXULONG;
+    Index->Buckets = ExAllocatePoolWithTag(PagedPool, Index->BucketCount * sizeof(PVFAT_DIR_INDEX_ENTRY), TAG_DIR_INDEX);
+    if (Index->Buckets == NULL)
+    {
+        ExFreePoolWithTag(Index, TAG_DIR_INDEX);
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+    RtlZeroMemory(Index->Buckets, Index->BucketCount * sizeof(PVFAT_DIR_INDEX_ENTRY));
+    pDirFcb->NameIndex = Index;
+
+    DirContext.DirIndex = 0;
+    DirContext.LongNameU.Buffer = LongNameBuffer;
+    DirContext.LongNameU.Length = 0;
+    DirContext.LongNameU.MaximumLength = sizeof(LongNameBuffer);
+    DirContext.ShortNameU.Buffer = ShortNameBuffer;
+    DirContext.ShortNameU.Length = 0;
+    DirContext.ShortNameU.MaximumLength = sizeof(ShortNameBuffer);
+    DirContext.DeviceExt = pDeviceExt;
+
+    while (TRUE)
+    {
+        Status = VfatGetNextDirEntry(pDeviceExt, &Context, &Page, pDirFcb, &DirContext, First);
+        First = FALSE;
+        if (Status == STATUS_NO_MORE_ENTRIES)
+        {
+            break;
+        }
+        if (!NT_SUCCESS(Status))
+        {
+            vfatFreeDirIndex(pDirFcb);
+            return Status;
+        }
+
+        /* Deleted entries are skipped, which leaves a hole before the long name */
+        if (DirContext.StartIndex != NextIndex && Index->FreeHint == MAXULONG)
+        {
+            Index->FreeHint = NextIndex;
+        }
+        NextIndex = DirContext.DirIndex + 1;
+
+        if (!FAT_ENTRY_VOLUME(&DirContext.DirEntry.Fat) &&
+            DirContext.LongNameU.Length != 0 && DirContext.ShortNameU.Length != 0 &&
+            !vfatDirIndexInsertNames(Index, &DirContext))
+        {
+            if (Context != NULL)
+            {
+                CcUnpinData(Context);
+            }
+            vfatFreeDirIndex(pDirFcb);
+            return STATUS_INSUFFICIENT_RESOURCES;
+        }
+
+        DirContext.DirIndex++;
+    }
+
+    /* Otherwise, the first free entry is the end of the directory */
+    if (Index->FreeHint == MAXULONG)
+    {
+        Index->FreeHint = NextIndex;
+    }
+
+    DPRINT("Indexed %u names of %wZ, free from %u\n", Index->EntryCount, &pDirFcb->PathNameU, Index->FreeHint);
+    return STATUS_SUCCESS;
+}
+
+/*
+ * Returns STATUS_OBJECT_NAME_NOT_FOUND only when the name is not in the
+ * directory; on any other failure, the caller has to scan the directory.
+ */
+NTSTATUS
+vfatDirIndexLookup(
+    PDEVICE_EXTENSION pDeviceExt,
+    PVFATFCB pDirFcb,
+    PUNICODE_STRING FileToFindU,
+    PVFAT_DIRENTRY_CONTEXT DirContext)
+{
+    NTSTATUS Status;
+    PVOID Context;
+    PVOID Page = NULL;
+    PVFAT_DIR_INDEX_ENTRY Entry;
+    ULONG Hash;
+
+    ASSERT(ExIsResourceAcquiredExclusive(&pDeviceExt->DirResource));
+    ASSERT(!vfatVolumeIsFatX(pDeviceExt));
+
+    if (pDirFcb->NameIndex == NULL)
+    {
+        Status = vfatBuildDirIndex(pDeviceExt, pDirFcb);
+        if (!NT_SUCCESS(Status))
+        {
+            return Status;
+        }
+    }
+
+    Hash = vfatDirIndexHash(FileToFindU);
+    for (Entry = pDirFcb->NameIndex->Buckets[Hash % pDirFcb->NameIndex->BucketCount];
+         Entry != NULL;
+         Entry = Entry->Next)
+    {
+        if (Entry->Hash != Hash)
+        {
+            continue;
+        }
+
+        /* Starting at the short entry, the long name in front of it is read as well */
+        Context = NULL;
+        DirContext->DirIndex = Entry->DirIndex;
+        Status = VfatGetNextDirEntry(pDeviceExt, &Context, &Page, pDirFcb, DirContext, TRUE);
+        if (Context != NULL)
+        {
+            CcUnpinData(Context);
+        }
+
+        if (!NT_SUCCESS(Status) || DirContext->DirIndex != Entry->DirIndex)
+        {
+            DPRINT1("Name index of %wZ is out of date at %u\n", &pDirFcb->PathNameU, Entry->DirIndex);
+            vfatFreeDirIndex(pDirFcb);
+            return STATUS_UNSUCCESSFUL;
+        }
+
+        if (RtlEqualUnicodeString(FileToFindU, &DirContext->LongNameU, TRUE) ||
+            RtlEqualUnicodeString(FileToFindU, &DirContext->ShortNameU, TRUE))
+        {
+            return STATUS_SUCCESS;
+        }
+    }
+
+    return STATUS_OBJECT_NAME_NOT_FOUND;
+}
+
+/* DirContext describes an entry that was just written to the directory */
+VOID
+vfatDirIndexAdd(
+    PVFATFCB pDirFcb,
+    PVFAT_DIRENTRY_CONTEXT DirContext)
+{
+    PVFAT_DIR_INDEX Index = pDirFcb->NameIndex;
+
+    if (Index == NULL)
+    {
+        return;
+    }
+
+    if (!vfatDirIndexInsertNames(Index, DirContext))
+    {
+        vfatFreeDirIndex(pDirFcb);
+    }
+}
+
+static
+BOOLEAN
+vfatDirIndexDelete(
+    PVFAT_DIR_INDEX Index,
+    PUNICODE_STRING NameU,
+    ULONG DirIndex)
+{
+    PVFAT_DIR_INDEX_ENTRY *Link, Entry;
+    ULONG Hash;
+
+    Hash = vfatDirIndexHash(NameU);
+    for (Link = &Index->Buckets[Hash % Index->BucketCount]; *Link != NULL; Link = &(*Link)->Next)
+    {
+        Entry = *Link;
+        if (Entry->Hash == Hash && Entry->DirIndex == DirIndex)
+        {
+            *Link = Entry->Next;
+            Index->EntryCount--;
+            ExFreeToPagedLookasideList(&VfatGlobalData->DirIndexLookasideList, Entry);
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+/* pFcb's entries are being deleted from the directory */
+VOID
+vfatDirIndexRemove(
+    PVFATFCB pDirFcb,
+    PVFATFCB pFcb)
+{
+    PVFAT_DIR_INDEX Index = pDirFcb->NameIndex;
+
+    if (Index == NULL)
+    {
+        return;
+    }
+
+    if (!vfatDirIndexDelete(Index, &pFcb->LongNameU, pFcb->dirIndex))
+    {
+        /* The FCB doesn't tell the names we indexed: start over */
+        vfatFreeDirIndex(pDirFcb);
+        return;
+    }
+
+    if (pFcb->ShortNameU.Length != 0 &&
+        !RtlEqualUnicodeString(&pFcb->LongNameU, &pFcb->ShortNameU, TRUE))
+    {
+        vfatDirIndexDelete(Index, &pFcb->ShortNameU, pFcb->dirIndex);
+    }
+
+    Index->FreeHint = min(Index->FreeHint, pFcb->startIndex);
+}
+
 NTSTATUS
 vfatDirFindFile(
     PDEVICE_EXTENSION pDeviceExt,
@@ -824,6 +1203,25 @@ vfatDirFindFile(
     DirContext.ShortNameU.MaximumLength = sizeof(ShortNameBuffer);
     DirContext.DeviceExt = pDeviceExt;
 
+    if (!IsFatX)
+    {
+        status = vfatDirIndexLookup(pDeviceExt, pDirectoryFCB, FileToFindU, &DirContext);
+        if (status == STATUS_SUCCESS)
+        {
+            return vfatMakeFCBFromDirEntry(pDeviceExt,
+                                           pDirectoryFCB,
+                                           &DirContext,
+                                           pFoundFCB);
+        }
+        if (status == STATUS_OBJECT_NAME_NOT_FOUND)
+        {
+            return status;
+        }
+
+        /* No index, scan the directory */
+        DirContext.DirIndex = 0;
+    }
+
     while (TRUE)
     {
         status = VfatGetNextDirEntry(pDeviceExt,
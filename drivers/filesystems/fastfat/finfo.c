@@ -1250,7 +1250,7 @@ VfatSetAllocationSizeInformation(
         AllocSizeChanged = TRUE;
         if (FirstCluster == 0)
         {
-            Fcb->LastCluster = Fcb->LastOffset = 0;
+            vfatTruncateFileRuns(Fcb, 0);
             Status = NextCluster(DeviceExt, FirstCluster, &FirstCluster, TRUE);
             if (!NT_SUCCESS(Status))
             {
@@ -1300,39 +1300,23 @@ VfatSetAllocationSizeInformation(
         }
         else
         {
-            if (Fcb->LastCluster > 0)
-            {
-                if (Fcb->RFCB.AllocationSize.u.LowPart - ClusterSize == Fcb->LastOffset)
-                {
-                    Cluster = Fcb->LastCluster;
-                    Status = STATUS_SUCCESS;
-                }
-                else
-                {
-                    Status = OffsetToCluster(DeviceExt, Fcb->LastCluster,
-                                             Fcb->RFCB.AllocationSize.u.LowPart - ClusterSize - Fcb->LastOffset,
-                                             &Cluster, FALSE);
-                }
-            }
-            else
-            {
-                Status = OffsetToCluster(DeviceExt, FirstCluster,
-                                         Fcb->RFCB.AllocationSize.u.LowPart - ClusterSize,
-                                         &Cluster, FALSE);
-            }
-
+            Status = vfatGetFileRun(DeviceExt, Fcb, FirstCluster,
+                                    Fcb->RFCB.AllocationSize.u.LowPart / ClusterSize - 1, 1,
+                                    &Cluster, &NCluster);
             if (!NT_SUCCESS(Status))
             {
                 return Status;
             }
-
-            Fcb->LastCluster = Cluster;
-            Fcb->LastOffset = Fcb->RFCB.AllocationSize.u.LowPart - ClusterSize;
+            if (Cluster == 0xffffffff)
+            {
+                return STATUS_FILE_CORRUPT_ERROR;
+            }
 
             /* FIXME: Check status */
             /* Cluster points now to the last cluster within the chain */
             Status = OffsetToCluster(DeviceExt, Cluster,
-                                     ROUND_DOWN(NewSize - 1, ClusterSize) - Fcb->LastOffset,
+                                     ROUND_DOWN(NewSize - 1, ClusterSize) -
+                                     (Fcb->RFCB.AllocationSize.u.LowPart - ClusterSize),
                                      &NCluster, TRUE);
             if (NCluster == 0xffffffff || !NT_SUCCESS(Status))
             {
@@ -1364,14 +1348,13 @@ VfatSetAllocationSizeInformation(
         DPRINT("Can set file size\n");
 
         AllocSizeChanged = TRUE;
-        /* FIXME: Use the cached cluster/offset better way. */
-        Fcb->LastCluster = Fcb->LastOffset = 0;
+        vfatTruncateFileRuns(Fcb, ROUND_UP(NewSize, ClusterSize) / ClusterSize);
         UpdateFileSize(FileObject, Fcb, NewSize, ClusterSize, vfatVolumeIsFatX(DeviceExt));
         if (NewSize > 0)
         {
-            Status = OffsetToCluster(DeviceExt, FirstCluster,
-                                     ROUND_DOWN(NewSize - 1, ClusterSize),
-                                     &Cluster, FALSE);
+            Status = vfatGetFileRun(DeviceExt, Fcb, FirstCluster,
+                                    ROUND_DOWN(NewSize - 1, ClusterSize) / ClusterSize, 1,
+                                    &Cluster, &NCluster);
 
             NCluster = Cluster;
             Status = NextCluster(DeviceExt, FirstCluster, &NCluster, FALSE);
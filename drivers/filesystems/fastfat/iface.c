@@ -144,6 +144,8 @@ DriverEntry(
                                     NULL, NULL, 0, sizeof(VFAT_IRP_CONTEXT), TAG_IRP, 0);
     ExInitializePagedLookasideList(&VfatGlobalData->CloseContextLookasideList,
                                    NULL, NULL, 0, sizeof(VFAT_CLOSE_CONTEXT), TAG_CLOSE, 0);
+    ExInitializePagedLookasideList(&VfatGlobalData->DirIndexLookasideList,
+                                   NULL, NULL, 0, sizeof(VFAT_DIR_INDEX_ENTRY), TAG_DIR_INDEX, 0);
 
     ExInitializeResourceLite(&VfatGlobalData->VolumeListLock);
     InitializeListHead(&VfatGlobalData->VolumeListHead);
@@ -113,6 +113,155 @@ OffsetToCluster(
    }
 }
 
+/*
+ * Return the cluster at ClusterIndex within the file, and how many clusters,
+ * up to ClusterCount, follow it contiguously on the disk. The FAT chain is
+ * only walked once: the runs found on the way are kept in the FCB's MCB.
+ */
+NTSTATUS
+vfatGetFileRun(
+    PDEVICE_EXTENSION DeviceExt,
+    PVFATFCB Fcb,
+    ULONG FirstCluster,
+    ULONG ClusterIndex,
+    ULONG ClusterCount,
+    PULONG Cluster,
+    PULONG RunLength)
+{
+    NTSTATUS Status = STATUS_SUCCESS;
+    ULONG CurrentCluster, RunIndex, RunCluster, RunCount;
+    LONGLONG Lbn, Count;
+
+    ASSERT(FirstCluster >= 2);
+    ASSERT(ClusterCount > 0);
+
+    ExAcquireFastMutex(&Fcb->McbMutex);
+
+    if (ClusterIndex + ClusterCount > Fcb->McbClusters)
+    {
+        /* Go on from the last cluster we know, collecting contiguous clusters in one run */
+        if (Fcb->McbClusters == 0)
+        {
+            CurrentCluster = FirstCluster;
+            RunCount = 1;
+        }
+        else
+        {
+            CurrentCluster = Fcb->McbLastCluster;
+            RunCount = 0;
+        }
+        RunIndex = Fcb->McbClusters;
+        RunCluster = CurrentCluster;
+
+        while (RunIndex + RunCount < ClusterIndex + ClusterCount)
+        {
+            Status = GetNextCluster(DeviceExt, CurrentCluster, &CurrentCluster);
+            if (!NT_SUCCESS(Status) || CurrentCluster == 0xffffffff || CurrentCluster < 2)
+            {
+                break;
+            }
+
+            if (RunCount != 0 && CurrentCluster == RunCluster + RunCount)
+            {
+                RunCount++;
+                continue;
+            }
+
+            if (RunCount != 0)
+            {
+                if (!FsRtlAddLargeMcbEntry(&Fcb->Mcb, RunIndex, RunCluster, RunCount))
+                {
+                    Status = STATUS_INSUFFICIENT_RESOURCES;
+                    break;
+                }
+                RunIndex += RunCount;
+                Fcb->McbClusters = RunIndex;
+                Fcb->McbLastCluster = RunCluster + RunCount - 1;
+            }
+            RunCluster = CurrentCluster;
+            RunCount = 1;
+        }
+
+        if (NT_SUCCESS(Status) && RunCount != 0)
+        {
+            if (FsRtlAddLargeMcbEntry(&Fcb->Mcb, RunIndex, RunCluster, RunCount))
+            {
+                Fcb->McbClusters = RunIndex + RunCount;
+                Fcb->McbLastCluster = RunCluster + RunCount - 1;
+            }
+            else
+            {
+                Status = STATUS_INSUFFICIENT_RESOURCES;
+            }
+        }
+    }
+
+    if (NT_SUCCESS(Status))
+    {
+        if (ClusterIndex < Fcb->McbClusters &&
+            FsRtlLookupLargeMcbEntry(&Fcb->Mcb, ClusterIndex, &Lbn, &Count, NULL, NULL, NULL) &&
+            Lbn != -1)
+        {
+            *Cluster = (ULONG)Lbn;
+            *RunLength = (ULONG)min(Count, ClusterCount);
+        }
+        else
+        {
+            /* The chain is shorter than that */
+            *Cluster = 0xffffffff;
+            *RunLength = 0;
+        }
+    }
+
+    ExReleaseFastMutex(&Fcb->McbMutex);
+
+#ifdef DEBUG_VERIFY_OFFSET_CACHING
+    /* DEBUG VERIFICATION */
+    if (NT_SUCCESS(Status) && *Cluster != 0xffffffff)
+    {
+        ULONG CorrectCluster;
+        OffsetToCluster(DeviceExt, FirstCluster,
+                        ClusterIndex * DeviceExt->FatInfo.BytesPerCluster,
+                        &CorrectCluster, FALSE);
+        if (CorrectCluster != *Cluster)
+            KeBugCheck(FAT_FILE_SYSTEM);
+    }
+#endif
+
+    return Status;
+}
+
+/*
+ * Forget the runs past the first ClusterCount clusters of the file, which
+ * are about to be freed.
+ */
+VOID
+vfatTruncateFileRuns(
+    PVFATFCB Fcb,
+    ULONG ClusterCount)
+{
+    LONGLONG Lbn;
+
+    ExAcquireFastMutex(&Fcb->McbMutex);
+    if (ClusterCount < Fcb->McbClusters)
+    {
+        FsRtlTruncateLargeMcb(&Fcb->Mcb, ClusterCount);
+        Fcb->McbClusters = ClusterCount;
+        Fcb->McbLastCluster = 0;
+        if (ClusterCount != 0 &&
+            FsRtlLookupLargeMcbEntry(&Fcb->Mcb, ClusterCount - 1, &Lbn, NULL, NULL, NULL, NULL))
+        {
+            Fcb->McbLastCluster = (ULONG)Lbn;
+        }
+        else
+        {
+            FsRtlResetLargeMcb(&Fcb->Mcb, FALSE);
+            Fcb->McbClusters = 0;
+        }
+    }
+    ExReleaseFastMutex(&Fcb->McbMutex);
+}
+
 /*
  * FUNCTION: Reads data from a file
  */
@@ -124,20 +273,16 @@ VfatReadFileData(
     LARGE_INTEGER ReadOffset,
     PULONG LengthRead)
 {
-    ULONG CurrentCluster;
     ULONG FirstCluster;
     ULONG StartCluster;
     ULONG ClusterCount;
     LARGE_INTEGER StartOffset;
     PDEVICE_EXTENSION DeviceExt;
-    BOOLEAN First = TRUE;
     PVFATFCB Fcb;
     NTSTATUS Status;
     ULONG BytesDone;
     ULONG BytesPerSector;
     ULONG BytesPerCluster;
-    ULONG LastCluster;
-    ULONG LastOffset;
 
     /* PRECONDITION */
     ASSERT(IrpContext);
@@ -194,8 +339,7 @@ VfatReadFileData(
     }
 
     /* Find the first cluster */
-    FirstCluster =
-    CurrentCluster = vfatDirEntryGetFirstCluster (DeviceExt, &Fcb->entry);
+    FirstCluster = vfatDirEntryGetFirstCluster (DeviceExt, &Fcb->entry);
 
     if (FirstCluster == 1)
     {
@@ -215,87 +359,25 @@ VfatReadFileData(
         return Status;
     }
 
-    ExAcquireFastMutex(&Fcb->LastMutex);
-    LastCluster = Fcb->LastCluster;
-    LastOffset = Fcb->LastOffset;
-    ExReleaseFastMutex(&Fcb->LastMutex);
-
-    /* Find the cluster to start the read from */
-    if (LastCluster > 0 && ReadOffset.u.LowPart >= LastOffset)
-    {
-        Status = OffsetToCluster(DeviceExt, LastCluster,
-                                 ROUND_DOWN(ReadOffset.u.LowPart, BytesPerCluster) -
-                                 LastOffset,
-                                 &CurrentCluster, FALSE);
-#ifdef DEBUG_VERIFY_OFFSET_CACHING
-        /* DEBUG VERIFICATION */
-        {
-            ULONG CorrectCluster;
-            OffsetToCluster(DeviceExt, FirstCluster,
-                            ROUND_DOWN(ReadOffset.u.LowPart, BytesPerCluster),
-                            &CorrectCluster, FALSE);
-            if (CorrectCluster != CurrentCluster)
-                KeBugCheck(FAT_FILE_SYSTEM);
-        }
-#endif
-    }
-    else
-    {
-        Status = OffsetToCluster(DeviceExt, FirstCluster,
-                                 ROUND_DOWN(ReadOffset.u.LowPart, BytesPerCluster),
-                                 &CurrentCluster, FALSE);
-    }
-
-    if (!NT_SUCCESS(Status))
-    {
-        return Status;
-    }
-
-    ExAcquireFastMutex(&Fcb->LastMutex);
-    Fcb->LastCluster = CurrentCluster;
-    Fcb->LastOffset = ROUND_DOWN (ReadOffset.u.LowPart, BytesPerCluster);
-    ExReleaseFastMutex(&Fcb->LastMutex);
-
     KeInitializeEvent(&IrpContext->Event, NotificationEvent, FALSE);
     IrpContext->RefCount = 1;
 
-    while (Length > 0 && CurrentCluster != 0xffffffff)
+    while (Length > 0)
     {
-        StartCluster = CurrentCluster;
-        StartOffset.QuadPart = ClusterToSector(DeviceExt, StartCluster) * BytesPerSector;
-        BytesDone = 0;
-        ClusterCount = 0;
-
-        do
+        /* Find the run of clusters to read from */
+        BytesDone = ReadOffset.u.LowPart % BytesPerCluster;
+        Status = vfatGetFileRun(DeviceExt, Fcb, FirstCluster,
+                                ReadOffset.u.LowPart / BytesPerCluster,
+                                ROUND_UP(BytesDone + Length, BytesPerCluster) / BytesPerCluster,
+                                &StartCluster, &ClusterCount);
+        if (!NT_SUCCESS(Status) || StartCluster == 0xffffffff)
         {
-            ClusterCount++;
-            if (First)
-            {
-                BytesDone =  min (Length, BytesPerCluster - (ReadOffset.u.LowPart % BytesPerCluster));
-                StartOffset.QuadPart += ReadOffset.u.LowPart % BytesPerCluster;
-                First = FALSE;
-            }
-            else
-            {
-                if (Length - BytesDone > BytesPerCluster)
-                {
-                    BytesDone += BytesPerCluster;
-                }
-                else
-                {
-                    BytesDone = Length;
-                }
-            }
-            Status = NextCluster(DeviceExt, FirstCluster, &CurrentCluster, FALSE);
+            break;
         }
-        while (StartCluster + ClusterCount == CurrentCluster && NT_SUCCESS(Status) && Length > BytesDone);
-        DPRINT("start %08x, next %08x, count %u\n",
-               StartCluster, CurrentCluster, ClusterCount);
+        DPRINT("start %08x, count %u\n", StartCluster, ClusterCount);
 
-        ExAcquireFastMutex(&Fcb->LastMutex);
-        Fcb->LastCluster = StartCluster + (ClusterCount - 1);
-        Fcb->LastOffset = ROUND_DOWN(ReadOffset.u.LowPart, BytesPerCluster) + (ClusterCount - 1) * BytesPerCluster;
-        ExReleaseFastMutex(&Fcb->LastMutex);
+        StartOffset.QuadPart = ClusterToSector(DeviceExt, StartCluster) * BytesPerSector + BytesDone;
+        BytesDone = min(Length, ClusterCount * BytesPerCluster - BytesDone);
 
         /* Fire up the read command */
         Status = VfatReadDiskPartial (IrpContext, &StartOffset, BytesDone, *LengthRead, FALSE);
@@ -339,18 +421,14 @@ VfatWriteFileData(
     PVFATFCB Fcb;
     ULONG Count;
     ULONG FirstCluster;
-    ULONG CurrentCluster;
     ULONG BytesDone;
     ULONG StartCluster;
     ULONG ClusterCount;
     NTSTATUS Status = STATUS_SUCCESS;
-    BOOLEAN First = TRUE;
     ULONG BytesPerSector;
     ULONG BytesPerCluster;
     LARGE_INTEGER StartOffset;
     ULONG BufferOffset;
-    ULONG LastCluster;
-    ULONG LastOffset;
 
     /* PRECONDITION */
     ASSERT(IrpContext);
@@ -415,8 +493,7 @@ VfatWriteFileData(
     /*
      * Find the first cluster
      */
-    FirstCluster =
-    CurrentCluster = vfatDirEntryGetFirstCluster (DeviceExt, &Fcb->entry);
+    FirstCluster = vfatDirEntryGetFirstCluster (DeviceExt, &Fcb->entry);
 
     if (FirstCluster == 1)
     {
@@ -428,89 +505,25 @@ VfatWriteFileData(
         return Status;
     }
 
-    ExAcquireFastMutex(&Fcb->LastMutex);
-    LastCluster = Fcb->LastCluster;
-    LastOffset = Fcb->LastOffset;
-    ExReleaseFastMutex(&Fcb->LastMutex);
-
-    /*
-     * Find the cluster to start the write from
-     */
-    if (LastCluster > 0 && WriteOffset.u.LowPart >= LastOffset)
-    {
-        Status = OffsetToCluster(DeviceExt, LastCluster,
-                                 ROUND_DOWN(WriteOffset.u.LowPart, BytesPerCluster) -
-                                 LastOffset,
-                                 &CurrentCluster, FALSE);
-#ifdef DEBUG_VERIFY_OFFSET_CACHING
-        /* DEBUG VERIFICATION */
-        {
-            ULONG CorrectCluster;
-            OffsetToCluster(DeviceExt, FirstCluster,
-                            ROUND_DOWN(WriteOffset.u.LowPart, BytesPerCluster),
-                            &CorrectCluster, FALSE);
-            if (CorrectCluster != CurrentCluster)
-                KeBugCheck(FAT_FILE_SYSTEM);
-        }
-#endif
-    }
-    else
-    {
-        Status = OffsetToCluster(DeviceExt, FirstCluster,
-                                 ROUND_DOWN(WriteOffset.u.LowPart, BytesPerCluster),
-                                 &CurrentCluster, FALSE);
-    }
-
-    if (!NT_SUCCESS(Status))
-    {
-        return Status;
-    }
-
-    ExAcquireFastMutex(&Fcb->LastMutex);
-    Fcb->LastCluster = CurrentCluster;
-    Fcb->LastOffset = ROUND_DOWN (WriteOffset.u.LowPart, BytesPerCluster);
-    ExReleaseFastMutex(&Fcb->LastMutex);
-
     IrpContext->RefCount = 1;
     BufferOffset = 0;
 
-    while (Length > 0 && CurrentCluster != 0xffffffff)
+    while (Length > 0)
     {
-        StartCluster = CurrentCluster;
-        StartOffset.QuadPart = ClusterToSector(DeviceExt, StartCluster) * BytesPerSector;
-        BytesDone = 0;
-        ClusterCount = 0;
-
-        do
+        /* Find the run of clusters to write to */
+        BytesDone = WriteOffset.u.LowPart % BytesPerCluster;
+        Status = vfatGetFileRun(DeviceExt, Fcb, FirstCluster,
+                                WriteOffset.u.LowPart / BytesPerCluster,
+                                ROUND_UP(BytesDone + Length, BytesPerCluster) / BytesPerCluster,
+                                &StartCluster, &ClusterCount);
+        if (!NT_SUCCESS(Status) || StartCluster == 0xffffffff)
         {
-            ClusterCount++;
-            if (First)
-            {
-                BytesDone =  min (Length, BytesPerCluster - (WriteOffset.u.LowPart % BytesPerCluster));
-                StartOffset.QuadPart += WriteOffset.u.LowPart % BytesPerCluster;
-                First = FALSE;
-            }
-            else
-            {
-                if (Length - BytesDone > BytesPerCluster)
-                {
-                    BytesDone += BytesPerCluster;
-                }
-                else
-                {
-                    BytesDone = Length;
-                }
-            }
-            Status = NextCluster(DeviceExt, FirstCluster, &CurrentCluster, FALSE);
+            break;
         }
-        while (StartCluster + ClusterCount == CurrentCluster && NT_SUCCESS(Status) && Length > BytesDone);
-        DPRINT("start %08x, next %08x, count %u\n",
-               StartCluster, CurrentCluster, ClusterCount);
-
-        ExAcquireFastMutex(&Fcb->LastMutex);
-        Fcb->LastCluster = StartCluster + (ClusterCount - 1);
-        Fcb->LastOffset = ROUND_DOWN(WriteOffset.u.LowPart, BytesPerCluster) + (ClusterCount - 1) * BytesPerCluster;
-        ExReleaseFastMutex(&Fcb->LastMutex);
+        DPRINT("start %08x, count %u\n", StartCluster, ClusterCount);
+
+        StartOffset.QuadPart = ClusterToSector(DeviceExt, StartCluster) * BytesPerSector + BytesDone;
+        BytesDone = min(Length, ClusterCount * BytesPerCluster - BytesDone);
 
         // Fire up the write command
         Status = VfatWriteDiskPartial (IrpContext, &StartOffset, BytesDone, BufferOffset, FALSE);
@@ -280,6 +280,24 @@ typedef struct _HASHENTRY
 }
 HASHENTRY;
 
+/* Name index of a directory FCB, see fcb.c */
+typedef struct _VFAT_DIR_INDEX_ENTRY
+{
+    struct _VFAT_DIR_INDEX_ENTRY* Next;
+    ULONG Hash;
+    /* Directory index of the short name entry */
+    ULONG DirIndex;
+} VFAT_DIR_INDEX_ENTRY, *PVFAT_DIR_INDEX_ENTRY;
+
+typedef struct _VFAT_DIR_INDEX
+{
+    ULONG BucketCount;
+    ULONG EntryCount;
+    PVFAT_DIR_INDEX_ENTRY* Buckets;
+    /* No free entry in the directory before this one */
+    ULONG FreeHint;
+} VFAT_DIR_INDEX, *PVFAT_DIR_INDEX;
+
 typedef struct DEVICE_EXTENSION *PDEVICE_EXTENSION;
 
 typedef NTSTATUS (*PGET_NEXT_CLUSTER)(PDEVICE_EXTENSION,ULONG,PULONG);
@@ -418,6 +436,7 @@ typedef struct
     NPAGED_LOOKASIDE_LIST CcbLookasideList;
     NPAGED_LOOKASIDE_LIST IrpContextLookasideList;
     PAGED_LOOKASIDE_LIST CloseContextLookasideList;
+    PAGED_LOOKASIDE_LIST DirIndexLookasideList;
     FAST_IO_DISPATCH FastIoDispatch;
     CACHE_MANAGER_CALLBACKS CacheMgrCallbacks;
     FAST_MUTEX CloseMutex;
@@ -516,17 +535,22 @@ typedef struct _VFATFCB
     /* Entry into the hash table for the path + short name */
     HASHENTRY ShortHash;
 
+    /* For directories, hash of the names they contain, built on first lookup */
+    PVFAT_DIR_INDEX NameIndex;
+
     /* List of byte-range locks for this file */
     FILE_LOCK FileLock;
 
     /*
-     * Optimization: caching of last read/write cluster+offset pair. Can't
-     * be in VFATCCB because it must be reset everytime the allocated clusters
-     * change.
+     * Runs of the cluster chain, as far as it has been walked: the MCB maps
+     * the first McbClusters clusters of the file, the last of them being
+     * McbLastCluster. Can't be in VFATCCB because it must be truncated
+     * everytime the allocated clusters are.
      */
-    FAST_MUTEX LastMutex;
-    ULONG LastCluster;
-    ULONG LastOffset;
+    FAST_MUTEX McbMutex;
+    LARGE_MCB Mcb;
+    ULONG McbClusters;
+    ULONG McbLastCluster;
 
     struct _VFAT_CLOSE_CONTEXT * CloseContext;
 } VFATFCB, *PVFATFCB;
@@ -553,6 +577,7 @@ typedef struct _VFATCCB
 #define TAG_NAME 'ntaF'
 #define TAG_SEARCH 'LtaF'
 #define TAG_DIRENT 'DtaF'
+#define TAG_DIR_INDEX 'HtaF'
 
 #define ENTRIES_PER_SECTOR (BLOCKSIZE / sizeof(FATDirEntry))
 
@@ -1057,6 +1082,27 @@ vfatAttachFCBToFileObject(
     PVFATFCB fcb,
     PFILE_OBJECT fileObject);
 
+NTSTATUS
+vfatDirIndexLookup(
+    PDEVICE_EXTENSION pDeviceExt,
+    PVFATFCB pDirFcb,
+    PUNICODE_STRING FileToFindU,
+    PVFAT_DIRENTRY_CONTEXT DirContext);
+
+VOID
+vfatDirIndexAdd(
+    PVFATFCB pDirFcb,
+    PVFAT_DIRENTRY_CONTEXT DirContext);
+
+VOID
+vfatDirIndexRemove(
+    PVFATFCB pDirFcb,
+    PVFATFCB pFcb);
+
+VOID
+vfatFreeDirIndex(
+    PVFATFCB pDirFcb);
+
 NTSTATUS
 vfatDirFindFile(
     PDEVICE_EXTENSION pVCB,
@@ -1202,6 +1248,21 @@ NextCluster(
     PULONG CurrentCluster,
     BOOLEAN Extend);
 
+NTSTATUS
+vfatGetFileRun(
+    PDEVICE_EXTENSION DeviceExt,
+    PVFATFCB Fcb,
+    ULONG FirstCluster,
+    ULONG ClusterIndex,
+    ULONG ClusterCount,
+    PULONG Cluster,
+    PULONG RunLength);
+
+VOID
+vfatTruncateFileRuns(
+    PVFATFCB Fcb,
+    ULONG ClusterCount);
+
 /* shutdown.c */
 
 DRIVER_DISPATCH
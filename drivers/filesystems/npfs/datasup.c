@@ -80,7 +80,9 @@ NpCompleteStalledWrites(IN PNP_DATA_QUEUE DataQueue,
                 QuotaLeft -= NewQuotaLeft;
                 DataQueueEntry->QuotaInEntry += NewQuotaLeft;
 
+                /* A direct write still owns its data, it completes once read */
                 if (DataQueueEntry->QuotaInEntry == DataLeft &&
+                    !DataQueueEntry->DataMdl &&
                     IoSetCancelRoutine(Irp, NULL))
                 {
                     DataQueueEntry->Irp = NULL;
@@ -152,7 +154,7 @@ NpRemoveDataQueueEntry(IN PNP_DATA_QUEUE DataQueue,
             Irp = NULL;
         }
 
-        ExFreePool(QueueEntry);
+        NpFreeDataQueueEntry(QueueEntry);
 
         if (Flag)
         {
@@ -281,7 +283,7 @@ NpCancelDataQueueIrp(IN PDEVICE_OBJECT DeviceObject,
         FsRtlExitFileSystem();
     }
 
-    if (DataEntry) ExFreePool(DataEntry);
+    if (DataEntry) NpFreeDataQueueEntry(DataEntry);
 
     NpFreeClientSecurityContext(ClientSecurityContext);
     Irp->IoStatus.Status = STATUS_CANCELLED;
@@ -290,6 +292,51 @@ NpCancelDataQueueIrp(IN PDEVICE_OBJECT DeviceObject,
     NpCompleteDeferredIrps(&DeferredList);
 }
 
+VOID
+NTAPI
+NpFreeDataQueueEntry(IN PNP_DATA_QUEUE_ENTRY DataEntry)
+{
+    if (DataEntry->DataMdl)
+    {
+        MmUnlockPages(DataEntry->DataMdl);
+        IoFreeMdl(DataEntry->DataMdl);
+    }
+
+    ExFreePool(DataEntry);
+}
+
+static
+PMDL
+NpLockWriteBuffer(IN PIRP Irp,
+                  IN ULONG DataSize)
+{
+    PMDL Mdl;
+
+    Mdl = IoAllocateMdl(Irp->UserBuffer, DataSize, FALSE, TRUE, NULL);
+    if (!Mdl) return NULL;
+
+    _SEH2_TRY
+    {
+        MmProbeAndLockPages(Mdl, Irp->RequestorMode, IoReadAccess);
+    }
+    _SEH2_EXCEPT(EXCEPTION_EXECUTE_HANDLER)
+    {
+        IoFreeMdl(Mdl);
+        _SEH2_YIELD(return NULL);
+    }
+    _SEH2_END;
+
+    /* Readers run in other processes, map it now rather than fail there */
+    if (!MmGetSystemAddressForMdlSafe(Mdl, NormalPagePriority))
+    {
+        MmUnlockPages(Mdl);
+        IoFreeMdl(Mdl);
+        return NULL;
+    }
+
+    return Mdl;
+}
+
 NTSTATUS
 NTAPI
 NpAddDataQueueEntry(IN ULONG NamedPipeEnd,
@@ -308,8 +355,10 @@ NpAddDataQueueEntry(IN ULONG NamedPipeEnd,
     ULONG QuotaInEntry;
     PSECURITY_CLIENT_CONTEXT ClientContext;
     BOOLEAN HasSpace;
+    PMDL DataMdl;
 
     ClientContext = NULL;
+    DataMdl = NULL;
     ASSERT((DataQueue->QueueState == Empty) || (DataQueue->QueueState == Who));
 
     Status = STATUS_SUCCESS;
@@ -348,23 +397,13 @@ NpAddDataQueueEntry(IN ULONG NamedPipeEnd,
             DataEntry->Irp = Irp;
             DataEntry->DataSize = DataSize;
             DataEntry->ClientSecurityContext = ClientContext;
+            DataEntry->DataMdl = NULL;
             ASSERT((DataQueue->QueueState == Empty) || (DataQueue->QueueState == Who));
             Status = STATUS_PENDING;
             break;
 
         case Buffered:
 
-            EntrySize = sizeof(*DataEntry);
-            if (Who != ReadEntries)
-            {
-                EntrySize += DataSize;
-                if (EntrySize < DataSize)
-                {
-                    NpFreeClientSecurityContext(ClientContext);
-                    return STATUS_INVALID_PARAMETER;
-                }
-            }
-
             QuotaInEntry = DataSize - ByteOffset;
             if (DataQueue->Quota - DataQueue->QuotaUsed < QuotaInEntry)
             {
@@ -376,11 +415,38 @@ NpAddDataQueueEntry(IN ULONG NamedPipeEnd,
                 HasSpace = FALSE;
             }
 
+            /*
+             * The writer waits for quota anyway: readers can take the data
+             * straight from its buffer, saving the pool copy. Quota is still
+             * charged the same way, so the pipe looks just as full.
+             */
+            if ((Who == WriteEntries) && HasSpace && (Irp) &&
+                (DataSize - ByteOffset >= NPFS_DIRECT_WRITE_THRESHOLD))
+            {
+                DataMdl = NpLockWriteBuffer(Irp, DataSize);
+            }
+
+            EntrySize = sizeof(*DataEntry);
+            if ((Who != ReadEntries) && !(DataMdl))
+            {
+                EntrySize += DataSize;
+                if (EntrySize < DataSize)
+                {
+                    NpFreeClientSecurityContext(ClientContext);
+                    return STATUS_INVALID_PARAMETER;
+                }
+            }
+
             DataEntry = ExAllocatePoolWithQuotaTag(NonPagedPool | POOL_QUOTA_FAIL_INSTEAD_OF_RAISE,
                                                    EntrySize,
                                                    NPFS_DATA_ENTRY_TAG);
             if (!DataEntry)
             {
+                if (DataMdl)
+                {
+                    MmUnlockPages(DataMdl);
+                    IoFreeMdl(DataMdl);
+                }
                 NpFreeClientSecurityContext(ClientContext);
                 return STATUS_INSUFFICIENT_RESOURCES;
             }
@@ -390,6 +456,7 @@ NpAddDataQueueEntry(IN ULONG NamedPipeEnd,
             DataEntry->DataEntryType = Buffered;
             DataEntry->ClientSecurityContext = ClientContext;
             DataEntry->DataSize = DataSize;
+            DataEntry->DataMdl = DataMdl;
 
             if (Who == ReadEntries)
             {
@@ -399,6 +466,10 @@ NpAddDataQueueEntry(IN ULONG NamedPipeEnd,
                 ASSERT((DataQueue->QueueState == Empty) ||
                        (DataQueue->QueueState == Who));
             }
+            else if (DataMdl)
+            {
+                Status = STATUS_PENDING;
+            }
             else
             {
                 _SEH2_TRY
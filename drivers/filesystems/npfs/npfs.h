@@ -32,6 +32,12 @@
 #define MIN_INDEXED_LENGTH 5
 #define MAX_INDEXED_LENGTH 9
 
+//
+// Writes of at least this size which have to wait for quota keep their data
+// in the writer's locked buffer instead of a copy in nonpaged pool
+//
+#define NPFS_DIRECT_WRITE_THRESHOLD (64 * 1024)
+
 /* TYPEDEFS & DEFINES *********************************************************/
 
 //
@@ -153,6 +159,7 @@ typedef struct _NP_DATA_QUEUE_ENTRY
     ULONG QuotaInEntry;
     PSECURITY_CLIENT_CONTEXT ClientSecurityContext;
     ULONG DataSize;
+    PMDL DataMdl;
 } NP_DATA_QUEUE_ENTRY, *PNP_DATA_QUEUE_ENTRY;
 
 /* A Wait Queue. Only the VCB has one of these. */
@@ -421,6 +428,10 @@ NTAPI
 NpCompleteStalledWrites(IN PNP_DATA_QUEUE DataQueue,
                         IN PLIST_ENTRY List);
 
+VOID
+NTAPI
+NpFreeDataQueueEntry(IN PNP_DATA_QUEUE_ENTRY DataEntry);
+
 NTSTATUS
 NTAPI
 NpInitializeDataQueue(IN PNP_DATA_QUEUE DataQueue,
@@ -63,6 +63,12 @@ NpReadDataQueue(IN PNP_DATA_QUEUE DataQueue,
             {
                 DataBuffer = DataEntry->Irp->AssociatedIrp.SystemBuffer;
             }
+            else if (DataEntry->DataMdl)
+            {
+                /* Mapped when the entry was queued, this only returns the mapping */
+                DataBuffer = MmGetSystemAddressForMdlSafe(DataEntry->DataMdl, NormalPagePriority);
+                ASSERT(DataBuffer);
+            }
             else
             {
                 DataBuffer = &DataEntry[1];
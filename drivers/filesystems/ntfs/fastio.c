@@ -39,10 +39,17 @@ NTAPI
 NtfsAcqLazyWrite(PVOID Context,
                  BOOLEAN Wait)
 {
-    UNREFERENCED_PARAMETER(Context);
-    UNREFERENCED_PARAMETER(Wait);
-    UNIMPLEMENTED;
-    return FALSE;
+    PNTFS_FCB Fcb = (PNTFS_FCB)Context;
+    ASSERT(Fcb);
+    DPRINT("NtfsAcqLazyWrite(): Fcb %p\n", Fcb);
+
+    if (!ExAcquireResourceExclusiveLite(&Fcb->MainResource, Wait))
+    {
+        return FALSE;
+    }
+
+    IoSetTopLevelIrp((PIRP)FSRTL_CACHE_TOP_LEVEL_IRP);
+    return TRUE;
 }
 
 
@@ -50,8 +57,12 @@ VOID
 NTAPI
 NtfsRelLazyWrite(PVOID Context)
 {
-    UNREFERENCED_PARAMETER(Context);
-    UNIMPLEMENTED;
+    PNTFS_FCB Fcb = (PNTFS_FCB)Context;
+    ASSERT(Fcb);
+    DPRINT("NtfsRelLazyWrite(): Fcb %p\n", Fcb);
+
+    IoSetTopLevelIrp(NULL);
+    ExReleaseResourceLite(&Fcb->MainResource);
 }
 
 
@@ -60,10 +71,17 @@ NTAPI
 NtfsAcqReadAhead(PVOID Context,
                  BOOLEAN Wait)
 {
-    UNREFERENCED_PARAMETER(Context);
-    UNREFERENCED_PARAMETER(Wait);
-    UNIMPLEMENTED;
-    return FALSE;
+    PNTFS_FCB Fcb = (PNTFS_FCB)Context;
+    ASSERT(Fcb);
+    DPRINT("NtfsAcqReadAhead(): Fcb %p\n", Fcb);
+
+    if (!ExAcquireResourceSharedLite(&Fcb->MainResource, Wait))
+    {
+        return FALSE;
+    }
+
+    IoSetTopLevelIrp((PIRP)FSRTL_CACHE_TOP_LEVEL_IRP);
+    return TRUE;
 }
 
 
@@ -71,8 +89,29 @@ VOID
 NTAPI
 NtfsRelReadAhead(PVOID Context)
 {
-    UNREFERENCED_PARAMETER(Context);
-    UNIMPLEMENTED;
+    PNTFS_FCB Fcb = (PNTFS_FCB)Context;
+    ASSERT(Fcb);
+    DPRINT("NtfsRelReadAhead(): Fcb %p\n", Fcb);
+
+    IoSetTopLevelIrp(NULL);
+    ExReleaseResourceLite(&Fcb->MainResource);
+}
+
+/*
+ * Only cached reads of plain (non-volume, uncompressed) streams are handled
+ * without an IRP; everything else goes through NtfsRead() and NtfsWrite().
+ */
+static
+BOOLEAN
+NtfsIsFastIoReadPossible(PFILE_OBJECT FileObject)
+{
+    PNTFS_FCB Fcb = FileObject->FsContext;
+
+    return (Fcb != NULL &&
+            Fcb->Identifier.Type == NTFS_TYPE_FCB &&
+            FileObject->PrivateCacheMap != NULL &&
+            !(Fcb->Flags & FCB_IS_VOLUME) &&
+            !NtfsFCBIsCompressed(Fcb));
 }
 
 BOOLEAN
@@ -87,16 +126,15 @@ NtfsFastIoCheckIfPossible(
     _Out_ PIO_STATUS_BLOCK IoStatus,
     _In_ PDEVICE_OBJECT DeviceObject)
 {
-    /* Deny FastIo */
-    UNREFERENCED_PARAMETER(FileObject);
     UNREFERENCED_PARAMETER(FileOffset);
     UNREFERENCED_PARAMETER(Length);
     UNREFERENCED_PARAMETER(Wait);
     UNREFERENCED_PARAMETER(LockKey);
-    UNREFERENCED_PARAMETER(CheckForReadOperation);
     UNREFERENCED_PARAMETER(IoStatus);
     UNREFERENCED_PARAMETER(DeviceObject);
-    return FALSE;
+
+    /* Writes are not cached, deny them */
+    return (CheckForReadOperation && NtfsIsFastIoReadPossible(FileObject));
 }
 
 BOOLEAN
@@ -111,15 +149,83 @@ NtfsFastIoRead(
     _Out_ PIO_STATUS_BLOCK IoStatus,
     _In_ PDEVICE_OBJECT DeviceObject)
 {
-    DBG_UNREFERENCED_PARAMETER(FileObject);
-    DBG_UNREFERENCED_PARAMETER(FileOffset);
-    DBG_UNREFERENCED_PARAMETER(Length);
-    DBG_UNREFERENCED_PARAMETER(Wait);
+    PNTFS_FCB Fcb;
+    LONGLONG FileSize;
+    BOOLEAN Success = FALSE;
+
     DBG_UNREFERENCED_PARAMETER(LockKey);
-    DBG_UNREFERENCED_PARAMETER(Buffer);
-    DBG_UNREFERENCED_PARAMETER(IoStatus);
     DBG_UNREFERENCED_PARAMETER(DeviceObject);
-    return FALSE;
+
+    DPRINT("NtfsFastIoRead(%p, %I64x, %lu, %d)\n", FileObject, FileOffset->QuadPart, Length, Wait);
+
+    if (!Wait || !NtfsIsFastIoReadPossible(FileObject))
+    {
+        return FALSE;
+    }
+
+    Fcb = FileObject->FsContext;
+
+    FsRtlEnterFileSystem();
+
+    if (!ExAcquireResourceSharedLite(&Fcb->MainResource, Wait))
+    {
+        FsRtlExitFileSystem();
+        return FALSE;
+    }
+
+    FileSize = Fcb->RFCB.FileSize.QuadPart;
+    if (FileOffset->QuadPart >= FileSize)
+    {
+        IoStatus->Status = (Length != 0 ? STATUS_END_OF_FILE : STATUS_SUCCESS);
+        IoStatus->Information = 0;
+        Success = TRUE;
+        goto ByeBye;
+    }
+
+    if (Length > FileSize - FileOffset->QuadPart)
+    {
+        Length = (ULONG)(FileSize - FileOffset->QuadPart);
+    }
+
+    IoSetTopLevelIrp((PIRP)FSRTL_FAST_IO_TOP_LEVEL_IRP);
+
+    _SEH2_TRY
+    {
+        /* The whole file fits in 32 bits: take the cheaper copy */
+        if (Fcb->RFCB.FileSize.HighPart == 0)
+        {
+            CcFastCopyRead(FileObject,
+                           FileOffset->LowPart,
+                           Length,
+                           ADDRESS_AND_SIZE_TO_SPAN_PAGES(FileOffset->LowPart, Length),
+                           Buffer,
+                           IoStatus);
+            Success = TRUE;
+        }
+        else
+        {
+            Success = CcCopyRead(FileObject, FileOffset, Length, Wait, Buffer, IoStatus);
+        }
+    }
+    _SEH2_EXCEPT(EXCEPTION_EXECUTE_HANDLER)
+    {
+        /* Let the IRP path report the error */
+        Success = FALSE;
+    }
+    _SEH2_END;
+
+    IoSetTopLevelIrp(NULL);
+
+    if (Success && (FileObject->Flags & FO_SYNCHRONOUS_IO))
+    {
+        FileObject->CurrentByteOffset.QuadPart = FileOffset->QuadPart + IoStatus->Information;
+    }
+
+ByeBye:
+    ExReleaseResourceLite(&Fcb->MainResource);
+    FsRtlExitFileSystem();
+
+    return Success;
 }
 
 BOOLEAN
@@ -103,8 +103,10 @@ NtfsCreateFCB(PCWSTR FileName,
         Fcb->Stream[0] = UNICODE_NULL;
     }
 
+    ExInitializeResourceLite(&Fcb->PagingIoResource);
     ExInitializeResourceLite(&Fcb->MainResource);
 
+    Fcb->RFCB.PagingIoResource = &(Fcb->PagingIoResource);
     Fcb->RFCB.Resource = &(Fcb->MainResource);
 
     return Fcb;
@@ -118,6 +120,7 @@ NtfsDestroyFCB(PNTFS_FCB Fcb)
     ASSERT(Fcb->Identifier.Type == NTFS_TYPE_FCB);
 
     ExDeleteResourceLite(&Fcb->MainResource);
+    ExDeleteResourceLite(&Fcb->PagingIoResource);
 
     ExFreeToNPagedLookasideList(&NtfsGlobalData->FcbLookasideList, Fcb);
 }
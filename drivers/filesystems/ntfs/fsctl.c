@@ -424,6 +424,7 @@ NtfsMountVolume(PDEVICE_OBJECT DeviceObject,
     PNTFS_VCB Vcb = NULL;
     NTSTATUS Status;
     BOOLEAN Lookaside = FALSE;
+    ULONG i;
 
     DPRINT("NtfsMountVolume() called\n");
 
@@ -466,6 +467,37 @@ NtfsMountVolume(PDEVICE_OBJECT DeviceObject,
 
     Lookaside = TRUE;
 
+    Status = NtfsInitializeRecordCache(&Vcb->MftCache,
+                                       NTFS_MFT_CACHE_ENTRIES,
+                                       Vcb->NtfsInfo.BytesPerFileRecord,
+                                       TAG_MFT_CACHE);
+    if (!NT_SUCCESS(Status))
+        goto ByeBye;
+
+    Status = NtfsInitializeRecordCache(&Vcb->IndexCache,
+                                       NTFS_INDEX_CACHE_ENTRIES,
+                                       Vcb->NtfsInfo.BytesPerIndexRecord,
+                                       TAG_INDEX_CACHE);
+    if (!NT_SUCCESS(Status))
+        goto ByeBye;
+
+    Vcb->Statistics = ExAllocatePoolWithTag(NonPagedPool,
+                                            sizeof(STATISTICS) * NtfsGlobalData->NumberProcessors,
+                                            TAG_STATS);
+    if (Vcb->Statistics == NULL)
+    {
+        Status = STATUS_INSUFFICIENT_RESOURCES;
+        goto ByeBye;
+    }
+
+    RtlZeroMemory(Vcb->Statistics, sizeof(STATISTICS) * NtfsGlobalData->NumberProcessors);
+    for (i = 0; i < NtfsGlobalData->NumberProcessors; ++i)
+    {
+        Vcb->Statistics[i].Base.FileSystemType = FILESYSTEM_STATISTICS_TYPE_NTFS;
+        Vcb->Statistics[i].Base.Version = 1;
+        Vcb->Statistics[i].Base.SizeOfCompleteStructure = sizeof(STATISTICS);
+    }
+
     NewDeviceObject->Vpb = DeviceToMount->Vpb;
 
     Vcb->StorageDevice = DeviceToMount;
@@ -567,6 +599,15 @@ ByeBye:
         if (Lookaside)
             ExDeleteNPagedLookasideList(&Vcb->FileRecLookasideList);
 
+        if (Vcb && Vcb->Statistics)
+            ExFreePoolWithTag(Vcb->Statistics, TAG_STATS);
+
+        if (Vcb)
+        {
+            NtfsFreeRecordCache(&Vcb->IndexCache);
+            NtfsFreeRecordCache(&Vcb->MftCache);
+        }
+
         if (NewDeviceObject)
             IoDeleteDevice(NewDeviceObject);
     }
@@ -895,6 +936,49 @@ LockOrUnlockVolume(PDEVICE_EXTENSION DeviceExt,
 }
 
 
+static
+NTSTATUS
+GetNtfsStatistics(PDEVICE_EXTENSION DeviceExt,
+                  PIRP Irp)
+{
+    PIO_STACK_LOCATION Stack;
+    PVOID Buffer;
+    ULONG Length;
+    NTSTATUS Status;
+
+    DPRINT("GetNtfsStatistics(%p, %p)\n", DeviceExt, Irp);
+
+    Stack = IoGetCurrentIrpStackLocation(Irp);
+    Length = Stack->Parameters.FileSystemControl.OutputBufferLength;
+    Buffer = Irp->AssociatedIrp.SystemBuffer;
+
+    if (Length < sizeof(FILESYSTEM_STATISTICS))
+    {
+        return STATUS_BUFFER_TOO_SMALL;
+    }
+
+    if (Buffer == NULL)
+    {
+        return STATUS_INVALID_USER_BUFFER;
+    }
+
+    if (Length >= sizeof(STATISTICS) * NtfsGlobalData->NumberProcessors)
+    {
+        Length = sizeof(STATISTICS) * NtfsGlobalData->NumberProcessors;
+        Status = STATUS_SUCCESS;
+    }
+    else
+    {
+        Status = STATUS_BUFFER_OVERFLOW;
+    }
+
+    RtlCopyMemory(Buffer, DeviceExt->Statistics, Length);
+    Irp->IoStatus.Information = Length;
+
+    return Status;
+}
+
+
 static
 NTSTATUS
 NtfsUserFsRequest(PDEVICE_OBJECT DeviceObject,
@@ -949,6 +1033,10 @@ NtfsUserFsRequest(PDEVICE_OBJECT DeviceObject,
             Status = GetVolumeBitmap(DeviceExt, Irp);
             break;
 
+        case FSCTL_FILESYSTEM_GET_STATISTICS:
+            Status = GetNtfsStatistics(DeviceExt, Irp);
+            break;
+
         default:
             DPRINT("Invalid user request: %x\n", Stack->Parameters.FileSystemControl.FsControlCode);
             Status = STATUS_INVALID_DEVICE_REQUEST;
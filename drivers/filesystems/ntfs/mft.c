@@ -174,6 +174,9 @@ FindAttribute(PDEVICE_EXTENSION Vcb,
 
                 (*AttrCtx)->FileMFTIndex = MftRecord->MFTRecordNumber;
 
+                if (Attribute->IsNonResident)
+                    NtfsAddToStat(Vcb, Cache.RunListDecodes, 1);
+
                 if (Offset != NULL)
                     *Offset = Context.Offset;
 
@@ -1068,18 +1071,13 @@ ReadAttribute(PDEVICE_EXTENSION Vcb,
               PCHAR Buffer,
               ULONG Length)
 {
-    ULONGLONG LastLCN;
-    PUCHAR DataRun;
-    LONGLONG DataRunOffset;
-    ULONGLONG DataRunLength;
-    LONGLONG DataRunStartLCN;
-    ULONGLONG CurrentOffset;
+    LONGLONG Lcn;
+    LONGLONG ClusterCount;
+    ULONGLONG AllocatedLength;
+    ULONG OffsetInCluster;
     ULONG ReadLength;
     ULONG AlreadyRead;
     NTSTATUS Status;
-    
-    //TEMPTEMP
-    PUCHAR TempBuffer;
 
     if (!Context->pRecord->IsNonResident)
     {
@@ -1099,172 +1097,59 @@ ReadAttribute(PDEVICE_EXTENSION Vcb,
 
     /*
      * Non-resident attribute
+     *
+     * The data runs were decoded once into the context MCB when the attribute
+     * was looked up; map each piece of the request through it.
      */
 
-    /*
-     * I. Find the corresponding start data run.
-     */
+    NtfsAddToStat(Vcb, Cache.RunListLookups, 1);
 
     AlreadyRead = 0;
+    AllocatedLength = AttributeAllocatedLength(Context->pRecord);
 
-    // FIXME: Cache seems to be non-working. Disable it for now
-    //if(Context->CacheRunOffset <= Offset && Offset < Context->CacheRunOffset + Context->CacheRunLength * Volume->ClusterSize)
-    if (0)
-    {
-        DataRun = Context->CacheRun;
-        LastLCN = Context->CacheRunLastLCN;
-        DataRunStartLCN = Context->CacheRunStartLCN;
-        DataRunLength = Context->CacheRunLength;
-        CurrentOffset = Context->CacheRunCurrentOffset;
-    }
-    else
+    while (Length > 0)
     {
-        //TEMPTEMP
-        ULONG UsedBufferSize;
-        TempBuffer = ExAllocatePoolWithTag(NonPagedPool, Vcb->NtfsInfo.BytesPerFileRecord, TAG_NTFS);
-        if (TempBuffer == NULL)
-        {
-            return STATUS_INSUFFICIENT_RESOURCES;
-        }
-
-        LastLCN = 0;
-        CurrentOffset = 0;
-
-        // This will be rewritten in the next iteration to just use the DataRuns MCB directly
-        ConvertLargeMCBToDataRuns(&Context->DataRunsMCB,
-                                  TempBuffer,
-                                  Vcb->NtfsInfo.BytesPerFileRecord,
-                                  &UsedBufferSize);
+        OffsetInCluster = (ULONG)(Offset % Vcb->NtfsInfo.BytesPerCluster);
 
-        DataRun = TempBuffer;
-
-        while (1)
+        if (!FsRtlLookupLargeMcbEntry(&Context->DataRunsMCB,
+                                      Offset / Vcb->NtfsInfo.BytesPerCluster,
+                                      &Lcn,
+                                      &ClusterCount,
+                                      NULL,
+                                      NULL,
+                                      NULL))
         {
-            DataRun = DecodeRun(DataRun, &DataRunOffset, &DataRunLength);
-            if (DataRunOffset != -1)
-            {
-                /* Normal data run. */
-                DataRunStartLCN = LastLCN + DataRunOffset;
-                LastLCN = DataRunStartLCN;
-            }
-            else
-            {
-                /* Sparse data run. */
-                DataRunStartLCN = -1;
-            }
-
-            if (Offset >= CurrentOffset &&
-                Offset < CurrentOffset + (DataRunLength * Vcb->NtfsInfo.BytesPerCluster))
-            {
+            /* Past the last mapped run: either a trailing sparse run or the end of the attribute */
+            if (Offset >= AllocatedLength)
                 break;
-            }
-
-            if (*DataRun == 0)
-            {
-                ExFreePoolWithTag(TempBuffer, TAG_NTFS);
-                return AlreadyRead;
-            }
 
-            CurrentOffset += DataRunLength * Vcb->NtfsInfo.BytesPerCluster;
+            Lcn = -1;
+            ClusterCount = (AllocatedLength - Offset + Vcb->NtfsInfo.BytesPerCluster - 1) / Vcb->NtfsInfo.BytesPerCluster;
         }
-    }
-
-    /*
-     * II. Go through the run list and read the data
-     */
-
-    ReadLength = (ULONG)min(DataRunLength * Vcb->NtfsInfo.BytesPerCluster - (Offset - CurrentOffset), Length);
-    if (DataRunStartLCN == -1)
-    {
-        RtlZeroMemory(Buffer, ReadLength);
-        Status = STATUS_SUCCESS;
-    }
-    else
-    {
-        Status = NtfsReadDisk(Vcb->StorageDevice,
-                              DataRunStartLCN * Vcb->NtfsInfo.BytesPerCluster + Offset - CurrentOffset,
-                              ReadLength,
-                              Vcb->NtfsInfo.BytesPerSector,
-                              (PVOID)Buffer,
-                              FALSE);
-    }
-    if (NT_SUCCESS(Status))
-    {
-        Length -= ReadLength;
-        Buffer += ReadLength;
-        AlreadyRead += ReadLength;
 
-        if (ReadLength == DataRunLength * Vcb->NtfsInfo.BytesPerCluster - (Offset - CurrentOffset))
+        ReadLength = (ULONG)min((ULONGLONG)ClusterCount * Vcb->NtfsInfo.BytesPerCluster - OffsetInCluster, Length);
+        if (Lcn == -1)
         {
-            CurrentOffset += DataRunLength * Vcb->NtfsInfo.BytesPerCluster;
-            DataRun = DecodeRun(DataRun, &DataRunOffset, &DataRunLength);
-            if (DataRunOffset != (ULONGLONG)-1)
-            {
-                DataRunStartLCN = LastLCN + DataRunOffset;
-                LastLCN = DataRunStartLCN;
-            }
-            else
-                DataRunStartLCN = -1;
+            /* Sparse data run. */
+            RtlZeroMemory(Buffer, ReadLength);
         }
-
-        while (Length > 0)
+        else
         {
-            ReadLength = (ULONG)min(DataRunLength * Vcb->NtfsInfo.BytesPerCluster, Length);
-            if (DataRunStartLCN == -1)
-                RtlZeroMemory(Buffer, ReadLength);
-            else
-            {
-                Status = NtfsReadDisk(Vcb->StorageDevice,
-                                      DataRunStartLCN * Vcb->NtfsInfo.BytesPerCluster,
-                                      ReadLength,
-                                      Vcb->NtfsInfo.BytesPerSector,
-                                      (PVOID)Buffer,
-                                      FALSE);
-                if (!NT_SUCCESS(Status))
-                    break;
-            }
-
-            Length -= ReadLength;
-            Buffer += ReadLength;
-            AlreadyRead += ReadLength;
-
-            /* We finished this request, but there still data in this data run. */
-            if (Length == 0 && ReadLength != DataRunLength * Vcb->NtfsInfo.BytesPerCluster)
-                break;
-
-            /*
-             * Go to next run in the list.
-             */
-
-            if (*DataRun == 0)
+            Status = NtfsReadDisk(Vcb->StorageDevice,
+                                  Lcn * Vcb->NtfsInfo.BytesPerCluster + OffsetInCluster,
+                                  ReadLength,
+                                  Vcb->NtfsInfo.BytesPerSector,
+                                  (PVOID)Buffer,
+                                  FALSE);
+            if (!NT_SUCCESS(Status))
                 break;
-            CurrentOffset += DataRunLength * Vcb->NtfsInfo.BytesPerCluster;
-            DataRun = DecodeRun(DataRun, &DataRunOffset, &DataRunLength);
-            if (DataRunOffset != -1)
-            {
-                /* Normal data run. */
-                DataRunStartLCN = LastLCN + DataRunOffset;
-                LastLCN = DataRunStartLCN;
-            }
-            else
-            {
-                /* Sparse data run. */
-                DataRunStartLCN = -1;
-            }
-        } /* while */
-
-    } /* if Disk */
-
-    // TEMPTEMP
-    if (Context->pRecord->IsNonResident)
-        ExFreePoolWithTag(TempBuffer, TAG_NTFS);
+        }
 
-    Context->CacheRun = DataRun;
-    Context->CacheRunOffset = Offset + AlreadyRead;
-    Context->CacheRunStartLCN = DataRunStartLCN;
-    Context->CacheRunLength = DataRunLength;
-    Context->CacheRunLastLCN = LastLCN;
-    Context->CacheRunCurrentOffset = CurrentOffset;
+        Length -= ReadLength;
+        Buffer += ReadLength;
+        Offset += ReadLength;
+        AlreadyRead += ReadLength;
+    }
 
     return AlreadyRead;
 }
@@ -1624,18 +1509,255 @@ Cleanup:
     if (Context->pRecord->IsNonResident)
         ExFreePoolWithTag(TempBuffer, TAG_NTFS);
 
+    // drop the directory's cached index buffers only now, see UpdateFileRecord()
+    if (Context->pRecord->Type == AttributeIndexAllocation)
+        NtfsInvalidateRecordCache(&Vcb->IndexCache, Context->FileMFTIndex);
+
     return Status;
 }
 
+/*
+ * Record caches
+ *
+ * Path lookups read the same file records and the same upper levels of the
+ * same $I30 B+trees over and over. Each volume keeps two small caches of
+ * fixed up records: one of MFT records, keyed by MFT index, and one of index
+ * buffers, keyed by directory MFT index and VCN. Both are hashed and recycled
+ * in LRU order. Writers drop the entries they touch once their write is done
+ * (UpdateFileRecord() for file records, WriteAttribute() for index buffers);
+ * the generation number keeps a reader that raced with such a writer from
+ * putting the old contents back.
+ */
+
+#define NtfsRecordCacheData(Entry) ((PVOID)((PNTFS_RECORD_CACHE_ENTRY)(Entry) + 1))
+#define NtfsRecordCacheBucket(Cache, Index, Vcn) (&(Cache)->HashBuckets[((Index) ^ (Vcn)) % NTFS_RECORD_CACHE_BUCKETS])
+
+NTSTATUS
+NtfsInitializeRecordCache(PNTFS_RECORD_CACHE Cache,
+                          ULONG EntryCount,
+                          ULONG RecordSize,
+                          ULONG Tag)
+{
+    PNTFS_RECORD_CACHE_ENTRY Entry;
+    ULONG EntrySize, i;
+
+    EntrySize = sizeof(NTFS_RECORD_CACHE_ENTRY) + RecordSize;
+    Cache->Entries = ExAllocatePoolWithTag(NonPagedPool, EntrySize * EntryCount, Tag);
+    if (Cache->Entries == NULL)
+    {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    ExInitializeFastMutex(&Cache->Lock);
+    Cache->Generation = 0;
+    Cache->RecordSize = RecordSize;
+    Cache->Tag = Tag;
+    InitializeListHead(&Cache->LruList);
+    for (i = 0; i < NTFS_RECORD_CACHE_BUCKETS; i++)
+    {
+        InitializeListHead(&Cache->HashBuckets[i]);
+    }
+
+    for (i = 0; i < EntryCount; i++)
+    {
+        Entry = (PNTFS_RECORD_CACHE_ENTRY)((ULONG_PTR)Cache->Entries + i * EntrySize);
+        Entry->MftIndex = NTFS_RECORD_CACHE_INVALID;
+        Entry->Vcn = 0;
+        InitializeListHead(&Entry->HashEntry);
+        InsertTailList(&Cache->LruList, &Entry->LruEntry);
+    }
+
+    return STATUS_SUCCESS;
+}
+
+VOID
+NtfsFreeRecordCache(PNTFS_RECORD_CACHE Cache)
+{
+    if (Cache->Entries != NULL)
+    {
+        ExFreePoolWithTag(Cache->Entries, Cache->Tag);
+        Cache->Entries = NULL;
+    }
+}
+
+static
+PNTFS_RECORD_CACHE_ENTRY
+NtfsFindRecordCacheEntry(PNTFS_RECORD_CACHE Cache,
+                         ULONGLONG MftIndex,
+                         ULONGLONG Vcn)
+{
+    PLIST_ENTRY Bucket, ListEntry;
+    PNTFS_RECORD_CACHE_ENTRY Entry;
+
+    Bucket = NtfsRecordCacheBucket(Cache, MftIndex, Vcn);
+    for (ListEntry = Bucket->Flink; ListEntry != Bucket; ListEntry = ListEntry->Flink)
+    {
+        Entry = CONTAINING_RECORD(ListEntry, NTFS_RECORD_CACHE_ENTRY, HashEntry);
+        if (Entry->MftIndex == MftIndex && Entry->Vcn == Vcn)
+        {
+            return Entry;
+        }
+    }
+
+    return NULL;
+}
+
+/* Cache lock held */
+static
+VOID
+NtfsDropRecordCacheEntry(PNTFS_RECORD_CACHE Cache,
+                         PNTFS_RECORD_CACHE_ENTRY Entry)
+{
+    RemoveEntryList(&Entry->HashEntry);
+    InitializeListHead(&Entry->HashEntry);
+    Entry->MftIndex = NTFS_RECORD_CACHE_INVALID;
+
+    /* Make it the first one to be recycled */
+    RemoveEntryList(&Entry->LruEntry);
+    InsertTailList(&Cache->LruList, &Entry->LruEntry);
+}
+
+static
+BOOLEAN
+NtfsLookupRecordCache(PNTFS_RECORD_CACHE Cache,
+                      ULONGLONG MftIndex,
+                      ULONGLONG Vcn,
+                      PVOID Record,
+                      PULONG Generation)
+{
+    PNTFS_RECORD_CACHE_ENTRY Entry;
+
+    ExAcquireFastMutex(&Cache->Lock);
+
+    *Generation = Cache->Generation;
+    Entry = NtfsFindRecordCacheEntry(Cache, MftIndex, Vcn);
+    if (Entry != NULL)
+    {
+        RtlCopyMemory(Record, NtfsRecordCacheData(Entry), Cache->RecordSize);
+
+        RemoveEntryList(&Entry->LruEntry);
+        InsertHeadList(&Cache->LruList, &Entry->LruEntry);
+    }
+
+    ExReleaseFastMutex(&Cache->Lock);
+
+    return (Entry != NULL);
+}
+
+static
+VOID
+NtfsInsertRecordCache(PNTFS_RECORD_CACHE Cache,
+                      ULONGLONG MftIndex,
+                      ULONGLONG Vcn,
+                      PVOID Record,
+                      ULONG Generation)
+{
+    PNTFS_RECORD_CACHE_ENTRY Entry;
+
+    ExAcquireFastMutex(&Cache->Lock);
+
+    /* The record was written while we were reading it: what we have may be stale */
+    if (Cache->Generation != Generation)
+    {
+        ExReleaseFastMutex(&Cache->Lock);
+        return;
+    }
+
+    Entry = NtfsFindRecordCacheEntry(Cache, MftIndex, Vcn);
+    if (Entry == NULL)
+    {
+        /* Recycle the least recently used entry */
+        Entry = CONTAINING_RECORD(Cache->LruList.Blink, NTFS_RECORD_CACHE_ENTRY, LruEntry);
+        RemoveEntryList(&Entry->HashEntry);
+        Entry->MftIndex = MftIndex;
+        Entry->Vcn = Vcn;
+        InsertHeadList(NtfsRecordCacheBucket(Cache, MftIndex, Vcn), &Entry->HashEntry);
+    }
+
+    RtlCopyMemory(NtfsRecordCacheData(Entry), Record, Cache->RecordSize);
+
+    RemoveEntryList(&Entry->LruEntry);
+    InsertHeadList(&Cache->LruList, &Entry->LruEntry);
+
+    ExReleaseFastMutex(&Cache->Lock);
+}
+
+/* Drops every record cached for the given file, whatever its VCN */
+VOID
+NtfsInvalidateRecordCache(PNTFS_RECORD_CACHE Cache,
+                          ULONGLONG MftIndex)
+{
+    PNTFS_RECORD_CACHE_ENTRY Entry;
+    PLIST_ENTRY ListEntry;
+
+    if (Cache->Entries == NULL)
+    {
+        return;
+    }
+
+    ExAcquireFastMutex(&Cache->Lock);
+
+    Cache->Generation++;
+    ListEntry = Cache->LruList.Flink;
+    while (ListEntry != &Cache->LruList)
+    {
+        Entry = CONTAINING_RECORD(ListEntry, NTFS_RECORD_CACHE_ENTRY, LruEntry);
+        ListEntry = ListEntry->Flink;
+
+        /* Dropped entries move to the tail, where they no longer match */
+        if (Entry->MftIndex == MftIndex)
+        {
+            NtfsDropRecordCacheEntry(Cache, Entry);
+        }
+    }
+
+    ExReleaseFastMutex(&Cache->Lock);
+}
+
+VOID
+NtfsPurgeRecordCache(PNTFS_RECORD_CACHE Cache)
+{
+    PNTFS_RECORD_CACHE_ENTRY Entry;
+    ULONG i;
+
+    if (Cache->Entries == NULL)
+    {
+        return;
+    }
+
+    ExAcquireFastMutex(&Cache->Lock);
+
+    Cache->Generation++;
+    for (i = 0; i < NTFS_RECORD_CACHE_BUCKETS; i++)
+    {
+        while (!IsListEmpty(&Cache->HashBuckets[i]))
+        {
+            Entry = CONTAINING_RECORD(Cache->HashBuckets[i].Flink, NTFS_RECORD_CACHE_ENTRY, HashEntry);
+            NtfsDropRecordCacheEntry(Cache, Entry);
+        }
+    }
+
+    ExReleaseFastMutex(&Cache->Lock);
+}
+
 NTSTATUS
 ReadFileRecord(PDEVICE_EXTENSION Vcb,
                ULONGLONG index,
                PFILE_RECORD_HEADER file)
 {
     ULONGLONG BytesRead;
+    ULONG Generation = 0;
+    NTSTATUS Status;
 
     DPRINT("ReadFileRecord(%p, %I64x, %p)\n", Vcb, index, file);
 
+    if (Vcb->MftCache.Entries != NULL &&
+        NtfsLookupRecordCache(&Vcb->MftCache, index, 0, file, &Generation))
+    {
+        NtfsAddToStat(Vcb, Cache.MftRecordCacheHits, 1);
+        return STATUS_SUCCESS;
+    }
+
     BytesRead = ReadAttribute(Vcb, Vcb->MFTContext, index * Vcb->NtfsInfo.BytesPerFileRecord, (PCHAR)file, Vcb->NtfsInfo.BytesPerFileRecord);
     if (BytesRead != Vcb->NtfsInfo.BytesPerFileRecord)
     {
@@ -1643,9 +1765,21 @@ ReadFileRecord(PDEVICE_EXTENSION Vcb,
         return STATUS_PARTIAL_COPY;
     }
 
+    NtfsAddToStat(Vcb, Base.MetaDataReads, 1);
+    NtfsAddToStat(Vcb, Base.MetaDataReadBytes, Vcb->NtfsInfo.BytesPerFileRecord);
+    NtfsAddToStat(Vcb, Ntfs.MftReads, 1);
+    NtfsAddToStat(Vcb, Ntfs.MftReadBytes, Vcb->NtfsInfo.BytesPerFileRecord);
+
     /* Apply update sequence array fixups. */
     DPRINT("Sequence number: %u\n", file->SequenceNumber);
-    return FixupUpdateSequenceArray(Vcb, &file->Ntfs);
+    Status = FixupUpdateSequenceArray(Vcb, &file->Ntfs);
+
+    if (NT_SUCCESS(Status) && Vcb->MftCache.Entries != NULL)
+    {
+        NtfsInsertRecordCache(&Vcb->MftCache, index, 0, file, Generation);
+    }
+
+    return Status;
 }
 
 
@@ -1953,10 +2087,20 @@ UpdateFileRecord(PDEVICE_EXTENSION Vcb,
     {
         DPRINT1("UpdateFileRecord failed: %lu written, %lu expected\n", BytesWritten, Vcb->NtfsInfo.BytesPerFileRecord);
     }
+    else
+    {
+        NtfsAddToStat(Vcb, Base.MetaDataWrites, 1);
+        NtfsAddToStat(Vcb, Base.MetaDataWriteBytes, BytesWritten);
+        NtfsAddToStat(Vcb, Ntfs.MftWrites, 1);
+        NtfsAddToStat(Vcb, Ntfs.MftWriteBytes, BytesWritten);
+    }
 
     // remove the fixup array (so the file record pointer can still be used)
     FixupUpdateSequenceArray(Vcb, &FileRecord->Ntfs);
 
+    // drop the cached copy only now, so that a concurrent miss can't cache what preceded the write
+    NtfsInvalidateRecordCache(&Vcb->MftCache, MftIndex);
+
     return Status;
 }
 
@@ -3142,6 +3286,252 @@ BrowseIndexEntries(PDEVICE_EXTENSION Vcb,
     return STATUS_OBJECT_PATH_NOT_FOUND;
 }
 
+#define NTFS_INDEX_SEARCH_ENTRIES   128
+#define NTFS_INDEX_SEARCH_DEPTH     32
+
+static
+NTSTATUS
+NtfsReadIndexBuffer(PDEVICE_EXTENSION Vcb,
+                    PNTFS_ATTR_CONTEXT IndexAllocationContext,
+                    ULONGLONG VCN,
+                    ULONG IndexBlockSize,
+                    PINDEX_BUFFER IndexBuffer)
+{
+    ULONGLONG MftIndex = IndexAllocationContext->FileMFTIndex;
+    BOOLEAN Cached;
+    ULONG Generation = 0;
+    ULONG BytesRead;
+    NTSTATUS Status;
+
+    Cached = (Vcb->IndexCache.Entries != NULL && IndexBlockSize == Vcb->NtfsInfo.BytesPerIndexRecord);
+    if (Cached && NtfsLookupRecordCache(&Vcb->IndexCache, MftIndex, VCN, IndexBuffer, &Generation))
+    {
+        NtfsAddToStat(Vcb, Cache.IndexBufferCacheHits, 1);
+        return STATUS_SUCCESS;
+    }
+
+    BytesRead = ReadAttribute(Vcb, IndexAllocationContext, VCN * Vcb->NtfsInfo.BytesPerCluster, (PCHAR)IndexBuffer, IndexBlockSize);
+    if (BytesRead != IndexBlockSize)
+    {
+        DPRINT1("Unable to read index record!\n");
+        return STATUS_UNSUCCESSFUL;
+    }
+
+    NtfsAddToStat(Vcb, Cache.IndexBufferReads, 1);
+
+    // Instead of checking the $I30 bitmap on every lookup, make sure we really got the node we asked for
+    if (IndexBuffer->Ntfs.Type != NRH_INDX_TYPE)
+    {
+        DPRINT1("File system corruption detected, VCN %I64u of %I64u isn't an index record.\n", VCN, MftIndex);
+        return STATUS_DATA_ERROR;
+    }
+
+    Status = FixupUpdateSequenceArray(Vcb, &((PFILE_RECORD_HEADER)IndexBuffer)->Ntfs);
+    if (!NT_SUCCESS(Status))
+    {
+        DPRINT1("Failed to apply fixup array!\n");
+        return Status;
+    }
+
+    if (IndexBuffer->VCN != VCN ||
+        IndexBuffer->Header.TotalSizeOfEntries > IndexBuffer->Header.AllocatedSize ||
+        IndexBuffer->Header.AllocatedSize + FIELD_OFFSET(INDEX_BUFFER, Header) > IndexBlockSize)
+    {
+        DPRINT1("File system corruption detected, bad index record at VCN %I64u of %I64u.\n", VCN, MftIndex);
+        return STATUS_DATA_ERROR;
+    }
+
+    if (Cached)
+    {
+        NtfsInsertRecordCache(&Vcb->IndexCache, MftIndex, VCN, IndexBuffer, Generation);
+    }
+
+    return STATUS_SUCCESS;
+}
+
+/**
+* @name NtfsFindIndexEntry
+* @implemented
+*
+* Looks a name up in a directory by walking down its $I30 B+tree.
+*
+* @param Vcb
+* Pointer to the volume the directory is on.
+*
+* @param MftRecord
+* Pointer to the file record of the directory.
+*
+* @param IndexRoot
+* Pointer to a copy of the directory's $I30 index root attribute.
+*
+* @param FileName
+* Name to look for. Wildcards aren't supported.
+*
+* @param CaseSensitive
+* TRUE if FileName must match the case of the entry.
+*
+* @param OutMFTIndex
+* Receives the MFT index of the file on success.
+*
+* @return
+* STATUS_SUCCESS if the name was found, STATUS_OBJECT_PATH_NOT_FOUND if it isn't in the directory.
+* STATUS_MORE_PROCESSING_REQUIRED if the caller has to browse the index entries instead.
+*
+* @remarks
+* Entries are sorted by their upcased names, a name coming before the longer names it is a prefix
+* of; that's also the order of RtlCompareUnicodeString() when ignoring case (see CompareTreeKeys()).
+* Each node is binary searched and only the one sub-node that can hold the name is read, instead of
+* every node of the index. Names that collate equal to FileName but are rejected (wrong case, DOS
+* names, system files) may have a match further in the tree, so we give up on them.
+*/
+static
+NTSTATUS
+NtfsFindIndexEntry(PDEVICE_EXTENSION Vcb,
+                   PFILE_RECORD_HEADER MftRecord,
+                   PINDEX_ROOT_ATTRIBUTE IndexRoot,
+                   PUNICODE_STRING FileName,
+                   BOOLEAN CaseSensitive,
+                   ULONGLONG *OutMFTIndex)
+{
+    PINDEX_ENTRY_ATTRIBUTE Entries[NTFS_INDEX_SEARCH_ENTRIES];
+    PINDEX_ENTRY_ATTRIBUTE IndexEntry, LastEntry;
+    PINDEX_HEADER_ATTRIBUTE Header;
+    PNTFS_ATTR_CONTEXT IndexAllocationContext = NULL;
+    PINDEX_BUFFER IndexBuffer = NULL;
+    UNICODE_STRING EntryName;
+    ULONG Count, Low, High, Middle, Depth;
+    ULONGLONG VCN;
+    BOOLEAN HasSubNodes;
+    LONG Comparison = 1;
+    NTSTATUS Status;
+
+    Header = &IndexRoot->Header;
+    HasSubNodes = (Header->Flags & INDEX_ROOT_LARGE) != 0;
+
+    for (Depth = 0; Depth < NTFS_INDEX_SEARCH_DEPTH; Depth++)
+    {
+        // Gather the entries of the node so they can be binary searched
+        Count = 0;
+        IndexEntry = (PINDEX_ENTRY_ATTRIBUTE)((ULONG_PTR)Header + Header->FirstEntryOffset);
+        LastEntry = (PINDEX_ENTRY_ATTRIBUTE)((ULONG_PTR)Header + Header->TotalSizeOfEntries);
+        while (IndexEntry < LastEntry && !(IndexEntry->Flags & NTFS_INDEX_ENTRY_END))
+        {
+            if (IndexEntry->Length < sizeof(INDEX_ENTRY_ATTRIBUTE) || Count == NTFS_INDEX_SEARCH_ENTRIES)
+            {
+                Status = STATUS_MORE_PROCESSING_REQUIRED;
+                goto Cleanup;
+            }
+
+            Entries[Count++] = IndexEntry;
+            IndexEntry = (PINDEX_ENTRY_ATTRIBUTE)((PCHAR)IndexEntry + IndexEntry->Length);
+        }
+
+        if (IndexEntry >= LastEntry)
+        {
+            DPRINT1("Filesystem corruption detected, index node has no end entry!\n");
+            Status = STATUS_MORE_PROCESSING_REQUIRED;
+            goto Cleanup;
+        }
+
+        // Find the first entry that doesn't come before FileName
+        Low = 0;
+        High = Count;
+        while (Low < High)
+        {
+            Middle = Low + (High - Low) / 2;
+            EntryName.Buffer = Entries[Middle]->FileName.Name;
+            EntryName.Length = EntryName.MaximumLength = Entries[Middle]->FileName.NameLength * sizeof(WCHAR);
+
+            Comparison = RtlCompareUnicodeString(FileName, &EntryName, TRUE);
+            if (Comparison > 0)
+                Low = Middle + 1;
+            else
+                High = Middle;
+        }
+
+        if (Low < Count)
+        {
+            EntryName.Buffer = Entries[Low]->FileName.Name;
+            EntryName.Length = EntryName.MaximumLength = Entries[Low]->FileName.NameLength * sizeof(WCHAR);
+
+            Comparison = RtlCompareUnicodeString(FileName, &EntryName, TRUE);
+            if (Comparison == 0)
+            {
+                if ((Entries[Low]->Data.Directory.IndexedFile & NTFS_MFT_MASK) >= NTFS_FILE_FIRST_USER_FILE &&
+                    Entries[Low]->FileName.NameType != NTFS_FILE_NAME_DOS &&
+                    CompareFileName(FileName, Entries[Low], FALSE, CaseSensitive))
+                {
+                    *OutMFTIndex = (Entries[Low]->Data.Directory.IndexedFile & NTFS_MFT_MASK);
+                    Status = STATUS_SUCCESS;
+                }
+                else
+                {
+                    Status = STATUS_MORE_PROCESSING_REQUIRED;
+                }
+                goto Cleanup;
+            }
+
+            // FileName can only be in the sub-node of the entry that follows it
+            IndexEntry = Entries[Low];
+        }
+
+        if (!(IndexEntry->Flags & NTFS_INDEX_ENTRY_NODE))
+        {
+            Status = STATUS_OBJECT_PATH_NOT_FOUND;
+            goto Cleanup;
+        }
+
+        if (!HasSubNodes)
+        {
+            DPRINT1("Filesystem corruption detected!\n");
+            Status = STATUS_MORE_PROCESSING_REQUIRED;
+            goto Cleanup;
+        }
+
+        if (IndexBuffer == NULL)
+        {
+            Status = FindAttribute(Vcb, MftRecord, AttributeIndexAllocation, L"$I30", 4, &IndexAllocationContext, NULL);
+            if (!NT_SUCCESS(Status))
+            {
+                DPRINT1("Filesystem corruption detected, no index allocation!\n");
+                IndexAllocationContext = NULL;
+                Status = STATUS_MORE_PROCESSING_REQUIRED;
+                goto Cleanup;
+            }
+
+            IndexBuffer = ExAllocatePoolWithTag(NonPagedPool, IndexRoot->SizeOfEntry, TAG_NTFS);
+            if (IndexBuffer == NULL)
+            {
+                Status = STATUS_INSUFFICIENT_RESOURCES;
+                goto Cleanup;
+            }
+        }
+
+        // The entries point into the buffer we're about to overwrite
+        VCN = GetIndexEntryVCN(IndexEntry);
+        Status = NtfsReadIndexBuffer(Vcb, IndexAllocationContext, VCN, IndexRoot->SizeOfEntry, IndexBuffer);
+        if (!NT_SUCCESS(Status))
+        {
+            Status = STATUS_MORE_PROCESSING_REQUIRED;
+            goto Cleanup;
+        }
+
+        Header = &IndexBuffer->Header;
+        HasSubNodes = (Header->Flags & INDEX_NODE_LARGE) != 0;
+    }
+
+    DPRINT1("Filesystem corruption detected, index is more than %u levels deep!\n", NTFS_INDEX_SEARCH_DEPTH);
+    Status = STATUS_MORE_PROCESSING_REQUIRED;
+
+Cleanup:
+    if (IndexBuffer != NULL)
+        ExFreePoolWithTag(IndexBuffer, TAG_NTFS);
+    if (IndexAllocationContext != NULL)
+        ReleaseAttributeContext(IndexAllocationContext);
+
+    return Status;
+}
+
 NTSTATUS
 NtfsFindMftRecord(PDEVICE_EXTENSION Vcb,
                   ULONGLONG MFTIndex,
@@ -3206,6 +3596,18 @@ NtfsFindMftRecord(PDEVICE_EXTENSION Vcb,
 
     DPRINT("IndexRecordSize: %x IndexBlockSize: %x\n", Vcb->NtfsInfo.BytesPerIndexRecord, IndexRoot->SizeOfEntry);
 
+    // Looking for a given name doesn't need to go through the whole index
+    if (!DirSearch)
+    {
+        Status = NtfsFindIndexEntry(Vcb, MftRecord, IndexRoot, FileName, CaseSensitive, OutMFTIndex);
+        if (Status != STATUS_MORE_PROCESSING_REQUIRED)
+        {
+            ExFreePoolWithTag(IndexRecord, TAG_NTFS);
+            ExFreeToNPagedLookasideList(&Vcb->FileRecLookasideList, MftRecord);
+            return Status;
+        }
+    }
+
     Status = BrowseIndexEntries(Vcb,
                                 MftRecord,
                                 (PINDEX_ROOT_ATTRIBUTE)IndexRecord,
@@ -125,6 +125,8 @@ DriverEntry(PDRIVER_OBJECT DriverObject,
     /* Keep trace of Driver Object */
     NtfsGlobalData->DriverObject = DriverObject;
 
+    NtfsGlobalData->NumberProcessors = KeNumberProcessors;
+
     /* Initialize IRP functions array */
     NtfsInitializeFunctionPointers(DriverObject);
 
@@ -15,6 +15,9 @@
 #define TAG_IRP_CTXT 'iftN'
 #define TAG_ATT_CTXT 'aftN'
 #define TAG_FILE_REC 'rftN'
+#define TAG_MFT_CACHE 'mftN'
+#define TAG_STATS 'sftN'
+#define TAG_INDEX_CACHE 'xftN'
 
 #define ROUND_UP(N, S) ((((N) + (S) - 1) / (S)) * (S))
 #define ROUND_DOWN(N, S) ((N) - ((N) % (S)))
@@ -96,6 +99,49 @@ typedef struct
     ULONG Size;
 } NTFSIDENTIFIER, *PNTFSIDENTIFIER;
 
+/* Counters that have no slot in NTFS_STATISTICS (ReactOS specific) */
+typedef struct _NTFS_CACHE_STATISTICS
+{
+    ULONG MftRecordCacheHits;
+    ULONG RunListDecodes;
+    ULONG RunListLookups;
+    ULONG IndexBufferReads;
+    ULONG IndexBufferCacheHits;
+} NTFS_CACHE_STATISTICS, *PNTFS_CACHE_STATISTICS;
+
+#define STATISTICS_SIZE_NO_PAD (sizeof(FILESYSTEM_STATISTICS) + sizeof(NTFS_STATISTICS) + sizeof(NTFS_CACHE_STATISTICS))
+typedef struct _STATISTICS {
+    FILESYSTEM_STATISTICS Base;
+    NTFS_STATISTICS Ntfs;
+    NTFS_CACHE_STATISTICS Cache;
+    UCHAR Pad[((STATISTICS_SIZE_NO_PAD + 0x3f) & ~0x3f) - STATISTICS_SIZE_NO_PAD];
+} STATISTICS, *PSTATISTICS;
+
+#define NTFS_MFT_CACHE_ENTRIES      64
+#define NTFS_INDEX_CACHE_ENTRIES    32
+#define NTFS_RECORD_CACHE_BUCKETS   16
+#define NTFS_RECORD_CACHE_INVALID   ((ULONGLONG)-1)
+
+/* Followed by RecordSize bytes of fixed up file record or index buffer */
+typedef struct _NTFS_RECORD_CACHE_ENTRY
+{
+    LIST_ENTRY HashEntry;
+    LIST_ENTRY LruEntry;
+    ULONGLONG MftIndex;
+    ULONGLONG Vcn;
+} NTFS_RECORD_CACHE_ENTRY, *PNTFS_RECORD_CACHE_ENTRY;
+
+typedef struct _NTFS_RECORD_CACHE
+{
+    FAST_MUTEX Lock;
+    ULONG Generation;
+    ULONG RecordSize;
+    ULONG Tag;
+    LIST_ENTRY LruList;
+    LIST_ENTRY HashBuckets[NTFS_RECORD_CACHE_BUCKETS];
+    PVOID Entries;
+} NTFS_RECORD_CACHE, *PNTFS_RECORD_CACHE;
+
 typedef struct
 {
     NTFSIDENTIFIER Identifier;
@@ -122,6 +168,10 @@ typedef struct
     ULONG Flags;
     ULONG OpenHandleCount;
 
+    NTFS_RECORD_CACHE MftCache;
+    NTFS_RECORD_CACHE IndexCache;
+    PSTATISTICS Statistics;
+
 } DEVICE_EXTENSION, *PDEVICE_EXTENSION, NTFS_VCB, *PNTFS_VCB;
 
 #define VCB_VOLUME_LOCKED       0x0001
@@ -153,6 +203,7 @@ typedef struct
     NPAGED_LOOKASIDE_LIST FcbLookasideList;
     NPAGED_LOOKASIDE_LIST AttrCtxtLookasideList;
     BOOLEAN EnableWriteSupport;
+    ULONG NumberProcessors;
 } NTFS_GLOBAL_DATA, *PNTFS_GLOBAL_DATA;
 
 
@@ -560,6 +611,16 @@ typedef struct
 
 extern PNTFS_GLOBAL_DATA NtfsGlobalData;
 
+/* Statistics are not available until the volume is fully mounted */
+#define NtfsAddToStat(Vcb, Stat, Inc)                                                                          \
+{                                                                                                              \
+    if ((Vcb)->Statistics != NULL)                                                                             \
+    {                                                                                                          \
+        PSTATISTICS Stats = &(Vcb)->Statistics[KeGetCurrentProcessorNumber() % NtfsGlobalData->NumberProcessors]; \
+        Stats->Stat += Inc;                                                                                    \
+    }                                                                                                          \
+}
+
 FORCEINLINE
 NTSTATUS
 NtfsMarkIrpContextForQueue(PNTFS_IRP_CONTEXT IrpContext)
@@ -1111,6 +1172,22 @@ ReadFileRecord(PDEVICE_EXTENSION Vcb,
                ULONGLONG index,
                PFILE_RECORD_HEADER file);
 
+NTSTATUS
+NtfsInitializeRecordCache(PNTFS_RECORD_CACHE Cache,
+                          ULONG EntryCount,
+                          ULONG RecordSize,
+                          ULONG Tag);
+
+VOID
+NtfsFreeRecordCache(PNTFS_RECORD_CACHE Cache);
+
+VOID
+NtfsInvalidateRecordCache(PNTFS_RECORD_CACHE Cache,
+                          ULONGLONG MftIndex);
+
+VOID
+NtfsPurgeRecordCache(PNTFS_RECORD_CACHE Cache);
+
 NTSTATUS
 UpdateIndexEntryFileNameSize(PDEVICE_EXTENSION Vcb,
                              PFILE_RECORD_HEADER MftRecord,
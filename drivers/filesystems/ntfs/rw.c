@@ -154,15 +154,20 @@ NtfsReadFile(PDEVICE_EXTENSION DeviceExt,
         }
 
 
-        ReadBuffer = ExAllocatePoolWithTag(NonPagedPool, RealLength, TAG_NTFS);
-        if (ReadBuffer == NULL)
+        /* An aligned read that only ends inside a sector (e.g. paging I/O of the
+         * tail of a file) still fits in the caller buffer, so read straight into it */
+        if (RealReadOffset != ReadOffset || RealLength > Length)
         {
-            DPRINT1("Not enough memory!\n");
-            ReleaseAttributeContext(DataContext);
-            ExFreeToNPagedLookasideList(&DeviceExt->FileRecLookasideList, FileRecord);
-            return STATUS_INSUFFICIENT_RESOURCES;
+            ReadBuffer = ExAllocatePoolWithTag(NonPagedPool, RealLength, TAG_NTFS);
+            if (ReadBuffer == NULL)
+            {
+                DPRINT1("Not enough memory!\n");
+                ReleaseAttributeContext(DataContext);
+                ExFreeToNPagedLookasideList(&DeviceExt->FileRecLookasideList, FileRecord);
+                return STATUS_INSUFFICIENT_RESOURCES;
+            }
+            AllocatedBuffer = TRUE;
         }
-        AllocatedBuffer = TRUE;
     }
 
     DPRINT("Effective read: %lu at %lu for stream '%S'\n", RealLength, RealReadOffset, Fcb->Stream);
@@ -205,12 +210,81 @@ NtfsReadFile(PDEVICE_EXTENSION DeviceExt,
 }
 
 
+/*
+ * FUNCTION: Reads data from a file through the cache manager
+ */
+static
+NTSTATUS
+NtfsCachedRead(PNTFS_IRP_CONTEXT IrpContext,
+               PNTFS_FCB Fcb,
+               PVOID Buffer,
+               LARGE_INTEGER ReadOffset,
+               ULONG Length,
+               PULONG LengthRead)
+{
+    PFILE_OBJECT FileObject = IrpContext->FileObject;
+    PIRP Irp = IrpContext->Irp;
+    NTSTATUS Status;
+
+    *LengthRead = 0;
+
+    if (ReadOffset.QuadPart >= Fcb->RFCB.FileSize.QuadPart)
+    {
+        return STATUS_END_OF_FILE;
+    }
+
+    if (Length > Fcb->RFCB.FileSize.QuadPart - ReadOffset.QuadPart)
+    {
+        Length = (ULONG)(Fcb->RFCB.FileSize.QuadPart - ReadOffset.QuadPart);
+    }
+
+    _SEH2_TRY
+    {
+        if (FileObject->PrivateCacheMap == NULL)
+        {
+            CcInitializeCacheMap(FileObject,
+                                 (PCC_FILE_SIZES)(&Fcb->RFCB.AllocationSize),
+                                 FALSE,
+                                 &(NtfsGlobalData->CacheMgrCallbacks),
+                                 Fcb);
+        }
+
+        if (!CcCopyRead(FileObject,
+                        &ReadOffset,
+                        Length,
+                        BooleanFlagOn(IrpContext->Flags, IRPCONTEXT_CANWAIT),
+                        Buffer,
+                        &Irp->IoStatus))
+        {
+            /* The data isn't cached yet and we may not block: post the request */
+            _SEH2_YIELD(return STATUS_PENDING);
+        }
+
+        Status = Irp->IoStatus.Status;
+    }
+    _SEH2_EXCEPT(EXCEPTION_EXECUTE_HANDLER)
+    {
+        Status = _SEH2_GetExceptionCode();
+    }
+    _SEH2_END;
+
+    if (NT_SUCCESS(Status))
+    {
+        *LengthRead = (ULONG)Irp->IoStatus.Information;
+    }
+
+    return Status;
+}
+
+
 NTSTATUS
 NtfsRead(PNTFS_IRP_CONTEXT IrpContext)
 {
     PDEVICE_EXTENSION DeviceExt;
     PIO_STACK_LOCATION Stack;
     PFILE_OBJECT FileObject;
+    PNTFS_FCB Fcb;
+    PERESOURCE Resource;
     PVOID Buffer;
     ULONG ReadLength;
     LARGE_INTEGER ReadOffset;
@@ -218,6 +292,7 @@ NtfsRead(PNTFS_IRP_CONTEXT IrpContext)
     NTSTATUS Status = STATUS_SUCCESS;
     PIRP Irp;
     PDEVICE_OBJECT DeviceObject;
+    BOOLEAN PagingIo, NoCache;
 
     DPRINT("NtfsRead(IrpContext %p)\n", IrpContext);
 
@@ -225,22 +300,68 @@ NtfsRead(PNTFS_IRP_CONTEXT IrpContext)
     Irp = IrpContext->Irp;
     Stack = IrpContext->Stack;
     FileObject = IrpContext->FileObject;
+    Fcb = FileObject->FsContext;
 
     DeviceExt = DeviceObject->DeviceExtension;
     ReadLength = Stack->Parameters.Read.Length;
     ReadOffset = Stack->Parameters.Read.ByteOffset;
-    Buffer = NtfsGetUserBuffer(Irp, BooleanFlagOn(Irp->Flags, IRP_PAGING_IO));
+    PagingIo = BooleanFlagOn(Irp->Flags, IRP_PAGING_IO);
+    NoCache = BooleanFlagOn(Irp->Flags, IRP_NOCACHE) ||
+              BooleanFlagOn(FileObject->Flags, FO_NO_INTERMEDIATE_BUFFERING);
+
+    if (ReadLength == 0)
+    {
+        Irp->IoStatus.Information = 0;
+        return STATUS_SUCCESS;
+    }
+
+    /* Paging reads are issued on behalf of the cache while the main resource
+     * may already be held, so they are serialized on their own resource */
+    Resource = (PagingIo ? &Fcb->PagingIoResource : &Fcb->MainResource);
+    if (!ExAcquireResourceSharedLite(Resource, BooleanFlagOn(IrpContext->Flags, IRPCONTEXT_CANWAIT)))
+    {
+        return NtfsMarkIrpContextForQueue(IrpContext);
+    }
+
+    Buffer = NtfsGetUserBuffer(Irp, PagingIo);
+    if (Buffer == NULL)
+    {
+        Status = STATUS_INSUFFICIENT_RESOURCES;
+    }
+    else if (!PagingIo && !NoCache &&
+             !(Fcb->Flags & FCB_IS_VOLUME) &&
+             !NtfsFCBIsCompressed(Fcb))
+    {
+        Status = NtfsCachedRead(IrpContext,
+                                Fcb,
+                                Buffer,
+                                ReadOffset,
+                                ReadLength,
+                                &ReturnedReadLength);
+    }
+    else
+    {
+        /* Non-cached and paging reads go to the disk, straight into the caller
+         * buffer (the MDL for paging I/O) whenever it is sector aligned */
+        Status = NtfsReadFile(DeviceExt,
+                              FileObject,
+                              Buffer,
+                              ReadLength,
+                              ReadOffset.u.LowPart,
+                              Irp->Flags,
+                              &ReturnedReadLength);
+    }
+
+    ExReleaseResourceLite(Resource);
+
+    if (Status == STATUS_PENDING)
+    {
+        return NtfsMarkIrpContextForQueue(IrpContext);
+    }
 
-    Status = NtfsReadFile(DeviceExt,
-                          FileObject,
-                          Buffer,
-                          ReadLength,
-                          ReadOffset.u.LowPart,
-                          Irp->Flags,
-                          &ReturnedReadLength);
     if (NT_SUCCESS(Status))
     {
-        if (FileObject->Flags & FO_SYNCHRONOUS_IO)
+        if ((FileObject->Flags & FO_SYNCHRONOUS_IO) && !PagingIo)
         {
             FileObject->CurrentByteOffset.QuadPart =
                 ReadOffset.QuadPart + ReturnedReadLength;
@@ -701,6 +822,20 @@ NtfsWrite(PNTFS_IRP_CONTEXT IrpContext)
             FileObject->CurrentByteOffset.QuadPart = ByteOffset.QuadPart + ReturnedWriteLength;
         }
 
+        // raw volume writes may rewrite any file record or index buffer behind our back
+        if (Fcb->Flags & FCB_IS_VOLUME)
+        {
+            NtfsPurgeRecordCache(&DeviceExt->MftCache);
+            NtfsPurgeRecordCache(&DeviceExt->IndexCache);
+        }
+
+        // writes go straight to the disk, so drop whatever the cache holds for that range
+        if (!(Irp->Flags & IRP_PAGING_IO) && !(Fcb->Flags & FCB_IS_VOLUME) &&
+            Fcb->SectionObjectPointers.DataSectionObject != NULL)
+        {
+            CcPurgeCacheSection(&Fcb->SectionObjectPointers, &ByteOffset, ReturnedWriteLength, FALSE);
+        }
+
         IrpContext->PriorityBoost = IO_DISK_INCREMENT;
     }
     else
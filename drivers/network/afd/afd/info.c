@@ -58,6 +58,14 @@ AfdGetInfo( PDEVICE_OBJECT DeviceObject, PIRP Irp,
         InfoReq->Information.Ulong = FCB->Recv.Content - FCB->Recv.BytesUsed;
         break;
 
+        case AFD_INFO_RECEIVE_DIRECT_BYTES:
+            InfoReq->Information.LargeInteger.QuadPart = FCB->RecvBytesDirect;
+            break;
+
+        case AFD_INFO_RECEIVE_BUFFERED_BYTES:
+            InfoReq->Information.LargeInteger.QuadPart = FCB->RecvBytesBuffered;
+            break;
+
         case AFD_INFO_SENDS_IN_PROGRESS:
             InfoReq->Information.Ulong = 0;
 
@@ -981,6 +981,12 @@ AfdDispatch(PDEVICE_OBJECT DeviceObject, PIRP Irp)
         case IOCTL_AFD_SEND_DATAGRAM:
             return AfdPacketSocketWriteData( DeviceObject, Irp, IrpSp );
 
+        case IOCTL_AFD_RECV_DATAGRAMS:
+            return AfdPacketSocketReadDatagrams( DeviceObject, Irp, IrpSp );
+
+        case IOCTL_AFD_SEND_DATAGRAMS:
+            return AfdPacketSocketWriteDatagrams( DeviceObject, Irp, IrpSp );
+
         case IOCTL_AFD_GET_INFO:
             return AfdGetInfo( DeviceObject, Irp, IrpSp );
 
@@ -1277,6 +1283,15 @@ AfdCancelHandler(PDEVICE_OBJECT DeviceObject,
             return;
     }
 
+    if (Function == FUNCTION_RECV && Irp == FCB->DirectRecvIrp)
+    {
+        /* The transport is filling this IRP's buffer, it is completed
+         * once the transport gives the buffer back */
+        IoCancelIrp(FCB->ReceiveIrp.InFlightRequest);
+        SocketStateUnlock(FCB);
+        return;
+    }
+
     CurrentEntry = FCB->PendingIrpList[Function].Flink;
     while (CurrentEntry != &FCB->PendingIrpList[Function])
     {
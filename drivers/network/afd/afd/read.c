@@ -10,6 +10,61 @@
 
 #include "afd.h"
 
+static BOOLEAN StartDirectReceive( PAFD_FCB FCB )
+{
+    PIRP NextIrp;
+    PIO_STACK_LOCATION NextIrpSp;
+    PAFD_RECV_INFO RecvReq;
+    PAFD_MAPBUF Map;
+    PLIST_ENTRY NextIrpEntry;
+    NTSTATUS Status;
+
+    if (IsListEmpty(&FCB->PendingIrpList[FUNCTION_RECV])) return FALSE;
+
+    NextIrpEntry = FCB->PendingIrpList[FUNCTION_RECV].Flink;
+    NextIrp = CONTAINING_RECORD(NextIrpEntry, IRP, Tail.Overlay.ListEntry);
+    NextIrpSp = IoGetCurrentIrpStackLocation( NextIrp );
+    RecvReq = GetLockedData(NextIrp, NextIrpSp);
+
+    /* The transport may complete the receive right away, so the IRP
+     * must not be in its dispatch routine anymore */
+    if (!(NextIrpSp->Control & SL_PENDING_RETURNED)) return FALSE;
+
+    /* Only plain single buffer receives are filled by the transport */
+    if (RecvReq->BufferCount != 1 || (RecvReq->TdiFlags & TDI_RECEIVE_PEEK))
+        return FALSE;
+
+    Map = (PAFD_MAPBUF)(RecvReq->BufferArray + RecvReq->BufferCount);
+    if (!Map[0].Mdl) return FALSE;
+
+    AFD_DbgPrint(MID_TRACE,("Receiving directly into %p (%u)\n",
+                            NextIrp, RecvReq->BufferArray[0].len));
+
+    /* The IRP stays out of the pending list until the transport is done.
+     * ReceiveComplete can run before TdiReceiveMdl returns, so this must
+     * be set up first */
+    RemoveEntryList(NextIrpEntry);
+    FCB->DirectRecvIrp = NextIrp;
+
+    Status = TdiReceiveMdl( &FCB->ReceiveIrp.InFlightRequest,
+                            FCB->Connection.Object,
+                            TDI_RECEIVE_NORMAL,
+                            Map[0].Mdl,
+                            RecvReq->BufferArray[0].len,
+                            ReceiveComplete,
+                            FCB );
+
+    if (!NT_SUCCESS(Status))
+    {
+        /* Nothing was sent to the transport, give the IRP back */
+        FCB->DirectRecvIrp = NULL;
+        InsertHeadList(&FCB->PendingIrpList[FUNCTION_RECV], NextIrpEntry);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
 static VOID RefillSocketBuffer( PAFD_FCB FCB )
 {
     /* Make sure nothing's in flight first */
@@ -18,6 +73,14 @@ static VOID RefillSocketBuffer( PAFD_FCB FCB )
     /* Now ensure that receive is still allowed */
     if (FCB->TdiReceiveClosed) return;
 
+    /* Bypass our buffer if it is empty and a receive is already waiting */
+    if (FCB->Recv.Content == FCB->Recv.BytesUsed)
+    {
+        FCB->Recv.Content = FCB->Recv.BytesUsed = 0;
+
+        if (StartDirectReceive(FCB)) return;
+    }
+
     /* Check if the buffer is full */
     if (FCB->Recv.Content == FCB->Recv.Size)
     {
@@ -85,6 +148,47 @@ static VOID HandleReceiveComplete( PAFD_FCB FCB, NTSTATUS Status, ULONG_PTR Info
     }
 }
 
+static VOID CompleteDirectReceive( PIRP Irp, NTSTATUS Status, ULONG_PTR Information )
+{
+    PIO_STACK_LOCATION IrpSp = IoGetCurrentIrpStackLocation( Irp );
+    PAFD_RECV_INFO RecvReq = GetLockedData(Irp, IrpSp);
+
+    AFD_DbgPrint(MID_TRACE,("Completing direct recv %p (%x, %u)\n",
+                            Irp, Status, (UINT)Information));
+
+    UnlockBuffers( RecvReq->BufferArray, RecvReq->BufferCount, FALSE );
+    Irp->IoStatus.Status = Status;
+    Irp->IoStatus.Information = Information;
+    if( Irp->MdlAddress ) UnlockRequest( Irp, IrpSp );
+    (void)IoSetCancelRoutine(Irp, NULL);
+    IoCompleteRequest( Irp, IO_NETWORK_INCREMENT );
+}
+
+static VOID HandleDirectReceiveComplete( PAFD_FCB FCB, PIRP Irp, NTSTATUS Status, ULONG_PTR Information )
+{
+    if (!FCB->TdiReceiveClosed && Status == STATUS_SUCCESS && Information != 0)
+    {
+        /* The data went straight into the user's buffer */
+        FCB->LastReceiveStatus = Status;
+        FCB->RecvBytesDirect += Information;
+        CompleteDirectReceive(Irp, Status, Information);
+        RefillSocketBuffer(FCB);
+    }
+    else if (!FCB->TdiReceiveClosed && Status == STATUS_CANCELLED)
+    {
+        /* Only the user's request was cancelled, the connection is fine */
+        CompleteDirectReceive(Irp, Status, 0);
+        RefillSocketBuffer(FCB);
+    }
+    else
+    {
+        /* Closure or failure: requeue the IRP so it is completed like the other ones */
+        InsertHeadList(&FCB->PendingIrpList[FUNCTION_RECV],
+                       &Irp->Tail.Overlay.ListEntry);
+        HandleReceiveComplete(FCB, Status, 0);
+    }
+}
+
 static BOOLEAN CantReadMore( PAFD_FCB FCB ) {
     UINT BytesAvailable = FCB->Recv.Content - FCB->Recv.BytesUsed;
 
@@ -138,7 +242,10 @@ static NTSTATUS TryToSatisfyRecvRequestFromBuffer( PAFD_FCB FCB,
             BytesAvailable -= BytesToCopy;
 
             if (!(RecvReq->TdiFlags & TDI_RECEIVE_PEEK))
+            {
                 FCB->Recv.BytesUsed += BytesToCopy;
+                FCB->RecvBytesBuffered += BytesToCopy;
+            }
         }
     }
 
@@ -272,7 +379,7 @@ NTSTATUS NTAPI ReceiveComplete
   PVOID Context ) {
     PAFD_FCB FCB = (PAFD_FCB)Context;
     PLIST_ENTRY NextIrpEntry;
-    PIRP NextIrp;
+    PIRP NextIrp, DirectIrp;
     PAFD_RECV_INFO RecvReq;
     PIO_STACK_LOCATION NextIrpSp;
 
@@ -286,6 +393,19 @@ NTSTATUS NTAPI ReceiveComplete
     ASSERT(FCB->ReceiveIrp.InFlightRequest == Irp);
     FCB->ReceiveIrp.InFlightRequest = NULL;
 
+    DirectIrp = FCB->DirectRecvIrp;
+    if( DirectIrp ) {
+        FCB->DirectRecvIrp = NULL;
+
+        /* Free our partial MDL before the user's buffer gets unlocked */
+        IoFreeMdl( Irp->MdlAddress );
+        Irp->MdlAddress = NULL;
+
+        if( FCB->State == SOCKET_STATE_CLOSED )
+            InsertHeadList(&FCB->PendingIrpList[FUNCTION_RECV],
+                           &DirectIrp->Tail.Overlay.ListEntry);
+    }
+
     if( FCB->State == SOCKET_STATE_CLOSED ) {
         /* Cleanup our IRP queue because the FCB is being destroyed */
         while( !IsListEmpty( &FCB->PendingIrpList[FUNCTION_RECV] ) ) {
@@ -308,7 +428,10 @@ NTSTATUS NTAPI ReceiveComplete
         return STATUS_INVALID_PARAMETER;
     }
 
-    HandleReceiveComplete( FCB, Irp->IoStatus.Status, Irp->IoStatus.Information );
+    if( DirectIrp )
+        HandleDirectReceiveComplete( FCB, DirectIrp, Irp->IoStatus.Status, Irp->IoStatus.Information );
+    else
+        HandleReceiveComplete( FCB, Irp->IoStatus.Status, Irp->IoStatus.Information );
 
     ReceiveActivity( FCB, NULL );
 
@@ -787,3 +910,159 @@ AfdPacketSocketReadData(PDEVICE_OBJECT DeviceObject, PIRP Irp,
         return LeaveIrpUntilLater( FCB, Irp, FUNCTION_RECV );
     }
 }
+
+NTSTATUS NTAPI
+AfdPacketSocketReadDatagrams(PDEVICE_OBJECT DeviceObject, PIRP Irp,
+                             PIO_STACK_LOCATION IrpSp ) {
+    NTSTATUS Status = STATUS_SUCCESS;
+    PFILE_OBJECT FileObject = IrpSp->FileObject;
+    PAFD_FCB FCB = FileObject->FsContext;
+    PAFD_DATAGRAMS_INFO RecvReq;
+    PAFD_DATAGRAM_MSG Msg;
+    AFD_WSABUF Buffer;
+    PVOID Address;
+    INT AddressLength;
+    PLIST_ENTRY ListEntry;
+    PAFD_STORED_DATAGRAM DatagramRecv;
+    UINT BytesToCopy, AddrLen;
+    PAFD_DATAGRAM_MSG Messages = NULL;
+    ULONG MessageCount = 0, TdiFlags = 0, Count = 0;
+
+    UNREFERENCED_PARAMETER(DeviceObject);
+
+    AFD_DbgPrint(MID_TRACE,("Called on %p\n", FCB));
+
+    if( !SocketAcquireStateLock( FCB ) ) return LostSocket( Irp );
+
+    FCB->EventSelectDisabled &= ~AFD_EVENT_RECEIVE;
+
+    /* Check that the socket is bound */
+    if( FCB->State != SOCKET_STATE_BOUND ||
+        !(FCB->Flags & AFD_ENDPOINT_CONNECTIONLESS) )
+    {
+        AFD_DbgPrint(MIN_TRACE,("Invalid socket state\n"));
+        return UnlockAndMaybeComplete(FCB, STATUS_INVALID_PARAMETER, Irp, 0);
+    }
+
+    if (FCB->TdiReceiveClosed)
+    {
+        AFD_DbgPrint(MIN_TRACE,("Receive closed\n"));
+        return UnlockAndMaybeComplete(FCB, STATUS_FILE_CLOSED, Irp, 0);
+    }
+
+    if (IrpSp->Parameters.DeviceIoControl.InputBufferLength < sizeof(AFD_DATAGRAMS_INFO))
+        return UnlockAndMaybeComplete(FCB, STATUS_INVALID_PARAMETER, Irp, 0);
+
+    if( !(RecvReq = LockRequest( Irp, IrpSp, FALSE, NULL )) )
+        return UnlockAndMaybeComplete(FCB, STATUS_NO_MEMORY, Irp, 0);
+
+    /* The request still lives in the caller's pages, read it only once */
+    _SEH2_TRY {
+        Messages = RecvReq->Messages;
+        MessageCount = RecvReq->MessageCount;
+        TdiFlags = RecvReq->TdiFlags;
+    } _SEH2_EXCEPT(EXCEPTION_EXECUTE_HANDLER) {
+        Status = STATUS_ACCESS_VIOLATION;
+    } _SEH2_END;
+
+    if (!NT_SUCCESS(Status))
+        return UnlockAndMaybeComplete(FCB, Status, Irp, 0);
+
+    if (MessageCount == 0 || MessageCount > AFD_MAX_DATAGRAM_BATCH)
+        return UnlockAndMaybeComplete(FCB, STATUS_INVALID_PARAMETER, Irp, 0);
+
+    /* A batch never pends; the caller blocks in a single receive when
+     * it wants to wait for the first datagram */
+    if (IsListEmpty(&FCB->DatagramList))
+    {
+        FCB->PollState &= ~AFD_EVENT_RECEIVE;
+        return UnlockAndMaybeComplete(FCB, STATUS_CANT_WAIT, Irp, 0);
+    }
+
+    _SEH2_TRY {
+        if (Irp->RequestorMode != KernelMode)
+        {
+            ProbeForWrite(Messages,
+                          MessageCount * sizeof(AFD_DATAGRAM_MSG),
+                          sizeof(ULONG));
+        }
+
+        while (Count < MessageCount &&
+               !IsListEmpty(&FCB->DatagramList))
+        {
+            Msg = &Messages[Count];
+            DatagramRecv = CONTAINING_RECORD(FCB->DatagramList.Flink,
+                                             AFD_STORED_DATAGRAM, ListEntry);
+
+            /* Capture the user's descriptor before probing it */
+            Buffer = Msg->Buffer;
+            Address = Msg->Address;
+            AddressLength = Msg->AddressLength;
+
+            BytesToCopy = MIN(Buffer.len, DatagramRecv->Len);
+            if (Irp->RequestorMode != KernelMode)
+                ProbeForWrite(Buffer.buf, BytesToCopy, 1);
+            RtlCopyMemory(Buffer.buf, DatagramRecv->Buffer, BytesToCopy);
+
+            if (Address && AddressLength > 0)
+            {
+                AddrLen = MIN(DatagramRecv->Address->Address->AddressLength +
+                              sizeof(USHORT),
+                              (UINT)AddressLength);
+                if (Irp->RequestorMode != KernelMode)
+                    ProbeForWrite(Address, AddrLen, 1);
+                RtlCopyMemory(Address,
+                              &DatagramRecv->Address->Address->AddressType,
+                              AddrLen);
+                Msg->AddressLength = AddrLen;
+            }
+
+            Msg->Length = BytesToCopy;
+            Msg->Flags = (BytesToCopy < DatagramRecv->Len) ? AFD_DATAGRAM_PARTIAL : 0;
+            Count++;
+
+            /* Peeking only ever looks at the head of the queue */
+            if (TdiFlags & TDI_RECEIVE_PEEK)
+                break;
+
+            ListEntry = RemoveHeadList(&FCB->DatagramList);
+            ASSERT(ListEntry == &DatagramRecv->ListEntry);
+            FCB->Recv.Content -= DatagramRecv->Len;
+            ExFreePoolWithTag(DatagramRecv->Address, TAG_AFD_TRANSPORT_ADDRESS);
+            ExFreePoolWithTag(DatagramRecv, TAG_AFD_STORED_DATAGRAM);
+        }
+    } _SEH2_EXCEPT(EXCEPTION_EXECUTE_HANDLER) {
+        AFD_DbgPrint(MIN_TRACE,("Access violation after %u datagrams\n", Count));
+        /* Datagrams handed out before the fault stay consumed */
+        if (Count == 0)
+            Status = STATUS_ACCESS_VIOLATION;
+    } _SEH2_END;
+
+    AFD_DbgPrint(MID_TRACE,("Received %u datagrams\n", Count));
+
+    if (!IsListEmpty(&FCB->DatagramList))
+    {
+        FCB->PollState |= AFD_EVENT_RECEIVE;
+        FCB->PollStatus[FD_READ_BIT] = STATUS_SUCCESS;
+        PollReeval( FCB->DeviceExt, FCB->FileObject );
+    }
+    else
+        FCB->PollState &= ~AFD_EVENT_RECEIVE;
+
+    /* Draining the queue may have made room for the transport to deliver
+     * again after PacketSocketRecvComplete stopped on a full window */
+    if (!FCB->ReceiveIrp.InFlightRequest &&
+        FCB->Recv.Content < FCB->Recv.Size)
+    {
+        TdiReceiveDatagram(&FCB->ReceiveIrp.InFlightRequest,
+                           FCB->AddressFile.Object,
+                           0,
+                           FCB->Recv.Window,
+                           FCB->Recv.Size,
+                           FCB->AddressFrom,
+                           PacketSocketRecvComplete,
+                           FCB);
+    }
+
+    return UnlockAndMaybeComplete(FCB, Status, Irp, Count);
+}
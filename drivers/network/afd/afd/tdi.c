@@ -1055,6 +1055,90 @@ NTSTATUS TdiReceive(
 }
 
 
+NTSTATUS TdiReceiveMdl(
+    PIRP *Irp,
+    PFILE_OBJECT TransportObject,
+    USHORT Flags,
+    PMDL LockedMdl,
+    UINT BufferLength,
+    PIO_COMPLETION_ROUTINE CompletionRoutine,
+    PVOID CompletionContext)
+/*
+ * FUNCTION: Receives data directly into an already locked buffer
+ * ARGUMENTS:
+ *     TransportObject = Pointer to transport object
+ *     LockedMdl       = MDL describing the locked buffer
+ *     BufferLength    = Number of bytes to receive at the start of the buffer
+ * RETURNS:
+ *     Status of operation
+ * NOTES:
+ *     The IRP is given a partial MDL of LockedMdl, so the buffer must
+ *     stay locked until the receive completes
+ */
+{
+    PDEVICE_OBJECT DeviceObject;
+    PVOID VirtualAddress;
+    PMDL Mdl;
+
+    ASSERT(*Irp == NULL);
+
+    if (!TransportObject) {
+        AFD_DbgPrint(MIN_TRACE, ("Bad transport object.\n"));
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    DeviceObject = IoGetRelatedDeviceObject(TransportObject);
+    if (!DeviceObject) {
+        AFD_DbgPrint(MIN_TRACE, ("Bad device object.\n"));
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    *Irp = TdiBuildInternalDeviceControlIrp(TDI_RECEIVE,             /* Sub function */
+                                            DeviceObject,            /* Device object */
+                                            TransportObject,         /* File object */
+                                            NULL,                    /* Event */
+                                            NULL);                   /* Status */
+
+    if (!*Irp) {
+        AFD_DbgPrint(MIN_TRACE, ("Insufficient resources.\n"));
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    VirtualAddress = MmGetMdlVirtualAddress(LockedMdl);
+
+    Mdl = IoAllocateMdl(VirtualAddress, /* Virtual address */
+                        BufferLength,   /* Length of buffer */
+                        FALSE,          /* Not secondary */
+                        FALSE,          /* Don't charge quota */
+                        NULL);          /* Don't use IRP */
+    if (!Mdl) {
+        AFD_DbgPrint(MIN_TRACE, ("Insufficient resources.\n"));
+        IoCompleteRequest(*Irp, IO_NO_INCREMENT);
+        *Irp = NULL;
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    IoBuildPartialMdl(LockedMdl, Mdl, VirtualAddress, BufferLength);
+
+    AFD_DbgPrint(MID_TRACE, ("AFD>>> Got a partial MDL: %p\n", Mdl));
+
+    TdiBuildReceive(*Irp,                   /* I/O Request Packet */
+                    DeviceObject,           /* Device object */
+                    TransportObject,        /* File object */
+                    CompletionRoutine,      /* Completion routine */
+                    CompletionContext,      /* Completion context */
+                    Mdl,                    /* Data buffer */
+                    Flags,                  /* Flags */
+                    BufferLength);          /* Length of data */
+
+    TdiCall(*Irp, DeviceObject, NULL, NULL);
+    /* Does not block...  The partial MDL is freed in the receive
+       completion routine, before LockedMdl is unlocked. */
+
+    return STATUS_PENDING;
+}
+
+
 NTSTATUS TdiReceiveDatagram(
     PIRP *Irp,
     PFILE_OBJECT TransportObject,
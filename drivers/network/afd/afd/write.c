@@ -325,6 +325,26 @@ static NTSTATUS NTAPI PacketSocketSendComplete
     return STATUS_SUCCESS;
 }
 
+typedef struct _AFD_BATCH_SEND_CONTEXT {
+    KEVENT Event;
+    IO_STATUS_BLOCK Iosb;
+} AFD_BATCH_SEND_CONTEXT, *PAFD_BATCH_SEND_CONTEXT;
+
+static IO_COMPLETION_ROUTINE PacketSocketBatchSendComplete;
+static NTSTATUS NTAPI PacketSocketBatchSendComplete
+( PDEVICE_OBJECT DeviceObject,
+  PIRP Irp,
+  PVOID Context ) {
+    PAFD_BATCH_SEND_CONTEXT SendContext = Context;
+
+    UNREFERENCED_PARAMETER(DeviceObject);
+
+    SendContext->Iosb = Irp->IoStatus;
+    KeSetEvent(&SendContext->Event, IO_NETWORK_INCREMENT, FALSE);
+
+    return STATUS_SUCCESS;
+}
+
 NTSTATUS NTAPI
 AfdConnectedSocketWriteData(PDEVICE_OBJECT DeviceObject, PIRP Irp,
                             PIO_STACK_LOCATION IrpSp, BOOLEAN Short) {
@@ -676,3 +696,239 @@ AfdPacketSocketWriteData(PDEVICE_OBJECT DeviceObject, PIRP Irp,
         return UnlockAndMaybeComplete( FCB, Status, Irp, 0 );
     }
 }
+
+NTSTATUS NTAPI
+AfdPacketSocketWriteDatagrams(PDEVICE_OBJECT DeviceObject, PIRP Irp,
+                              PIO_STACK_LOCATION IrpSp) {
+    NTSTATUS Status = STATUS_SUCCESS;
+    PTDI_CONNECTION_INFORMATION TargetAddress = NULL;
+    PTRANSPORT_ADDRESS RemoteAddress, MsgAddress;
+    PFILE_OBJECT FileObject = IrpSp->FileObject;
+    PAFD_FCB FCB = FileObject->FsContext;
+    PAFD_DATAGRAMS_INFO SendReq;
+    AFD_DATAGRAM_MSG Msg;
+    AFD_BATCH_SEND_CONTEXT SendContext;
+    PAFD_DATAGRAM_MSG Messages = NULL;
+    ULONG MessageCount = 0;
+    PIRP SendIrp;
+    ULONG Count;
+
+    UNREFERENCED_PARAMETER(DeviceObject);
+
+    AFD_DbgPrint(MID_TRACE,("Called on %p\n", FCB));
+
+    if( !SocketAcquireStateLock( FCB ) ) return LostSocket( Irp );
+
+    FCB->EventSelectDisabled &= ~AFD_EVENT_SEND;
+
+    /* Check that the socket is bound */
+    if( (FCB->State != SOCKET_STATE_BOUND &&
+         FCB->State != SOCKET_STATE_CREATED) ||
+        !(FCB->Flags & AFD_ENDPOINT_CONNECTIONLESS) )
+    {
+        AFD_DbgPrint(MIN_TRACE,("Invalid socket state\n"));
+        return UnlockAndMaybeComplete(FCB, STATUS_INVALID_PARAMETER, Irp, 0);
+    }
+
+    if (FCB->SendClosed)
+    {
+        AFD_DbgPrint(MIN_TRACE,("No more sends\n"));
+        return UnlockAndMaybeComplete(FCB, STATUS_FILE_CLOSED, Irp, 0);
+    }
+
+    if (IrpSp->Parameters.DeviceIoControl.InputBufferLength < sizeof(AFD_DATAGRAMS_INFO))
+        return UnlockAndMaybeComplete(FCB, STATUS_INVALID_PARAMETER, Irp, 0);
+
+    if( !(SendReq = LockRequest( Irp, IrpSp, FALSE, NULL )) )
+        return UnlockAndMaybeComplete(FCB, STATUS_NO_MEMORY, Irp, 0);
+
+    /* The request still lives in the caller's pages, read it only once.
+     * The lengths are written back, so the array must be writable */
+    _SEH2_TRY {
+        Messages = SendReq->Messages;
+        MessageCount = SendReq->MessageCount;
+
+        if (MessageCount != 0 &&
+            MessageCount <= AFD_MAX_DATAGRAM_BATCH &&
+            Irp->RequestorMode != KernelMode)
+        {
+            ProbeForWrite(Messages,
+                          MessageCount * sizeof(AFD_DATAGRAM_MSG),
+                          sizeof(ULONG));
+        }
+    } _SEH2_EXCEPT(EXCEPTION_EXECUTE_HANDLER) {
+        Status = STATUS_ACCESS_VIOLATION;
+    } _SEH2_END;
+
+    if (!NT_SUCCESS(Status))
+        return UnlockAndMaybeComplete(FCB, Status, Irp, 0);
+
+    if (MessageCount == 0 || MessageCount > AFD_MAX_DATAGRAM_BATCH)
+        return UnlockAndMaybeComplete(FCB, STATUS_INVALID_PARAMETER, Irp, 0);
+
+    /* Per-datagram destinations are captured here in TDI format */
+    MsgAddress = ExAllocatePoolWithTag(NonPagedPool,
+                                       FIELD_OFFSET(TRANSPORT_ADDRESS, Address[0].AddressType) +
+                                       AFD_MAX_DATAGRAM_ADDRESS,
+                                       TAG_AFD_TRANSPORT_ADDRESS);
+    if (!MsgAddress)
+        return UnlockAndMaybeComplete(FCB, STATUS_NO_MEMORY, Irp, 0);
+
+    KeInitializeEvent(&SendContext.Event, SynchronizationEvent, FALSE);
+
+    for (Count = 0; Count < MessageCount; Count++)
+    {
+        RtlZeroMemory(MsgAddress,
+                      FIELD_OFFSET(TRANSPORT_ADDRESS, Address[0].AddressType) +
+                      AFD_MAX_DATAGRAM_ADDRESS);
+
+        _SEH2_TRY {
+            Msg = Messages[Count];
+
+            if (Irp->RequestorMode != KernelMode)
+                ProbeForRead(Msg.Buffer.buf, Msg.Buffer.len, 1);
+
+            if (Msg.Address)
+            {
+                if (Msg.AddressLength <= (INT)sizeof(USHORT) ||
+                    Msg.AddressLength > AFD_MAX_DATAGRAM_ADDRESS)
+                {
+                    Status = STATUS_INVALID_PARAMETER;
+                }
+                else
+                {
+                    if (Irp->RequestorMode != KernelMode)
+                        ProbeForRead(Msg.Address, Msg.AddressLength, 1);
+
+                    /* Same conversion msafd does for WSPSendTo */
+                    MsgAddress->TAAddressCount = 1;
+                    MsgAddress->Address[0].AddressLength =
+                        (USHORT)(Msg.AddressLength - sizeof(USHORT));
+                    RtlCopyMemory(&MsgAddress->Address[0].AddressType,
+                                  Msg.Address,
+                                  Msg.AddressLength);
+                }
+            }
+        } _SEH2_EXCEPT(EXCEPTION_EXECUTE_HANDLER) {
+            Status = STATUS_ACCESS_VIOLATION;
+        } _SEH2_END;
+
+        if (!NT_SUCCESS(Status))
+            break;
+
+        /* Datagrams without an address go to the connected peer */
+        RemoteAddress = Msg.Address ? MsgAddress : FCB->RemoteAddress;
+        if (!RemoteAddress)
+        {
+            Status = STATUS_INVALID_PARAMETER;
+            break;
+        }
+
+        if (FCB->State == SOCKET_STATE_CREATED)
+        {
+            if (FCB->LocalAddress)
+            {
+                ExFreePoolWithTag(FCB->LocalAddress, TAG_AFD_TRANSPORT_ADDRESS);
+            }
+
+            FCB->LocalAddress =
+            TaBuildNullTransportAddress( RemoteAddress->Address[0].AddressType );
+
+            if( !FCB->LocalAddress )
+            {
+                Status = STATUS_NO_MEMORY;
+                break;
+            }
+
+            Status = WarmSocketForBind( FCB, AFD_SHARE_WILDCARD );
+            if( !NT_SUCCESS(Status) )
+                break;
+
+            FCB->State = SOCKET_STATE_BOUND;
+        }
+
+        /* Reuse the connection information while the family stays the same */
+        if (TargetAddress &&
+            ((PTRANSPORT_ADDRESS)TargetAddress->RemoteAddress)->Address[0].AddressType ==
+            RemoteAddress->Address[0].AddressType)
+        {
+            Status = TdiBuildConnectionInfoInPlace(TargetAddress, RemoteAddress);
+        }
+        else
+        {
+            if (TargetAddress)
+                ExFreePoolWithTag(TargetAddress, TAG_AFD_TDI_CONNECTION_INFORMATION);
+            Status = TdiBuildConnectionInfo(&TargetAddress, RemoteAddress);
+        }
+
+        if (!NT_SUCCESS(Status))
+            break;
+
+        SendIrp = NULL;
+        SendContext.Iosb.Status = STATUS_SUCCESS;
+        SendContext.Iosb.Information = 0;
+
+        Status = TdiSendDatagram(&SendIrp,
+                                 FCB->AddressFile.Object,
+                                 Msg.Buffer.buf,
+                                 Msg.Buffer.len,
+                                 TargetAddress,
+                                 PacketSocketBatchSendComplete,
+                                 &SendContext);
+        if (Status == STATUS_PENDING)
+        {
+            /* Don't hold up every other request on the socket while the
+             * transport sends; the IRP keeps the FCB alive meanwhile */
+            SocketStateUnlock(FCB);
+            KeWaitForSingleObject(&SendContext.Event,
+                                  Executive,
+                                  KernelMode,
+                                  FALSE,
+                                  NULL);
+            SocketAcquireStateLock(FCB);
+            Status = SendContext.Iosb.Status;
+        }
+
+        if (!NT_SUCCESS(Status))
+            break;
+
+        _SEH2_TRY {
+            Messages[Count].Length = (ULONG)SendContext.Iosb.Information;
+        } _SEH2_EXCEPT(EXCEPTION_EXECUTE_HANDLER) {
+            Status = STATUS_ACCESS_VIOLATION;
+        } _SEH2_END;
+
+        if (!NT_SUCCESS(Status))
+        {
+            /* The datagram went out, only its length could not be reported */
+            Count++;
+            break;
+        }
+
+        /* The socket may have been closed or shut down while we waited */
+        if (FCB->State == SOCKET_STATE_CLOSED || FCB->SendClosed)
+        {
+            Count++;
+            Status = STATUS_FILE_CLOSED;
+            break;
+        }
+    }
+
+    AFD_DbgPrint(MID_TRACE,("Sent %u datagrams (Status %x)\n", Count, Status));
+
+    if (TargetAddress)
+        ExFreePoolWithTag(TargetAddress, TAG_AFD_TDI_CONNECTION_INFORMATION);
+    ExFreePoolWithTag(MsgAddress, TAG_AFD_TRANSPORT_ADDRESS);
+
+    /* Partial batches succeed with the number of datagrams sent */
+    if (Count > 0)
+    {
+        Status = STATUS_SUCCESS;
+
+        FCB->PollState |= AFD_EVENT_SEND;
+        FCB->PollStatus[FD_WRITE_BIT] = STATUS_SUCCESS;
+        PollReeval(FCB->DeviceExt, FCB->FileObject);
+    }
+
+    return UnlockAndMaybeComplete(FCB, Status, Irp, Count);
+}
@@ -185,6 +185,9 @@ typedef struct _AFD_FCB {
     DWORD PollState;
     NTSTATUS PollStatus[FD_MAX_EVENTS];
     NTSTATUS LastReceiveStatus;
+    PIRP DirectRecvIrp;             /* Receive IRP the transport is filling directly */
+    ULONGLONG RecvBytesDirect;      /* Bytes received directly into user buffers */
+    ULONGLONG RecvBytesBuffered;    /* Bytes copied to user buffers from Recv.Window */
     UINT ContextSize;
     PVOID ConnectData;
     UINT FilledConnectData;
@@ -316,6 +319,9 @@ AfdConnectedSocketReadData(PDEVICE_OBJECT DeviceObject, PIRP Irp, PIO_STACK_LOCA
 NTSTATUS NTAPI
 AfdPacketSocketReadData(PDEVICE_OBJECT DeviceObject, PIRP Irp,
 			PIO_STACK_LOCATION IrpSp );
+NTSTATUS NTAPI
+AfdPacketSocketReadDatagrams(PDEVICE_OBJECT DeviceObject, PIRP Irp,
+			     PIO_STACK_LOCATION IrpSp );
 
 /* select.c */
 
@@ -370,6 +376,15 @@ NTSTATUS TdiReceive
   PIO_COMPLETION_ROUTINE  CompletionRoutine,
   PVOID CompletionContext);
 
+NTSTATUS TdiReceiveMdl(
+    PIRP *Irp,
+    PFILE_OBJECT TransportObject,
+    USHORT Flags,
+    PMDL LockedMdl,
+    UINT BufferLength,
+    PIO_COMPLETION_ROUTINE CompletionRoutine,
+    PVOID CompletionContext);
+
 NTSTATUS TdiSend
 ( PIRP *Irp,
   PFILE_OBJECT ConnectionObject,
@@ -410,5 +425,8 @@ AfdConnectedSocketWriteData(PDEVICE_OBJECT DeviceObject, PIRP Irp,
 NTSTATUS NTAPI
 AfdPacketSocketWriteData(PDEVICE_OBJECT DeviceObject, PIRP Irp,
 			 PIO_STACK_LOCATION IrpSp);
+NTSTATUS NTAPI
+AfdPacketSocketWriteDatagrams(PDEVICE_OBJECT DeviceObject, PIRP Irp,
+			      PIO_STACK_LOCATION IrpSp);
 
 #endif /* _AFD_H */
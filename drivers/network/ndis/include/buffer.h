@@ -7,28 +7,70 @@
 
 #pragma once
 
+/* Number of pages a pooled buffer descriptor can describe. Larger
+   buffers fall back to IoAllocateMdl */
+#define NDIS_BUFFER_POOL_MAX_PAGES  8
+
+/* Maximum number of free descriptors kept in a per-processor cache */
+#define NDIS_POOL_CACHE_DEPTH       32
+
+#define NDIS_BUFFER_POOL_TAG        'PBDN'
+#define NDIS_PACKET_POOL_TAG        'PPDN'
+
+/* Per-processor descriptor cache and usage counters */
+typedef struct _NDISI_POOL_CACHE
+{
+    PVOID FreeList;                         /* Free descriptors cached on this processor */
+    ULONG Depth;                            /* Number of descriptors in FreeList */
+    ULONG Allocations;                      /* Descriptors handed out */
+    ULONG Frees;                            /* Descriptors returned */
+    ULONG CacheHits;                        /* Allocations satisfied without the pool lock */
+    ULONG Failures;                         /* Allocations the pool could not satisfy */
+    UCHAR Padding[SYSTEM_CACHE_ALIGNMENT_SIZE - sizeof(PVOID) - 5 * sizeof(ULONG)];
+} NDISI_POOL_CACHE, *PNDISI_POOL_CACHE;
+
+/* Common part of buffer and packet pools */
+typedef struct _NDISI_POOL_HEADER
+{
+    LIST_ENTRY ListEntry;                   /* Entry in NdisPoolListHead */
+    ULONG Tag;                              /* NDIS_BUFFER_POOL_TAG or NDIS_PACKET_POOL_TAG */
+    KSPIN_LOCK SpinLock;                    /* Protects FreeList */
+    PVOID FreeList;                         /* Shared list of free descriptors */
+    ULONG LinkOffset;                       /* Offset of the free list link in a descriptor */
+    ULONG NumberOfDescriptors;              /* Number of preallocated descriptors */
+    ULONG CacheDepth;                       /* Per-processor cache limit, 0 disables caching */
+    PNDISI_POOL_CACHE Caches;               /* One cache per processor */
+} NDISI_POOL_HEADER, *PNDISI_POOL_HEADER;
+
 /* FIXME: Possibly move this to ntddk.h */
 typedef struct _NETWORK_HEADER
 {
-    MDL Mdl;                                /* Memory Descriptor List */
     struct _NETWORK_HEADER *Next;           /* Link to next NDIS buffer in pool */
     struct _NDIS_BUFFER_POOL *BufferPool;   /* Link to NDIS buffer pool */
+    MDL Mdl;                                /* Memory Descriptor List */
+    PFN_NUMBER Pages[NDIS_BUFFER_POOL_MAX_PAGES]; /* Page array of Mdl */
 } NETWORK_HEADER, *PNETWORK_HEADER;
 
 typedef struct _NDIS_BUFFER_POOL
 {
-    KSPIN_LOCK SpinLock;
-    PNETWORK_HEADER FreeList;
+    NDISI_POOL_HEADER Header;
     NETWORK_HEADER Buffers[0];
 } NDIS_BUFFER_POOL, *PNDIS_BUFFER_POOL;
 
 typedef struct _NDISI_PACKET_POOL {
-  NDIS_SPIN_LOCK  SpinLock;
-  struct _NDIS_PACKET *FreeList;
+  NDISI_POOL_HEADER Header;
   UINT  PacketLength;
   UCHAR  Buffer[1];
 } NDISI_PACKET_POOL, * PNDISI_PACKET_POOL;
 
+extern LIST_ENTRY NdisPoolListHead;
+extern KSPIN_LOCK NdisPoolListLock;
+
+VOID
+NdisiQueryPoolUsage(
+    IN PNDISI_POOL_HEADER Pool,
+    OUT PNDISI_POOL_CACHE Totals);
+
 UINT CopyBufferToBufferChain(
     PNDIS_BUFFER DstBuffer,
     UINT DstOffset,
@@ -11,6 +11,10 @@
 #define __NDISSYS_H
 
 #include <ndis.h>
+#ifdef KDBG
+#include <ndk/kdfuncs.h>
+#include <reactos/kdros.h>
+#endif
 
 #include "debug.h"
 #include "miniport.h"
@@ -54,6 +58,11 @@ NTAPI
 ExGetCurrentProcessorCpuUsage(
     PULONG CpuUsage);
 
+#ifdef KDBG
+/* kdbg.c */
+KDBG_CLI_ROUTINE NdisKdbgHandler;
+#endif
+
 /* portability fixes */
 #ifdef _M_AMD64
 #define KfReleaseSpinLock KeReleaseSpinLock
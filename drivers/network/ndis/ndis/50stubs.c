@@ -487,23 +487,3 @@ NdisIMInitializeDeviceInstanceEx(
 
     return NDIS_STATUS_FAILURE;
 }
-
-
-/*
- * @unimplemented
- */
-UINT
-EXPORT
-NdisPacketPoolUsage(
-    IN  NDIS_HANDLE PoolHandle)
-/*
- * FUNCTION:
- * ARGUMENTS:
- * NOTES:
- *    NDIS 5.0
- */
-{
-    UNIMPLEMENTED;
-
-    return 0;
-}
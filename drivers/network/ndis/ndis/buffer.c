@@ -10,6 +10,270 @@
 
 #include <ndissys.h>
 
+LIST_ENTRY NdisPoolListHead;
+KSPIN_LOCK NdisPoolListLock;
+
+#define NDIS_POOL_LINK(Pool, Descriptor) \
+    (*(PVOID*)((PUCHAR)(Descriptor) + (Pool)->LinkOffset))
+
+static
+BOOLEAN
+NdisiInitializePool(
+    IN PNDISI_POOL_HEADER Pool,
+    IN ULONG Tag,
+    IN ULONG LinkOffset,
+    IN PUCHAR Descriptors,
+    IN ULONG DescriptorLength,
+    IN ULONG NumberOfDescriptors)
+/*
+ * FUNCTION: Initializes the part common to buffer and packet pools
+ * ARGUMENTS:
+ *     Pool                = Address of the pool header
+ *     Tag                 = Pool type tag
+ *     LinkOffset          = Offset of the free list link in a descriptor
+ *     Descriptors         = Address of the preallocated descriptors
+ *     DescriptorLength    = Size of a descriptor in bytes
+ *     NumberOfDescriptors = Number of preallocated descriptors
+ * RETURNS:
+ *     TRUE if the pool was initialized, FALSE if out of resources
+ */
+{
+    PVOID Descriptor;
+    KIRQL OldIrql;
+    ULONG i;
+
+    Pool->Caches = ExAllocatePoolWithTag(NonPagedPool,
+                                         KeNumberProcessors * sizeof(NDISI_POOL_CACHE),
+                                         Tag);
+    if (!Pool->Caches)
+        return FALSE;
+
+    RtlZeroMemory(Pool->Caches, KeNumberProcessors * sizeof(NDISI_POOL_CACHE));
+
+    Pool->Tag = Tag;
+    KeInitializeSpinLock(&Pool->SpinLock);
+    Pool->LinkOffset = LinkOffset;
+    Pool->NumberOfDescriptors = NumberOfDescriptors;
+
+    /* Never strand more than half of the descriptors in processor caches */
+    Pool->CacheDepth = MIN(NDIS_POOL_CACHE_DEPTH,
+                           NumberOfDescriptors / (2 * KeNumberProcessors));
+
+    Pool->FreeList = NULL;
+    for (i = NumberOfDescriptors; i > 0; i--)
+    {
+        Descriptor = Descriptors + (i - 1) * DescriptorLength;
+        NDIS_POOL_LINK(Pool, Descriptor) = Pool->FreeList;
+        Pool->FreeList = Descriptor;
+    }
+
+    KeAcquireSpinLock(&NdisPoolListLock, &OldIrql);
+    InsertTailList(&NdisPoolListHead, &Pool->ListEntry);
+    KeReleaseSpinLock(&NdisPoolListLock, OldIrql);
+
+    return TRUE;
+}
+
+static
+VOID
+NdisiDeletePool(
+    IN PNDISI_POOL_HEADER Pool)
+/*
+ * FUNCTION: Releases the resources held by the common part of a pool
+ * ARGUMENTS:
+ *     Pool = Address of the pool header
+ */
+{
+    KIRQL OldIrql;
+
+    KeAcquireSpinLock(&NdisPoolListLock, &OldIrql);
+    RemoveEntryList(&Pool->ListEntry);
+    KeReleaseSpinLock(&NdisPoolListLock, OldIrql);
+
+    ExFreePoolWithTag(Pool->Caches, Pool->Tag);
+}
+
+static
+PVOID
+NdisiPopPoolDescriptor(
+    IN PNDISI_POOL_HEADER Pool)
+/*
+ * FUNCTION: Takes a free descriptor from a pool
+ * ARGUMENTS:
+ *     Pool = Address of the pool header
+ * RETURNS:
+ *     Address of the descriptor, NULL if the pool is exhausted
+ * NOTES:
+ *     Must be called at IRQL DISPATCH_LEVEL
+ */
+{
+    PNDISI_POOL_CACHE Cache = &Pool->Caches[KeGetCurrentProcessorNumber()];
+    PVOID Descriptor, Next;
+    ULONG i;
+
+    Descriptor = Cache->FreeList;
+    if (Descriptor) {
+        Cache->FreeList = NDIS_POOL_LINK(Pool, Descriptor);
+        Cache->Depth--;
+        Cache->CacheHits++;
+    } else {
+        KeAcquireSpinLockAtDpcLevel(&Pool->SpinLock);
+
+        Descriptor = Pool->FreeList;
+        if (Descriptor) {
+            Pool->FreeList = NDIS_POOL_LINK(Pool, Descriptor);
+
+            /* Refill half of the cache while we own the lock */
+            for (i = 0; i < Pool->CacheDepth / 2 && Pool->FreeList; i++) {
+                Next = Pool->FreeList;
+                Pool->FreeList = NDIS_POOL_LINK(Pool, Next);
+                NDIS_POOL_LINK(Pool, Next) = Cache->FreeList;
+                Cache->FreeList = Next;
+                Cache->Depth++;
+            }
+        }
+
+        KeReleaseSpinLockFromDpcLevel(&Pool->SpinLock);
+    }
+
+    if (Descriptor)
+        Cache->Allocations++;
+    else
+        Cache->Failures++;
+
+    return Descriptor;
+}
+
+static
+VOID
+NdisiPushPoolDescriptor(
+    IN PNDISI_POOL_HEADER Pool,
+    IN PVOID Descriptor)
+/*
+ * FUNCTION: Returns a descriptor to a pool
+ * ARGUMENTS:
+ *     Pool       = Address of the pool header
+ *     Descriptor = Address of the descriptor
+ * NOTES:
+ *     Must be called at IRQL DISPATCH_LEVEL
+ */
+{
+    PNDISI_POOL_CACHE Cache = &Pool->Caches[KeGetCurrentProcessorNumber()];
+
+    NDIS_POOL_LINK(Pool, Descriptor) = Cache->FreeList;
+    Cache->FreeList = Descriptor;
+    Cache->Depth++;
+    Cache->Frees++;
+
+    if (Cache->Depth > Pool->CacheDepth) {
+        /* Give the cache back to the shared list, keeping half of it */
+        KeAcquireSpinLockAtDpcLevel(&Pool->SpinLock);
+
+        while (Cache->Depth > Pool->CacheDepth / 2) {
+            Descriptor = Cache->FreeList;
+            Cache->FreeList = NDIS_POOL_LINK(Pool, Descriptor);
+            NDIS_POOL_LINK(Pool, Descriptor) = Pool->FreeList;
+            Pool->FreeList = Descriptor;
+            Cache->Depth--;
+        }
+
+        KeReleaseSpinLockFromDpcLevel(&Pool->SpinLock);
+    }
+}
+
+VOID
+NdisiQueryPoolUsage(
+    IN PNDISI_POOL_HEADER Pool,
+    OUT PNDISI_POOL_CACHE Totals)
+/*
+ * FUNCTION: Sums up the per-processor counters of a pool
+ * ARGUMENTS:
+ *     Pool   = Address of the pool header
+ *     Totals = Address of buffer for the summed counters
+ * NOTES:
+ *     Counters are read without synchronization, the result is a snapshot
+ */
+{
+    PNDISI_POOL_CACHE Cache;
+    CCHAR i;
+
+    RtlZeroMemory(Totals, sizeof(NDISI_POOL_CACHE));
+
+    for (i = 0; i < KeNumberProcessors; i++) {
+        Cache = &Pool->Caches[i];
+        Totals->Depth       += Cache->Depth;
+        Totals->Allocations += Cache->Allocations;
+        Totals->Frees       += Cache->Frees;
+        Totals->CacheHits   += Cache->CacheHits;
+        Totals->Failures    += Cache->Failures;
+    }
+}
+
+static
+VOID
+NdisiInitializePoolPacket(
+    IN PNDISI_PACKET_POOL Pool,
+    IN PNDIS_PACKET Packet)
+/*
+ * FUNCTION: Prepares a packet descriptor taken from a pool for use
+ * ARGUMENTS:
+ *     Pool   = Pointer to the packet pool
+ *     Packet = Pointer to the packet descriptor
+ */
+{
+    RtlZeroMemory(Packet, Pool->PacketLength);
+    Packet->Private.Pool = Pool;
+    Packet->Private.ValidCounts = TRUE;
+    Packet->Private.NdisPacketFlags = fPACKET_ALLOCATED_BY_NDIS;
+    Packet->Private.NdisPacketOobOffset = Pool->PacketLength -
+                                          (sizeof(NDIS_PACKET_OOB_DATA) +
+                                           sizeof(NDIS_PACKET_EXTENSION));
+}
+
+static
+PNDIS_BUFFER
+NdisiAllocateBufferDescriptor(
+    IN NDIS_HANDLE PoolHandle,
+    IN PVOID VirtualAddress,
+    IN UINT Length)
+/*
+ * FUNCTION: Allocates and initializes a buffer descriptor
+ * ARGUMENTS:
+ *     PoolHandle     = Handle returned by NdisAllocateBufferPool
+ *     VirtualAddress = Pointer to virtual address of data buffer
+ *     Length         = Number of bytes in data buffer
+ * RETURNS:
+ *     Pointer to the descriptor, NULL if out of resources
+ * NOTES:
+ *     Descriptors taken from the pool are marked with MDL_NETWORK_HEADER.
+ *     Buffers spanning too many pages, or requested while the pool is
+ *     exhausted, get a descriptor from IoAllocateMdl instead
+ */
+{
+    PNDIS_BUFFER_POOL Pool = (PNDIS_BUFFER_POOL)PoolHandle;
+    PNETWORK_HEADER Header = NULL;
+    KIRQL OldIrql;
+
+    if (Pool) {
+        KeRaiseIrql(DISPATCH_LEVEL, &OldIrql);
+
+        if (ADDRESS_AND_SIZE_TO_SPAN_PAGES(VirtualAddress, Length) <= NDIS_BUFFER_POOL_MAX_PAGES)
+            Header = NdisiPopPoolDescriptor(&Pool->Header);
+        else
+            Pool->Header.Caches[KeGetCurrentProcessorNumber()].Failures++;
+
+        KeLowerIrql(OldIrql);
+    }
+
+    if (!Header)
+        return IoAllocateMdl(VirtualAddress, Length, FALSE, FALSE, NULL);
+
+    MmInitializeMdl(&Header->Mdl, VirtualAddress, Length);
+    Header->Mdl.MdlFlags |= MDL_NETWORK_HEADER;
+
+    return &Header->Mdl;
+}
+
 FORCEINLINE
 ULONG
 SkipToOffset(
@@ -352,7 +616,7 @@ NdisAllocateBuffer(
     ASSERT(VirtualAddress != NULL);
     ASSERT(Length > 0);
 
-    *Buffer = IoAllocateMdl(VirtualAddress, Length, FALSE, FALSE, NULL);
+    *Buffer = NdisiAllocateBufferDescriptor(PoolHandle, VirtualAddress, Length);
     if (*Buffer != NULL) {
         MmBuildMdlForNonPagedPool(*Buffer);
         (*Buffer)->Next = NULL;
@@ -381,8 +645,47 @@ NdisAllocateBufferPool(
  *     NumberOfDescriptors = Size of buffer pool in number of descriptors
  */
 {
+    PNDIS_BUFFER_POOL Pool;
+    UINT i;
+
+    NDIS_DbgPrint(MAX_TRACE, ("Status (0x%X)  PoolHandle (0x%X)  "
+        "NumberOfDescriptors (%d).\n", Status, PoolHandle, NumberOfDescriptors));
+
+    *PoolHandle = NULL;
+
+    if (NumberOfDescriptors > 0xffff)
+    {
+        NDIS_DbgPrint(MIN_TRACE, ("Number of descriptors > 0xffff (%lx)\n", NumberOfDescriptors));
+        NumberOfDescriptors = 0xffff;
+    }
+
+    Pool = ExAllocatePoolWithTag(NonPagedPool,
+                                 sizeof(NDIS_BUFFER_POOL) +
+                                 NumberOfDescriptors * sizeof(NETWORK_HEADER),
+                                 NDIS_BUFFER_POOL_TAG);
+    if (!Pool)
+    {
+        *Status = NDIS_STATUS_RESOURCES;
+        return;
+    }
+
+    for (i = 0; i < NumberOfDescriptors; i++)
+        Pool->Buffers[i].BufferPool = Pool;
+
+    if (!NdisiInitializePool(&Pool->Header,
+                             NDIS_BUFFER_POOL_TAG,
+                             FIELD_OFFSET(NETWORK_HEADER, Next),
+                             (PUCHAR)Pool->Buffers,
+                             sizeof(NETWORK_HEADER),
+                             NumberOfDescriptors))
+    {
+        ExFreePoolWithTag(Pool, NDIS_BUFFER_POOL_TAG);
+        *Status = NDIS_STATUS_RESOURCES;
+        return;
+    }
+
     *Status = NDIS_STATUS_SUCCESS;
-    *PoolHandle = 0;
+    *PoolHandle = (NDIS_HANDLE)Pool;
 }
 
 
@@ -403,13 +706,11 @@ NdisAllocatePacket(
  *     PoolHandle = Handle returned by NdisAllocatePacketPool
  */
 {
-    PNDISI_PACKET_POOL Pool = (PNDISI_PACKET_POOL)PoolHandle;
+    KIRQL OldIrql;
 
-    KeAcquireSpinLock(&Pool->SpinLock.SpinLock, &Pool->SpinLock.OldIrql);
-    NdisDprAllocatePacketNonInterlocked(Status,
-                                        Packet,
-                                        PoolHandle);
-    KeReleaseSpinLock(&Pool->SpinLock.SpinLock, Pool->SpinLock.OldIrql);
+    KeRaiseIrql(DISPATCH_LEVEL, &OldIrql);
+    NdisDprAllocatePacket(Status, Packet, PoolHandle);
+    KeLowerIrql(OldIrql);
 }
 
 
@@ -460,8 +761,7 @@ NdisAllocatePacketPoolEx(
  */
 {
     PNDISI_PACKET_POOL Pool;
-    UINT Size, Length, i;
-    PNDIS_PACKET Packet, NextPacket;
+    UINT Size, Length;
 
     NDIS_DbgPrint(MAX_TRACE, ("Status (0x%X)  PoolHandle (0x%X)  "
         "NumberOfDescriptors (%d)  ProtocolReservedLength (%d).\n",
@@ -487,30 +787,24 @@ NdisAllocatePacketPoolEx(
                  sizeof(NDIS_PACKET_EXTENSION) + ProtocolReservedLength;
         Size   = sizeof(NDISI_PACKET_POOL) + Length * NumberOfDescriptors;
 
-        Pool   = ExAllocatePool(NonPagedPool, Size);
+        Pool   = ExAllocatePoolWithTag(NonPagedPool, Size, NDIS_PACKET_POOL_TAG);
+        if (Pool && !NdisiInitializePool(&Pool->Header,
+                                         NDIS_PACKET_POOL_TAG,
+                                         FIELD_OFFSET(NDIS_PACKET, Reserved[0]),
+                                         Pool->Buffer,
+                                         Length,
+                                         NumberOfDescriptors))
+        {
+            ExFreePoolWithTag(Pool, NDIS_PACKET_POOL_TAG);
+            Pool = NULL;
+        }
+
         if (Pool)
         {
-            KeInitializeSpinLock(&Pool->SpinLock.SpinLock);
             Pool->PacketLength = Length;
 
-            if (NumberOfDescriptors > 0)
-            {
-                Packet         = (PNDIS_PACKET)&Pool->Buffer;
-                Pool->FreeList = Packet;
-
-                NextPacket = (PNDIS_PACKET)((ULONG_PTR)Packet + Length);
-                for (i = 1; i < NumberOfDescriptors; i++)
-                {
-                    Packet->Reserved[0]  = (ULONG_PTR)NextPacket;
-                    Packet               = NextPacket;
-                    NextPacket           = (PNDIS_PACKET)((ULONG_PTR)Packet + Length);
-                }
-                Packet->Reserved[0] = 0;
-            }
-            else {
+            if (NumberOfDescriptors == 0)
                 NDIS_DbgPrint(MIN_TRACE, ("Attempted to allocate a packet pool with 0 descriptors\n"));
-                Pool->FreeList = NULL;
-            }
 
             *Status     = NDIS_STATUS_SUCCESS;
             *PoolHandle = (PNDIS_HANDLE)Pool;
@@ -665,13 +959,31 @@ NdisDprAllocatePacket(
  *     PoolHandle = Handle returned by NdisAllocatePacketPool
  */
 {
+    PNDIS_PACKET Temp;
     PNDISI_PACKET_POOL Pool = (PNDISI_PACKET_POOL)PoolHandle;
 
-    KeAcquireSpinLockAtDpcLevel(&Pool->SpinLock.SpinLock);
-    NdisDprAllocatePacketNonInterlocked(Status,
-                                        Packet,
-                                        PoolHandle);
-    KeReleaseSpinLockFromDpcLevel(&Pool->SpinLock.SpinLock);
+    NDIS_DbgPrint(MAX_TRACE, ("Status (0x%X)  Packet (0x%X)  PoolHandle (0x%X).\n",
+        Status, Packet, PoolHandle));
+
+    *Packet = NULL;
+
+    if (Pool == NULL)
+    {
+        *Status = NDIS_STATUS_FAILURE;
+        NDIS_DbgPrint(MIN_TRACE, ("Called passed a bad pool handle\n"));
+        return;
+    }
+
+    Temp = NdisiPopPoolDescriptor(&Pool->Header);
+    if (Temp) {
+        NdisiInitializePoolPacket(Pool, Temp);
+
+        *Packet = Temp;
+        *Status = NDIS_STATUS_SUCCESS;
+    } else {
+        NDIS_DbgPrint(MIN_TRACE, ("No more free descriptors\n"));
+        *Status = NDIS_STATUS_RESOURCES;
+    }
 }
 
 
@@ -694,6 +1006,7 @@ NdisDprAllocatePacketNonInterlocked(
 {
     PNDIS_PACKET Temp;
     PNDISI_PACKET_POOL Pool = (PNDISI_PACKET_POOL)PoolHandle;
+    PNDISI_POOL_CACHE Cache;
 
     NDIS_DbgPrint(MAX_TRACE, ("Status (0x%X)  Packet (0x%X)  PoolHandle (0x%X).\n",
         Status, Packet, PoolHandle));
@@ -707,22 +1020,29 @@ NdisDprAllocatePacketNonInterlocked(
         return;
     }
 
-    if (Pool->FreeList) {
-        Temp           = Pool->FreeList;
-        Pool->FreeList = (PNDIS_PACKET)Temp->Reserved[0];
+    ASSERT(KeGetCurrentIrql() == DISPATCH_LEVEL);
+
+    /* The same pool may be used through the interlocked variants at the
+       same time, so the shared list still needs the pool lock. Only the
+       processor caches are left alone */
+    Cache = &Pool->Header.Caches[KeGetCurrentProcessorNumber()];
+
+    KeAcquireSpinLockAtDpcLevel(&Pool->Header.SpinLock);
+    Temp = Pool->Header.FreeList;
+    if (Temp)
+        Pool->Header.FreeList = (PNDIS_PACKET)Temp->Reserved[0];
+    KeReleaseSpinLockFromDpcLevel(&Pool->Header.SpinLock);
 
-        RtlZeroMemory(Temp, Pool->PacketLength);
-        Temp->Private.Pool = Pool;
-        Temp->Private.ValidCounts = TRUE;
-        Temp->Private.NdisPacketFlags = fPACKET_ALLOCATED_BY_NDIS;
-        Temp->Private.NdisPacketOobOffset = Pool->PacketLength -
-                                            (sizeof(NDIS_PACKET_OOB_DATA) +
-                                             sizeof(NDIS_PACKET_EXTENSION));
+    if (Temp) {
+        Cache->Allocations++;
+
+        NdisiInitializePoolPacket(Pool, Temp);
 
         *Packet = Temp;
         *Status = NDIS_STATUS_SUCCESS;
     } else {
         NDIS_DbgPrint(MIN_TRACE, ("No more free descriptors\n"));
+        Cache->Failures++;
         *Status = NDIS_STATUS_RESOURCES;
     }
 }
@@ -743,9 +1063,9 @@ NdisDprFreePacket(
 {
     PNDISI_PACKET_POOL Pool = (PNDISI_PACKET_POOL)Packet->Private.Pool;
 
-    KeAcquireSpinLockAtDpcLevel(&Pool->SpinLock.SpinLock);
-    NdisDprFreePacketNonInterlocked(Packet);
-    KeReleaseSpinLockFromDpcLevel(&Pool->SpinLock.SpinLock);
+    NDIS_DbgPrint(MAX_TRACE, ("Packet (0x%X).\n", Packet));
+
+    NdisiPushPoolDescriptor(&Pool->Header, Packet);
 }
 
 
@@ -762,10 +1082,18 @@ NdisDprFreePacketNonInterlocked(
  *     Packet = Pointer to packet to free
  */
 {
+    PNDISI_PACKET_POOL Pool = (PNDISI_PACKET_POOL)Packet->Private.Pool;
+
     NDIS_DbgPrint(MAX_TRACE, ("Packet (0x%X).\n", Packet));
 
-    Packet->Reserved[0]          = (ULONG_PTR)((NDISI_PACKET_POOL*)Packet->Private.Pool)->FreeList;
-    ((NDISI_PACKET_POOL*)Packet->Private.Pool)->FreeList = Packet;
+    ASSERT(KeGetCurrentIrql() == DISPATCH_LEVEL);
+
+    KeAcquireSpinLockAtDpcLevel(&Pool->Header.SpinLock);
+    Packet->Reserved[0]   = (ULONG_PTR)Pool->Header.FreeList;
+    Pool->Header.FreeList = Packet;
+    KeReleaseSpinLockFromDpcLevel(&Pool->Header.SpinLock);
+
+    Pool->Header.Caches[KeGetCurrentProcessorNumber()].Frees++;
 }
 
 
@@ -782,6 +1110,13 @@ NdisFreeBufferPool(
  *     PoolHandle = Handle returned by NdisAllocateBufferPool
  */
 {
+    PNDIS_BUFFER_POOL Pool = (PNDIS_BUFFER_POOL)PoolHandle;
+
+    if (!Pool)
+        return;
+
+    NdisiDeletePool(&Pool->Header);
+    ExFreePoolWithTag(Pool, NDIS_BUFFER_POOL_TAG);
 }
 
 
@@ -798,14 +1133,16 @@ NdisFreePacketPool(
  *     PoolHandle = Handle returned by NdisAllocatePacketPool
  */
 {
-    ExFreePool((PVOID)PoolHandle);
+    PNDISI_PACKET_POOL Pool = (PNDISI_PACKET_POOL)PoolHandle;
+
+    NdisiDeletePool(&Pool->Header);
+    ExFreePoolWithTag(Pool, NDIS_PACKET_POOL_TAG);
 }
 
 
 /*
  * @implemented
  */
-#undef NdisFreeBuffer
 VOID
 EXPORT
 NdisFreeBuffer(
@@ -816,7 +1153,21 @@ NdisFreeBuffer(
  *     Buffer = Pointer to buffer descriptor
  */
 {
-    IoFreeMdl(Buffer);
+    PNETWORK_HEADER Header;
+    KIRQL OldIrql;
+
+    if (!(Buffer->MdlFlags & MDL_NETWORK_HEADER)) {
+        IoFreeMdl(Buffer);
+        return;
+    }
+
+    MmPrepareMdlForReuse(Buffer);
+
+    Header = CONTAINING_RECORD(Buffer, NETWORK_HEADER, Mdl);
+
+    KeRaiseIrql(DISPATCH_LEVEL, &OldIrql);
+    NdisiPushPoolDescriptor(&Header->BufferPool->Header, Header);
+    KeLowerIrql(OldIrql);
 }
 
 
@@ -833,11 +1184,11 @@ NdisFreePacket(
  *     Packet = Pointer to packet descriptor
  */
 {
-    PNDISI_PACKET_POOL Pool = (PNDISI_PACKET_POOL)Packet->Private.Pool;
+    KIRQL OldIrql;
 
-    KeAcquireSpinLock(&Pool->SpinLock.SpinLock, &Pool->SpinLock.OldIrql);
-    NdisDprFreePacketNonInterlocked(Packet);
-    KeReleaseSpinLock(&Pool->SpinLock.SpinLock, Pool->SpinLock.OldIrql);
+    KeRaiseIrql(DISPATCH_LEVEL, &OldIrql);
+    NdisDprFreePacket(Packet);
+    KeLowerIrql(OldIrql);
 }
 
 
@@ -946,6 +1297,32 @@ NdisGetFirstBufferFromPacketSafe(
     }
 }
 
+/*
+ * @implemented
+ */
+UINT
+EXPORT
+NdisPacketPoolUsage(
+    IN  NDIS_HANDLE PoolHandle)
+/*
+ * FUNCTION: Returns the number of packet descriptors in use
+ * ARGUMENTS:
+ *     PoolHandle = Handle returned by NdisAllocatePacketPool
+ * RETURNS:
+ *     Number of allocated packets not yet returned to the pool
+ * NOTES:
+ *    NDIS 5.0
+ */
+{
+    PNDISI_PACKET_POOL Pool = (PNDISI_PACKET_POOL)PoolHandle;
+    NDISI_POOL_CACHE Totals;
+
+    NdisiQueryPoolUsage(&Pool->Header, &Totals);
+
+    return Totals.Allocations - Totals.Frees;
+}
+
+
 /*
  * @implemented
  */
@@ -1126,10 +1503,11 @@ NdisCopyBuffer(
  */
 {
     PVOID CurrentVa = (PUCHAR)(MmGetMdlVirtualAddress((PNDIS_BUFFER)MemoryDescriptor)) + Offset;
+    USHORT PoolFlags;
 
     NDIS_DbgPrint(MAX_TRACE, ("Called\n"));
 
-    *Buffer = IoAllocateMdl(CurrentVa, Length, FALSE, FALSE, NULL);
+    *Buffer = NdisiAllocateBufferDescriptor(PoolHandle, CurrentVa, Length);
     if (!*Buffer)
     {
         NDIS_DbgPrint(MIN_TRACE, ("IoAllocateMdl failed (%x, %lx)\n", CurrentVa, Length));
@@ -1137,11 +1515,15 @@ NdisCopyBuffer(
         return;
     }
 
+    /* IoBuildPartialMdl resets the flags we use to recognize pooled descriptors */
+    PoolFlags = (*Buffer)->MdlFlags & MDL_NETWORK_HEADER;
+
     IoBuildPartialMdl((PNDIS_BUFFER)MemoryDescriptor,
                       *Buffer,
                       CurrentVa,
                       Length);
 
+    (*Buffer)->MdlFlags |= PoolFlags;
     (*Buffer)->Next = NULL;
     *Status = NDIS_STATUS_SUCCESS;
 }
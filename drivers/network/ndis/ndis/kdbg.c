@@ -0,0 +1,77 @@
+/*
+ * COPYRIGHT:   See COPYING in the top level directory
+ * PROJECT:     ReactOS NDIS library
+ * FILE:        ndis/kdbg.c
+ * PURPOSE:     KDBG extension
+ */
+
+#include "ndissys.h"
+
+#ifdef KDBG
+
+static
+VOID
+NdisiKdbgDumpPool(
+    IN PNDISI_POOL_HEADER Pool)
+/*
+ * FUNCTION: Prints the usage counters of a buffer or packet pool
+ * ARGUMENTS:
+ *     Pool = Address of the pool header
+ */
+{
+    NDISI_POOL_CACHE Totals;
+
+    NdisiQueryPoolUsage(Pool, &Totals);
+
+    DbgPrint("%s pool %p: %lu descriptors, %lu in use, %lu cached (depth %lu)\n",
+             (Pool->Tag == NDIS_BUFFER_POOL_TAG ? "Buffer" : "Packet"),
+             Pool, Pool->NumberOfDescriptors,
+             Totals.Allocations - Totals.Frees,
+             Totals.Depth, Pool->CacheDepth);
+    DbgPrint("    allocations %lu, frees %lu, cache hits %lu, failures %lu\n",
+             Totals.Allocations, Totals.Frees, Totals.CacheHits, Totals.Failures);
+}
+
+BOOLEAN
+NTAPI
+NdisKdbgHandler(
+    IN PCHAR Command,
+    IN ULONG Argc,
+    IN PCH Argv[])
+/*
+ * FUNCTION: Handles NDIS debugger commands
+ * ARGUMENTS:
+ *     Command = Command line
+ *     Argc    = Number of arguments in Argv
+ *     Argv    = Command line arguments
+ * RETURNS:
+ *     TRUE if the command was handled, FALSE otherwise
+ * NOTES:
+ *     Supported commands:
+ *       ?ndis.pools - dumps the usage counters of all buffer and packet pools
+ */
+{
+    PLIST_ENTRY ListEntry;
+    ULONG Count = 0;
+
+    if (strcmp(Command, "?ndis.pools") != 0)
+        return FALSE;
+
+    /* We are in the debugger, the other processors are frozen */
+    for (ListEntry = NdisPoolListHead.Flink;
+         ListEntry != &NdisPoolListHead;
+         ListEntry = ListEntry->Flink)
+    {
+        NdisiKdbgDumpPool(CONTAINING_RECORD(ListEntry, NDISI_POOL_HEADER, ListEntry));
+        ++Count;
+    }
+
+    if (Count == 0)
+        DbgPrint("No pool found\n");
+
+    return TRUE;
+}
+
+#endif /* KDBG */
+
+/* EOF */
@@ -31,6 +31,10 @@ VOID NTAPI MainUnload(
  *     DriverObject = Pointer to driver object created by the system
  */
 {
+#ifdef KDBG
+  KdRosDeregisterCliCallback(NdisKdbgHandler);
+#endif
+
   NDIS_DbgPrint(MAX_TRACE, ("Leaving.\n"));
 }
 
@@ -60,8 +64,16 @@ DriverEntry(
   InitializeListHead(&AdapterListHead);
   KeInitializeSpinLock(&AdapterListLock);
 
+  InitializeListHead(&NdisPoolListHead);
+  KeInitializeSpinLock(&NdisPoolListLock);
+
   DriverObject->DriverUnload = MainUnload;
 
+#ifdef KDBG
+  if (!KdRosRegisterCliCallback(NdisKdbgHandler))
+      NDIS_DbgPrint(MIN_TRACE, ("Failed to register KDBG extension\n"));
+#endif
+
   CancelId = 0;
 
   return STATUS_SUCCESS;
@@ -385,7 +385,7 @@ VOID LanReceiveWorker( PVOID Context ) {
     }
 }
 
-VOID LanSubmitReceiveWork(
+BOOLEAN LanSubmitReceiveWork(
     NDIS_HANDLE BindingContext,
     PNDIS_PACKET Packet,
     UINT BytesTransferred,
@@ -393,18 +393,26 @@ VOID LanSubmitReceiveWork(
     PLAN_WQ_ITEM WQItem = ExAllocatePoolWithTag(NonPagedPool, sizeof(LAN_WQ_ITEM),
                                                 WQ_CONTEXT_TAG);
     PLAN_ADAPTER Adapter = (PLAN_ADAPTER)BindingContext;
+    ULONG FlowHash;
 
     TI_DbgPrint(DEBUG_DATALINK,("called\n"));
 
-    if (!WQItem) return;
+    if (!WQItem) return FALSE;
 
     WQItem->Packet = Packet;
     WQItem->Adapter = Adapter;
     WQItem->BytesTransferred = BytesTransferred;
     WQItem->LegacyReceive = LegacyReceive;
 
-    if (!ChewCreate( LanReceiveWorker, WQItem ))
+    /* Legacy receive packets don't contain the media header */
+    FlowHash = IPHashPacketFlow(Packet, LegacyReceive ? 0 : Adapter->HeaderSize, FALSE);
+
+    if (!IPQueueReceiveWork(FlowHash, LanReceiveWorker, WQItem)) {
         ExFreePoolWithTag(WQItem, WQ_CONTEXT_TAG);
+        return FALSE;
+    }
+
+    return TRUE;
 }
 
 VOID NTAPI ProtocolTransferDataComplete(
@@ -433,10 +441,14 @@ VOID NTAPI ProtocolTransferDataComplete(
 
     if( Status != NDIS_STATUS_SUCCESS ) return;
 
-    LanSubmitReceiveWork(BindingContext,
-                         Packet,
-                         BytesTransferred,
-                         TRUE);
+    if (!LanSubmitReceiveWork(BindingContext,
+                              Packet,
+                              BytesTransferred,
+                              TRUE))
+    {
+        /* The packet was allocated by ProtocolReceive */
+        FreeNdisPacket(Packet);
+    }
 }
 
 INT NTAPI ProtocolReceivePacket(
@@ -450,10 +462,14 @@ INT NTAPI ProtocolReceivePacket(
         return 0;
     }
 
-    LanSubmitReceiveWork(BindingContext,
-                         NdisPacket,
-                         0, /* Unused */
-                         FALSE);
+    if (!LanSubmitReceiveWork(BindingContext,
+                              NdisPacket,
+                              0, /* Unused */
+                              FALSE))
+    {
+        /* The packet is dropped, the miniport keeps ownership */
+        return 0;
+    }
 
     /* Hold 1 reference on this packet */
     return 1;
@@ -7,7 +7,16 @@
 
 #pragma once
 
-#define NB_HASHMASK 0xF /* Hash mask for neighbor cache */
+#define NB_INITIAL_HASH_SIZE 64  /* Initial number of hash buckets */
+#define NB_MAX_HASH_SIZE 4096     /* Maximum number of hash buckets */
+#define NB_MAX_LOAD 4             /* Average chain length before the table grows */
+
+/* Number of bucket locks. Bucket N is protected by lock N % NB_LOCK_COUNT, so
+ * each bucket has its own lock until the table grows past NB_INITIAL_HASH_SIZE */
+#define NB_LOCK_COUNT NB_INITIAL_HASH_SIZE
+
+/* Maximum number of packets waiting on an unresolved neighbor */
+#define NB_MAX_QUEUED_PACKETS 32
 
 typedef VOID (*PNEIGHBOR_PACKET_COMPLETE)
     ( PVOID Context, PNDIS_PACKET Packet, NDIS_STATUS Status );
@@ -20,21 +29,29 @@ typedef struct _NEIGHBOR_PACKET {
 } NEIGHBOR_PACKET, *PNEIGHBOR_PACKET;
 
 typedef struct NEIGHBOR_CACHE_TABLE {
-    struct NEIGHBOR_CACHE_ENTRY *Cache; /* Pointer to cache */
-    KSPIN_LOCK Lock;                    /* Protecting lock */
+    struct NEIGHBOR_CACHE_ENTRY **Buckets; /* Hash buckets */
+    ULONG HashMask;                        /* Number of buckets - 1 */
+    LONG EntryCount;                       /* Number of NCEs in the table */
+    ULONG SweepIndex;                      /* Next bucket to age in NBTimeout */
+    ULONG CurrentTime;                     /* Seconds since NBStartup */
+    ULONG DroppedPackets;                  /* Packets dropped on full NCE queues */
+    KSPIN_LOCK Lock[NB_LOCK_COUNT];        /* Bucket locks, all of them are needed
+                                              to change Buckets and HashMask */
 } NEIGHBOR_CACHE_TABLE, *PNEIGHBOR_CACHE_TABLE;
 
 /* Information about a neighbor */
 typedef struct NEIGHBOR_CACHE_ENTRY {
     struct NEIGHBOR_CACHE_ENTRY *Next;  /* Pointer to next entry */
     UCHAR State;                        /* State of NCE */
-    UINT EventTimer;                    /* Ticks since last event */
-    UINT EventCount;                    /* Number of events */
+    UINT EventTimer;                    /* Seconds before the NCE times out */
+    ULONG LastEvent;                    /* Time of last event */
+    ULONG LastSolicit;                  /* Time of last solicitation */
     PIP_INTERFACE Interface;            /* Pointer to interface */
     UINT LinkAddressLength;             /* Length of link address */
     PVOID LinkAddress;                  /* Pointer to link address */
     IP_ADDRESS Address;                 /* IP address of neighbor */
     LIST_ENTRY PacketQueue;             /* Packet queue */
+    UINT PacketCount;                   /* Number of packets in PacketQueue */
 } NEIGHBOR_CACHE_ENTRY, *PNEIGHBOR_CACHE_ENTRY;
 
 /* NCE states */
@@ -54,7 +71,10 @@ typedef struct NEIGHBOR_CACHE_ENTRY {
 /* Number of seconds before retransmission */
 #define ARP_TIMEOUT_RETRANSMISSION 3
 
-extern NEIGHBOR_CACHE_TABLE NeighborCache[NB_HASHMASK + 1];
+/* Number of seconds NBTimeout takes to age the whole table */
+#define NB_SWEEP_PERIOD ARP_TIMEOUT_RETRANSMISSION
+
+extern NEIGHBOR_CACHE_TABLE NeighborCache;
 
 
 VOID NBTimeout(
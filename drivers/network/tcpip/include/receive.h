@@ -12,6 +12,15 @@
 /* Number of seconds before destroying the IPDR */
 #define MAX_TIMEOUT_COUNT 3
 
+/* Maximum number of per-processor receive queues */
+#define IP_MAX_RECEIVE_QUEUES 32
+
+/* Maximum number of packets waiting on a single receive queue */
+#define IP_MAX_RECEIVE_QUEUE_DEPTH 512
+
+/* Priority of the receive queue threads (same as the delayed worker threads) */
+#define IP_RECEIVE_QUEUE_PRIORITY 12
+
 /* IP datagram fragment descriptor. Used to store IP datagram fragments */
 typedef struct IP_FRAGMENT {
     LIST_ENTRY ListEntry; /* Entry on list */
@@ -45,12 +54,35 @@ typedef struct IPDATAGRAM_REASSEMBLY {
     UINT TimeoutCount;           /* Timeout counter */
 } IPDATAGRAM_REASSEMBLY, *PIPDATAGRAM_REASSEMBLY;
 
+/* Deferred receive work item */
+typedef struct IP_RECEIVE_WORK {
+    LIST_ENTRY ListEntry;            /* Entry on receive queue */
+    VOID (*Worker)(PVOID Context);   /* Routine processing the packet */
+    PVOID Context;                   /* Argument for the routine */
+} IP_RECEIVE_WORK, *PIP_RECEIVE_WORK;
+
+/* Receive queue bound to a processor. All packets of a flow are hashed
+   to the same queue, so they are processed in the order they arrived */
+typedef struct IP_RECEIVE_QUEUE {
+    LIST_ENTRY WorkListHead;         /* Pending IP_RECEIVE_WORK items */
+    KSPIN_LOCK Lock;                 /* Protecting spin lock */
+    KEVENT Event;                    /* Signaled when work is queued */
+    PKTHREAD Thread;                 /* Thread draining this queue */
+    CCHAR Processor;                 /* Processor the thread runs on */
+    LONG Depth;                      /* Number of pending work items */
+    ULONG MaxDepth;                  /* Highest number of pending work items */
+    ULONG Packets;                   /* Number of packets processed */
+    ULONG Dropped;                   /* Number of packets dropped */
+} IP_RECEIVE_QUEUE, *PIP_RECEIVE_QUEUE;
+
 
 extern LIST_ENTRY ReassemblyListHead;
 extern KSPIN_LOCK ReassemblyListLock;
 extern NPAGED_LOOKASIDE_LIST IPDRList;
 extern NPAGED_LOOKASIDE_LIST IPFragmentList;
 extern NPAGED_LOOKASIDE_LIST IPHoleList;
+extern IP_RECEIVE_QUEUE IPReceiveQueue[IP_MAX_RECEIVE_QUEUES];
+extern ULONG IPReceiveQueueCount;
 
 
 VOID IPFreeReassemblyList(
@@ -63,4 +95,20 @@ VOID IPReceive(
     PIP_INTERFACE IF,
     PIP_PACKET IPPacket);
 
+NTSTATUS IPStartReceiveQueues(
+    VOID);
+
+VOID IPStopReceiveQueues(
+    VOID);
+
+ULONG IPHashPacketFlow(
+    PNDIS_PACKET NdisPacket,
+    UINT Offset,
+    BOOLEAN Local);
+
+BOOLEAN IPQueueReceiveWork(
+    ULONG FlowHash,
+    VOID (*Worker)(PVOID Context),
+    PVOID Context);
+
 /* EOF */
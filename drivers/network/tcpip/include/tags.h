@@ -23,6 +23,7 @@
 #define OSKITTCP_CONTEXT_TAG 'TKSO'
 #define NEIGHBOR_PACKET_TAG 'kPbN'
 #define NCE_TAG ' ECN'
+#define NCE_HASH_TAG 'HECN'
 #define PORT_SET_TAG 'teSP'
 #define PACKET_BUFFER_TAG 'fuBP'
 #define FRAGMENT_DATA_TAG 'taDF'
@@ -44,3 +45,4 @@
 #define KEY_VALUE_TAG 'vkCT'
 #define HEADER_TAG 'rhCT'
 #define REG_STR_TAG 'srCT'
+#define RECEIVE_WORK_TAG 'wrCT'
@@ -28,6 +28,11 @@
 #include <tdiinfo.h>
 #endif
 
+#ifdef KDBG
+#include <ndk/kdfuncs.h>
+#include <reactos/kdros.h>
+#endif
+
 #include <debug.h>
 
 #define TAG_STRING	' RTS' /* string */
@@ -172,4 +177,9 @@ extern ULONG EntityMax;
 extern NTSTATUS TiGetProtocolNumber( PUNICODE_STRING FileName,
 				     PULONG Protocol );
 
+#ifdef KDBG
+/* kdbg.c */
+KDBG_CLI_ROUTINE TcpipKdbgHandler;
+#endif
+
 /* EOF */
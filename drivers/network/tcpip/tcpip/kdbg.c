@@ -0,0 +1,59 @@
+/*
+ * COPYRIGHT:   See COPYING in the top level directory
+ * PROJECT:     ReactOS TCP/IP protocol driver
+ * FILE:        tcpip/kdbg.c
+ * PURPOSE:     KDBG extension
+ */
+
+#include "precomp.h"
+
+#include <receive.h>
+
+#ifdef KDBG
+
+BOOLEAN
+NTAPI
+TcpipKdbgHandler(
+    IN PCHAR Command,
+    IN ULONG Argc,
+    IN PCH Argv[])
+/*
+ * FUNCTION: Handles TCP/IP debugger commands
+ * ARGUMENTS:
+ *     Command = Command line
+ *     Argc    = Number of arguments in Argv
+ *     Argv    = Command line arguments
+ * RETURNS:
+ *     TRUE if the command was handled, FALSE otherwise
+ * NOTES:
+ *     Supported commands:
+ *       ?tcpip.rxqueues - dumps the per-processor receive queue counters
+ */
+{
+    PIP_RECEIVE_QUEUE Queue;
+    ULONG i;
+
+    if (strcmp(Command, "?tcpip.rxqueues") != 0)
+        return FALSE;
+
+    if (IPReceiveQueueCount == 0)
+    {
+        DbgPrint("No receive queue, packets are processed by system worker threads\n");
+        return TRUE;
+    }
+
+    for (i = 0; i < IPReceiveQueueCount; i++)
+    {
+        Queue = &IPReceiveQueue[i];
+
+        DbgPrint("CPU %d: %lu packets, %lu dropped, %ld pending (max %lu)\n",
+                 Queue->Processor, Queue->Packets, Queue->Dropped,
+                 Queue->Depth, Queue->MaxDepth);
+    }
+
+    return TRUE;
+}
+
+#endif /* KDBG */
+
+/* EOF */
@@ -12,6 +12,7 @@
 
 #include <dispatch.h>
 #include <fileobjs.h>
+#include <receive.h>
 
 PDEVICE_OBJECT TCPDeviceObject   = NULL;
 PDEVICE_OBJECT UDPDeviceObject   = NULL;
@@ -577,12 +578,19 @@ VOID NTAPI TiUnload(
     /* Cancel timer */
     KeCancelTimer(&IPTimer);
 
+#ifdef KDBG
+    KdRosDeregisterCliCallback(TcpipKdbgHandler);
+#endif
+
     /* Unregister loopback adapter */
     LoopUnregisterAdapter(NULL);
 
     /* Unregister protocol with NDIS */
     LANUnregisterProtocol();
 
+    /* Process pending packets and stop the receive queues */
+    IPStopReceiveQueues();
+
     /* Shutdown transport level protocol subsystems */
     TCPShutdown();
     UDPShutdown();
@@ -736,6 +744,15 @@ DriverEntry(
     /* Initialize network level protocol subsystem */
     IPStartup(RegistryPath);
 
+    /* Start per-processor receive queues. Received packets are processed
+       by system worker threads if this fails */
+    IPStartReceiveQueues();
+
+#ifdef KDBG
+    if (!KdRosRegisterCliCallback(TcpipKdbgHandler))
+        TI_DbgPrint(MIN_TRACE, ("Failed to register KDBG extension\n"));
+#endif
+
     /* Initialize transport level protocol subsystems */
     Status = RawIPStartup();
     if( !NT_SUCCESS(Status) ) {
@@ -168,6 +168,7 @@ TDI_STATUS InfoTdiQueryGetIPSnmpInfo( TDIEntityID ID,
     SnmpInfo.ipsi_numif = IfCount;
     SnmpInfo.ipsi_numaddr = 1;
     SnmpInfo.ipsi_numroutes = RouteCount;
+    SnmpInfo.ipsi_outdiscards = NeighborCache.DroppedPackets;
 
     Status = InfoCopyOut( (PCHAR)&SnmpInfo, sizeof(SnmpInfo),
 			  Buffer, BufferSize );
@@ -128,6 +128,75 @@ SpiGetInquiryData(
     return STATUS_SUCCESS;
 }
 
+static
+NTSTATUS
+SpiGetLunStatistics(
+    _In_ PSCSI_PORT_DEVICE_EXTENSION DeviceExtension,
+    _In_ PIRP Irp)
+{
+    PIO_STACK_LOCATION IrpStack;
+    PSCSI_ADAPTER_STATISTICS Statistics;
+    PSCSI_PORT_LUN_EXTENSION LunExtension;
+    PSCSI_LUN_STATISTICS LunStatistics;
+    ULONG Length, MaxLuns, Count, i;
+    KIRQL Irql;
+
+    DPRINT("SpiGetLunStatistics() called\n");
+
+    IrpStack = IoGetCurrentIrpStackLocation(Irp);
+    Length = IrpStack->Parameters.DeviceIoControl.OutputBufferLength;
+    if (Length < FIELD_OFFSET(SCSI_ADAPTER_STATISTICS, Luns))
+    {
+        return STATUS_BUFFER_TOO_SMALL;
+    }
+
+    Statistics = Irp->AssociatedIrp.SystemBuffer;
+    MaxLuns = (Length - FIELD_OFFSET(SCSI_ADAPTER_STATISTICS, Luns)) / sizeof(SCSI_LUN_STATISTICS);
+    KeQueryPerformanceCounter(&Statistics->LatencyFrequency);
+    Count = 0;
+
+    /* The counters are updated under the adapter lock */
+    KeAcquireSpinLock(&DeviceExtension->SpinLock, &Irql);
+    for (i = 0; i < LUS_NUMBER; i++)
+    {
+        for (LunExtension = DeviceExtension->LunExtensionList[i];
+             LunExtension != NULL;
+             LunExtension = LunExtension->Next)
+        {
+            /* Not a LUN yet, the scan may still drop it */
+            if (LunExtension->Flags & SCSI_PORT_SCAN_IN_PROGRESS)
+                continue;
+
+            if (Count < MaxLuns)
+            {
+                LunStatistics = &Statistics->Luns[Count];
+                LunStatistics->PathId = LunExtension->PathId;
+                LunStatistics->TargetId = LunExtension->TargetId;
+                LunStatistics->Lun = LunExtension->Lun;
+                LunStatistics->QueueCount = LunExtension->QueueCount;
+                LunStatistics->PeakQueueCount = LunExtension->PeakQueueCount;
+                LunStatistics->RequestCount = LunExtension->RequestCount;
+                LunStatistics->TotalLatency = LunExtension->TotalLatency;
+                LunStatistics->MaxLatency = LunExtension->MaxLatency;
+            }
+            Count++;
+        }
+    }
+    KeReleaseSpinLock(&DeviceExtension->SpinLock, Irql);
+
+    Statistics->NumberOfLuns = Count;
+    if (Count > MaxLuns)
+    {
+        /* Only the header is valid, it tells the caller how much room is needed */
+        Irp->IoStatus.Information = FIELD_OFFSET(SCSI_ADAPTER_STATISTICS, Luns);
+        return STATUS_BUFFER_OVERFLOW;
+    }
+
+    Irp->IoStatus.Information = FIELD_OFFSET(SCSI_ADAPTER_STATISTICS, Luns) +
+                                Count * sizeof(SCSI_LUN_STATISTICS);
+    return STATUS_SUCCESS;
+}
+
 /**********************************************************************
  * NAME                         INTERNAL
  *  ScsiPortDeviceControl
@@ -215,6 +284,12 @@ ScsiPortDeviceControl(
           Status = SpiGetInquiryData(DeviceExtension, Irp);
           break;
 
+      case IOCTL_SCSI_GET_LUN_STATISTICS:
+          DPRINT("  IOCTL_SCSI_GET_LUN_STATISTICS\n");
+
+          Status = SpiGetLunStatistics(DeviceExtension, Irp);
+          break;
+
       case IOCTL_SCSI_MINIPORT:
           DPRINT1("IOCTL_SCSI_MINIPORT unimplemented!\n");
           Status = STATUS_NOT_IMPLEMENTED;
@@ -627,6 +627,64 @@ SpiSendRequestSense(
 }
 
 
+static
+PSCSI_REQUEST_BLOCK_INFO
+SpiPopFreeSrbInfo(
+    _Inout_ PSCSI_PORT_DEVICE_EXTENSION DeviceExtension)
+{
+    PSCSI_REQUEST_BLOCK_INFO SrbInfo;
+
+    KeAcquireSpinLockAtDpcLevel(&DeviceExtension->FreeListLock);
+    SrbInfo = DeviceExtension->FreeSrbInfo;
+    if (SrbInfo != NULL)
+        DeviceExtension->FreeSrbInfo = (PSCSI_REQUEST_BLOCK_INFO)SrbInfo->Requests.Flink;
+    KeReleaseSpinLockFromDpcLevel(&DeviceExtension->FreeListLock);
+
+    return SrbInfo;
+}
+
+static
+VOID
+SpiPushFreeSrbInfo(
+    _Inout_ PSCSI_PORT_DEVICE_EXTENSION DeviceExtension,
+    _Inout_ PSCSI_REQUEST_BLOCK_INFO SrbInfo)
+{
+    SrbInfo->Requests.Blink = NULL;
+
+    KeAcquireSpinLockAtDpcLevel(&DeviceExtension->FreeListLock);
+    SrbInfo->Requests.Flink = (PLIST_ENTRY)DeviceExtension->FreeSrbInfo;
+    DeviceExtension->FreeSrbInfo = SrbInfo;
+    KeReleaseSpinLockFromDpcLevel(&DeviceExtension->FreeListLock);
+}
+
+static
+PVOID
+SpiPopFreeSrbExtension(
+    _Inout_ PSCSI_PORT_DEVICE_EXTENSION DeviceExtension)
+{
+    PVOID SrbExtension;
+
+    KeAcquireSpinLockAtDpcLevel(&DeviceExtension->FreeListLock);
+    SrbExtension = DeviceExtension->FreeSrbExtensions;
+    if (SrbExtension != NULL)
+        DeviceExtension->FreeSrbExtensions = *((PVOID *)SrbExtension);
+    KeReleaseSpinLockFromDpcLevel(&DeviceExtension->FreeListLock);
+
+    return SrbExtension;
+}
+
+static
+VOID
+SpiPushFreeSrbExtension(
+    _Inout_ PSCSI_PORT_DEVICE_EXTENSION DeviceExtension,
+    _Inout_ PVOID SrbExtension)
+{
+    KeAcquireSpinLockAtDpcLevel(&DeviceExtension->FreeListLock);
+    *((PVOID *)SrbExtension) = DeviceExtension->FreeSrbExtensions;
+    DeviceExtension->FreeSrbExtensions = SrbExtension;
+    KeReleaseSpinLockFromDpcLevel(&DeviceExtension->FreeListLock);
+}
+
 static
 VOID
 SpiProcessCompletedRequest(
@@ -636,6 +694,8 @@ SpiProcessCompletedRequest(
 {
     PSCSI_REQUEST_BLOCK Srb;
     PSCSI_PORT_LUN_EXTENSION LunExtension;
+    LARGE_INTEGER CompletionTime;
+    ULONGLONG Latency;
     LONG Result;
     PIRP Irp;
     //ULONG SequenceNumber;
@@ -708,10 +768,11 @@ SpiProcessCompletedRequest(
         ASSERT(FALSE);
     }
 
-    /* Acquire spinlock (we're freeing SrbExtension) */
-    KeAcquireSpinLockAtDpcLevel(&DeviceExtension->SpinLock);
+    /* Measure the latency before taking the spinlock */
+    CompletionTime = KeQueryPerformanceCounter(NULL);
+    Latency = CompletionTime.QuadPart - SrbInfo->StartTime.QuadPart;
 
-    /* Free it (if needed) */
+    /* Free it (if needed), the free lists don't need the adapter spinlock */
     if (Srb->SrbExtension)
     {
         if (Srb->SenseInfoBuffer != NULL && DeviceExtension->SupportsAutoSense)
@@ -731,8 +792,7 @@ SpiProcessCompletedRequest(
         }
 
         /* Put it into the free srb extensions list */
-        *((PVOID *)Srb->SrbExtension) = DeviceExtension->FreeSrbExtensions;
-        DeviceExtension->FreeSrbExtensions = Srb->SrbExtension;
+        SpiPushFreeSrbExtension(DeviceExtension, Srb->SrbExtension);
     }
 
     /* Save transfer length in the IRP */
@@ -741,21 +801,30 @@ SpiProcessCompletedRequest(
     //SequenceNumber = SrbInfo->SequenceNumber;
     SrbInfo->SequenceNumber = 0;
 
-    /* Decrement the queue count */
-    LunExtension->QueueCount--;
-
     /* Free Srb, if needed*/
     if (Srb->QueueTag != SP_UNTAGGED)
     {
         /* Put it into the free list */
-        SrbInfo->Requests.Blink = NULL;
-        SrbInfo->Requests.Flink = (PLIST_ENTRY)DeviceExtension->FreeSrbInfo;
-        DeviceExtension->FreeSrbInfo = SrbInfo;
+        SpiPushFreeSrbInfo(DeviceExtension, SrbInfo);
     }
 
     /* SrbInfo is not used anymore */
     SrbInfo = NULL;
 
+    /* Acquire spinlock (we're updating the LUN and checking for a pending request).
+       Whoever ran out of free structures set the pending flag under it,
+       so freeing them first cannot miss it */
+    KeAcquireSpinLockAtDpcLevel(&DeviceExtension->SpinLock);
+
+    /* Decrement the queue count */
+    LunExtension->QueueCount--;
+
+    /* Account the request to its LUN */
+    LunExtension->RequestCount++;
+    LunExtension->TotalLatency += Latency;
+    if (Latency > LunExtension->MaxLatency)
+        LunExtension->MaxLatency = Latency;
+
     if (DeviceExtension->Flags & SCSI_PORT_REQUEST_PENDING)
     {
         /* Clear the flag */
@@ -945,21 +1014,21 @@ Error:
     IoCompleteRequest(Irp, IO_DISK_INCREMENT);
 }
 
+static
 BOOLEAN
-NTAPI
-ScsiPortStartPacket(
-    _In_ PVOID Context)
+SpiStartPacket(
+    _In_ PDEVICE_OBJECT DeviceObject,
+    _Out_opt_ PBOOLEAN StartNextRequest)
 {
     PSCSI_PORT_DEVICE_EXTENSION DeviceExtension;
     PIO_STACK_LOCATION IrpStack;
     PSCSI_REQUEST_BLOCK Srb;
-    PDEVICE_OBJECT DeviceObject = (PDEVICE_OBJECT)Context;
     PSCSI_PORT_LUN_EXTENSION LunExtension;
     PSCSI_REQUEST_BLOCK_INFO SrbInfo;
     BOOLEAN Result;
     BOOLEAN StartTimer;
 
-    DPRINT("ScsiPortStartPacket() called\n");
+    DPRINT("SpiStartPacket() called\n");
 
     DeviceExtension = (PSCSI_PORT_DEVICE_EXTENSION)DeviceObject->DeviceExtension;
 
@@ -1087,6 +1156,10 @@ ScsiPortStartPacket(
         }
     }
 
+    /* Keep track of the deepest queue this LUN has seen */
+    if (LunExtension->QueueCount > LunExtension->PeakQueueCount)
+        LunExtension->PeakQueueCount = LunExtension->QueueCount;
+
     /* Mark this Srb active */
     Srb->SrbFlags |= SRB_FLAGS_IS_ACTIVE;
 
@@ -1094,6 +1167,26 @@ ScsiPortStartPacket(
     Result = DeviceExtension->HwStartIo(&DeviceExtension->MiniPortDeviceExtension,
                                         Srb);
 
+    /* If the miniport only asked for the next request, the caller can start it right away */
+    if (StartNextRequest != NULL &&
+        Result &&
+        DeviceExtension->InterruptData.Flags ==
+            (SCSI_PORT_NOTIFICATION_NEEDED | SCSI_PORT_NEXT_REQUEST_READY) &&
+        DeviceExtension->InterruptData.CompletedRequests == NULL &&
+        DeviceExtension->InterruptData.CompletedAbort == NULL &&
+        DeviceExtension->InterruptData.ReadyLun == NULL &&
+        (DeviceExtension->Flags & (SCSI_PORT_DEVICE_BUSY | SCSI_PORT_DISCONNECT_ALLOWED)) ==
+            (SCSI_PORT_DEVICE_BUSY | SCSI_PORT_DISCONNECT_ALLOWED))
+    {
+        /* Do what ScsiPortDpcForIsr() would have done */
+        DeviceExtension->InterruptData.Flags = 0;
+        DeviceExtension->Flags &= ~SCSI_PORT_DEVICE_BUSY;
+        DeviceExtension->TimerCount = -1;
+
+        *StartNextRequest = TRUE;
+        return Result;
+    }
+
     /* If notification is needed, then request a DPC */
     if (DeviceExtension->InterruptData.Flags & SCSI_PORT_NOTIFICATION_NEEDED)
         IoRequestDpc(DeviceExtension->DeviceObject, NULL, NULL);
@@ -1101,6 +1194,25 @@ ScsiPortStartPacket(
     return Result;
 }
 
+BOOLEAN
+NTAPI
+ScsiPortStartPacket(
+    _In_ PVOID Context)
+{
+    return SpiStartPacket((PDEVICE_OBJECT)Context, NULL);
+}
+
+static
+BOOLEAN
+NTAPI
+SpiStartPacketFromStartIo(
+    _In_ PVOID Context)
+{
+    PSCSI_PORT_START_PACKET StartContext = Context;
+
+    return SpiStartPacket(StartContext->DeviceObject, &StartContext->StartNextRequest);
+}
+
 BOOLEAN
 NTAPI
 SpiSaveInterruptData(IN PVOID Context)
@@ -1447,7 +1559,7 @@ SpiAllocateSrbStructures(
     PCHAR SrbExtension;
     PSCSI_REQUEST_BLOCK_INFO SrbInfo;
 
-    /* Spinlock must be held while this function executes */
+    /* Spinlock must be held while the LUN state is looked at */
     KeAcquireSpinLockAtDpcLevel(&DeviceExtension->SpinLock);
 
     /* Allocate SRB data structure */
@@ -1481,7 +1593,7 @@ SpiAllocateSrbStructures(
             }
 
             ASSERT(LunExtension->SrbInfo.Srb == NULL);
-            SrbInfo = DeviceExtension->FreeSrbInfo;
+            SrbInfo = SpiPopFreeSrbInfo(DeviceExtension);
 
             if (SrbInfo == NULL)
             {
@@ -1493,8 +1605,6 @@ SpiAllocateSrbStructures(
                 return NULL;
             }
 
-            DeviceExtension->FreeSrbInfo = (PSCSI_REQUEST_BLOCK_INFO)SrbInfo->Requests.Flink;
-
             /* QueueTag must never be 0, so +1 to it */
             Srb->QueueTag = (UCHAR)(SrbInfo - DeviceExtension->SrbInfo) + 1;
         }
@@ -1526,37 +1636,43 @@ SpiAllocateSrbStructures(
         SrbInfo = &LunExtension->SrbInfo;
     }
 
+    /* The LUN is settled, the SRB extension comes from its own list */
+    KeReleaseSpinLockFromDpcLevel(&DeviceExtension->SpinLock);
+
     /* Allocate SRB extension structure */
     if (DeviceExtension->NeedSrbExtensionAlloc)
     {
-        /* Check the list of free extensions */
-        SrbExtension = DeviceExtension->FreeSrbExtensions;
+        /* Remove a free SRB extension from the list (since
+           we're going to use it) */
+        SrbExtension = SpiPopFreeSrbExtension(DeviceExtension);
 
         /* If no free extensions... */
+        if (SrbExtension == NULL)
+        {
+            /* Ask to be called again later. One may have been freed before
+               the completion path could see the flag, so look again under
+               the spinlock it checks the flag with */
+            KeAcquireSpinLockAtDpcLevel(&DeviceExtension->SpinLock);
+            DeviceExtension->Flags |= SCSI_PORT_REQUEST_PENDING;
+            SrbExtension = SpiPopFreeSrbExtension(DeviceExtension);
+            if (SrbExtension != NULL)
+                DeviceExtension->Flags &= ~SCSI_PORT_REQUEST_PENDING;
+            KeReleaseSpinLockFromDpcLevel(&DeviceExtension->SpinLock);
+        }
+
         if (SrbExtension == NULL)
         {
             /* Free SRB data */
             if (Srb->Function != SRB_FUNCTION_ABORT_COMMAND &&
                 Srb->QueueTag != SP_UNTAGGED)
             {
-                SrbInfo->Requests.Blink = NULL;
-                SrbInfo->Requests.Flink = (PLIST_ENTRY)DeviceExtension->FreeSrbInfo;
-                DeviceExtension->FreeSrbInfo = SrbInfo;
+                SpiPushFreeSrbInfo(DeviceExtension, SrbInfo);
             }
 
             /* Return, in order to be called again later */
-            DeviceExtension->Flags |= SCSI_PORT_REQUEST_PENDING;
-            KeReleaseSpinLockFromDpcLevel(&DeviceExtension->SpinLock);
             return NULL;
         }
 
-        /* Remove that free SRB extension from the list (since
-           we're going to use it) */
-        DeviceExtension->FreeSrbExtensions = *((PVOID *)SrbExtension);
-
-        /* Spinlock can be released now */
-        KeReleaseSpinLockFromDpcLevel(&DeviceExtension->SpinLock);
-
         Srb->SrbExtension = SrbExtension;
 
         if (Srb->SenseInfoBuffer != NULL &&
@@ -1582,7 +1698,6 @@ SpiAllocateSrbStructures(
     {
         /* Cleanup... */
         Srb->SrbExtension = NULL;
-        KeReleaseSpinLockFromDpcLevel(&DeviceExtension->SpinLock);
     }
 
     return SrbInfo;
@@ -1599,6 +1714,7 @@ ScsiPortStartIo(
     PIO_STACK_LOCATION IrpStack;
     PSCSI_REQUEST_BLOCK Srb;
     PSCSI_REQUEST_BLOCK_INFO SrbInfo;
+    SCSI_PORT_START_PACKET StartContext;
     LONG CounterResult;
     NTSTATUS Status;
 
@@ -1666,6 +1782,7 @@ ScsiPortStartIo(
     else
     {
         SrbInfo->Srb = Srb;
+        SrbInfo->StartTime = KeQueryPerformanceCounter(NULL);
     }
 
     if (Srb->SrbFlags & SRB_FLAGS_UNSPECIFIED_DIRECTION)
@@ -1743,11 +1860,14 @@ ScsiPortStartIo(
         return;
     }
 
+    StartContext.DeviceObject = DeviceObject;
+    StartContext.StartNextRequest = FALSE;
+
     KeAcquireSpinLockAtDpcLevel(&DeviceExtension->SpinLock);
 
     if (!KeSynchronizeExecution(DeviceExtension->Interrupt[0],
-                                ScsiPortStartPacket,
-                                DeviceObject))
+                                SpiStartPacketFromStartIo,
+                                &StartContext))
     {
         DPRINT("Synchronization failed!\n");
 
@@ -1763,6 +1883,13 @@ ScsiPortStartIo(
         KeReleaseSpinLockFromDpcLevel(&DeviceExtension->SpinLock);
     }
 
+    /* The miniport can take another request, don't wait for the DPC to start it.
+       IoStartPacket calls us directly, so this can nest StartIo one level. The
+       nested call runs under the deferred StartIo attribute, which turns any
+       further IoStartNextPacket into a loop in the I/O manager */
+    if (StartContext.StartNextRequest)
+        IoStartNextPacket(DeviceObject, FALSE);
+
 
     DPRINT("ScsiPortStartIo() done\n");
 }
@@ -925,6 +925,9 @@ ScsiPortInitialize(
         PortDeviceObject->Flags |= DO_DIRECT_IO;
         PortDeviceObject->AlignmentRequirement = FILE_WORD_ALIGNMENT; /* FIXME: Is this really needed? */
 
+        /* StartIo starts the next packet itself when the miniport is ready for it */
+        IoSetStartIoAttributes(PortDeviceObject, TRUE, FALSE);
+
         /* Fill Device Extension */
         DeviceExtension = PortDeviceObject->DeviceExtension;
         RtlZeroMemory(DeviceExtension, DeviceExtensionSize);
@@ -956,6 +959,7 @@ ScsiPortInitialize(
         /* Initialize the spin lock in the controller extension */
         KeInitializeSpinLock(&DeviceExtension->IrqLock);
         KeInitializeSpinLock(&DeviceExtension->SpinLock);
+        KeInitializeSpinLock(&DeviceExtension->FreeListLock);
 
         /* Initialize the DPC object */
         IoInitializeDpcRequest(PortDeviceObject,
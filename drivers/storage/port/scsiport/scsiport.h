@@ -14,6 +14,7 @@
 #include <ntddscsi.h>
 #include <ntdddisk.h>
 #include <mountdev.h>
+#include <reactos/drivers/ntddscsp.h>
 
 #define VERSION "0.0.3"
 
@@ -103,6 +104,7 @@ typedef struct _SCSI_REQUEST_BLOCK_INFO
     PVOID SaveSenseRequest;
 
     ULONG SequenceNumber;
+    LARGE_INTEGER StartTime;
 
     /* DMA stuff */
     PVOID BaseOfMapRegister;
@@ -135,6 +137,12 @@ typedef struct _SCSI_PORT_LUN_EXTENSION
     ULONG QueueCount;
     ULONG MaxQueueCount;
 
+    /* Statistics, latencies are in performance counter ticks */
+    ULONG PeakQueueCount;
+    ULONGLONG RequestCount;
+    ULONGLONG TotalLatency;
+    ULONGLONG MaxLatency;
+
     ULONG AttemptCount;
     LONG RequestTimeout;
 
@@ -197,6 +205,13 @@ typedef struct _SCSI_PORT_SAVE_INTERRUPT
     struct _SCSI_PORT_DEVICE_EXTENSION *DeviceExtension;
 } SCSI_PORT_SAVE_INTERRUPT, *PSCSI_PORT_SAVE_INTERRUPT;
 
+/* Only for starting a packet from StartIo */
+typedef struct _SCSI_PORT_START_PACKET
+{
+    PDEVICE_OBJECT DeviceObject;
+    BOOLEAN StartNextRequest;
+} SCSI_PORT_START_PACKET, *PSCSI_PORT_START_PACKET;
+
 /*
  * SCSI_PORT_DEVICE_EXTENSION
  *
@@ -242,6 +257,9 @@ typedef struct _SCSI_PORT_DEVICE_EXTENSION
 
     SCSI_PORT_INTERRUPT_DATA InterruptData;
 
+    /* Guards the free SRB extensions and SRB information lists */
+    KSPIN_LOCK FreeListLock;
+
     /* SRB extension stuff*/
     ULONG SrbExtensionSize;
     PVOID SrbExtensionBuffer;
@@ -172,7 +172,9 @@ AhciAllocateResourceForAdapter (
     AdapterExtension->PortCount = portCount;
     nonCachedExtensionSize =    sizeof(AHCI_COMMAND_HEADER) * AlignedNCS + //should be 1K aligned
                                 sizeof(AHCI_RECEIVED_FIS) +
-                                sizeof(IDENTIFY_DEVICE_DATA);
+                                sizeof(AHCI_COMMAND_TABLE) + //should be 128 byte aligned
+                                sizeof(IDENTIFY_DEVICE_DATA) +
+                                DEVICE_ATA_BLOCK_SIZE;
 
     // align nonCachedExtensionSize to 1024
     nonCachedExtensionSize = ROUND_UP(nonCachedExtensionSize, 1024);
@@ -205,7 +207,13 @@ AhciAllocateResourceForAdapter (
             tmp = (PCHAR)(nonCachedExtension + sizeof(AHCI_COMMAND_HEADER) * AlignedNCS);
 
             PortExtension->ReceivedFIS = (PAHCI_RECEIVED_FIS)tmp;
-            PortExtension->IdentifyDeviceData = (PIDENTIFY_DEVICE_DATA)(tmp + sizeof(AHCI_RECEIVED_FIS));
+            tmp += sizeof(AHCI_RECEIVED_FIS);
+
+            PortExtension->RecoveryCommandTable = (PAHCI_COMMAND_TABLE)tmp;
+            tmp += sizeof(AHCI_COMMAND_TABLE);
+
+            PortExtension->IdentifyDeviceData = (PIDENTIFY_DEVICE_DATA)tmp;
+            PortExtension->NcqErrorLog = (PUCHAR)(tmp + sizeof(IDENTIFY_DEVICE_DATA));
             PortExtension->MaxPortQueueDepth = NCS;
             nonCachedExtension += nonCachedExtensionSize;
         }
@@ -608,6 +616,309 @@ AhciCompleteIssuedSrb (
     return;
 }// -- AhciCompleteIssuedSrb();
 
+/**
+ * @name AhciRestartPort
+ * @implemented
+ *
+ * Stop and restart the command engine of a port after an error,
+ * which also clears PxCI and PxSACT
+ *
+ * @param PortExtension
+ *
+ * @return
+ * return TRUE if the port is running again
+ */
+BOOLEAN
+AhciRestartPort (
+    __in PAHCI_PORT_EXTENSION PortExtension
+    )
+{
+    ULONG index;
+    AHCI_PORT_CMD cmd;
+    AHCI_TASK_FILE_DATA tfd;
+    AHCI_SERIAL_ATA_STATUS ssts;
+    AHCI_SERIAL_ATA_CONTROL sctl;
+    PAHCI_ADAPTER_EXTENSION AdapterExtension;
+
+    AhciDebugPrint("AhciRestartPort()\n");
+
+    AdapterExtension = PortExtension->AdapterExtension;
+
+    // 6.2.2.1 / 10.1.2
+    // Clear PxCMD.ST and wait at least 500 milliseconds for PxCMD.CR to return '0'
+    cmd.Status = StorPortReadRegisterUlong(AdapterExtension, &PortExtension->Port->CMD);
+    cmd.ST = 0;
+    StorPortWriteRegisterUlong(AdapterExtension, &PortExtension->Port->CMD, cmd.Status);
+
+    index = 0;
+    do
+    {
+        StorPortStallExecution(1000);
+        cmd.Status = StorPortReadRegisterUlong(AdapterExtension, &PortExtension->Port->CMD);
+        index++;
+    }
+    while ((cmd.CR != 0) && (index < 500));
+
+    if (cmd.CR != 0)
+    {
+        AhciDebugPrint("\tPort refused to stop\n");
+        return FALSE;
+    }
+
+    // clear the error bits
+    StorPortWriteRegisterUlong(AdapterExtension, &PortExtension->Port->SERR, (ULONG)~0);
+    StorPortWriteRegisterUlong(AdapterExtension, &PortExtension->Port->IS, (ULONG)~0);
+
+    // A device still holding BSY or DRQ must be released before the port is started again,
+    // with a command list override if the HBA has one, with a COMRESET otherwise
+    tfd.Status = StorPortReadRegisterUlong(AdapterExtension, &PortExtension->Port->TFD);
+    if (tfd.STS.BSY || tfd.STS.DRQ)
+    {
+        if (IsAdapterCAPSCLO(AdapterExtension->CAP))
+        {
+            cmd.CLO = 1;
+            StorPortWriteRegisterUlong(AdapterExtension, &PortExtension->Port->CMD, cmd.Status);
+
+            index = 0;
+            do
+            {
+                StorPortStallExecution(1000);
+                cmd.Status = StorPortReadRegisterUlong(AdapterExtension, &PortExtension->Port->CMD);
+                index++;
+            }
+            while ((cmd.CLO != 0) && (index < 500));
+        }
+        else
+        {
+            // section 10.4.2
+            sctl.Status = StorPortReadRegisterUlong(AdapterExtension, &PortExtension->Port->SCTL);
+            sctl.DET = 1;
+            StorPortWriteRegisterUlong(AdapterExtension, &PortExtension->Port->SCTL, sctl.Status);
+
+            StorPortStallExecution(1000);
+
+            sctl.DET = 0;
+            StorPortWriteRegisterUlong(AdapterExtension, &PortExtension->Port->SCTL, sctl.Status);
+
+            index = 0;
+            do
+            {
+                StorPortStallExecution(1000);
+                ssts.Status = StorPortReadRegisterUlong(AdapterExtension, &PortExtension->Port->SSTS);
+                index++;
+            }
+            while ((ssts.DET != 0x3) && (index < 500));
+
+            StorPortWriteRegisterUlong(AdapterExtension, &PortExtension->Port->SERR, (ULONG)~0);
+            StorPortWriteRegisterUlong(AdapterExtension, &PortExtension->Port->IS, (ULONG)~0);
+        }
+    }
+
+    cmd.Status = StorPortReadRegisterUlong(AdapterExtension, &PortExtension->Port->CMD);
+    cmd.ST = 1;
+    StorPortWriteRegisterUlong(AdapterExtension, &PortExtension->Port->CMD, cmd.Status);
+    cmd.Status = StorPortReadRegisterUlong(AdapterExtension, &PortExtension->Port->CMD);
+
+    if (cmd.ST != 1)
+    {
+        AhciDebugPrint("\tFailed to restart Port\n");
+        return FALSE;
+    }
+
+    return TRUE;
+}// -- AhciRestartPort();
+
+/**
+ * @name AhciReadNcqErrorLog
+ * @implemented
+ *
+ * Read the NCQ command error log (page 10h) after a native queued command failed.
+ * Reading it is also what takes the device out of its error state.
+ * The port must be idle, slot 0 is used and polled for completion.
+ *
+ * @param PortExtension
+ *
+ * @return
+ * return the tag of the command which failed, or MAXULONG if unknown
+ */
+ULONG
+AhciReadNcqErrorLog (
+    __in PAHCI_PORT_EXTENSION PortExtension
+    )
+{
+    ULONG index, ci, length;
+    AHCI_TASK_FILE_DATA tfd;
+    PAHCI_COMMAND_TABLE cmdTable;
+    PAHCI_COMMAND_HEADER CommandHeader;
+    PAHCI_ADAPTER_EXTENSION AdapterExtension;
+    STOR_PHYSICAL_ADDRESS PhysicalAddress;
+
+    AhciDebugPrint("AhciReadNcqErrorLog()\n");
+
+    AdapterExtension = PortExtension->AdapterExtension;
+    cmdTable = PortExtension->RecoveryCommandTable;
+    CommandHeader = &PortExtension->CommandList[0];
+
+    AhciZeroMemory((PCHAR)cmdTable, FIELD_OFFSET(AHCI_COMMAND_TABLE, PRDT[1]));
+    AhciZeroMemory((PCHAR)PortExtension->NcqErrorLog, DEVICE_ATA_BLOCK_SIZE);
+
+    cmdTable->CFIS[AHCI_ATA_CFIS_FisType] = FIS_TYPE_REG_H2D;
+    cmdTable->CFIS[AHCI_ATA_CFIS_PMPort_C] = (1 << 7);
+    cmdTable->CFIS[AHCI_ATA_CFIS_CommandReg] = IDE_COMMAND_READ_LOG_EXT;
+    cmdTable->CFIS[AHCI_ATA_CFIS_LBA0] = IDE_LOG_NCQ_COMMAND_ERROR;
+    cmdTable->CFIS[AHCI_ATA_CFIS_Device] = IDE_LBA_MODE;
+    cmdTable->CFIS[AHCI_ATA_CFIS_SectorCountLow] = 1;
+
+    PhysicalAddress = StorPortGetPhysicalAddress(AdapterExtension, NULL, PortExtension->NcqErrorLog, &length);
+    cmdTable->PRDT[0].DBA = PhysicalAddress.LowPart;
+    if (IsAdapterCAPS64(AdapterExtension->CAP))
+    {
+        cmdTable->PRDT[0].DBAU = PhysicalAddress.HighPart;
+    }
+    cmdTable->PRDT[0].DBC = DEVICE_ATA_BLOCK_SIZE - 1;
+
+    CommandHeader->DI.Status = 0;
+    CommandHeader->DI.CFL = 5;
+    CommandHeader->DI.PRDTL = 1;
+    CommandHeader->PRDBC = 0;
+
+    PhysicalAddress = StorPortGetPhysicalAddress(AdapterExtension, NULL, cmdTable, &length);
+    NT_ASSERT((PhysicalAddress.LowPart % 128) == 0);
+    CommandHeader->CTBA = PhysicalAddress.LowPart;
+    if (IsAdapterCAPS64(AdapterExtension->CAP))
+    {
+        CommandHeader->CTBA_U = PhysicalAddress.HighPart;
+    }
+
+    StorPortWriteRegisterUlong(AdapterExtension, &PortExtension->Port->CI, 1);
+
+    index = 0;
+    do
+    {
+        StorPortStallExecution(1000);
+        ci = StorPortReadRegisterUlong(AdapterExtension, &PortExtension->Port->CI);
+        tfd.Status = StorPortReadRegisterUlong(AdapterExtension, &PortExtension->Port->TFD);
+        index++;
+    }
+    while ((ci & 1) && !tfd.STS.ERR && (index < 100));
+
+    // the completion raised an interrupt of its own, nothing is waiting for it
+    StorPortWriteRegisterUlong(AdapterExtension, &PortExtension->Port->IS, (ULONG)~0);
+
+    if ((ci & 1) || tfd.STS.ERR)
+    {
+        AhciDebugPrint("\tREAD LOG EXT failed: %x\n", tfd.Status);
+        AhciRestartPort(PortExtension);
+        return MAXULONG;
+    }
+
+    if (PortExtension->NcqErrorLog[0] & IDE_NCQ_ERROR_LOG_NQ)
+    {
+        return MAXULONG;
+    }
+
+    return IDE_NCQ_ERROR_LOG_TAG(PortExtension->NcqErrorLog[0]);
+}// -- AhciReadNcqErrorLog();
+
+/**
+ * @name AhciPortErrorRecovery
+ * @implemented
+ *
+ * Recover a port from a fatal error (section 6.2.2). The command which failed
+ * is completed with an error, the others outstanding are issued again.
+ * Caller must hold the InterruptLock.
+ *
+ * @param PortExtension
+ *
+ */
+VOID
+AhciPortErrorRecovery (
+    __in PAHCI_PORT_EXTENSION PortExtension
+    )
+{
+    AHCI_PORT_CMD cmd;
+    PSCSI_REQUEST_BLOCK Srb;
+    PAHCI_ADAPTER_EXTENSION AdapterExtension;
+    ULONG ci, sact, outstanding, failedSlot, NCS, i;
+    BOOLEAN ncq;
+
+    AhciDebugPrint("AhciPortErrorRecovery()\n");
+
+    AdapterExtension = PortExtension->AdapterExtension;
+    NCS = AHCI_Global_Port_CAP_NCS(AdapterExtension->CAP);
+
+    // commands which completed before the error are done with
+    ci = StorPortReadRegisterUlong(AdapterExtension, &PortExtension->Port->CI);
+    sact = StorPortReadRegisterUlong(AdapterExtension, &PortExtension->Port->SACT);
+
+    outstanding = PortExtension->CommandIssuedSlots & (ci | sact);
+    if ((PortExtension->CommandIssuedSlots & ~outstanding) != 0)
+    {
+        AhciCompleteIssuedSrb(PortExtension, PortExtension->CommandIssuedSlots & ~outstanding);
+    }
+
+    // 6.2.2.1 for non-queued commands PxCMD.CCS holds the slot which failed,
+    // for native queued ones the device tells which one in the NCQ error log
+    cmd.Status = StorPortReadRegisterUlong(AdapterExtension, &PortExtension->Port->CMD);
+    failedSlot = cmd.CCS;
+    ncq = (outstanding & PortExtension->NcqSlots) != 0;
+
+    // stopping the port clears PxCI and PxSACT, nothing is issued anymore
+    PortExtension->CommandIssuedSlots = 0;
+    PortExtension->NcqSlots &= PortExtension->QueueSlots;
+
+    if (!AhciRestartPort(PortExtension))
+    {
+        failedSlot = MAXULONG;
+    }
+    else if (ncq)
+    {
+        failedSlot = AhciReadNcqErrorLog(PortExtension);
+    }
+
+    StorPortWriteRegisterUlong(AdapterExtension, AdapterExtension->IS, (1 << PortExtension->PortNumber));
+
+    if ((failedSlot >= NCS) || ((outstanding & (1 << failedSlot)) == 0))
+    {
+        failedSlot = MAXULONG;
+    }
+
+    for (i = 0; i < NCS; i++)
+    {
+        if ((outstanding & (1 << i)) == 0)
+        {
+            continue;
+        }
+
+        Srb = PortExtension->Slot[i];
+        if (Srb == NULL)
+        {
+            continue;
+        }
+
+        if (i == failedSlot)
+        {
+            Srb->SrbStatus = SRB_STATUS_ERROR;
+        }
+        else if ((failedSlot != MAXULONG) && AddQueue(&PortExtension->SrbQueue, Srb))
+        {
+            // innocent command, aborted because of the failed one
+            continue;
+        }
+        else
+        {
+            // we don't know which command failed, let the class driver retry them all
+            Srb->SrbStatus = SRB_STATUS_BUS_RESET;
+        }
+
+        StorPortNotification(RequestComplete, AdapterExtension, Srb);
+    }
+
+    AhciIssueQueuedSrbs(PortExtension);
+
+    return;
+}// -- AhciPortErrorRecovery();
+
 /**
  * @name AhciInterruptHandler
  * @not_implemented
@@ -663,6 +974,9 @@ AhciInterruptHandler (
         // non-queued commands were being issued or native command queuing commands were being issued.
 
         AhciDebugPrint("\tFatal Error: %x\n", PxIS.Status);
+
+        AhciPortErrorRecovery(PortExtension);
+        return;
     }
 
     // Normal Command Completion
@@ -697,6 +1011,13 @@ AhciInterruptHandler (
     {
         AhciCompleteIssuedSrb(PortExtension, (PortExtension->CommandIssuedSlots & (~outstanding)));
         PortExtension->CommandIssuedSlots &= outstanding;
+        PortExtension->NcqSlots &= (outstanding | PortExtension->QueueSlots);
+
+        // freed slots can take the Srbs which are still waiting
+        if (PortExtension->DeviceParams.IsActive)
+        {
+            AhciIssueQueuedSrbs(PortExtension);
+        }
     }
 
     return;
@@ -1403,6 +1724,13 @@ AhciProcessSrb (
     NT_ASSERT(SlotIndex < AHCI_Global_Port_CAP_NCS(AdapterExtension->CAP));
     SrbExtension->SlotIndex = SlotIndex;
 
+    // FPDMA QUEUED commands carry their tag in Count[7:3], we use the slot index as tag
+    if (IsNcqCommand(SrbExtension))
+    {
+        NT_ASSERT(SlotIndex < PortExtension->MaxPortQueueDepth);
+        SrbExtension->SectorCountLow = (UCHAR)(SlotIndex << 3);
+    }
+
     // program the CFIS in the CommandTable
     CommandHeader = &PortExtension->CommandList[SlotIndex];
 
@@ -1468,6 +1796,12 @@ AhciProcessSrb (
     // mark this slot
     PortExtension->Slot[SlotIndex] = Srb;
     PortExtension->QueueSlots |= 1 << SlotIndex;
+
+    if (IsNcqCommand(SrbExtension))
+    {
+        PortExtension->NcqSlots |= 1 << SlotIndex;
+    }
+
     return;
 }// -- AhciProcessSrb();
 
@@ -1492,7 +1826,7 @@ AhciActivatePort (
     )
 {
     AHCI_PORT_CMD cmd;
-    ULONG QueueSlots, slotToActivate, tmp;
+    ULONG QueueSlots, ncqSlots;
     PAHCI_ADAPTER_EXTENSION AdapterExtension;
 
     AhciDebugPrint("AhciActivatePort()\n");
@@ -1514,23 +1848,23 @@ AhciActivatePort (
         return;
     }
 
-    // get the lowest set bit
-    tmp = QueueSlots & (QueueSlots - 1);
-
-    if (tmp == 0)
-        slotToActivate = QueueSlots;
-    else
-        slotToActivate = (QueueSlots & (~tmp));
-
-    // mark that bit off in QueueSlots
+    // mark all of them off in QueueSlots
     // so we can know we it is really needed to activate port or not
-    PortExtension->QueueSlots &= ~slotToActivate;
+    PortExtension->QueueSlots = 0;
     // mark this CommandIssuedSlots
     // to validate in completeIssuedCommand
-    PortExtension->CommandIssuedSlots |= slotToActivate;
+    PortExtension->CommandIssuedSlots |= QueueSlots;
 
-    // tell the HBA to issue this Command Slot to the given port
-    StorPortWriteRegisterUlong(AdapterExtension, &PortExtension->Port->CI, slotToActivate);
+    // section 3.3.13
+    // This field is set by software prior to issuing a native queued command for a particular command slot
+    ncqSlots = QueueSlots & PortExtension->NcqSlots;
+    if (ncqSlots != 0)
+    {
+        StorPortWriteRegisterUlong(AdapterExtension, &PortExtension->Port->SACT, ncqSlots);
+    }
+
+    // tell the HBA to issue these Command Slots to the given port
+    StorPortWriteRegisterUlong(AdapterExtension, &PortExtension->Port->CI, QueueSlots);
 
     return;
 }// -- AhciActivatePort();
@@ -1539,6 +1873,78 @@ AhciActivatePort (
     #pragma warning(pop)
 #endif
 
+/**
+ * @name AhciIssueQueuedSrbs
+ * @implemented
+ *
+ * Move pending Srbs to free command slots and program controller's port
+ * to process them. Caller must hold the InterruptLock.
+ *
+ * @param PortExtension
+ *
+ */
+VOID
+AhciIssueQueuedSrbs (
+    __in PAHCI_PORT_EXTENSION PortExtension
+    )
+{
+    PSCSI_REQUEST_BLOCK tmpSrb;
+    PAHCI_ADAPTER_EXTENSION AdapterExtension;
+    ULONG commandSlotMask, occupiedSlots, slotIndex, NCS;
+
+    AhciDebugPrint("AhciIssueQueuedSrbs()\n");
+
+    AdapterExtension = PortExtension->AdapterExtension;
+
+    occupiedSlots = (PortExtension->QueueSlots | PortExtension->CommandIssuedSlots); // Busy command slots for given port
+    NCS = min(AHCI_Global_Port_CAP_NCS(AdapterExtension->CAP), PortExtension->MaxPortQueueDepth);
+    commandSlotMask = AHCI_SLOT_MASK(NCS); // available slots mask
+
+    commandSlotMask = (commandSlotMask & ~occupiedSlots);
+    if(commandSlotMask != 0)
+    {
+        // iterate over HBA port slots
+        for (slotIndex = 0; slotIndex < NCS; slotIndex++)
+        {
+            // skip busy slots
+            if ((commandSlotMask & (1 << slotIndex)) == 0)
+            {
+                continue;
+            }
+
+            tmpSrb = PeekQueue(&PortExtension->SrbQueue);
+            if (tmpSrb == NULL)
+            {
+                break;
+            }
+
+            // Native queued and non-queued commands must not be outstanding at the same time,
+            // the next one waits for the other kind to drain
+            if (IsNcqCommand(GetSrbExtension(tmpSrb)))
+            {
+                if ((occupiedSlots & ~PortExtension->NcqSlots) != 0)
+                {
+                    break;
+                }
+            }
+            else if (PortExtension->NcqSlots != 0)
+            {
+                break;
+            }
+
+            tmpSrb = RemoveQueue(&PortExtension->SrbQueue);
+            NT_ASSERT(tmpSrb->PathId == PortExtension->PortNumber);
+            AhciProcessSrb(PortExtension, tmpSrb, slotIndex);
+            occupiedSlots |= (1 << slotIndex);
+        }
+    }
+
+    // program HBA port
+    AhciActivatePort(PortExtension);
+
+    return;
+}// -- AhciIssueQueuedSrbs();
+
 /**
  * @name AhciProcessIO
  * @implemented
@@ -1558,10 +1964,8 @@ AhciProcessIO (
     __in PSCSI_REQUEST_BLOCK Srb
     )
 {
-    PSCSI_REQUEST_BLOCK tmpSrb;
     STOR_LOCK_HANDLE lockhandle = {0};
     PAHCI_PORT_EXTENSION PortExtension;
-    ULONG commandSlotMask, occupiedSlots, slotIndex, NCS;
 
     AhciDebugPrint("AhciProcessIO()\n");
     AhciDebugPrint("\tPathId: %d\n", PathId);
@@ -1583,39 +1987,7 @@ AhciProcessIO (
         return; // we should wait for device to get active
     }
 
-    occupiedSlots = (PortExtension->QueueSlots | PortExtension->CommandIssuedSlots); // Busy command slots for given port
-    NCS = AHCI_Global_Port_CAP_NCS(AdapterExtension->CAP);
-    commandSlotMask = (1 << NCS) - 1; // available slots mask
-
-    commandSlotMask = (commandSlotMask & ~occupiedSlots);
-    if(commandSlotMask != 0)
-    {
-        // iterate over HBA port slots
-        for (slotIndex = 0; slotIndex < NCS; slotIndex++)
-        {
-            // find first free slot
-            if ((commandSlotMask & (1 << slotIndex)) != 0)
-            {
-                tmpSrb = RemoveQueue(&PortExtension->SrbQueue);
-                if (tmpSrb != NULL)
-                {
-                    NT_ASSERT(tmpSrb->PathId == PathId);
-                    AhciProcessSrb(PortExtension, tmpSrb, slotIndex);
-                }
-                else
-                {
-                    break;
-                }
-            }
-            else
-            {
-                break;
-            }
-        }
-    }
-
-    // program HBA port
-    AhciActivatePort(PortExtension);
+    AhciIssueQueuedSrbs(PortExtension);
 
     // Release Lock
     StorPortReleaseSpinLock(AdapterExtension, &lockhandle);
@@ -1735,6 +2107,20 @@ InquiryCompletion (
             PortExtension->DeviceParams.Lba48BitMode = 1;
         }
 
+        // FPDMA QUEUED commands need NCQ from both HBA and device, and always use 48-bit LBA
+        if (IsAdapterCAPSNCQ(AdapterExtension->CAP) &&
+            (IdentifyDeviceData->ReservedWords76[0] & IDE_SATA_CAPABILITY_NCQ) &&
+            PortExtension->DeviceParams.Lba48BitMode)
+        {
+            PortExtension->DeviceParams.NcqSupported = 1;
+
+            // QueueDepth is 0's based, tags are slot indexes so stay below both limits
+            PortExtension->MaxPortQueueDepth = min(AHCI_Global_Port_CAP_NCS(AdapterExtension->CAP),
+                                                   (ULONG)IdentifyDeviceData->QueueDepth + 1);
+
+            AhciDebugPrint("\tNCQ Queue Depth: %d\n", PortExtension->MaxPortQueueDepth);
+        }
+
         PortExtension->DeviceParams.AccessType = DIRECT_ACCESS_DEVICE;
 
         /* Device max address lba */
@@ -1798,7 +2184,7 @@ InquiryCompletion (
     // prepare data to send
     InquiryData->Versions = 2;
     InquiryData->Wide32Bit = 1;
-    InquiryData->CommandQueue = 0; // NCQ not supported
+    InquiryData->CommandQueue = PortExtension->DeviceParams.NcqSupported;
     InquiryData->ResponseDataFormat = 0x2;
     InquiryData->DeviceTypeModifier = 0;
     InquiryData->DeviceTypeQualifier = DEVICE_CONNECTED;
@@ -1820,7 +2206,7 @@ InquiryCompletion (
                                          Srb->PathId,
                                          Srb->TargetId,
                                          Srb->Lun,
-                                         AHCI_Global_Port_CAP_NCS(AdapterExtension->CAP));
+                                         PortExtension->MaxPortQueueDepth);
 
     NT_ASSERT(status == TRUE);
     return;
@@ -2027,7 +2413,7 @@ DeviceRequestReadWrite (
     NT_ASSERT(SectorCount > 0);
 
     SrbExtension->AtaFunction = ATA_FUNCTION_ATA_READ;
-    SrbExtension->Flags |= ATA_FLAGS_USE_DMA;
+    SrbExtension->Flags = ATA_FLAGS_USE_DMA;
     SrbExtension->CompletionRoutine = NULL;
 
     if (IsReading)
@@ -2074,6 +2460,18 @@ DeviceRequestReadWrite (
     SrbExtension->SectorCountLow = (SectorCount >> 0) & 0xFF;
     SrbExtension->SectorCountHigh = (SectorCount >> 8) & 0xFF;
 
+    if (PortExtension->DeviceParams.NcqSupported)
+    {
+        // FPDMA QUEUED: the sector count moves to Features, AhciProcessSrb puts the tag in Count
+        SrbExtension->Flags |= ATA_FLAGS_NCQ;
+        SrbExtension->CommandReg = IsReading ? IDE_COMMAND_READ_FPDMA_QUEUED : IDE_COMMAND_WRITE_FPDMA_QUEUED;
+        SrbExtension->FeaturesLow = SrbExtension->SectorCountLow;
+        SrbExtension->FeaturesHigh = SrbExtension->SectorCountHigh;
+        SrbExtension->SectorCountLow = 0;
+        SrbExtension->SectorCountHigh = 0;
+        SrbExtension->Device = IDE_LBA_MODE;
+    }
+
     NT_ASSERT(SectorCount < 0x100);
 
     SrbExtension->pSgl = (PLOCAL_SCATTER_GATHER_LIST)StorPortGetScatterGatherList(AdapterExtension, Srb);
@@ -2547,6 +2945,33 @@ RemoveQueue (
     return Srb;
 }// -- RemoveQueue();
 
+/**
+ * @name PeekQueue
+ * @implemented
+ *
+ * Return the Srb at the front of Queue without removing it
+ *
+ * @param Queue
+ *
+ * @return
+ * return Srb
+ *
+ */
+FORCEINLINE
+PVOID
+PeekQueue (
+    __in PAHCI_QUEUE Queue
+    )
+{
+    NT_ASSERT(Queue->Head < MAXIMUM_QUEUE_BUFFER_SIZE);
+    NT_ASSERT(Queue->Tail < MAXIMUM_QUEUE_BUFFER_SIZE);
+
+    if (Queue->Head == Queue->Tail)
+        return NULL;
+
+    return Queue->Buffer[Queue->Tail];
+}// -- PeekQueue();
+
 /**
  * @name GetSrbExtension
  * @implemented
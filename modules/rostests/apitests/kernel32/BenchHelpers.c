@@ -0,0 +1,204 @@
+/*
+ * PROJECT:         ReactOS api tests
+ * LICENSE:         GPL - See COPYING in the top level directory
+ * PURPOSE:         Helpers for the file system and disk benchmarks
+ */
+
+#include "precomp.h"
+
+#include <initguid.h>
+#include <ntddstor.h>
+#include <winioctl.h>
+#include <setupapi.h>
+#include <cfgmgr32.h>
+
+VOID
+BenchStartTimer(
+    _Out_ PBENCH_TIMER Timer)
+{
+    QueryPerformanceFrequency(&Timer->Frequency);
+    QueryPerformanceCounter(&Timer->Start);
+}
+
+ULONGLONG
+BenchElapsedUs(
+    _In_ PBENCH_TIMER Timer)
+{
+    LARGE_INTEGER Now;
+
+    QueryPerformanceCounter(&Now);
+    return (ULONGLONG)(Now.QuadPart - Timer->Start.QuadPart) * 1000000 / Timer->Frequency.QuadPart;
+}
+
+ULONG
+BenchElapsedMs(
+    _In_ PBENCH_TIMER Timer)
+{
+    return (ULONG)(BenchElapsedUs(Timer) / 1000);
+}
+
+/* Count per second */
+ULONG
+BenchRate(
+    _In_ ULONGLONG Count,
+    _In_ ULONGLONG ElapsedUs)
+{
+    return (ULONG)(Count * 1000000 / max(ElapsedUs, 1));
+}
+
+/* Creates a directory of its own for the test under the temporary directory */
+BOOL
+BenchCreateTestDir(
+    _In_ PCWSTR Name,
+    _Out_writes_(MAX_PATH) PWSTR TestDir)
+{
+    WCHAR TempPath[MAX_PATH];
+
+    GetTempPathW(MAX_PATH, TempPath);
+    StringCchPrintfW(TestDir, MAX_PATH, L"%s%s%lu", TempPath, Name, GetCurrentProcessId());
+    if (!CreateDirectoryW(TestDir, NULL))
+    {
+        skip("Could not create the test directory %S, error %lu\n", TestDir, GetLastError());
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+/* Removes the test directory along with whatever the test left in it */
+VOID
+BenchRemoveTestDir(
+    _In_ PCWSTR TestDir)
+{
+    WCHAR Name[MAX_PATH];
+    WIN32_FIND_DATAW FindData;
+    HANDLE hFind;
+
+    StringCchPrintfW(Name, _countof(Name), L"%s\\*", TestDir);
+    hFind = FindFirstFileW(Name, &FindData);
+    if (hFind != INVALID_HANDLE_VALUE)
+    {
+        do
+        {
+            if (FindData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+                continue;
+            StringCchPrintfW(Name, _countof(Name), L"%s\\%s", TestDir, FindData.cFileName);
+            DeleteFileW(Name);
+        } while (FindNextFileW(hFind, &FindData));
+        FindClose(hFind);
+    }
+
+    ok(RemoveDirectoryW(TestDir), "RemoveDirectory(%S) failed, error %lu\n", TestDir, GetLastError());
+}
+
+/* Skips unless Path is on a volume of the given file system, e.g. L"NTFS" or L"FAT" (FAT32 too) */
+BOOL
+BenchRequireFileSystem(
+    _In_ PCWSTR Path,
+    _In_ PCWSTR FileSystem)
+{
+    WCHAR Root[4] = L"C:\\";
+    WCHAR VolumeFileSystem[MAX_PATH];
+
+    Root[0] = Path[0];
+    if (!GetVolumeInformationW(Root, NULL, 0, NULL, NULL, NULL, VolumeFileSystem, _countof(VolumeFileSystem)))
+    {
+        skip("GetVolumeInformation(%S) failed, error %lu\n", Root, GetLastError());
+        return FALSE;
+    }
+
+    if (_wcsnicmp(VolumeFileSystem, FileSystem, wcslen(FileSystem)) != 0)
+    {
+        skip("%S is %S, this test is for %S\n", Root, VolumeFileSystem, FileSystem);
+        return FALSE;
+    }
+
+    trace("Testing on %S (%S)\n", Root, VolumeFileSystem);
+    return TRUE;
+}
+
+static BOOL GetDiskNumber(PCWSTR DevicePath, PULONG DiskNumber)
+{
+    STORAGE_DEVICE_NUMBER Number;
+    HANDLE hDevice;
+    DWORD Size;
+    BOOL Ret;
+
+    hDevice = CreateFileW(DevicePath, 0, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, 0, NULL);
+    if (hDevice == INVALID_HANDLE_VALUE)
+        return FALSE;
+
+    Ret = DeviceIoControl(hDevice, IOCTL_STORAGE_GET_DEVICE_NUMBER, NULL, 0, &Number, sizeof(Number), &Size, NULL);
+    CloseHandle(hDevice);
+    if (Ret)
+        *DiskNumber = Number.DeviceNumber;
+    return Ret;
+}
+
+/* Finds the service of the adapter the disk holding Path hangs off */
+static BOOL GetAdapterService(PCWSTR Path, PWSTR Service, ULONG Length)
+{
+    WCHAR VolumePath[8] = L"\\\\.\\C:";
+    SP_DEVICE_INTERFACE_DATA InterfaceData;
+    PSP_DEVICE_INTERFACE_DETAIL_DATA_W Detail;
+    SP_DEVINFO_DATA DevInfoData;
+    HDEVINFO DevInfo;
+    DEVINST Parent;
+    ULONG VolumeDisk, Disk, Size, i;
+    BOOL Found = FALSE;
+
+    VolumePath[4] = Path[0];
+    if (!GetDiskNumber(VolumePath, &VolumeDisk))
+        return FALSE;
+
+    DevInfo = SetupDiGetClassDevsW(&GUID_DEVINTERFACE_DISK, NULL, NULL, DIGCF_PRESENT | DIGCF_DEVICEINTERFACE);
+    if (DevInfo == INVALID_HANDLE_VALUE)
+        return FALSE;
+
+    Detail = HeapAlloc(GetProcessHeap(), 0, 1024);
+    InterfaceData.cbSize = sizeof(InterfaceData);
+    for (i = 0; Detail && !Found && SetupDiEnumDeviceInterfaces(DevInfo, NULL, &GUID_DEVINTERFACE_DISK, i, &InterfaceData); i++)
+    {
+        Detail->cbSize = sizeof(*Detail);
+        DevInfoData.cbSize = sizeof(DevInfoData);
+        if (!SetupDiGetDeviceInterfaceDetailW(DevInfo, &InterfaceData, Detail, 1024, NULL, &DevInfoData) ||
+            !GetDiskNumber(Detail->DevicePath, &Disk) || Disk != VolumeDisk)
+        {
+            continue;
+        }
+
+        Size = Length * sizeof(WCHAR);
+        Found = CM_Get_Parent(&Parent, DevInfoData.DevInst, 0) == CR_SUCCESS &&
+                CM_Get_DevNode_Registry_PropertyW(Parent, CM_DRP_SERVICE, NULL, Service, &Size, 0) == CR_SUCCESS;
+        break;
+    }
+
+    if (Detail)
+        HeapFree(GetProcessHeap(), 0, Detail);
+    SetupDiDestroyDeviceInfoList(DevInfo);
+    return Found;
+}
+
+/* Skips unless Path is on a disk driven by the given miniport, e.g. L"storahci" */
+BOOL
+BenchRequireDiskDriver(
+    _In_ PCWSTR Path,
+    _In_ PCWSTR Service)
+{
+    WCHAR AdapterService[MAX_PATH];
+
+    if (!GetAdapterService(Path, AdapterService, _countof(AdapterService)))
+    {
+        skip("Could not find the adapter of the disk holding %S, error %lu\n", Path, GetLastError());
+        return FALSE;
+    }
+
+    if (_wcsicmp(AdapterService, Service) != 0)
+    {
+        skip("%S is on a %S disk, this test is for %S\n", Path, AdapterService, Service);
+        return FALSE;
+    }
+
+    trace("Testing on %c: (%S)\n", Path[0], AdapterService);
+    return TRUE;
+}
@@ -0,0 +1,49 @@
+/*
+ * PROJECT:         ReactOS api tests
+ * LICENSE:         GPL - See COPYING in the top level directory
+ * PURPOSE:         Helper declarations for the file system and disk benchmarks
+ */
+
+#pragma once
+
+typedef struct _BENCH_TIMER
+{
+    LARGE_INTEGER Frequency;
+    LARGE_INTEGER Start;
+} BENCH_TIMER, *PBENCH_TIMER;
+
+VOID
+BenchStartTimer(
+    _Out_ PBENCH_TIMER Timer);
+
+ULONGLONG
+BenchElapsedUs(
+    _In_ PBENCH_TIMER Timer);
+
+ULONG
+BenchElapsedMs(
+    _In_ PBENCH_TIMER Timer);
+
+ULONG
+BenchRate(
+    _In_ ULONGLONG Count,
+    _In_ ULONGLONG ElapsedUs);
+
+BOOL
+BenchCreateTestDir(
+    _In_ PCWSTR Name,
+    _Out_writes_(MAX_PATH) PWSTR TestDir);
+
+VOID
+BenchRemoveTestDir(
+    _In_ PCWSTR TestDir);
+
+BOOL
+BenchRequireFileSystem(
+    _In_ PCWSTR Path,
+    _In_ PCWSTR FileSystem);
+
+BOOL
+BenchRequireDiskDriver(
+    _In_ PCWSTR Path,
+    _In_ PCWSTR Service);
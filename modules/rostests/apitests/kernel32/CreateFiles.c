@@ -0,0 +1,146 @@
+/*
+ * PROJECT:         ReactOS api tests
+ * LICENSE:         GPL - See COPYING in the top level directory
+ * PURPOSE:         Test for creating, renaming and deleting many files in one directory
+ */
+
+#include "precomp.h"
+
+#define BENCH_FILES     10000
+#define BENCH_STEP      1000
+
+static WCHAR TestDir[MAX_PATH];
+
+static void MakeName(PWSTR Name, ULONG Index)
+{
+    swprintf(Name, L"%s\\Long file name %05lu.txt", TestDir, Index);
+}
+
+static HANDLE OpenName(PCWSTR Name)
+{
+    return CreateFileW(Name,
+                       FILE_READ_ATTRIBUTES,
+                       FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                       NULL,
+                       OPEN_EXISTING,
+                       FILE_ATTRIBUTE_NORMAL,
+                       NULL);
+}
+
+static BOOL Exists(PCWSTR Name)
+{
+    HANDLE hFile;
+
+    hFile = OpenName(Name);
+    if (hFile == INVALID_HANDLE_VALUE)
+        return FALSE;
+    CloseHandle(hFile);
+    return TRUE;
+}
+
+static ULONG CreateFiles(void)
+{
+    WCHAR Name[MAX_PATH];
+    BENCH_TIMER Timer, Step;
+    HANDLE hFile;
+    ULONG i;
+
+    /* Creation has to stay as fast in a full directory as in an empty one */
+    BenchStartTimer(&Timer);
+    BenchStartTimer(&Step);
+    for (i = 0; i < BENCH_FILES; i++)
+    {
+        MakeName(Name, i);
+        hFile = CreateFileW(Name, GENERIC_WRITE, 0, NULL, CREATE_NEW, FILE_ATTRIBUTE_NORMAL, NULL);
+        if (hFile == INVALID_HANDLE_VALUE)
+            break;
+        CloseHandle(hFile);
+
+        if ((i + 1) % BENCH_STEP == 0)
+        {
+            trace("Files %lu to %lu created in %lu ms\n", i + 1 - BENCH_STEP, i, BenchElapsedMs(&Step));
+            BenchStartTimer(&Step);
+        }
+    }
+
+    trace("Created %lu files in %lu ms\n", i, BenchElapsedMs(&Timer));
+    return i;
+}
+
+static void Test_Names(ULONG Count)
+{
+    WCHAR Name[MAX_PATH], ShortName[MAX_PATH], NewName[MAX_PATH];
+    HANDLE hFile;
+
+    /* An existing name can't be created again */
+    MakeName(Name, Count / 2);
+    SetLastError(0xdeadbeef);
+    hFile = CreateFileW(Name, GENERIC_WRITE, 0, NULL, CREATE_NEW, FILE_ATTRIBUTE_NORMAL, NULL);
+    ok(hFile == INVALID_HANDLE_VALUE && GetLastError() == ERROR_FILE_EXISTS,
+       "Created %S twice, error %lu\n", Name, GetLastError());
+    if (hFile != INVALID_HANDLE_VALUE)
+        CloseHandle(hFile);
+
+    /* Files can be opened by their short names too */
+    MakeName(Name, Count - 1);
+    if (GetShortPathNameW(Name, ShortName, _countof(ShortName)) && wcscmp(Name, ShortName) != 0)
+        ok(Exists(ShortName), "Failed to open %S, error %lu\n", ShortName, GetLastError());
+    else
+        skip("No short name for %S\n", Name);
+
+    /* Renamed files are found under the new name only */
+    MakeName(Name, 0);
+    swprintf(NewName, L"%s\\Renamed file.txt", TestDir);
+    ok(MoveFileW(Name, NewName), "MoveFile failed, error %lu\n", GetLastError());
+    ok(!Exists(Name), "%S still exists\n", Name);
+    ok(Exists(NewName), "Failed to open %S, error %lu\n", NewName, GetLastError());
+    ok(MoveFileW(NewName, Name), "MoveFile failed, error %lu\n", GetLastError());
+    ok(Exists(Name), "Failed to open %S, error %lu\n", Name, GetLastError());
+
+    /* Deleted files are gone, and their entries can be reused */
+    MakeName(Name, 1);
+    ok(DeleteFileW(Name), "DeleteFile failed, error %lu\n", GetLastError());
+    ok(!Exists(Name), "%S still exists\n", Name);
+    hFile = CreateFileW(Name, GENERIC_WRITE, 0, NULL, CREATE_NEW, FILE_ATTRIBUTE_NORMAL, NULL);
+    ok(hFile != INVALID_HANDLE_VALUE, "Failed to create %S, error %lu\n", Name, GetLastError());
+    if (hFile != INVALID_HANDLE_VALUE)
+        CloseHandle(hFile);
+}
+
+static void DeleteFiles(ULONG Count)
+{
+    WCHAR Name[MAX_PATH];
+    BENCH_TIMER Timer;
+    ULONG i, Deleted = 0;
+
+    BenchStartTimer(&Timer);
+    for (i = 0; i < Count; i++)
+    {
+        MakeName(Name, i);
+        if (DeleteFileW(Name))
+            Deleted++;
+    }
+    ok(Deleted == Count, "Deleted %lu of %lu files\n", Deleted, Count);
+    trace("Deleted %lu files in %lu ms\n", Deleted, BenchElapsedMs(&Timer));
+}
+
+START_TEST(CreateFiles)
+{
+    ULONG Count;
+
+    if (!BenchCreateTestDir(L"CreateFiles", TestDir))
+        return;
+
+    /* The per-directory name index is FAT specific */
+    if (BenchRequireFileSystem(TestDir, L"FAT"))
+    {
+        Count = CreateFiles();
+        ok(Count == BENCH_FILES, "Created %lu of %u files, error %lu\n", Count, BENCH_FILES, GetLastError());
+        if (Count >= 2)
+            Test_Names(Count);
+
+        DeleteFiles(Count);
+    }
+
+    BenchRemoveTestDir(TestDir);
+}
@@ -0,0 +1,168 @@
+/*
+ * PROJECT:         ReactOS api tests
+ * LICENSE:         GPL - See COPYING in the top level directory
+ * PURPOSE:         Test for random reads in a fragmented file
+ */
+
+#include "precomp.h"
+
+/* FAT can hold files of up to 4 GiB - 1; raise this to measure the worst case */
+#define BENCH_FILE_SIZE     (64 * 1024 * 1024)
+#define BENCH_READS         2000
+
+static WCHAR TestDir[MAX_PATH];
+static ULONG ClusterSize;
+
+/* Stamp every cluster with its index in the file, so misplaced reads show */
+static void FillCluster(PULONG Buffer, ULONG Index)
+{
+    ULONG i;
+
+    for (i = 0; i < ClusterSize / sizeof(ULONG); i++)
+        Buffer[i] = Index;
+}
+
+/* Grow both files one cluster at a time, so that neither has two contiguous clusters */
+static BOOL CreateFragmentedFile(PCWSTR Name, PCWSTR OtherName, ULONG Clusters)
+{
+    HANDLE hFile, hOther;
+    BENCH_TIMER Timer;
+    PULONG Buffer;
+    DWORD Written;
+    BOOL Ret = TRUE;
+    ULONG i;
+
+    Buffer = HeapAlloc(GetProcessHeap(), 0, ClusterSize);
+    if (!Buffer)
+        return FALSE;
+
+    hFile = CreateFileW(Name, GENERIC_WRITE, 0, NULL, CREATE_NEW, FILE_ATTRIBUTE_NORMAL, NULL);
+    hOther = CreateFileW(OtherName, GENERIC_WRITE, 0, NULL, CREATE_NEW, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (hFile == INVALID_HANDLE_VALUE || hOther == INVALID_HANDLE_VALUE)
+    {
+        Ret = FALSE;
+        goto Quit;
+    }
+
+    BenchStartTimer(&Timer);
+    for (i = 0; i < Clusters && Ret; i++)
+    {
+        FillCluster(Buffer, i);
+        Ret = WriteFile(hFile, Buffer, ClusterSize, &Written, NULL) && Written == ClusterSize &&
+              WriteFile(hOther, Buffer, ClusterSize, &Written, NULL) && Written == ClusterSize;
+
+        /* Make the allocations happen in turn */
+        if (Ret && (i % 16) == 15)
+            Ret = FlushFileBuffers(hFile) && FlushFileBuffers(hOther);
+    }
+    trace("Wrote 2 x %lu clusters of %lu bytes in %lu ms\n", i, ClusterSize, BenchElapsedMs(&Timer));
+
+Quit:
+    if (hFile != INVALID_HANDLE_VALUE)
+        CloseHandle(hFile);
+    if (hOther != INVALID_HANDLE_VALUE)
+        CloseHandle(hOther);
+    HeapFree(GetProcessHeap(), 0, Buffer);
+    return Ret;
+}
+
+static void Benchmark(PCWSTR Name, ULONG Clusters)
+{
+    HANDLE hFile;
+    PULONG Buffer;
+    LARGE_INTEGER Offset;
+    BENCH_TIMER Timer;
+    ULONGLONG Elapsed;
+    ULONG Seed = 0x5eed, Errors = 0, Index, i;
+    DWORD Read;
+
+    /* Bypass the cache, so that each read has to map its offset */
+    hFile = CreateFileW(Name, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+                        FILE_FLAG_NO_BUFFERING | FILE_FLAG_RANDOM_ACCESS, NULL);
+    ok(hFile != INVALID_HANDLE_VALUE, "Failed to open %S, error %lu\n", Name, GetLastError());
+    if (hFile == INVALID_HANDLE_VALUE)
+        return;
+
+    Buffer = VirtualAlloc(NULL, ClusterSize, MEM_COMMIT, PAGE_READWRITE);
+    if (!Buffer)
+    {
+        skip("No memory\n");
+        CloseHandle(hFile);
+        return;
+    }
+
+    BenchStartTimer(&Timer);
+    for (i = 0; i < BENCH_READS; i++)
+    {
+        Seed = Seed * 1103515245 + 12345;
+        Index = (i == 0) ? Clusters - 1 : Seed % Clusters;
+        Offset.QuadPart = (LONGLONG)Index * ClusterSize;
+
+        if (!SetFilePointerEx(hFile, Offset, NULL, FILE_BEGIN) ||
+            !ReadFile(hFile, Buffer, ClusterSize, &Read, NULL) ||
+            Read != ClusterSize || Buffer[0] != Index || Buffer[ClusterSize / sizeof(ULONG) - 1] != Index)
+        {
+            Errors++;
+        }
+    }
+    Elapsed = BenchElapsedUs(&Timer);
+
+    ok(Errors == 0, "%lu of %u reads failed or returned the wrong cluster\n", Errors, BENCH_READS);
+    trace("Random reads in %lu fragments: %lu us per read\n", Clusters, (ULONG)(Elapsed / BENCH_READS));
+
+    /* Reading backwards must not cost more than reading forwards */
+    BenchStartTimer(&Timer);
+    for (i = 0; i < BENCH_READS && i < Clusters; i++)
+    {
+        Offset.QuadPart = (LONGLONG)(Clusters - 1 - i) * ClusterSize;
+        if (!SetFilePointerEx(hFile, Offset, NULL, FILE_BEGIN) ||
+            !ReadFile(hFile, Buffer, ClusterSize, &Read, NULL))
+        {
+            break;
+        }
+    }
+    Elapsed = BenchElapsedUs(&Timer);
+    trace("Backward reads from the end: %lu us per read\n", (ULONG)(Elapsed / max(i, 1)));
+
+    VirtualFree(Buffer, 0, MEM_RELEASE);
+    CloseHandle(hFile);
+}
+
+START_TEST(FragmentedRead)
+{
+    WCHAR Name[MAX_PATH], OtherName[MAX_PATH];
+    WCHAR Root[4] = L"C:\\";
+    DWORD SectorsPerCluster, BytesPerSector, FreeClusters, TotalClusters;
+    ULONG Clusters;
+
+    if (!BenchCreateTestDir(L"FragmentedRead", TestDir))
+        return;
+
+    /* The per-FCB run cache is FAT specific */
+    if (!BenchRequireFileSystem(TestDir, L"FAT"))
+        goto Cleanup;
+
+    Root[0] = TestDir[0];
+    if (!GetDiskFreeSpaceW(Root, &SectorsPerCluster, &BytesPerSector, &FreeClusters, &TotalClusters))
+    {
+        skip("GetDiskFreeSpace failed, error %lu\n", GetLastError());
+        goto Cleanup;
+    }
+    ClusterSize = SectorsPerCluster * BytesPerSector;
+    Clusters = BENCH_FILE_SIZE / ClusterSize;
+    if (FreeClusters / 2 < Clusters + 1024)
+    {
+        skip("Not enough free space for 2 x %lu clusters\n", Clusters);
+        goto Cleanup;
+    }
+
+    swprintf(Name, L"%s\\fragmented.dat", TestDir);
+    swprintf(OtherName, L"%s\\other.dat", TestDir);
+    if (CreateFragmentedFile(Name, OtherName, Clusters))
+        Benchmark(Name, Clusters);
+    else
+        skip("Could not create the test files, error %lu\n", GetLastError());
+
+Cleanup:
+    BenchRemoveTestDir(TestDir);
+}
@@ -0,0 +1,172 @@
+/*
+ * PROJECT:         ReactOS api tests
+ * LICENSE:         GPL - See COPYING in the top level directory
+ * PURPOSE:         Test for opening files by name in a very large directory
+ */
+
+#include "precomp.h"
+
+#define BENCH_FILES         4096
+#define BENCH_CREATE_TIME   (60 * 1000)
+#define BENCH_OPENS         10000
+
+static WCHAR TestDir[MAX_PATH];
+
+static void MakeName(PWSTR Name, ULONG Index)
+{
+    /* Spread the names over the collation order, not just the tail of it */
+    swprintf(Name, L"%s\\f%08lx_%lu.dat", TestDir, (Index * 2654435761UL) ^ 0x5a5a5a5a, Index);
+}
+
+static HANDLE OpenName(PCWSTR Name)
+{
+    return CreateFileW(Name,
+                       FILE_READ_ATTRIBUTES,
+                       FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                       NULL,
+                       OPEN_EXISTING,
+                       FILE_ATTRIBUTE_NORMAL,
+                       NULL);
+}
+
+static ULONG CreateFiles(ULONG Count)
+{
+    WCHAR Name[MAX_PATH];
+    BENCH_TIMER Timer;
+    HANDLE hFile;
+    ULONG i;
+
+    BenchStartTimer(&Timer);
+    for (i = 0; i < Count; i++)
+    {
+        MakeName(Name, i);
+        hFile = CreateFileW(Name, GENERIC_WRITE, 0, NULL, CREATE_NEW, FILE_ATTRIBUTE_NORMAL, NULL);
+        if (hFile == INVALID_HANDLE_VALUE)
+            break;
+        CloseHandle(hFile);
+
+        if (BenchElapsedMs(&Timer) > BENCH_CREATE_TIME)
+        {
+            trace("Gave up creating files after %lu ms\n", BenchElapsedMs(&Timer));
+            i++;
+            break;
+        }
+    }
+
+    trace("Created %lu files in %lu ms\n", i, BenchElapsedMs(&Timer));
+    return i;
+}
+
+static void Test_Lookup(ULONG Count)
+{
+    WCHAR Name[MAX_PATH];
+    HANDLE hFile;
+    ULONG i;
+
+    /* First, last and middle of the creation order */
+    for (i = 0; i < 3; i++)
+    {
+        MakeName(Name, i == 0 ? 0 : (i == 1 ? Count - 1 : Count / 2));
+        hFile = OpenName(Name);
+        ok(hFile != INVALID_HANDLE_VALUE, "Failed to open %S, error %lu\n", Name, GetLastError());
+        if (hFile != INVALID_HANDLE_VALUE)
+            CloseHandle(hFile);
+    }
+
+    /* Names are looked up without regard to case */
+    MakeName(Name, Count / 3);
+    _wcsupr(Name + wcslen(TestDir));
+    hFile = OpenName(Name);
+    ok(hFile != INVALID_HANDLE_VALUE, "Failed to open %S, error %lu\n", Name, GetLastError());
+    if (hFile != INVALID_HANDLE_VALUE)
+        CloseHandle(hFile);
+
+    /* A name sorting between two existing ones, and names sorting before and after all of them */
+    MakeName(Name, Count / 4);
+    wcscat(Name, L"x");
+    SetLastError(0xdeadbeef);
+    hFile = OpenName(Name);
+    ok(hFile == INVALID_HANDLE_VALUE && GetLastError() == ERROR_FILE_NOT_FOUND,
+       "Opened %S, error %lu\n", Name, GetLastError());
+
+    swprintf(Name, L"%s\\0", TestDir);
+    SetLastError(0xdeadbeef);
+    hFile = OpenName(Name);
+    ok(hFile == INVALID_HANDLE_VALUE && GetLastError() == ERROR_FILE_NOT_FOUND,
+       "Opened %S, error %lu\n", Name, GetLastError());
+
+    swprintf(Name, L"%s\\zzzz", TestDir);
+    SetLastError(0xdeadbeef);
+    hFile = OpenName(Name);
+    ok(hFile == INVALID_HANDLE_VALUE && GetLastError() == ERROR_FILE_NOT_FOUND,
+       "Opened %S, error %lu\n", Name, GetLastError());
+}
+
+static void Benchmark(ULONG Count)
+{
+    WCHAR Name[MAX_PATH];
+    ULONG Seed = 0x5eed, Opened = 0, Missed = 0, i;
+    BENCH_TIMER Timer;
+    ULONGLONG Elapsed;
+    HANDLE hFile;
+
+    BenchStartTimer(&Timer);
+    for (i = 0; i < BENCH_OPENS; i++)
+    {
+        Seed = Seed * 1103515245 + 12345;
+        MakeName(Name, Seed % Count);
+        hFile = OpenName(Name);
+        if (hFile == INVALID_HANDLE_VALUE)
+            continue;
+        CloseHandle(hFile);
+        Opened++;
+    }
+    Elapsed = BenchElapsedUs(&Timer);
+    ok(Opened == BENCH_OPENS, "Opened %lu of %u files\n", Opened, BENCH_OPENS);
+    trace("Random opens in %lu entries: %lu ms, %lu opens/s\n",
+          Count, (ULONG)(Elapsed / 1000), BenchRate(BENCH_OPENS, Elapsed));
+
+    /* Names that aren't there must be as cheap to rule out */
+    BenchStartTimer(&Timer);
+    for (i = 0; i < BENCH_OPENS; i++)
+    {
+        Seed = Seed * 1103515245 + 12345;
+        MakeName(Name, Count + Seed % Count);
+        hFile = OpenName(Name);
+        if (hFile != INVALID_HANDLE_VALUE)
+        {
+            CloseHandle(hFile);
+            continue;
+        }
+        Missed++;
+    }
+    Elapsed = BenchElapsedUs(&Timer);
+    ok(Missed == BENCH_OPENS, "Missed %lu of %u files\n", Missed, BENCH_OPENS);
+    trace("Random misses in %lu entries: %lu ms, %lu lookups/s\n",
+          Count, (ULONG)(Elapsed / 1000), BenchRate(BENCH_OPENS, Elapsed));
+}
+
+START_TEST(LargeDirectory)
+{
+    ULONG Count;
+
+    if (!BenchCreateTestDir(L"LargeDirectory", TestDir))
+        return;
+
+    /* The directory B+tree lookup is NTFS specific */
+    if (BenchRequireFileSystem(TestDir, L"NTFS"))
+    {
+        Count = CreateFiles(BENCH_FILES);
+        if (Count < 2)
+        {
+            skip("Could not create the test files, error %lu\n", GetLastError());
+        }
+        else
+        {
+            Test_Lookup(Count);
+            Benchmark(Count);
+        }
+    }
+
+    BenchRemoveTestDir(TestDir);
+}
@@ -0,0 +1,205 @@
+/*
+ * PROJECT:         ReactOS api tests
+ * LICENSE:         GPL - See COPYING in the top level directory
+ * PURPOSE:         Test for random reads with many requests in flight
+ */
+
+#include "precomp.h"
+
+#define BENCH_FILE_SIZE     (64 * 1024 * 1024)
+#define BENCH_BLOCK_SIZE    4096
+#define BENCH_READS         4096
+#define MAX_DEPTH           32
+
+#define BLOCK(Buffers, i)   ((Buffers) + (i) * (BENCH_BLOCK_SIZE / sizeof(ULONG)))
+
+/* Stamp every block with its index in the file, so misplaced reads show */
+static void FillBlock(PULONG Buffer, ULONG Index)
+{
+    ULONG i;
+
+    for (i = 0; i < BENCH_BLOCK_SIZE / sizeof(ULONG); i++)
+        Buffer[i] = Index;
+}
+
+static BOOL CreateTestFile(PCWSTR Name, ULONG Blocks)
+{
+    HANDLE hFile;
+    PULONG Buffer;
+    DWORD Written;
+    BOOL Ret = TRUE;
+    ULONG i;
+
+    Buffer = HeapAlloc(GetProcessHeap(), 0, BENCH_BLOCK_SIZE);
+    if (!Buffer)
+        return FALSE;
+
+    hFile = CreateFileW(Name, GENERIC_WRITE, 0, NULL, CREATE_NEW, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (hFile == INVALID_HANDLE_VALUE)
+    {
+        HeapFree(GetProcessHeap(), 0, Buffer);
+        return FALSE;
+    }
+
+    for (i = 0; i < Blocks && Ret; i++)
+    {
+        FillBlock(Buffer, i);
+        Ret = WriteFile(hFile, Buffer, BENCH_BLOCK_SIZE, &Written, NULL) && Written == BENCH_BLOCK_SIZE;
+    }
+
+    CloseHandle(hFile);
+    HeapFree(GetProcessHeap(), 0, Buffer);
+    return Ret;
+}
+
+static BOOL StartRead(HANDLE hFile, PULONG Buffer, OVERLAPPED *Overlapped, ULONG Index)
+{
+    LONGLONG Offset = (LONGLONG)Index * BENCH_BLOCK_SIZE;
+
+    Overlapped->Offset = (DWORD)Offset;
+    Overlapped->OffsetHigh = (DWORD)(Offset >> 32);
+    ResetEvent(Overlapped->hEvent);
+
+    return ReadFile(hFile, Buffer, BENCH_BLOCK_SIZE, NULL, Overlapped) || GetLastError() == ERROR_IO_PENDING;
+}
+
+static BOOL CheckRead(HANDLE hFile, PULONG Buffer, OVERLAPPED *Overlapped, ULONG Index)
+{
+    DWORD Read;
+
+    return GetOverlappedResult(hFile, Overlapped, &Read, TRUE) && Read == BENCH_BLOCK_SIZE &&
+           Buffer[0] == Index && Buffer[BENCH_BLOCK_SIZE / sizeof(ULONG) - 1] == Index;
+}
+
+/* Keep Depth reads in flight until BENCH_READS have completed, the way fio's libaio engine does */
+static void Benchmark(HANDLE hFile, PULONG Buffers, ULONG Blocks, ULONG Depth)
+{
+    OVERLAPPED Overlapped[MAX_DEPTH];
+    HANDLE Events[MAX_DEPTH];
+    ULONG Index[MAX_DEPTH];
+    BOOL Pending[MAX_DEPTH];
+    BENCH_TIMER Timer;
+    ULONGLONG Elapsed;
+    ULONG Seed = 0x5eed, Errors = 0, Issued = 0, Completed = 0, i;
+    DWORD Wait;
+
+    ZeroMemory(Overlapped, sizeof(Overlapped));
+    for (i = 0; i < Depth; i++)
+    {
+        Events[i] = Overlapped[i].hEvent = CreateEventW(NULL, TRUE, FALSE, NULL);
+        if (!Events[i])
+        {
+            skip("CreateEvent failed, error %lu\n", GetLastError());
+            Depth = i;
+            goto Cleanup;
+        }
+    }
+
+    BenchStartTimer(&Timer);
+    for (i = 0; i < Depth; i++)
+    {
+        Seed = Seed * 1103515245 + 12345;
+        Index[i] = Seed % Blocks;
+        /* A read that failed to start is counted when its slot comes up */
+        Pending[i] = StartRead(hFile, BLOCK(Buffers, i), &Overlapped[i], Index[i]);
+        if (!Pending[i])
+            SetEvent(Events[i]);
+        Issued++;
+    }
+
+    while (Issued < BENCH_READS)
+    {
+        Wait = WaitForMultipleObjects(Depth, Events, FALSE, 30000);
+        if (Wait >= WAIT_OBJECT_0 + Depth)
+        {
+            ok(0, "Wait returned %lu after %lu reads\n", Wait, Completed);
+            break;
+        }
+
+        i = Wait - WAIT_OBJECT_0;
+        if (!Pending[i] || !CheckRead(hFile, BLOCK(Buffers, i), &Overlapped[i], Index[i]))
+            Errors++;
+        Completed++;
+
+        Seed = Seed * 1103515245 + 12345;
+        Index[i] = Seed % Blocks;
+        Pending[i] = StartRead(hFile, BLOCK(Buffers, i), &Overlapped[i], Index[i]);
+        if (!Pending[i])
+            SetEvent(Events[i]);
+        Issued++;
+    }
+
+    /* Drain what is still in flight */
+    for (i = 0; i < Depth; i++)
+    {
+        if (!Pending[i] || !CheckRead(hFile, BLOCK(Buffers, i), &Overlapped[i], Index[i]))
+            Errors++;
+        Completed++;
+    }
+    Elapsed = BenchElapsedUs(&Timer);
+
+    ok(Errors == 0, "%lu of %lu reads failed or returned the wrong block\n", Errors, Issued);
+    trace("Queue depth %lu: %lu random 4k reads in %lu ms, %lu IOPS\n", Depth, Completed,
+          (ULONG)(Elapsed / 1000), BenchRate(Completed, Elapsed));
+
+Cleanup:
+    for (i = 0; i < Depth; i++)
+        CloseHandle(Events[i]);
+}
+
+START_TEST(QueuedRead)
+{
+    WCHAR TestDir[MAX_PATH];
+    WCHAR Name[MAX_PATH];
+    WCHAR Root[4] = L"C:\\";
+    DWORD SectorsPerCluster, BytesPerSector, FreeClusters, TotalClusters;
+    ULONG Blocks = BENCH_FILE_SIZE / BENCH_BLOCK_SIZE;
+    HANDLE hFile;
+    PULONG Buffers;
+
+    if (!BenchCreateTestDir(L"QueuedRead", TestDir))
+        return;
+
+    /* Only the AHCI miniport queues commands on the device */
+    if (!BenchRequireDiskDriver(TestDir, L"storahci"))
+        goto Cleanup;
+
+    Root[0] = TestDir[0];
+    if (!GetDiskFreeSpaceW(Root, &SectorsPerCluster, &BytesPerSector, &FreeClusters, &TotalClusters) ||
+        (ULONGLONG)FreeClusters * SectorsPerCluster * BytesPerSector < 2 * BENCH_FILE_SIZE)
+    {
+        skip("Not enough free space on %S\n", Root);
+        goto Cleanup;
+    }
+
+    swprintf(Name, L"%s\\queued.dat", TestDir);
+    if (!CreateTestFile(Name, Blocks))
+    {
+        skip("Could not create the test file, error %lu\n", GetLastError());
+        goto Cleanup;
+    }
+
+    /* Bypass the cache, so that every read reaches the disk */
+    hFile = CreateFileW(Name, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+                        FILE_FLAG_NO_BUFFERING | FILE_FLAG_OVERLAPPED | FILE_FLAG_RANDOM_ACCESS, NULL);
+    ok(hFile != INVALID_HANDLE_VALUE, "Failed to open %S, error %lu\n", Name, GetLastError());
+
+    Buffers = VirtualAlloc(NULL, MAX_DEPTH * BENCH_BLOCK_SIZE, MEM_COMMIT, PAGE_READWRITE);
+    if (hFile != INVALID_HANDLE_VALUE && Buffers)
+    {
+        Benchmark(hFile, Buffers, Blocks, 1);
+        Benchmark(hFile, Buffers, Blocks, MAX_DEPTH);
+    }
+    else if (!Buffers)
+    {
+        skip("No memory\n");
+    }
+
+    if (Buffers)
+        VirtualFree(Buffers, 0, MEM_RELEASE);
+    if (hFile != INVALID_HANDLE_VALUE)
+        CloseHandle(hFile);
+
+Cleanup:
+    BenchRemoveTestDir(TestDir);
+}
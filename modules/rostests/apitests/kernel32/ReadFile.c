@@ -0,0 +1,294 @@
+/*
+ * PROJECT:         ReactOS api tests
+ * LICENSE:         GPL - See COPYING in the top level directory
+ * PURPOSE:         Test for ReadFile on cached and non-cached file handles
+ */
+
+#include "precomp.h"
+
+#define FILE_SIZE       (8 * 1024 * 1024)
+#define SEQ_CHUNK       (64 * 1024)
+#define RANDOM_CHUNK    4096
+#define RANDOM_READS    2048
+
+static WCHAR TestDir[MAX_PATH];
+static WCHAR TestFile[MAX_PATH];
+
+static HANDLE OpenTestFile(DWORD Flags)
+{
+    return CreateFileW(TestFile,
+                       GENERIC_READ,
+                       FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                       NULL,
+                       OPEN_EXISTING,
+                       FILE_ATTRIBUTE_NORMAL | Flags,
+                       NULL);
+}
+
+static BOOL ReadAt(HANDLE hFile, ULONG Offset, PVOID Buffer, DWORD Length, PDWORD Read)
+{
+    OVERLAPPED ov;
+
+    ZeroMemory(&ov, sizeof(ov));
+    ov.Offset = Offset;
+    return ReadFile(hFile, Buffer, Length, Read, &ov);
+}
+
+/* Every DWORD of the file holds its own offset */
+static BOOL CheckPattern(PVOID Buffer, ULONG Offset, DWORD Length)
+{
+    PUCHAR Bytes = Buffer;
+    DWORD i;
+
+    for (i = 0; i < Length; i++)
+    {
+        ULONG Value = (Offset + i) & ~3;
+        if (Bytes[i] != ((PUCHAR)&Value)[(Offset + i) & 3])
+            return FALSE;
+    }
+
+    return TRUE;
+}
+
+static BOOL CreateTestFile(void)
+{
+    PULONG Buffer;
+    HANDLE hFile;
+    DWORD Written;
+    ULONG Offset, i;
+    BOOL Ret = TRUE;
+
+    swprintf(TestFile, L"%s\\read.dat", TestDir);
+    hFile = CreateFileW(TestFile, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (hFile == INVALID_HANDLE_VALUE)
+        return FALSE;
+
+    Buffer = HeapAlloc(GetProcessHeap(), 0, SEQ_CHUNK);
+    if (!Buffer)
+    {
+        CloseHandle(hFile);
+        return FALSE;
+    }
+
+    for (Offset = 0; Ret && Offset < FILE_SIZE; Offset += SEQ_CHUNK)
+    {
+        for (i = 0; i < SEQ_CHUNK / sizeof(ULONG); i++)
+            Buffer[i] = Offset + i * sizeof(ULONG);
+        Ret = WriteFile(hFile, Buffer, SEQ_CHUNK, &Written, NULL) && Written == SEQ_CHUNK;
+    }
+
+    HeapFree(GetProcessHeap(), 0, Buffer);
+    CloseHandle(hFile);
+    return Ret;
+}
+
+static void Test_Cached(void)
+{
+    UCHAR Buffer[3 * RANDOM_CHUNK];
+    HANDLE hFile;
+    DWORD Read;
+    BOOL Ret;
+
+    hFile = OpenTestFile(0);
+    ok(hFile != INVALID_HANDLE_VALUE, "CreateFile failed, error %lu\n", GetLastError());
+    if (hFile == INVALID_HANDLE_VALUE)
+        return;
+
+    /* Unaligned reads come back exactly as written */
+    Ret = ReadAt(hFile, 1, Buffer, 5, &Read);
+    ok(Ret && Read == 5, "Ret %d, Read %lu\n", Ret, Read);
+    ok(CheckPattern(Buffer, 1, Read), "Wrong data at 1\n");
+
+    Ret = ReadAt(hFile, RANDOM_CHUNK - 3, Buffer, sizeof(Buffer), &Read);
+    ok(Ret && Read == sizeof(Buffer), "Ret %d, Read %lu\n", Ret, Read);
+    ok(CheckPattern(Buffer, RANDOM_CHUNK - 3, Read), "Wrong data across pages\n");
+
+    /* Reading the same range again is served from the cache */
+    Ret = ReadAt(hFile, RANDOM_CHUNK - 3, Buffer, sizeof(Buffer), &Read);
+    ok(Ret && Read == sizeof(Buffer), "Ret %d, Read %lu\n", Ret, Read);
+    ok(CheckPattern(Buffer, RANDOM_CHUNK - 3, Read), "Wrong data on second read\n");
+
+    /* A read crossing the end of file is truncated */
+    Ret = ReadAt(hFile, FILE_SIZE - 10, Buffer, sizeof(Buffer), &Read);
+    ok(Ret && Read == 10, "Ret %d, Read %lu\n", Ret, Read);
+    ok(CheckPattern(Buffer, FILE_SIZE - 10, Read), "Wrong data at end of file\n");
+
+    /* A read at the end of file succeeds with nothing read */
+    SetLastError(0xdeadbeef);
+    Ret = ReadAt(hFile, FILE_SIZE, Buffer, sizeof(Buffer), &Read);
+    ok(!Ret && GetLastError() == ERROR_HANDLE_EOF, "Ret %d, error %lu\n", Ret, GetLastError());
+    ok(Read == 0, "Read %lu\n", Read);
+
+    /* The file pointer follows synchronous reads */
+    SetFilePointer(hFile, 100, NULL, FILE_BEGIN);
+    Ret = ReadFile(hFile, Buffer, 20, &Read, NULL);
+    ok(Ret && Read == 20, "Ret %d, Read %lu\n", Ret, Read);
+    ok(CheckPattern(Buffer, 100, Read), "Wrong data at file pointer\n");
+    ok(SetFilePointer(hFile, 0, NULL, FILE_CURRENT) == 120, "File pointer not advanced\n");
+
+    CloseHandle(hFile);
+}
+
+static void Test_Coherency(void)
+{
+    UCHAR Buffer[16];
+    HANDLE hFile, hWrite;
+    DWORD Read, Written;
+    ULONG Value;
+    BOOL Ret;
+
+    hFile = OpenTestFile(0);
+    hWrite = CreateFileW(TestFile, GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL,
+                         OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    ok(hFile != INVALID_HANDLE_VALUE && hWrite != INVALID_HANDLE_VALUE, "CreateFile failed, error %lu\n", GetLastError());
+    if (hFile == INVALID_HANDLE_VALUE || hWrite == INVALID_HANDLE_VALUE)
+        goto Cleanup;
+
+    /* Bring the page into the cache, then change it behind its back */
+    Ret = ReadAt(hFile, 2 * RANDOM_CHUNK, Buffer, sizeof(Buffer), &Read);
+    ok(Ret && Read == sizeof(Buffer), "Ret %d, Read %lu\n", Ret, Read);
+
+    Value = 0x12345678;
+    SetFilePointer(hWrite, 2 * RANDOM_CHUNK, NULL, FILE_BEGIN);
+    Ret = WriteFile(hWrite, &Value, sizeof(Value), &Written, NULL);
+    if (!Ret && GetLastError() == ERROR_ACCESS_DENIED)
+    {
+        skip("File system is read-only\n");
+        goto Cleanup;
+    }
+    ok(Ret && Written == sizeof(Value), "Ret %d, Written %lu\n", Ret, Written);
+
+    Ret = ReadAt(hFile, 2 * RANDOM_CHUNK, Buffer, sizeof(Buffer), &Read);
+    ok(Ret && Read == sizeof(Buffer), "Ret %d, Read %lu\n", Ret, Read);
+    ok(*(PULONG)Buffer == Value, "Read stale data %lx\n", *(PULONG)Buffer);
+    ok(CheckPattern(Buffer + sizeof(Value), 2 * RANDOM_CHUNK + sizeof(Value), sizeof(Buffer) - sizeof(Value)),
+       "Wrong data after the written value\n");
+
+    /* Put the pattern back */
+    Value = 2 * RANDOM_CHUNK;
+    SetFilePointer(hWrite, 2 * RANDOM_CHUNK, NULL, FILE_BEGIN);
+    WriteFile(hWrite, &Value, sizeof(Value), &Written, NULL);
+
+Cleanup:
+    if (hWrite != INVALID_HANDLE_VALUE)
+        CloseHandle(hWrite);
+    if (hFile != INVALID_HANDLE_VALUE)
+        CloseHandle(hFile);
+}
+
+static void Test_NoBuffering(void)
+{
+    PUCHAR Buffer;
+    HANDLE hFile;
+    DWORD Read;
+    BOOL Ret;
+
+    hFile = OpenTestFile(FILE_FLAG_NO_BUFFERING);
+    ok(hFile != INVALID_HANDLE_VALUE, "CreateFile failed, error %lu\n", GetLastError());
+    if (hFile == INVALID_HANDLE_VALUE)
+        return;
+
+    Buffer = VirtualAlloc(NULL, SEQ_CHUNK, MEM_COMMIT, PAGE_READWRITE);
+    Ret = ReadAt(hFile, SEQ_CHUNK, Buffer, SEQ_CHUNK, &Read);
+    ok(Ret && Read == SEQ_CHUNK, "Ret %d, Read %lu\n", Ret, Read);
+    ok(CheckPattern(Buffer, SEQ_CHUNK, Read), "Wrong data from non-cached read\n");
+
+    VirtualFree(Buffer, 0, MEM_RELEASE);
+    CloseHandle(hFile);
+}
+
+static ULONG RunSequential(HANDLE hFile, PVOID Buffer)
+{
+    BENCH_TIMER Timer;
+    ULONG Offset;
+    DWORD Read;
+
+    BenchStartTimer(&Timer);
+    for (Offset = 0; Offset < FILE_SIZE; Offset += SEQ_CHUNK)
+    {
+        if (!ReadAt(hFile, Offset, Buffer, SEQ_CHUNK, &Read) || Read != SEQ_CHUNK)
+            break;
+    }
+    ok(Offset == FILE_SIZE, "Sequential read stopped at %lu\n", Offset);
+
+    return BenchElapsedMs(&Timer);
+}
+
+static ULONG RunRandom(HANDLE hFile, PVOID Buffer)
+{
+    BENCH_TIMER Timer;
+    ULONG Seed = 0x5eed, i;
+    DWORD Read;
+
+    BenchStartTimer(&Timer);
+    for (i = 0; i < RANDOM_READS; i++)
+    {
+        Seed = Seed * 1103515245 + 12345;
+        if (!ReadAt(hFile, (Seed % (FILE_SIZE / RANDOM_CHUNK)) * RANDOM_CHUNK, Buffer, RANDOM_CHUNK, &Read) ||
+            Read != RANDOM_CHUNK)
+            break;
+    }
+    ok(i == RANDOM_READS, "Random read stopped after %lu reads\n", i);
+
+    return BenchElapsedMs(&Timer);
+}
+
+static void Benchmark(void)
+{
+    PVOID Buffer;
+    HANDLE hFile;
+    ULONG Cold, Warm;
+
+    Buffer = VirtualAlloc(NULL, SEQ_CHUNK, MEM_COMMIT, PAGE_READWRITE);
+
+    /* Non-cached handles always go to the disk: use them as the cold case */
+    hFile = OpenTestFile(FILE_FLAG_NO_BUFFERING);
+    if (hFile != INVALID_HANDLE_VALUE)
+    {
+        Cold = RunSequential(hFile, Buffer);
+        trace("Sequential non-cached: %lu ms, %lu KB/s\n", Cold, (FILE_SIZE / 1024) * 1000 / max(Cold, 1));
+        Cold = RunRandom(hFile, Buffer);
+        trace("Random non-cached: %lu ms, %lu reads/s\n", Cold, RANDOM_READS * 1000 / max(Cold, 1));
+        CloseHandle(hFile);
+    }
+
+    hFile = OpenTestFile(0);
+    if (hFile != INVALID_HANDLE_VALUE)
+    {
+        Cold = RunSequential(hFile, Buffer);
+        Warm = RunSequential(hFile, Buffer);
+        trace("Sequential cached: first %lu ms, again %lu ms, %lu KB/s\n",
+              Cold, Warm, (FILE_SIZE / 1024) * 1000 / max(Warm, 1));
+        Cold = RunRandom(hFile, Buffer);
+        Warm = RunRandom(hFile, Buffer);
+        trace("Random cached: first %lu ms, again %lu ms, %lu reads/s\n",
+              Cold, Warm, RANDOM_READS * 1000 / max(Warm, 1));
+        CloseHandle(hFile);
+    }
+
+    VirtualFree(Buffer, 0, MEM_RELEASE);
+}
+
+START_TEST(ReadFile)
+{
+    if (!BenchCreateTestDir(L"ReadFile", TestDir))
+        return;
+
+    /* Cached reads through the cache manager are NTFS specific */
+    if (!BenchRequireFileSystem(TestDir, L"NTFS"))
+        goto Cleanup;
+
+    if (!CreateTestFile())
+    {
+        skip("Could not create the test file, error %lu\n", GetLastError());
+        goto Cleanup;
+    }
+
+    Test_Cached();
+    Test_Coherency();
+    Test_NoBuffering();
+    Benchmark();
+
+Cleanup:
+    BenchRemoveTestDir(TestDir);
+}
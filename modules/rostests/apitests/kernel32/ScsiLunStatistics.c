@@ -0,0 +1,225 @@
+/*
+ * PROJECT:         ReactOS api tests
+ * LICENSE:         GPL - See COPYING in the top level directory
+ * PURPOSE:         Test for the per-LUN statistics of the SCSI port driver
+ */
+
+#include "precomp.h"
+
+#include <winioctl.h>
+#include <ntddscsi.h>
+#include <reactos/drivers/ntddscsp.h>
+
+#define MAX_LUNS 64
+
+static PSCSI_ADAPTER_STATISTICS QueryStatistics(HANDLE hPort, DWORD Length, DWORD *Size, DWORD *Error)
+{
+    PSCSI_ADAPTER_STATISTICS Statistics;
+    BOOL Ret;
+
+    Statistics = HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, max(Length, 1));
+    if (!Statistics)
+        return NULL;
+
+    *Size = 0;
+    SetLastError(0xdeadbeef);
+    Ret = DeviceIoControl(hPort, IOCTL_SCSI_GET_LUN_STATISTICS, NULL, 0, Statistics, Length, Size, NULL);
+    *Error = Ret ? ERROR_SUCCESS : GetLastError();
+    return Statistics;
+}
+
+static PSCSI_LUN_STATISTICS FindLun(PSCSI_ADAPTER_STATISTICS Statistics, PSCSI_ADDRESS Address)
+{
+    ULONG i;
+
+    for (i = 0; i < Statistics->NumberOfLuns; i++)
+    {
+        if (Statistics->Luns[i].PathId == Address->PathId &&
+            Statistics->Luns[i].TargetId == Address->TargetId &&
+            Statistics->Luns[i].Lun == Address->Lun)
+        {
+            return &Statistics->Luns[i];
+        }
+    }
+
+    return NULL;
+}
+
+static void TestPort(HANDLE hPort, ULONG PortNumber)
+{
+    const DWORD FullLength = FIELD_OFFSET(SCSI_ADAPTER_STATISTICS, Luns) + MAX_LUNS * sizeof(SCSI_LUN_STATISTICS);
+    PSCSI_ADAPTER_STATISTICS Statistics;
+    PSCSI_LUN_STATISTICS Lun;
+    DWORD Size, Error;
+    ULONG NumberOfLuns, i;
+
+    /* Not even room for the header */
+    Statistics = QueryStatistics(hPort, FIELD_OFFSET(SCSI_ADAPTER_STATISTICS, Luns) - 1, &Size, &Error);
+    if (!Statistics)
+        return;
+    if (Error == ERROR_INVALID_FUNCTION || Error == ERROR_NOT_SUPPORTED)
+    {
+        skip("Port %lu doesn't keep LUN statistics\n", PortNumber);
+        HeapFree(GetProcessHeap(), 0, Statistics);
+        return;
+    }
+    ok(Error == ERROR_INSUFFICIENT_BUFFER, "Port %lu: expected ERROR_INSUFFICIENT_BUFFER, got %lu\n", PortNumber, Error);
+    ok(Size == 0, "Port %lu: invalid output size %lu\n", PortNumber, Size);
+    HeapFree(GetProcessHeap(), 0, Statistics);
+
+    /* Only the header, it tells how many LUNs there are */
+    Statistics = QueryStatistics(hPort, FIELD_OFFSET(SCSI_ADAPTER_STATISTICS, Luns), &Size, &Error);
+    if (!Statistics)
+        return;
+    NumberOfLuns = Statistics->NumberOfLuns;
+    if (NumberOfLuns == 0)
+    {
+        ok(Error == ERROR_SUCCESS, "Port %lu: DeviceIoControl failed: %lu\n", PortNumber, Error);
+    }
+    else
+    {
+        ok(Error == ERROR_MORE_DATA, "Port %lu: expected ERROR_MORE_DATA, got %lu\n", PortNumber, Error);
+    }
+    ok(Size == FIELD_OFFSET(SCSI_ADAPTER_STATISTICS, Luns), "Port %lu: invalid output size %lu\n", PortNumber, Size);
+    ok(Statistics->LatencyFrequency.QuadPart != 0, "Port %lu: no latency frequency\n", PortNumber);
+    HeapFree(GetProcessHeap(), 0, Statistics);
+
+    if (NumberOfLuns > MAX_LUNS)
+    {
+        skip("Port %lu has %lu LUNs\n", PortNumber, NumberOfLuns);
+        return;
+    }
+
+    /* Every LUN fits */
+    Statistics = QueryStatistics(hPort, FullLength, &Size, &Error);
+    if (!Statistics)
+        return;
+    ok(Error == ERROR_SUCCESS, "Port %lu: DeviceIoControl failed: %lu\n", PortNumber, Error);
+    ok(Statistics->NumberOfLuns == NumberOfLuns, "Port %lu: %lu LUNs, was %lu\n", PortNumber, Statistics->NumberOfLuns, NumberOfLuns);
+    ok(Size == FIELD_OFFSET(SCSI_ADAPTER_STATISTICS, Luns) + Statistics->NumberOfLuns * sizeof(SCSI_LUN_STATISTICS),
+       "Port %lu: invalid output size %lu\n", PortNumber, Size);
+
+    for (i = 0; i < Statistics->NumberOfLuns && i < MAX_LUNS; i++)
+    {
+        Lun = &Statistics->Luns[i];
+        ok(Lun->PeakQueueCount >= Lun->QueueCount, "%u/%u/%u: peak %lu below current %lu\n",
+           Lun->PathId, Lun->TargetId, Lun->Lun, Lun->PeakQueueCount, Lun->QueueCount);
+        ok(Lun->MaxLatency <= Lun->TotalLatency, "%u/%u/%u: max latency %I64u above total %I64u\n",
+           Lun->PathId, Lun->TargetId, Lun->Lun, Lun->MaxLatency, Lun->TotalLatency);
+        if (Lun->RequestCount == 0)
+        {
+            ok(Lun->TotalLatency == 0, "%u/%u/%u: latency %I64u without requests\n",
+               Lun->PathId, Lun->TargetId, Lun->Lun, Lun->TotalLatency);
+        }
+    }
+
+    HeapFree(GetProcessHeap(), 0, Statistics);
+}
+
+/* A read from the first disk must be accounted to its LUN */
+static void TestDiskRead(void)
+{
+    const DWORD FullLength = FIELD_OFFSET(SCSI_ADAPTER_STATISTICS, Luns) + MAX_LUNS * sizeof(SCSI_LUN_STATISTICS);
+    PSCSI_ADAPTER_STATISTICS Before, After;
+    PSCSI_LUN_STATISTICS LunBefore, LunAfter;
+    SCSI_ADDRESS Address;
+    WCHAR PortName[32];
+    HANDLE hDisk, hPort;
+    DWORD Size, Error;
+    PVOID Buffer;
+    BOOL Ret;
+
+    hDisk = CreateFileW(L"\\\\.\\PhysicalDrive0", GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE,
+                        NULL, OPEN_EXISTING, FILE_FLAG_NO_BUFFERING, NULL);
+    if (hDisk == INVALID_HANDLE_VALUE)
+    {
+        skip("Can't open the first disk: %lu\n", GetLastError());
+        return;
+    }
+
+    Ret = DeviceIoControl(hDisk, IOCTL_SCSI_GET_ADDRESS, NULL, 0, &Address, sizeof(Address), &Size, NULL);
+    if (!Ret)
+    {
+        skip("The first disk has no SCSI address: %lu\n", GetLastError());
+        CloseHandle(hDisk);
+        return;
+    }
+
+    StringCbPrintfW(PortName, sizeof(PortName), L"\\\\.\\Scsi%u:", Address.PortNumber);
+    hPort = CreateFileW(PortName, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE,
+                        NULL, OPEN_EXISTING, 0, NULL);
+    if (hPort == INVALID_HANDLE_VALUE)
+    {
+        skip("Can't open %S: %lu\n", PortName, GetLastError());
+        CloseHandle(hDisk);
+        return;
+    }
+
+    Buffer = VirtualAlloc(NULL, 4096, MEM_COMMIT, PAGE_READWRITE);
+    Before = QueryStatistics(hPort, FullLength, &Size, &Error);
+    if (!Buffer || !Before || Error != ERROR_SUCCESS)
+    {
+        skip("%S doesn't keep LUN statistics: %lu\n", PortName, Error);
+        goto Cleanup;
+    }
+
+    LunBefore = FindLun(Before, &Address);
+    ok(LunBefore != NULL, "LUN %u/%u/%u of the first disk isn't listed\n", Address.PathId, Address.TargetId, Address.Lun);
+    if (!LunBefore)
+        goto Cleanup;
+
+    Ret = ReadFile(hDisk, Buffer, 4096, &Size, NULL);
+    ok(Ret, "ReadFile failed: %lu\n", GetLastError());
+
+    After = QueryStatistics(hPort, FullLength, &Size, &Error);
+    if (After)
+    {
+        ok(Error == ERROR_SUCCESS, "DeviceIoControl failed: %lu\n", Error);
+        LunAfter = FindLun(After, &Address);
+        ok(LunAfter != NULL, "LUN %u/%u/%u of the first disk went away\n", Address.PathId, Address.TargetId, Address.Lun);
+        if (LunAfter)
+        {
+            ok(LunAfter->RequestCount > LunBefore->RequestCount, "Read not accounted: %I64u requests, were %I64u\n",
+               LunAfter->RequestCount, LunBefore->RequestCount);
+            ok(LunAfter->TotalLatency >= LunBefore->TotalLatency, "Total latency went down\n");
+            ok(LunAfter->PeakQueueCount >= 1, "Peak queue count is %lu\n", LunAfter->PeakQueueCount);
+        }
+        HeapFree(GetProcessHeap(), 0, After);
+    }
+
+Cleanup:
+    if (Before)
+        HeapFree(GetProcessHeap(), 0, Before);
+    if (Buffer)
+        VirtualFree(Buffer, 0, MEM_RELEASE);
+    CloseHandle(hPort);
+    CloseHandle(hDisk);
+}
+
+START_TEST(ScsiLunStatistics)
+{
+    WCHAR PortName[32];
+    HANDLE hPort;
+    ULONG PortNumber, Tested = 0;
+
+    for (PortNumber = 0; PortNumber < 16; PortNumber++)
+    {
+        StringCbPrintfW(PortName, sizeof(PortName), L"\\\\.\\Scsi%lu:", PortNumber);
+        hPort = CreateFileW(PortName, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE,
+                            NULL, OPEN_EXISTING, 0, NULL);
+        if (hPort == INVALID_HANDLE_VALUE)
+            continue;
+
+        TestPort(hPort, PortNumber);
+        CloseHandle(hPort);
+        Tested++;
+    }
+
+    if (Tested == 0)
+    {
+        skip("No SCSI port found\n");
+        return;
+    }
+
+    TestDiskRead();
+}
@@ -15,4 +15,6 @@
 #include <ndk/exfuncs.h>
 #include <ndk/rtlfuncs.h>
 
+#include "BenchHelpers.h"
+
 #endif /* _KERNEL32_APITEST_PRECOMP_H_ */
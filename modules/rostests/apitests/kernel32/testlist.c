@@ -5,6 +5,7 @@
 
 extern void func_ActCtxWithXmlNamespaces(void);
 extern void func_ConsoleCP(void);
+extern void func_CreateFiles(void);
 extern void func_CreateProcess(void);
 extern void func_DefaultActCtx(void);
 extern void func_DeviceIoControl(void);
@@ -13,6 +14,7 @@ extern void func_FindActCtxSectionStringW(void);
 extern void func_FindFiles(void);
 extern void func_FLS(void);
 extern void func_FormatMessage(void);
+extern void func_FragmentedRead(void);
 extern void func_GetComputerNameEx(void);
 extern void func_GetCurrentDirectory(void);
 extern void func_GetDriveType(void);
@@ -21,13 +23,17 @@ extern void func_GetVolumeInformation(void);
 extern void func_interlck(void);
 extern void func_IsDBCSLeadByteEx(void);
 extern void func_JapaneseCalendar(void);
+extern void func_LargeDirectory(void);
 extern void func_LoadLibraryExW(void);
 extern void func_lstrcpynW(void);
 extern void func_lstrlen(void);
 extern void func_Mailslot(void);
 extern void func_MultiByteToWideChar(void);
 extern void func_PrivMoveFileIdentityW(void);
+extern void func_QueuedRead(void);
 extern void func_QueueUserAPC(void);
+extern void func_ReadFile(void);
+extern void func_ScsiLunStatistics(void);
 extern void func_SetComputerNameExW(void);
 extern void func_SetConsoleWindowInfo(void);
 extern void func_SetCurrentDirectory(void);
@@ -40,6 +46,7 @@ extern void func_WideCharToMultiByte(void);
 const struct test winetest_testlist[] =
 {
     { "ConsoleCP",                   func_ConsoleCP },
+    { "CreateFiles",                 func_CreateFiles },
     { "CreateProcess",               func_CreateProcess },
     { "DefaultActCtx",               func_DefaultActCtx },
     { "DeviceIoControl",             func_DeviceIoControl },
@@ -48,6 +55,7 @@ const struct test winetest_testlist[] =
     { "FindFiles",                   func_FindFiles },
     { "FLS",                         func_FLS },
     { "FormatMessage",               func_FormatMessage },
+    { "FragmentedRead",              func_FragmentedRead },
     { "GetComputerNameEx",           func_GetComputerNameEx },
     { "GetCurrentDirectory",         func_GetCurrentDirectory },
     { "GetDriveType",                func_GetDriveType },
@@ -56,13 +64,17 @@ const struct test winetest_testlist[] =
     { "interlck",                    func_interlck },
     { "IsDBCSLeadByteEx",            func_IsDBCSLeadByteEx },
     { "JapaneseCalendar",            func_JapaneseCalendar },
+    { "LargeDirectory",              func_LargeDirectory },
     { "LoadLibraryExW",              func_LoadLibraryExW },
     { "lstrcpynW",                   func_lstrcpynW },
     { "lstrlen",                     func_lstrlen },
     { "MailslotRead",                func_Mailslot },
     { "MultiByteToWideChar",         func_MultiByteToWideChar },
     { "PrivMoveFileIdentityW",       func_PrivMoveFileIdentityW },
+    { "QueuedRead",                  func_QueuedRead },
     { "QueueUserAPC",                func_QueueUserAPC },
+    { "ReadFile",                    func_ReadFile },
+    { "ScsiLunStatistics",           func_ScsiLunStatistics },
     { "SetComputerNameExW",          func_SetComputerNameExW },
     { "SetConsoleWindowInfo",        func_SetConsoleWindowInfo },
     { "SetCurrentDirectory",         func_SetCurrentDirectory },
@@ -323,6 +323,131 @@ Test_ProcessWx86Information(void)
     trace("VdmPower = %lu\n", VdmPower);
 }
 
+static
+BOOL
+QueryVmCounters(PVM_COUNTERS VmCounters)
+{
+    NTSTATUS Status;
+    ULONG Length;
+
+    Status = NtQueryInformationProcess(NtCurrentProcess(),
+                                       ProcessVmCounters,
+                                       VmCounters,
+                                       sizeof(*VmCounters),
+                                       &Length);
+    ok_hex(Status, STATUS_SUCCESS);
+    return NT_SUCCESS(Status);
+}
+
+static
+ULONG
+TouchPages(PUCHAR Base, SIZE_T PageCount)
+{
+    volatile UCHAR *Page = Base;
+    ULONG Sum = 0;
+    SIZE_T i;
+
+    for (i = 0; i < PageCount; i++)
+        Sum += Page[i * PAGE_SIZE];
+
+    return Sum;
+}
+
+static
+void
+Test_ProcessVmCounters(void)
+{
+#define TEST_PAGES 64
+#define COLD_PAGES 4096
+#define BENCH_ROUNDS 8
+    VM_COUNTERS Before, After;
+    WCHAR TempPath[MAX_PATH], FileName[MAX_PATH];
+    HANDLE File, Mapping;
+    PUCHAR Private, View;
+    LARGE_INTEGER Size;
+    ULONG HotFaults = 0, Round;
+    DWORD Start, Elapsed;
+
+    /* Every first touch of a fresh private page is a fault of this process */
+    if (!QueryVmCounters(&Before))
+        return;
+    Private = VirtualAlloc(NULL, TEST_PAGES * PAGE_SIZE, MEM_COMMIT, PAGE_READWRITE);
+    ok(Private != NULL, "VirtualAlloc failed with %lu\n", GetLastError());
+    if (!Private)
+        return;
+    TouchPages(Private, TEST_PAGES);
+    if (QueryVmCounters(&After))
+    {
+        ok(After.PageFaultCount >= Before.PageFaultCount + TEST_PAGES,
+           "PageFaultCount went from %lu to %lu\n", Before.PageFaultCount, After.PageFaultCount);
+    }
+    VirtualFree(Private, 0, MEM_RELEASE);
+
+    /* A file view touched in full becomes part of the working set */
+    GetTempPathW(RTL_NUMBER_OF(TempPath), TempPath);
+    ok(GetTempFileNameW(TempPath, L"nta", 0, FileName) != 0, "GetTempFileNameW failed with %lu\n", GetLastError());
+    File = CreateFileW(FileName,
+                       GENERIC_READ | GENERIC_WRITE,
+                       0,
+                       NULL,
+                       CREATE_ALWAYS,
+                       FILE_ATTRIBUTE_TEMPORARY | FILE_FLAG_DELETE_ON_CLOSE,
+                       NULL);
+    ok(File != INVALID_HANDLE_VALUE, "CreateFileW failed with %lu\n", GetLastError());
+    if (File == INVALID_HANDLE_VALUE)
+        return;
+
+    Size.QuadPart = (LONGLONG)(TEST_PAGES + COLD_PAGES) * PAGE_SIZE;
+    Mapping = CreateFileMappingW(File, NULL, PAGE_READWRITE, Size.HighPart, Size.LowPart, NULL);
+    ok(Mapping != NULL, "CreateFileMappingW failed with %lu\n", GetLastError());
+    View = Mapping ? MapViewOfFile(Mapping, FILE_MAP_WRITE, 0, 0, 0) : NULL;
+    ok(View != NULL, "MapViewOfFile failed with %lu\n", GetLastError());
+    if (!View)
+        goto Cleanup;
+
+    if (QueryVmCounters(&Before))
+    {
+        TouchPages(View, TEST_PAGES);
+        if (QueryVmCounters(&After))
+        {
+            ok(After.WorkingSetSize >= Before.WorkingSetSize + TEST_PAGES * PAGE_SIZE,
+               "WorkingSetSize went from %Iu to %Iu\n", Before.WorkingSetSize, After.WorkingSetSize);
+            ok(After.PeakWorkingSetSize >= After.WorkingSetSize,
+               "PeakWorkingSetSize %Iu is below WorkingSetSize %Iu\n", After.PeakWorkingSetSize, After.WorkingSetSize);
+        }
+    }
+
+    /*
+     * Memory pressure benchmark: keep a small hot set busy while streaming
+     * through a cold region. Pages that keep getting referenced should stay
+     * resident, so the hot set should see few refaults when memory gets tight.
+     */
+    Start = GetTickCount();
+    for (Round = 0; Round < BENCH_ROUNDS; Round++)
+    {
+        TouchPages(View + TEST_PAGES * PAGE_SIZE, COLD_PAGES);
+        if (!QueryVmCounters(&Before))
+            break;
+        TouchPages(View, TEST_PAGES);
+        if (!QueryVmCounters(&After))
+            break;
+        HotFaults += After.PageFaultCount - Before.PageFaultCount;
+    }
+    Elapsed = GetTickCount() - Start;
+    trace("%lu rounds over %lu cold pages: %lu hot set refaults, %lu ms, working set %Iu KB\n",
+          Round, (ULONG)COLD_PAGES, HotFaults, Elapsed, After.WorkingSetSize / 1024);
+
+Cleanup:
+    if (View)
+        UnmapViewOfFile(View);
+    if (Mapping)
+        CloseHandle(Mapping);
+    CloseHandle(File);
+#undef BENCH_ROUNDS
+#undef COLD_PAGES
+#undef TEST_PAGES
+}
+
 START_TEST(NtQueryInformationProcess)
 {
     NTSTATUS Status;
@@ -333,4 +458,5 @@ START_TEST(NtQueryInformationProcess)
     Test_ProcessTimes();
     Test_ProcessPriorityClassAlignment();
     Test_ProcessWx86Information();
+    Test_ProcessVmCounters();
 }
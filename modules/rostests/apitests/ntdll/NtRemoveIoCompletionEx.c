@@ -0,0 +1,152 @@
+/*
+ * PROJECT:         ReactOS api tests
+ * LICENSE:         GPL - See COPYING in the top level directory
+ * PURPOSE:         Test for NtRemoveIoCompletionEx
+ */
+
+#include "precomp.h"
+
+#define PACKET_COUNT    64
+#define BENCH_TIME      1000
+
+static NTSTATUS (NTAPI *pNtRemoveIoCompletionEx)(HANDLE, PFILE_IO_COMPLETION_INFORMATION, ULONG, PULONG, PLARGE_INTEGER, BOOLEAN);
+
+static VOID PostPackets(HANDLE Port, ULONG Count)
+{
+    NTSTATUS Status;
+    ULONG i;
+
+    for (i = 0; i < Count; i++)
+    {
+        Status = NtSetIoCompletion(Port, (PVOID)(ULONG_PTR)(i + 1), (PVOID)(ULONG_PTR)(i + 0x1000), STATUS_SUCCESS, i);
+        ok_ntstatus(Status, STATUS_SUCCESS);
+    }
+}
+
+static VOID Test_Batch(HANDLE Port)
+{
+    FILE_IO_COMPLETION_INFORMATION Info[PACKET_COUNT];
+    LARGE_INTEGER Timeout;
+    NTSTATUS Status;
+    ULONG Removed, Total, i;
+
+    /* Everything queued comes back in order, in as few calls as the batch allows */
+    PostPackets(Port, PACKET_COUNT);
+    Timeout.QuadPart = 0;
+    Removed = 0xdeadbeef;
+    Status = pNtRemoveIoCompletionEx(Port, Info, PACKET_COUNT, &Removed, &Timeout, FALSE);
+    ok_ntstatus(Status, STATUS_SUCCESS);
+    ok(Removed == PACKET_COUNT, "Removed %lu packets\n", Removed);
+    for (i = 0; i < Removed; i++)
+    {
+        ok(Info[i].KeyContext == (PVOID)(ULONG_PTR)(i + 1), "Packet %lu: key %p\n", i, Info[i].KeyContext);
+        ok(Info[i].ApcContext == (PVOID)(ULONG_PTR)(i + 0x1000), "Packet %lu: context %p\n", i, Info[i].ApcContext);
+        ok(Info[i].IoStatusBlock.Status == STATUS_SUCCESS, "Packet %lu: status %lx\n", i, Info[i].IoStatusBlock.Status);
+        ok(Info[i].IoStatusBlock.Information == i, "Packet %lu: information %lu\n", i, (ULONG)Info[i].IoStatusBlock.Information);
+    }
+
+    /* A smaller array leaves the rest queued */
+    PostPackets(Port, 10);
+    Status = pNtRemoveIoCompletionEx(Port, Info, 3, &Removed, &Timeout, FALSE);
+    ok_ntstatus(Status, STATUS_SUCCESS);
+    ok(Removed == 3, "Removed %lu packets\n", Removed);
+    Total = Removed;
+    Status = pNtRemoveIoCompletionEx(Port, Info, PACKET_COUNT, &Removed, &Timeout, FALSE);
+    ok_ntstatus(Status, STATUS_SUCCESS);
+    ok(Removed == 7, "Removed %lu packets\n", Removed);
+    ok(Info[0].KeyContext == (PVOID)4, "First key %p\n", Info[0].KeyContext);
+    Total += Removed;
+    ok(Total == 10, "Removed %lu packets in total\n", Total);
+
+    /* An empty port times out */
+    Removed = 0xdeadbeef;
+    Status = pNtRemoveIoCompletionEx(Port, Info, PACKET_COUNT, &Removed, &Timeout, FALSE);
+    ok_ntstatus(Status, STATUS_TIMEOUT);
+    ok(Removed == 0, "Removed %lu packets\n", Removed);
+
+    /* At least one entry must be asked for */
+    Status = pNtRemoveIoCompletionEx(Port, Info, 0, &Removed, &Timeout, FALSE);
+    ok_ntstatus(Status, STATUS_INVALID_PARAMETER);
+}
+
+static VOID NTAPI DummyApc(ULONG_PTR Parameter)
+{
+    *(PBOOLEAN)Parameter = TRUE;
+}
+
+static VOID Test_Alertable(HANDLE Port)
+{
+    FILE_IO_COMPLETION_INFORMATION Info;
+    LARGE_INTEGER Timeout;
+    BOOLEAN ApcCalled = FALSE;
+    NTSTATUS Status;
+    ULONG Removed;
+
+    /* A queued user APC interrupts an alertable wait */
+    ok(QueueUserAPC(DummyApc, GetCurrentThread(), (ULONG_PTR)&ApcCalled), "QueueUserAPC failed\n");
+    Timeout.QuadPart = -10 * 1000 * 1000;
+    Status = pNtRemoveIoCompletionEx(Port, &Info, 1, &Removed, &Timeout, TRUE);
+    ok_ntstatus(Status, STATUS_USER_APC);
+    ok(ApcCalled == TRUE, "APC was not called\n");
+    ok(Removed == 0, "Removed %lu packets\n", Removed);
+}
+
+static VOID Benchmark(HANDLE Port)
+{
+    FILE_IO_COMPLETION_INFORMATION Info[PACKET_COUNT];
+    IO_STATUS_BLOCK IoStatus;
+    PVOID Key, Context;
+    DWORD Start, Elapsed;
+    ULONG Single = 0, Batched = 0, Removed, i;
+
+    Start = GetTickCount();
+    do
+    {
+        PostPackets(Port, PACKET_COUNT);
+        for (i = 0; i < PACKET_COUNT; i++)
+        {
+            if (!NT_SUCCESS(NtRemoveIoCompletion(Port, &Key, &Context, &IoStatus, NULL)))
+                break;
+            Single++;
+        }
+        Elapsed = GetTickCount() - Start;
+    } while (Elapsed < BENCH_TIME);
+    trace("NtRemoveIoCompletion: %lu packets/sec\n", Single * 1000 / max(Elapsed, 1));
+
+    Start = GetTickCount();
+    do
+    {
+        PostPackets(Port, PACKET_COUNT);
+        if (!NT_SUCCESS(pNtRemoveIoCompletionEx(Port, Info, PACKET_COUNT, &Removed, NULL, FALSE)))
+            break;
+        Batched += Removed;
+        Elapsed = GetTickCount() - Start;
+    } while (Elapsed < BENCH_TIME);
+    trace("NtRemoveIoCompletionEx: %lu packets/sec\n", Batched * 1000 / max(Elapsed, 1));
+
+    ok(Batched > 0, "No packets removed by the batched function\n");
+}
+
+START_TEST(NtRemoveIoCompletionEx)
+{
+    HANDLE Port;
+    NTSTATUS Status;
+
+    pNtRemoveIoCompletionEx = (void*)GetProcAddress(GetModuleHandleA("ntdll.dll"), "NtRemoveIoCompletionEx");
+    if (!pNtRemoveIoCompletionEx)
+    {
+        win_skip("NtRemoveIoCompletionEx not available, skipping tests\n");
+        return;
+    }
+
+    Status = NtCreateIoCompletion(&Port, IO_COMPLETION_ALL_ACCESS, NULL, 0);
+    ok_ntstatus(Status, STATUS_SUCCESS);
+    if (!NT_SUCCESS(Status))
+        return;
+
+    Test_Batch(Port);
+    Test_Alertable(Port);
+    Benchmark(Port);
+
+    NtClose(Port);
+}
@@ -0,0 +1,185 @@
+/*
+ * PROJECT:         ReactOS api tests
+ * LICENSE:         GPL - See COPYING in the top level directory
+ * PURPOSE:         Throughput benchmark for concurrent TCP loopback connections
+ */
+
+#include "ws2_32.h"
+
+#define MAX_CONNECTIONS 8
+#define CHUNK_SIZE      8192
+#define CONN_BYTES      (8 * 1024 * 1024)
+
+typedef struct _LOOPBACK_CONN
+{
+    SOCKET Client;
+    SOCKET Server;
+    HANDLE SendThread;
+    HANDLE RecvThread;
+    ULONG Received;
+    BOOL Corrupt;
+} LOOPBACK_CONN, *PLOOPBACK_CONN;
+
+/* Every byte of a stream depends on its position so reordering shows up */
+static char PatternByte(ULONG Offset)
+{
+    return (char)(Offset ^ (Offset >> 8));
+}
+
+static DWORD WINAPI SendThread(LPVOID Context)
+{
+    PLOOPBACK_CONN Conn = Context;
+    char buf[CHUNK_SIZE];
+    ULONG sent = 0, i;
+    int ret;
+
+    while (sent < CONN_BYTES)
+    {
+        for (i = 0; i < CHUNK_SIZE; i++)
+            buf[i] = PatternByte(sent + i);
+
+        ret = send(Conn->Client, buf, CHUNK_SIZE, 0);
+        if (ret <= 0)
+            break;
+        /* A short send restarts the pattern at the first unsent byte */
+        sent += ret;
+    }
+
+    shutdown(Conn->Client, SD_SEND);
+    return 0;
+}
+
+static DWORD WINAPI RecvThread(LPVOID Context)
+{
+    PLOOPBACK_CONN Conn = Context;
+    char buf[CHUNK_SIZE];
+    int ret, i;
+
+    for (;;)
+    {
+        ret = recv(Conn->Server, buf, sizeof(buf), 0);
+        if (ret <= 0)
+            break;
+
+        for (i = 0; i < ret; i++)
+        {
+            if (buf[i] != PatternByte(Conn->Received + i))
+                Conn->Corrupt = TRUE;
+        }
+        Conn->Received += ret;
+    }
+
+    return 0;
+}
+
+static BOOL CreateConnection(SOCKET listener, struct sockaddr_in *addr, PLOOPBACK_CONN Conn)
+{
+    Conn->Client = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (Conn->Client == INVALID_SOCKET)
+        return FALSE;
+
+    if (connect(Conn->Client, (struct sockaddr *)addr, sizeof(*addr)) == SOCKET_ERROR)
+        return FALSE;
+
+    Conn->Server = accept(listener, NULL, NULL);
+    return Conn->Server != INVALID_SOCKET;
+}
+
+static void Benchmark(SOCKET listener, struct sockaddr_in *addr, int Count)
+{
+    LOOPBACK_CONN Conn[MAX_CONNECTIONS];
+    HANDLE Threads[2 * MAX_CONNECTIONS];
+    DWORD start, elapsed;
+    ULONGLONG total = 0;
+    int i, started = 0;
+
+    ZeroMemory(Conn, sizeof(Conn));
+    for (i = 0; i < Count; i++)
+    {
+        Conn[i].Client = INVALID_SOCKET;
+        Conn[i].Server = INVALID_SOCKET;
+    }
+
+    for (i = 0; i < Count; i++)
+    {
+        if (!CreateConnection(listener, addr, &Conn[i]))
+        {
+            ok(0, "Failed to create connection %d, error %d\n", i, WSAGetLastError());
+            goto cleanup;
+        }
+    }
+
+    start = GetTickCount();
+    for (i = 0; i < Count; i++)
+    {
+        Conn[i].RecvThread = CreateThread(NULL, 0, RecvThread, &Conn[i], 0, NULL);
+        Conn[i].SendThread = CreateThread(NULL, 0, SendThread, &Conn[i], 0, NULL);
+        ok(Conn[i].RecvThread != NULL && Conn[i].SendThread != NULL,
+           "CreateThread failed, error %lu\n", GetLastError());
+        if (Conn[i].RecvThread)
+            Threads[started++] = Conn[i].RecvThread;
+        if (Conn[i].SendThread)
+            Threads[started++] = Conn[i].SendThread;
+    }
+
+    WaitForMultipleObjects(started, Threads, TRUE, INFINITE);
+    elapsed = GetTickCount() - start;
+
+    for (i = 0; i < Count; i++)
+    {
+        ok(Conn[i].Received == CONN_BYTES, "Connection %d received %lu bytes\n", i, Conn[i].Received);
+        ok(!Conn[i].Corrupt, "Connection %d received corrupt data\n", i);
+        total += Conn[i].Received;
+    }
+    trace("%d connection(s): %lu KB/sec\n", Count,
+          (ULONG)(total * 1000 / 1024 / max(elapsed, 1)));
+
+cleanup:
+    for (i = 0; i < Count; i++)
+    {
+        if (Conn[i].RecvThread)
+            CloseHandle(Conn[i].RecvThread);
+        if (Conn[i].SendThread)
+            CloseHandle(Conn[i].SendThread);
+        if (Conn[i].Client != INVALID_SOCKET)
+            closesocket(Conn[i].Client);
+        if (Conn[i].Server != INVALID_SOCKET)
+            closesocket(Conn[i].Server);
+    }
+}
+
+START_TEST(loopback)
+{
+    WSADATA wdata;
+    SOCKET listener;
+    struct sockaddr_in addr;
+    int iResult, len = sizeof(addr), Count;
+
+    iResult = WSAStartup(MAKEWORD(2, 2), &wdata);
+    ok(iResult == 0, "WSAStartup failed, iResult == %d\n", iResult);
+
+    listener = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    ok(listener != INVALID_SOCKET, "socket failed, error %d\n", WSAGetLastError());
+    if (listener == INVALID_SOCKET)
+        goto cleanup;
+
+    ZeroMemory(&addr, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (bind(listener, (struct sockaddr *)&addr, sizeof(addr)) == SOCKET_ERROR ||
+        getsockname(listener, (struct sockaddr *)&addr, &len) == SOCKET_ERROR ||
+        listen(listener, MAX_CONNECTIONS) == SOCKET_ERROR)
+    {
+        ok(0, "Failed to set up the listening socket, error %d\n", WSAGetLastError());
+        goto cleanup;
+    }
+
+    /* Each connection is its own flow, so more of them should spread over the receive queues */
+    for (Count = 1; Count <= MAX_CONNECTIONS; Count *= 2)
+        Benchmark(listener, &addr, Count);
+
+cleanup:
+    if (listener != INVALID_SOCKET)
+        closesocket(listener);
+    WSACleanup();
+}
@@ -0,0 +1,235 @@
+/*
+ * PROJECT:         ReactOS api tests
+ * LICENSE:         GPL - See COPYING in the top level directory
+ * PURPOSE:         Test for the batched datagram extension functions
+ */
+
+#include "ws2_32.h"
+#include <mswsock.h>
+#include <reactos/winsock/mswinsock.h>
+
+#define MMSG_COUNT      16
+#define MMSG_SIZE       64
+#define BENCH_BATCH     32
+#define BENCH_TIME      1000
+
+static LPFN_WSARECVMMSG pRecvMMsg;
+static LPFN_WSASENDMMSG pSendMMsg;
+
+static BOOL GetExtensions(SOCKET sck)
+{
+    GUID RecvGuid = WSAID_WSARECVMMSG;
+    GUID SendGuid = WSAID_WSASENDMMSG;
+    DWORD dwBytes;
+
+    if (WSAIoctl(sck, SIO_GET_EXTENSION_FUNCTION_POINTER,
+                 &RecvGuid, sizeof(RecvGuid), &pRecvMMsg, sizeof(pRecvMMsg),
+                 &dwBytes, NULL, NULL) == SOCKET_ERROR)
+        return FALSE;
+
+    if (WSAIoctl(sck, SIO_GET_EXTENSION_FUNCTION_POINTER,
+                 &SendGuid, sizeof(SendGuid), &pSendMMsg, sizeof(pSendMMsg),
+                 &dwBytes, NULL, NULL) == SOCKET_ERROR)
+        return FALSE;
+
+    return TRUE;
+}
+
+static SOCKET CreateBoundUdpSocket(struct sockaddr_in *addr)
+{
+    SOCKET sck;
+    int len = sizeof(*addr);
+
+    sck = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (sck == INVALID_SOCKET)
+        return sck;
+
+    ZeroMemory(addr, sizeof(*addr));
+    addr->sin_family = AF_INET;
+    addr->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (bind(sck, (struct sockaddr *)addr, sizeof(*addr)) == SOCKET_ERROR ||
+        getsockname(sck, (struct sockaddr *)addr, &len) == SOCKET_ERROR)
+    {
+        closesocket(sck);
+        return INVALID_SOCKET;
+    }
+
+    return sck;
+}
+
+/* Receive until Count datagrams arrived; the receiving socket is blocking */
+static int RecvAll(SOCKET sck, WSAMMSG *msgs, struct sockaddr_in *from, char (*buf)[MMSG_SIZE], int Count)
+{
+    int i, received = 0, ret;
+
+    while (received < Count)
+    {
+        for (i = received; i < Count; i++)
+        {
+            msgs[i].buf.buf = buf[i];
+            msgs[i].buf.len = MMSG_SIZE;
+            msgs[i].name = (LPSOCKADDR)&from[i];
+            msgs[i].namelen = sizeof(from[i]);
+            msgs[i].dwBytes = 0;
+            msgs[i].dwFlags = 0;
+        }
+
+        ret = pRecvMMsg(sck, &msgs[received], Count - received, 0);
+        if (ret == SOCKET_ERROR)
+            return received ? received : SOCKET_ERROR;
+        received += ret;
+    }
+
+    return received;
+}
+
+static void Test_Batch(SOCKET rx, struct sockaddr_in *rxaddr, SOCKET tx, struct sockaddr_in *txaddr)
+{
+    WSAMMSG msgs[MMSG_COUNT];
+    struct sockaddr_in from[MMSG_COUNT];
+    char sendbuf[MMSG_COUNT][MMSG_SIZE];
+    char recvbuf[MMSG_COUNT][MMSG_SIZE];
+    int i, ret;
+
+    for (i = 0; i < MMSG_COUNT; i++)
+    {
+        memset(sendbuf[i], i, MMSG_SIZE);
+        msgs[i].buf.buf = sendbuf[i];
+        msgs[i].buf.len = MMSG_SIZE - i;
+        msgs[i].name = (LPSOCKADDR)rxaddr;
+        msgs[i].namelen = sizeof(*rxaddr);
+        msgs[i].dwBytes = 0;
+        msgs[i].dwFlags = 0;
+    }
+
+    ret = pSendMMsg(tx, msgs, MMSG_COUNT, 0);
+    ok(ret == MMSG_COUNT, "sendmmsg returned %d, error %d\n", ret, WSAGetLastError());
+    for (i = 0; i < MMSG_COUNT; i++)
+        ok(msgs[i].dwBytes == MMSG_SIZE - i, "msg %d: dwBytes = %lu\n", i, msgs[i].dwBytes);
+
+    ret = RecvAll(rx, msgs, from, recvbuf, MMSG_COUNT);
+    ok(ret == MMSG_COUNT, "recvmmsg returned %d, error %d\n", ret, WSAGetLastError());
+    for (i = 0; i < ret; i++)
+    {
+        ok(msgs[i].dwBytes == MMSG_SIZE - i, "msg %d: dwBytes = %lu\n", i, msgs[i].dwBytes);
+        ok(msgs[i].dwFlags == 0, "msg %d: dwFlags = %lx\n", i, msgs[i].dwFlags);
+        ok(recvbuf[i][0] == i, "msg %d: payload %d\n", i, recvbuf[i][0]);
+        ok(msgs[i].namelen == sizeof(struct sockaddr_in), "msg %d: namelen = %d\n", i, msgs[i].namelen);
+        ok(from[i].sin_port == txaddr->sin_port, "msg %d: port %u\n", i, ntohs(from[i].sin_port));
+    }
+
+    /* A datagram larger than its buffer is truncated and flagged */
+    ret = sendto(tx, sendbuf[0], MMSG_SIZE, 0, (struct sockaddr *)rxaddr, sizeof(*rxaddr));
+    ok(ret == MMSG_SIZE, "sendto returned %d\n", ret);
+    msgs[0].buf.buf = recvbuf[0];
+    msgs[0].buf.len = 4;
+    msgs[0].name = NULL;
+    msgs[0].namelen = 0;
+    msgs[0].dwBytes = 0;
+    msgs[0].dwFlags = 0;
+    ret = pRecvMMsg(rx, msgs, 1, 0);
+    ok(ret == 1, "recvmmsg returned %d, error %d\n", ret, WSAGetLastError());
+    ok(msgs[0].dwBytes == 4, "dwBytes = %lu\n", msgs[0].dwBytes);
+    ok(msgs[0].dwFlags == MSG_PARTIAL, "dwFlags = %lx\n", msgs[0].dwFlags);
+}
+
+static void Test_NonBlocking(SOCKET rx)
+{
+    WSAMMSG msg;
+    char buf[MMSG_SIZE];
+    u_long mode = 1;
+    int ret;
+
+    ok(ioctlsocket(rx, FIONBIO, &mode) == 0, "ioctlsocket failed\n");
+
+    ZeroMemory(&msg, sizeof(msg));
+    msg.buf.buf = buf;
+    msg.buf.len = sizeof(buf);
+    ret = pRecvMMsg(rx, &msg, 1, 0);
+    ok(ret == SOCKET_ERROR, "recvmmsg returned %d\n", ret);
+    ok(WSAGetLastError() == WSAEWOULDBLOCK, "error %d\n", WSAGetLastError());
+
+    mode = 0;
+    ok(ioctlsocket(rx, FIONBIO, &mode) == 0, "ioctlsocket failed\n");
+}
+
+static void Benchmark(SOCKET rx, struct sockaddr_in *rxaddr, SOCKET tx)
+{
+    WSAMMSG msgs[BENCH_BATCH];
+    struct sockaddr_in from[BENCH_BATCH];
+    char buf[BENCH_BATCH][MMSG_SIZE];
+    DWORD start, elapsed;
+    ULONG single = 0, batched = 0;
+    int i, ret;
+
+    start = GetTickCount();
+    do
+    {
+        for (i = 0; i < BENCH_BATCH; i++)
+            sendto(tx, buf[i], MMSG_SIZE, 0, (struct sockaddr *)rxaddr, sizeof(*rxaddr));
+        for (i = 0; i < BENCH_BATCH; i++)
+        {
+            if (recvfrom(rx, buf[i], MMSG_SIZE, 0, NULL, NULL) == SOCKET_ERROR)
+                break;
+            single++;
+        }
+        elapsed = GetTickCount() - start;
+    } while (elapsed < BENCH_TIME);
+    trace("sendto/recvfrom: %lu datagrams/sec\n", single * 1000 / max(elapsed, 1));
+
+    start = GetTickCount();
+    do
+    {
+        for (i = 0; i < BENCH_BATCH; i++)
+        {
+            msgs[i].buf.buf = buf[i];
+            msgs[i].buf.len = MMSG_SIZE;
+            msgs[i].name = (LPSOCKADDR)rxaddr;
+            msgs[i].namelen = sizeof(*rxaddr);
+        }
+        if (pSendMMsg(tx, msgs, BENCH_BATCH, 0) == SOCKET_ERROR)
+            break;
+        ret = RecvAll(rx, msgs, from, buf, BENCH_BATCH);
+        if (ret == SOCKET_ERROR)
+            break;
+        batched += ret;
+        elapsed = GetTickCount() - start;
+    } while (elapsed < BENCH_TIME);
+    trace("sendmmsg/recvmmsg: %lu datagrams/sec\n", batched * 1000 / max(elapsed, 1));
+
+    ok(batched > 0, "No datagrams moved by the batched functions\n");
+}
+
+START_TEST(mmsg)
+{
+    WSADATA wdata;
+    SOCKET rx, tx;
+    struct sockaddr_in rxaddr, txaddr;
+    int iResult;
+
+    iResult = WSAStartup(MAKEWORD(2, 2), &wdata);
+    ok(iResult == 0, "WSAStartup failed, iResult == %d\n", iResult);
+
+    rx = CreateBoundUdpSocket(&rxaddr);
+    tx = CreateBoundUdpSocket(&txaddr);
+    ok(rx != INVALID_SOCKET && tx != INVALID_SOCKET, "Failed to create sockets\n");
+    if (rx == INVALID_SOCKET || tx == INVALID_SOCKET)
+        goto cleanup;
+
+    if (!GetExtensions(rx))
+    {
+        skip("Batched datagram extension functions are not available\n");
+        goto cleanup;
+    }
+
+    Test_Batch(rx, &rxaddr, tx, &txaddr);
+    Test_NonBlocking(rx);
+    Benchmark(rx, &rxaddr, tx);
+
+cleanup:
+    if (rx != INVALID_SOCKET)
+        closesocket(rx);
+    if (tx != INVALID_SOCKET)
+        closesocket(tx);
+    WSACleanup();
+}
@@ -166,6 +166,18 @@ USHORT KmtGetPoolType(PVOID Memory);
 PVOID KmtGetSystemRoutineAddress(IN PCWSTR RoutineName);
 PKTHREAD KmtStartThread(IN PKSTART_ROUTINE StartRoutine, IN PVOID StartContext OPTIONAL);
 VOID KmtFinishThread(IN PKTHREAD Thread OPTIONAL, IN PKEVENT Event OPTIONAL);
+
+/* Must be the first member of the per-thread data passed to KmtRunWorkers */
+typedef struct _KMT_WORKER
+{
+    PKTHREAD Thread;
+    KAFFINITY Affinity;
+    volatile BOOLEAN *Measuring;
+    volatile BOOLEAN *Stop;
+    ULONGLONG Iterations;
+} KMT_WORKER, *PKMT_WORKER;
+
+ULONGLONG KmtRunWorkers(IN PKSTART_ROUTINE StartRoutine, IN OUT PVOID Workers, IN SIZE_T WorkerSize, IN ULONG WorkerCount, IN LONGLONG RunTime);
 #elif defined KMT_USER_MODE
 DWORD KmtRunKernelTest(IN PCSTR TestName);
 
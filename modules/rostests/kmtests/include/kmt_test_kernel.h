@@ -186,6 +186,64 @@ VOID KmtFinishThread(IN PKTHREAD Thread OPTIONAL, IN PKEVENT Event OPTIONAL)
     ObDereferenceObject(Thread);
 }
 
+NTKERNELAPI
+KAFFINITY
+NTAPI
+KeSetAffinityThread(
+    IN PKTHREAD Thread,
+    IN KAFFINITY Affinity);
+
+/*
+ * Runs WorkerCount threads for RunTime (relative, in 100ns units) and returns
+ * the sum of their Iterations. Workers is an array of per-thread structures of
+ * WorkerSize bytes each, starting with a KMT_WORKER. A nonzero Affinity is
+ * applied before the thread gets going. Measuring is set once the threads had
+ * time to move to their processors, Stop when the time is up; the routine must
+ * then store its Iterations and return.
+ */
+ULONGLONG KmtRunWorkers(IN PKSTART_ROUTINE StartRoutine, IN OUT PVOID Workers, IN SIZE_T WorkerSize, IN ULONG WorkerCount, IN LONGLONG RunTime)
+{
+    volatile BOOLEAN Measuring = FALSE;
+    volatile BOOLEAN Stop = FALSE;
+    LARGE_INTEGER Timeout;
+    PKMT_WORKER Worker;
+    ULONGLONG Total = 0;
+    ULONG i;
+
+    for (i = 0; i < WorkerCount; ++i)
+    {
+        Worker = (PKMT_WORKER)((PUCHAR)Workers + i * WorkerSize);
+        Worker->Measuring = &Measuring;
+        Worker->Stop = &Stop;
+        Worker->Iterations = 0;
+        Worker->Thread = KmtStartThread(StartRoutine, Worker);
+        if (Worker->Thread && Worker->Affinity)
+            KeSetAffinityThread(Worker->Thread, Worker->Affinity);
+    }
+
+    /* Give threads moved by an affinity change time to leave their CPU */
+    Timeout.QuadPart = -10 * MILLISECOND;
+    KeDelayExecutionThread(KernelMode, FALSE, &Timeout);
+    Measuring = TRUE;
+
+    Timeout.QuadPart = -RunTime;
+    KeDelayExecutionThread(KernelMode, FALSE, &Timeout);
+    Stop = TRUE;
+
+    for (i = 0; i < WorkerCount; ++i)
+    {
+        Worker = (PKMT_WORKER)((PUCHAR)Workers + i * WorkerSize);
+        if (Worker->Thread)
+        {
+            KmtFinishThread(Worker->Thread, NULL);
+            Worker->Thread = NULL;
+            Total += Worker->Iterations;
+        }
+    }
+
+    return Total;
+}
+
 INT __cdecl KmtVSNPrintF(PSTR Buffer, SIZE_T BufferMaxLength, PCSTR Format, va_list Arguments) KMT_FORMAT(ms_printf, 3, 0);
 
 #endif /* !defined _KMTEST_TEST_KERNEL_H_ */
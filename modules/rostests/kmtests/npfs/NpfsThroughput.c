@@ -0,0 +1,283 @@
+/*
+ * PROJECT:         ReactOS kernel-mode tests
+ * LICENSE:         LGPLv2+ - See COPYING.LIB in the top level directory
+ * PURPOSE:         Kernel-Mode Test Suite NPFS large write and throughput test
+ */
+
+#include <kmt_test.h>
+#include "npfs.h"
+
+#define MAX_INSTANCES   1
+#define IN_QUOTA        4096
+#define OUT_QUOTA       4096
+
+#define DIRECT_SIZE     (128 * 1024)
+#define BENCH_BYTES     (64 * 1024 * 1024)
+#define BENCH_MESSAGES  65536
+#define BUFFER_TAG      'TPmK'
+
+typedef struct _BENCH_CONTEXT
+{
+    HANDLE PipeHandle;
+    PULONG Buffer;
+    ULONG MessageSize;
+    ULONG Messages;
+    ULONG Errors;
+} BENCH_CONTEXT, *PBENCH_CONTEXT;
+
+#define CheckServerQuota(ServerHandle, InQ, OutQ)                       \
+    NpCheckServerPipe(ServerHandle,                                     \
+                      BYTE_STREAM, QUEUE, BYTE_STREAM, DUPLEX,          \
+                      MAX_INSTANCES, 1,                                 \
+                      IN_QUOTA, InQ,                                    \
+                      OUT_QUOTA, OUT_QUOTA - (OutQ),                    \
+                      FILE_PIPE_CONNECTED_STATE)
+
+#define CheckClientQuota(ClientHandle, InQ, OutQ)                       \
+    NpCheckClientPipe(ClientHandle,                                     \
+                      BYTE_STREAM, QUEUE, BYTE_STREAM, DUPLEX,          \
+                      MAX_INSTANCES, 1,                                 \
+                      IN_QUOTA, InQ,                                    \
+                      OUT_QUOTA, OUT_QUOTA - (OutQ),                    \
+                      FILE_PIPE_CONNECTED_STATE)
+
+static
+VOID
+WritePipe(
+    IN OUT PTHREAD_CONTEXT Context)
+{
+    Context->ReadWrite.Status = NpWritePipe(Context->ReadWrite.PipeHandle,
+                                            Context->ReadWrite.Buffer,
+                                            Context->ReadWrite.BufferSize,
+                                            (PULONG_PTR)&Context->ReadWrite.BytesTransferred);
+}
+
+static
+NTSTATUS
+ConnectPipes(
+    IN PCWSTR PipePath,
+    IN ULONG PipeType,
+    OUT PHANDLE ServerHandle,
+    OUT PHANDLE ClientHandle)
+{
+    NTSTATUS Status;
+    LARGE_INTEGER DefaultTimeout;
+
+    DefaultTimeout.QuadPart = -50 * 1000 * 10;
+    Status = NpCreatePipeEx(ServerHandle,
+                            PipePath,
+                            PipeType,
+                            QUEUE,
+                            PipeType,
+                            FILE_SHARE_READ | FILE_SHARE_WRITE,
+                            MAX_INSTANCES,
+                            IN_QUOTA,
+                            OUT_QUOTA,
+                            SYNCHRONIZE | GENERIC_READ | GENERIC_WRITE,
+                            FILE_OPEN_IF,
+                            FILE_SYNCHRONOUS_IO_NONALERT,
+                            &DefaultTimeout);
+    if (!NT_SUCCESS(Status))
+        return Status;
+
+    Status = NpOpenPipeEx(ClientHandle,
+                          PipePath,
+                          SYNCHRONIZE | GENERIC_READ | GENERIC_WRITE,
+                          FILE_SHARE_READ | FILE_SHARE_WRITE,
+                          FILE_OPEN,
+                          FILE_SYNCHRONOUS_IO_NONALERT);
+    if (!NT_SUCCESS(Status))
+        ObCloseHandle(*ServerHandle, KernelMode);
+    return Status;
+}
+
+/* A write larger than the quota waits for the reader, who takes the data from the writer's buffer */
+static
+VOID
+TestDirectWrite(
+    IN PCWSTR PipePath)
+{
+    NTSTATUS Status;
+    HANDLE ServerHandle, ClientHandle;
+    THREAD_CONTEXT WriteContext;
+    PUCHAR WriteBuffer, ReadBuffer;
+    ULONG_PTR BytesRead;
+    ULONG Offset, Errors = 0, i;
+    BOOLEAN Okay;
+
+    WriteBuffer = ExAllocatePoolWithTag(PagedPool, DIRECT_SIZE, BUFFER_TAG);
+    ReadBuffer = ExAllocatePoolWithTag(PagedPool, OUT_QUOTA, BUFFER_TAG);
+    if (skip(WriteBuffer && ReadBuffer, "No buffer\n"))
+        goto Cleanup;
+
+    for (i = 0; i < DIRECT_SIZE; i++)
+        WriteBuffer[i] = (UCHAR)(i * 7 + i / 256);
+
+    Status = ConnectPipes(PipePath, BYTE_STREAM, &ServerHandle, &ClientHandle);
+    ok_eq_hex(Status, STATUS_SUCCESS);
+    if (skip(NT_SUCCESS(Status), "No pipe\n"))
+        goto Cleanup;
+
+    StartWorkerThread(&WriteContext);
+    WriteContext.Work = WritePipe;
+    WriteContext.ReadWrite.PipeHandle = ServerHandle;
+    WriteContext.ReadWrite.Buffer = WriteBuffer;
+    WriteContext.ReadWrite.BufferSize = DIRECT_SIZE;
+    Okay = TriggerWork(&WriteContext, 100);
+    ok_bool_false(Okay, "TriggerWork returned");
+
+    /* All of the data is readable, but only the quota is charged */
+    CheckServerQuota(ServerHandle, 0, OUT_QUOTA);
+    CheckClientQuota(ClientHandle, DIRECT_SIZE, 0);
+
+    for (Offset = 0; Offset < DIRECT_SIZE; Offset += (ULONG)BytesRead)
+    {
+        RtlFillMemory(ReadBuffer, OUT_QUOTA, 0x55);
+        Status = NpReadPipe(ClientHandle, ReadBuffer, OUT_QUOTA, &BytesRead);
+        if (Status != STATUS_SUCCESS || BytesRead == 0 || BytesRead > DIRECT_SIZE - Offset)
+        {
+            ok(0, "Read at %lu returned 0x%lx, %Iu bytes\n", Offset, Status, BytesRead);
+            break;
+        }
+        if (RtlCompareMemory(ReadBuffer, WriteBuffer + Offset, BytesRead) != BytesRead)
+            Errors++;
+
+        /* The writer owns the data until the last byte is read */
+        if (Offset == 0)
+        {
+            Okay = WaitForWork(&WriteContext, 10);
+            ok_bool_false(Okay, "WaitForWork returned");
+            CheckServerQuota(ServerHandle, 0, OUT_QUOTA);
+            CheckClientQuota(ClientHandle, DIRECT_SIZE - (ULONG)BytesRead, 0);
+        }
+    }
+    ok_eq_ulong(Offset, DIRECT_SIZE);
+    ok_eq_ulong(Errors, 0);
+
+    Okay = WaitForWork(&WriteContext, 100);
+    ok_bool_true(Okay, "WaitForWork returned");
+    ok_eq_hex(WriteContext.ReadWrite.Status, STATUS_SUCCESS);
+    ok_eq_ulongptr(WriteContext.ReadWrite.BytesTransferred, DIRECT_SIZE);
+    CheckServerQuota(ServerHandle, 0, 0);
+    CheckClientQuota(ClientHandle, 0, 0);
+
+    FinishWorkerThread(&WriteContext);
+    ObCloseHandle(ClientHandle, KernelMode);
+    ObCloseHandle(ServerHandle, KernelMode);
+
+Cleanup:
+    if (ReadBuffer) ExFreePoolWithTag(ReadBuffer, BUFFER_TAG);
+    if (WriteBuffer) ExFreePoolWithTag(WriteBuffer, BUFFER_TAG);
+}
+
+static KSTART_ROUTINE ReadMessages;
+static
+VOID
+NTAPI
+ReadMessages(
+    IN PVOID Context)
+{
+    PBENCH_CONTEXT BenchContext = Context;
+    ULONG LastIndex = BenchContext->MessageSize / sizeof(ULONG) - 1;
+    IO_STATUS_BLOCK IoStatusBlock;
+    NTSTATUS Status;
+    ULONG i;
+
+    for (i = 0; i < BenchContext->Messages; i++)
+    {
+        Status = ZwReadFile(BenchContext->PipeHandle, NULL, NULL, NULL, &IoStatusBlock,
+                            BenchContext->Buffer, BenchContext->MessageSize, NULL, NULL);
+        if (!NT_SUCCESS(Status))
+        {
+            BenchContext->Errors += BenchContext->Messages - i;
+            break;
+        }
+
+        /* Every message is stamped with its number at both ends */
+        if (IoStatusBlock.Information != BenchContext->MessageSize ||
+            BenchContext->Buffer[0] != i ||
+            BenchContext->Buffer[LastIndex] != i)
+        {
+            BenchContext->Errors++;
+        }
+    }
+}
+
+static
+VOID
+Benchmark(
+    IN PCWSTR PipePath,
+    IN ULONG MessageSize)
+{
+    NTSTATUS Status;
+    HANDLE ServerHandle, ClientHandle;
+    BENCH_CONTEXT Context;
+    IO_STATUS_BLOCK IoStatusBlock;
+    LARGE_INTEGER Start, End, Frequency;
+    PULONG WriteBuffer;
+    PKTHREAD Thread;
+    ULONG LastIndex = MessageSize / sizeof(ULONG) - 1;
+    ULONG Elapsed, i;
+
+    RtlZeroMemory(&Context, sizeof(Context));
+    Context.MessageSize = MessageSize;
+    Context.Messages = min(BENCH_BYTES / MessageSize, BENCH_MESSAGES);
+
+    WriteBuffer = ExAllocatePoolWithTag(PagedPool, MessageSize, BUFFER_TAG);
+    Context.Buffer = ExAllocatePoolWithTag(PagedPool, MessageSize, BUFFER_TAG);
+    if (skip(WriteBuffer && Context.Buffer, "No buffer for %lu byte messages\n", MessageSize))
+        goto Cleanup;
+    RtlFillMemory(WriteBuffer, MessageSize, 0x55);
+
+    Status = ConnectPipes(PipePath, MESSAGE, &ServerHandle, &ClientHandle);
+    ok_eq_hex(Status, STATUS_SUCCESS);
+    if (skip(NT_SUCCESS(Status), "No pipe\n"))
+        goto Cleanup;
+
+    Context.PipeHandle = ClientHandle;
+    Start = KeQueryPerformanceCounter(&Frequency);
+    Thread = KmtStartThread(ReadMessages, &Context);
+    for (i = 0; i < Context.Messages; i++)
+    {
+        WriteBuffer[0] = WriteBuffer[LastIndex] = i;
+        Status = ZwWriteFile(ServerHandle, NULL, NULL, NULL, &IoStatusBlock,
+                             WriteBuffer, MessageSize, NULL, NULL);
+        if (!NT_SUCCESS(Status) || IoStatusBlock.Information != MessageSize)
+        {
+            ok(0, "Write %lu returned 0x%lx, %Iu bytes\n", i, Status, IoStatusBlock.Information);
+            break;
+        }
+    }
+
+    /* Unblocks the reader if a write failed */
+    if (i != Context.Messages)
+        ObCloseHandle(ServerHandle, KernelMode);
+    KmtFinishThread(Thread, NULL);
+    End = KeQueryPerformanceCounter(NULL);
+
+    ok(Context.Errors == 0, "%lu of %lu messages of %lu bytes were wrong\n",
+       Context.Errors, Context.Messages, MessageSize);
+    Elapsed = (ULONG)((End.QuadPart - Start.QuadPart) * 1000000 / Frequency.QuadPart);
+    trace("%7lu byte messages: %lu in %lu ms, %lu MB/s\n", MessageSize, Context.Messages, Elapsed / 1000,
+          (ULONG)((ULONGLONG)Context.Messages * MessageSize / max(Elapsed, 1)));
+
+    if (i == Context.Messages)
+        ObCloseHandle(ServerHandle, KernelMode);
+    ObCloseHandle(ClientHandle, KernelMode);
+
+Cleanup:
+    if (Context.Buffer) ExFreePoolWithTag(Context.Buffer, BUFFER_TAG);
+    if (WriteBuffer) ExFreePoolWithTag(WriteBuffer, BUFFER_TAG);
+}
+
+START_TEST(NpfsThroughput)
+{
+    static const ULONG MessageSizes[] = { 64, 512, 4096, 16 * 1024, 64 * 1024, 256 * 1024, 1024 * 1024 };
+    PCWSTR PipePath = DEVICE_NAMED_PIPE L"\\KmtestNpfsThroughputTestPipe";
+    ULONG i;
+
+    TestDirectWrite(PipePath);
+
+    for (i = 0; i < RTL_NUMBER_OF(MessageSizes); i++)
+        Benchmark(PipePath, MessageSizes[i]);
+}
@@ -0,0 +1,322 @@
+/*
+ * PROJECT:         ReactOS kernel-mode tests
+ * LICENSE:         LGPLv2.1+ - See COPYING.LIB in the top level directory
+ * PURPOSE:         Test driver for the read ahead done by CcCopyRead
+ */
+
+#include <kmt_test.h>
+
+#define NDEBUG
+#include <debug.h>
+
+#define TEST_FILE_SIZE  (16 * 1024 * 1024)
+#define TEST_READ_SIZE  (1024 * 1024)
+#define TEST_PAGES      (TEST_FILE_SIZE / PAGE_SIZE)
+
+typedef struct _TEST_FCB
+{
+    FSRTL_ADVANCED_FCB_HEADER Header;
+    SECTION_OBJECT_POINTERS SectionObjectPointers;
+    FAST_MUTEX HeaderMutex;
+} TEST_FCB, *PTEST_FCB;
+
+static PFILE_OBJECT TestFileObject;
+static PDEVICE_OBJECT TestDeviceObject;
+static KMT_IRP_HANDLER TestIrpHandler;
+static FAST_IO_DISPATCH TestFastIoDispatch;
+
+/* Pages brought in by paging reads, be it for the reader or for read ahead */
+static KSPIN_LOCK PagesReadLock;
+static RTL_BITMAP PagesRead;
+static ULONG PagesReadBuffer[TEST_PAGES / 32];
+
+/* Read ahead is held back until the reader pushed its window several times */
+static KEVENT ReadAheadGate;
+static KEVENT ReadAheadDone;
+
+static
+BOOLEAN
+NTAPI
+FastIoRead(
+    _In_ PFILE_OBJECT FileObject,
+    _In_ PLARGE_INTEGER FileOffset,
+    _In_ ULONG Length,
+    _In_ BOOLEAN Wait,
+    _In_ ULONG LockKey,
+    _Out_ PVOID Buffer,
+    _Out_ PIO_STATUS_BLOCK IoStatus,
+    _In_ PDEVICE_OBJECT DeviceObject)
+{
+    IoStatus->Status = STATUS_NOT_SUPPORTED;
+    return FALSE;
+}
+
+NTSTATUS
+TestEntry(
+    _In_ PDRIVER_OBJECT DriverObject,
+    _In_ PCUNICODE_STRING RegistryPath,
+    _Out_ PCWSTR *DeviceName,
+    _Inout_ INT *Flags)
+{
+    NTSTATUS Status = STATUS_SUCCESS;
+
+    PAGED_CODE();
+
+    UNREFERENCED_PARAMETER(RegistryPath);
+
+    *DeviceName = L"CcReadAhead";
+    *Flags = TESTENTRY_NO_EXCLUSIVE_DEVICE |
+             TESTENTRY_BUFFERED_IO_DEVICE |
+             TESTENTRY_NO_READONLY_DEVICE;
+
+    KmtRegisterIrpHandler(IRP_MJ_CLEANUP, NULL, TestIrpHandler);
+    KmtRegisterIrpHandler(IRP_MJ_CREATE, NULL, TestIrpHandler);
+    KmtRegisterIrpHandler(IRP_MJ_READ, NULL, TestIrpHandler);
+
+    TestFastIoDispatch.FastIoRead = FastIoRead;
+    DriverObject->FastIoDispatch = &TestFastIoDispatch;
+
+    KeInitializeSpinLock(&PagesReadLock);
+    RtlInitializeBitMap(&PagesRead, PagesReadBuffer, TEST_PAGES);
+    KeInitializeEvent(&ReadAheadGate, NotificationEvent, FALSE);
+    KeInitializeEvent(&ReadAheadDone, NotificationEvent, FALSE);
+
+    return Status;
+}
+
+VOID
+TestUnload(
+    _In_ PDRIVER_OBJECT DriverObject)
+{
+    PAGED_CODE();
+}
+
+BOOLEAN
+NTAPI
+AcquireForLazyWrite(
+    _In_ PVOID Context,
+    _In_ BOOLEAN Wait)
+{
+    return TRUE;
+}
+
+VOID
+NTAPI
+ReleaseFromLazyWrite(
+    _In_ PVOID Context)
+{
+    return;
+}
+
+BOOLEAN
+NTAPI
+AcquireForReadAhead(
+    _In_ PVOID Context,
+    _In_ BOOLEAN Wait)
+{
+    LARGE_INTEGER Timeout;
+    NTSTATUS Status;
+
+    /* Keep the read ahead worker busy while the reader moves on */
+    Timeout.QuadPart = -10 * 1000 * 1000 * 10LL;
+    Status = KeWaitForSingleObject(&ReadAheadGate, Executive, KernelMode, FALSE, &Timeout);
+    ok_eq_hex(Status, STATUS_SUCCESS);
+
+    return TRUE;
+}
+
+VOID
+NTAPI
+ReleaseFromReadAhead(
+    _In_ PVOID Context)
+{
+    KeSetEvent(&ReadAheadDone, IO_NO_INCREMENT, FALSE);
+}
+
+static CACHE_MANAGER_CALLBACKS Callbacks = {
+    AcquireForLazyWrite,
+    ReleaseFromLazyWrite,
+    AcquireForReadAhead,
+    ReleaseFromReadAhead,
+};
+
+static
+VOID
+CheckPagesRead(VOID)
+{
+    KIRQL OldIrql;
+    ULONG FirstMissing;
+
+    KeAcquireSpinLock(&PagesReadLock, &OldIrql);
+    FirstMissing = RtlFindClearBits(&PagesRead, 1, 0);
+    KeReleaseSpinLock(&PagesReadLock, OldIrql);
+
+    /* Read ahead went past what the reader asked for... */
+    ok(FirstMissing == MAXULONG || FirstMissing > (5 * TEST_READ_SIZE) / PAGE_SIZE,
+       "Read ahead stopped at %lx\n", FirstMissing * PAGE_SIZE);
+
+    /* ...and didn't leave a hole on the way */
+    if (FirstMissing != MAXULONG)
+    {
+        ok(RtlAreBitsClear(&PagesRead, FirstMissing, TEST_PAGES - FirstMissing),
+           "Page %lx was skipped, but later ones were read\n", FirstMissing);
+    }
+}
+
+static
+NTSTATUS
+TestIrpHandler(
+    _In_ PDEVICE_OBJECT DeviceObject,
+    _In_ PIRP Irp,
+    _In_ PIO_STACK_LOCATION IoStack)
+{
+    LARGE_INTEGER Zero = RTL_CONSTANT_LARGE_INTEGER(0LL);
+    LARGE_INTEGER Timeout;
+    NTSTATUS Status;
+    PTEST_FCB Fcb;
+    CACHE_UNINITIALIZE_EVENT CacheUninitEvent;
+
+    PAGED_CODE();
+
+    DPRINT("IRP %x/%x\n", IoStack->MajorFunction, IoStack->MinorFunction);
+    ASSERT(IoStack->MajorFunction == IRP_MJ_CLEANUP ||
+           IoStack->MajorFunction == IRP_MJ_CREATE ||
+           IoStack->MajorFunction == IRP_MJ_READ);
+
+    Status = STATUS_NOT_SUPPORTED;
+    Irp->IoStatus.Information = 0;
+
+    if (IoStack->MajorFunction == IRP_MJ_CREATE)
+    {
+        ok_irql(PASSIVE_LEVEL);
+
+        if (IoStack->FileObject->FileName.Length >= 2 * sizeof(WCHAR))
+        {
+            TestDeviceObject = DeviceObject;
+            TestFileObject = IoStack->FileObject;
+        }
+        Fcb = ExAllocatePoolWithTag(NonPagedPool, sizeof(*Fcb), 'FwrI');
+        RtlZeroMemory(Fcb, sizeof(*Fcb));
+        ExInitializeFastMutex(&Fcb->HeaderMutex);
+        FsRtlSetupAdvancedHeader(&Fcb->Header, &Fcb->HeaderMutex);
+        Fcb->Header.AllocationSize.QuadPart = TEST_FILE_SIZE;
+        Fcb->Header.FileSize.QuadPart = TEST_FILE_SIZE;
+        Fcb->Header.ValidDataLength.QuadPart = TEST_FILE_SIZE;
+        Fcb->Header.IsFastIoPossible = FastIoIsNotPossible;
+        IoStack->FileObject->FsContext = Fcb;
+        IoStack->FileObject->SectionObjectPointer = &Fcb->SectionObjectPointers;
+
+        RtlClearAllBits(&PagesRead);
+        KeClearEvent(&ReadAheadGate);
+        KeClearEvent(&ReadAheadDone);
+
+        CcInitializeCacheMap(IoStack->FileObject,
+                             (PCC_FILE_SIZES)&Fcb->Header.AllocationSize,
+                             FALSE, &Callbacks, NULL);
+
+        Irp->IoStatus.Information = FILE_OPENED;
+        Status = STATUS_SUCCESS;
+    }
+    else if (IoStack->MajorFunction == IRP_MJ_READ)
+    {
+        BOOLEAN Ret;
+        ULONG Length;
+        PVOID Buffer;
+        LARGE_INTEGER Offset;
+        KIRQL OldIrql;
+
+        Offset = IoStack->Parameters.Read.ByteOffset;
+        Length = IoStack->Parameters.Read.Length;
+
+        ok_eq_pointer(DeviceObject, TestDeviceObject);
+
+        if (!FlagOn(Irp->Flags, IRP_NOCACHE))
+        {
+            ok_irql(PASSIVE_LEVEL);
+            ok_eq_pointer(IoStack->FileObject, TestFileObject);
+
+            Buffer = Irp->AssociatedIrp.SystemBuffer;
+            ok(Buffer != NULL, "Null pointer!\n");
+
+            _SEH2_TRY
+            {
+                Ret = CcCopyRead(IoStack->FileObject, &Offset, Length, TRUE, Buffer,
+                                 &Irp->IoStatus);
+                ok_bool_true(Ret, "CcCopyRead");
+            }
+            _SEH2_EXCEPT(EXCEPTION_EXECUTE_HANDLER)
+            {
+                Irp->IoStatus.Status = _SEH2_GetExceptionCode();
+            }
+            _SEH2_END;
+
+            Status = Irp->IoStatus.Status;
+
+            /* The window was pushed enough times, let read ahead catch up */
+            if (Offset.QuadPart + Length >= 5 * TEST_READ_SIZE)
+            {
+                KeSetEvent(&ReadAheadGate, IO_NO_INCREMENT, FALSE);
+            }
+        }
+        else
+        {
+            ok(Offset.QuadPart % PAGE_SIZE == 0, "Offset is not aligned: %I64i\n", Offset.QuadPart);
+            ok(Length % PAGE_SIZE == 0, "Length is not aligned: %I64i\n", Length);
+            ok((Irp->Flags & IRP_PAGING_IO) != 0, "Non paging IO\n");
+
+            if (Offset.QuadPart < TEST_FILE_SIZE)
+            {
+                Length = min(Length, (ULONG)(TEST_FILE_SIZE - Offset.QuadPart));
+                KeAcquireSpinLock(&PagesReadLock, &OldIrql);
+                RtlSetBits(&PagesRead, (ULONG)(Offset.QuadPart / PAGE_SIZE),
+                           BYTES_TO_PAGES(Length));
+                KeReleaseSpinLock(&PagesReadLock, OldIrql);
+            }
+
+            Status = STATUS_SUCCESS;
+        }
+
+        if (NT_SUCCESS(Status))
+        {
+            Irp->IoStatus.Information = Length;
+            IoStack->FileObject->CurrentByteOffset.QuadPart = Offset.QuadPart + Length;
+        }
+    }
+    else if (IoStack->MajorFunction == IRP_MJ_CLEANUP)
+    {
+        ok_irql(PASSIVE_LEVEL);
+
+        if (IoStack->FileObject == TestFileObject)
+        {
+            /* Let read ahead finish before looking at what it did */
+            KeSetEvent(&ReadAheadGate, IO_NO_INCREMENT, FALSE);
+            Timeout.QuadPart = -10 * 1000 * 1000 * 10LL;
+            Status = KeWaitForSingleObject(&ReadAheadDone, Executive, KernelMode, FALSE, &Timeout);
+            ok_eq_hex(Status, STATUS_SUCCESS);
+
+            CheckPagesRead();
+        }
+
+        KeInitializeEvent(&CacheUninitEvent.Event, NotificationEvent, FALSE);
+        CcUninitializeCacheMap(IoStack->FileObject, &Zero, &CacheUninitEvent);
+        KeWaitForSingleObject(&CacheUninitEvent.Event, Executive, KernelMode, FALSE, NULL);
+        Fcb = IoStack->FileObject->FsContext;
+        ExFreePoolWithTag(Fcb, 'FwrI');
+        IoStack->FileObject->FsContext = NULL;
+        Status = STATUS_SUCCESS;
+    }
+
+    if (Status == STATUS_PENDING)
+    {
+        IoMarkIrpPending(Irp);
+        IoCompleteRequest(Irp, IO_NO_INCREMENT);
+        Status = STATUS_PENDING;
+    }
+    else
+    {
+        Irp->IoStatus.Status = Status;
+        IoCompleteRequest(Irp, IO_NO_INCREMENT);
+    }
+
+    return Status;
+}
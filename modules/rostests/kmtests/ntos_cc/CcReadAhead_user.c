@@ -0,0 +1,51 @@
+/*
+ * PROJECT:         ReactOS kernel-mode tests
+ * LICENSE:         GPLv2+ - See COPYING in the top level directory
+ * PURPOSE:         Kernel-Mode Test Suite CcReadAhead test user-mode part
+ */
+
+#include <kmt_test.h>
+
+#define TEST_READ_SIZE  (1024 * 1024)
+
+START_TEST(CcReadAhead)
+{
+    HANDLE Handle;
+    NTSTATUS Status;
+    LARGE_INTEGER ByteOffset;
+    IO_STATUS_BLOCK IoStatusBlock;
+    OBJECT_ATTRIBUTES ObjectAttributes;
+    PVOID Buffer;
+    UNICODE_STRING SequentialFile = RTL_CONSTANT_STRING(L"\\Device\\Kmtest-CcReadAhead\\SequentialFile");
+    ULONG i;
+
+    Buffer = RtlAllocateHeap(RtlGetProcessHeap(), 0, TEST_READ_SIZE);
+    if (!skip(Buffer != NULL, "Out of memory\n"))
+    {
+        KmtLoadDriver(L"CcReadAhead", FALSE);
+        KmtOpenDriver();
+
+        InitializeObjectAttributes(&ObjectAttributes, &SequentialFile, OBJ_CASE_INSENSITIVE, NULL, NULL);
+        Status = NtOpenFile(&Handle, FILE_ALL_ACCESS, &ObjectAttributes, &IoStatusBlock, 0, FILE_NON_DIRECTORY_FILE | FILE_SYNCHRONOUS_IO_NONALERT);
+        ok_eq_hex(Status, STATUS_SUCCESS);
+
+        /* Read ahead is blocked in the driver until the last read, so every
+         * read but the first pushes the window while a read ahead is pending
+         */
+        for (i = 0; i < 5; i++)
+        {
+            ByteOffset.QuadPart = i * TEST_READ_SIZE;
+            Status = NtReadFile(Handle, NULL, NULL, NULL, &IoStatusBlock, Buffer, TEST_READ_SIZE, &ByteOffset, NULL);
+            ok_eq_hex(Status, STATUS_SUCCESS);
+            ok_eq_ulongptr(IoStatusBlock.Information, TEST_READ_SIZE);
+        }
+
+        /* The driver checks what was read ahead when the file is cleaned up */
+        NtClose(Handle);
+
+        KmtCloseDriver();
+        KmtUnloadDriver();
+
+        RtlFreeHeap(RtlGetProcessHeap(), 0, Buffer);
+    }
+}
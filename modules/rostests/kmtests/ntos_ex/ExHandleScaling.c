@@ -0,0 +1,304 @@
+/*
+ * PROJECT:         ReactOS kernel-mode tests
+ * LICENSE:         LGPLv2+ - See COPYING.LIB in the top level directory
+ * PURPOSE:         Kernel-Mode Test Suite handle table scaling test
+ */
+
+#include <kmt_test.h>
+
+#define NDEBUG
+#include <debug.h>
+
+#define MAX_THREADS     16
+#define RUN_TIME        (500 * MILLISECOND)
+#define LIVE_HANDLES    4
+#define REUSE_HANDLES   32
+
+typedef struct _HANDLE_THREAD_DATA
+{
+    KMT_WORKER Worker;
+    PKEVENT Event;
+    ULONG Failures;
+} HANDLE_THREAD_DATA, *PHANDLE_THREAD_DATA;
+
+static
+NTSTATUS
+OpenEvent(
+    IN PKEVENT Event,
+    OUT PHANDLE Handle)
+{
+    return ObOpenObjectByPointer(Event,
+                                 OBJ_KERNEL_HANDLE,
+                                 NULL,
+                                 EVENT_ALL_ACCESS,
+                                 *ExEventObjectType,
+                                 KernelMode,
+                                 Handle);
+}
+
+static
+BOOLEAN
+HandleRefersTo(
+    IN HANDLE Handle,
+    IN PKEVENT Event)
+{
+    NTSTATUS Status;
+    PVOID Object;
+
+    Status = ObReferenceObjectByHandle(Handle, SYNCHRONIZE, *ExEventObjectType, KernelMode, &Object, NULL);
+    if (!NT_SUCCESS(Status))
+        return FALSE;
+    ObDereferenceObject(Object);
+    return (Object == Event);
+}
+
+static
+VOID
+NTAPI
+HandleThread(
+    IN PVOID Context)
+{
+    PHANDLE_THREAD_DATA ThreadData = Context;
+    HANDLE Handles[LIVE_HANDLES] = { NULL };
+    ULONGLONG Iterations = 0;
+    NTSTATUS Status;
+    ULONG Slot;
+
+    while (!*ThreadData->Worker.Stop)
+    {
+        /*
+         * Open, look up and close handles, without creating new objects.
+         * Every thread has an event of its own, so a handle that is handed
+         * out twice resolves to the wrong one.
+         */
+        Slot = Iterations % LIVE_HANDLES;
+        if (Handles[Slot])
+        {
+            if (!HandleRefersTo(Handles[Slot], ThreadData->Event))
+                ThreadData->Failures++;
+            ObCloseHandle(Handles[Slot], KernelMode);
+            Handles[Slot] = NULL;
+        }
+
+        Status = OpenEvent(ThreadData->Event, &Handles[Slot]);
+        if (!NT_SUCCESS(Status))
+        {
+            Handles[Slot] = NULL;
+            ThreadData->Failures++;
+            break;
+        }
+        Iterations++;
+    }
+
+    for (Slot = 0; Slot < LIVE_HANDLES; Slot++)
+    {
+        if (!Handles[Slot])
+            continue;
+        if (!HandleRefersTo(Handles[Slot], ThreadData->Event))
+            ThreadData->Failures++;
+        ObCloseHandle(Handles[Slot], KernelMode);
+    }
+
+    ThreadData->Worker.Iterations = Iterations;
+    PsTerminateSystemThread(STATUS_SUCCESS);
+}
+
+static
+ULONG
+GetHandleCount(
+    IN PKEVENT Event)
+{
+    OBJECT_BASIC_INFORMATION Information;
+    NTSTATUS Status;
+    HANDLE Handle;
+
+    Status = OpenEvent(Event, &Handle);
+    ok_eq_hex(Status, STATUS_SUCCESS);
+    if (!NT_SUCCESS(Status))
+        return 0;
+
+    RtlZeroMemory(&Information, sizeof(Information));
+    Status = ZwQueryObject(Handle, ObjectBasicInformation, &Information, sizeof(Information), NULL);
+    ok_eq_hex(Status, STATUS_SUCCESS);
+    ObCloseHandle(Handle, KernelMode);
+
+    /* Don't count the handle we opened for the query */
+    return Information.HandleCount - 1;
+}
+
+static
+PKEVENT
+CreateEventObject(VOID)
+{
+    OBJECT_ATTRIBUTES ObjectAttributes;
+    NTSTATUS Status;
+    HANDLE EventHandle;
+    PKEVENT Event = NULL;
+
+    InitializeObjectAttributes(&ObjectAttributes, NULL, OBJ_KERNEL_HANDLE, NULL, NULL);
+    Status = ZwCreateEvent(&EventHandle, EVENT_ALL_ACCESS, &ObjectAttributes, NotificationEvent, FALSE);
+    ok_eq_hex(Status, STATUS_SUCCESS);
+    if (!NT_SUCCESS(Status))
+        return NULL;
+    Status = ObReferenceObjectByHandle(EventHandle, EVENT_ALL_ACCESS, *ExEventObjectType, KernelMode, (PVOID *)&Event, NULL);
+    ok_eq_hex(Status, STATUS_SUCCESS);
+    ZwClose(EventHandle);
+    return NT_SUCCESS(Status) ? Event : NULL;
+}
+
+static
+ULONG
+OpenHandles(
+    IN PKEVENT Event,
+    OUT PHANDLE Handles,
+    IN ULONG Processor)
+{
+    NTSTATUS Status;
+    ULONG Count, i, j;
+
+    for (Count = 0; Count < REUSE_HANDLES; Count++)
+    {
+        Status = OpenEvent(Event, &Handles[Count]);
+        ok(NT_SUCCESS(Status), "CPU %lu: open %lu failed with %lx\n", Processor, Count, Status);
+        if (!NT_SUCCESS(Status))
+            break;
+        ok(HandleRefersTo(Handles[Count], Event), "CPU %lu: handle %p doesn't refer to its event\n", Processor, Handles[Count]);
+    }
+
+    /* Live handles are never the same */
+    for (i = 0; i < Count; i++)
+    {
+        for (j = i + 1; j < Count; j++)
+            ok(Handles[i] != Handles[j], "CPU %lu: got handle %p twice\n", Processor, Handles[i]);
+    }
+
+    return Count;
+}
+
+static
+VOID
+TestReuse(
+    IN PKEVENT Event,
+    IN PKEVENT Event2)
+{
+    HANDLE Handles[REUSE_HANDLES], Handles2[REUSE_HANDLES];
+    ULONG Processor, Count, Count2, Reused, i, j;
+
+    /* Each processor frees handles to a cache of its own */
+    for (Processor = 0; Processor < (ULONG)KeNumberProcessors; Processor++)
+    {
+        KeSetSystemAffinityThread((KAFFINITY)1 << Processor);
+
+        Count = OpenHandles(Event, Handles, Processor);
+        for (i = 0; i < Count; i++)
+            ObCloseHandle(Handles[i], KernelMode);
+
+        /* A closed handle must not resolve to anything */
+        for (i = 0; i < Count; i++)
+            ok(!HandleRefersTo(Handles[i], Event), "CPU %lu: closed handle %p still works\n", Processor, Handles[i]);
+
+        /* The freed handles are handed out again, and then refer to the new object */
+        Count2 = OpenHandles(Event2, Handles2, Processor);
+        Reused = 0;
+        for (i = 0; i < Count2; i++)
+        {
+            for (j = 0; j < Count; j++)
+            {
+                if (Handles2[i] == Handles[j])
+                {
+                    Reused++;
+                    break;
+                }
+            }
+        }
+        ok(Reused != 0, "CPU %lu: none of %lu closed handles reused\n", Processor, Count);
+        for (i = 0; i < Count2; i++)
+            ObCloseHandle(Handles2[i], KernelMode);
+    }
+    KeRevertToUserAffinityThread();
+
+    ok_eq_ulong(GetHandleCount(Event), 0);
+    ok_eq_ulong(GetHandleCount(Event2), 0);
+}
+
+static
+ULONGLONG
+RunHandleThreads(
+    IN INT ThreadCount,
+    IN PKEVENT *Events)
+{
+    HANDLE_THREAD_DATA Threads[MAX_THREADS];
+    ULONGLONG Total;
+    INT i;
+
+    RtlZeroMemory(Threads, sizeof(Threads));
+    for (i = 0; i < ThreadCount; ++i)
+    {
+        Threads[i].Event = Events[i];
+        /* Spread the threads over the processors */
+        Threads[i].Worker.Affinity = (KAFFINITY)1 << (i % KeNumberProcessors);
+    }
+
+    Total = KmtRunWorkers(HandleThread, Threads, sizeof(Threads[0]), ThreadCount, RUN_TIME);
+
+    for (i = 0; i < ThreadCount; ++i)
+    {
+        ok(Threads[i].Failures == 0, "Thread %d on CPU %d: %lu failed handle operations\n",
+           i, i % KeNumberProcessors, Threads[i].Failures);
+        ok(Threads[i].Worker.Iterations != 0, "Thread %d on CPU %d opened no handles\n",
+           i, i % KeNumberProcessors);
+
+        /* Every handle opened by the thread must have been closed again */
+        ok_eq_ulong(GetHandleCount(Events[i]), 0);
+    }
+
+    return Total;
+}
+
+static
+VOID
+TestThroughput(
+    IN PKEVENT *Events)
+{
+    ULONGLONG Iterations, Single = 0;
+    INT ThreadCount;
+
+    for (ThreadCount = 1; ThreadCount <= MAX_THREADS; ThreadCount *= 2)
+    {
+        Iterations = RunHandleThreads(ThreadCount, Events);
+        ok(Iterations != 0, "No handles opened with %d threads\n", ThreadCount);
+        if (ThreadCount == 1)
+            Single = Iterations;
+
+        trace("%d threads on %d CPUs: %lu open/close pairs/ms (%lu%% of one thread)\n",
+              ThreadCount, KeNumberProcessors, (ULONG)(Iterations * MILLISECOND / RUN_TIME),
+              Single ? (ULONG)(Iterations * 100 / Single) : 0);
+    }
+}
+
+START_TEST(ExHandleScaling)
+{
+    KPRIORITY Priority;
+    PKEVENT Events[MAX_THREADS];
+    INT i;
+
+    for (i = 0; i < MAX_THREADS; i++)
+    {
+        Events[i] = CreateEventObject();
+        if (!Events[i])
+            break;
+    }
+    if (skip(i == MAX_THREADS, "No event objects\n"))
+        goto Cleanup;
+
+    TestReuse(Events[0], Events[1]);
+
+    /* Stay above the worker threads so we can stop them */
+    Priority = KeSetPriorityThread(KeGetCurrentThread(), LOW_REALTIME_PRIORITY);
+    TestThroughput(Events);
+    KeSetPriorityThread(KeGetCurrentThread(), Priority);
+
+Cleanup:
+    while (i-- > 0)
+        ObDereferenceObject(Events[i]);
+}
@@ -0,0 +1,314 @@
+/*
+ * PROJECT:         ReactOS kernel-mode tests
+ * LICENSE:         LGPLv2+ - See COPYING.LIB in the top level directory
+ * PURPOSE:         Kernel-Mode Test Suite pool allocation scaling test
+ */
+
+#include <kmt_test.h>
+
+#define NDEBUG
+#include <debug.h>
+
+#define MAX_THREADS     8
+#define RUN_TIME        (500 * MILLISECOND)
+#define LIVE_BLOCKS     4
+#define CROSS_BLOCKS    16
+#define SMALL_TAG       'SPeK'
+#define BIG_TAG         'BPeK'
+#define CROSS_TAG       'CPeK'
+
+typedef struct _ALLOC_THREAD_DATA
+{
+    KMT_WORKER Worker;
+    SIZE_T Size;
+    ULONG Tag;
+    ULONG Number;
+    ULONG Failures;
+    KAFFINITY SeenProcessors;
+} ALLOC_THREAD_DATA, *PALLOC_THREAD_DATA;
+
+typedef struct _TAG_COUNTERS
+{
+    ULONG Allocs;
+    ULONG Frees;
+    SIZE_T Used;
+} TAG_COUNTERS, *PTAG_COUNTERS;
+
+/* Every live block carries a stamp of its owner, so a block handed out twice shows up */
+static
+ULONG
+MakeStamp(
+    IN ULONG Number,
+    IN ULONGLONG Iteration)
+{
+    return (Number << 24) ^ (ULONG)Iteration ^ 0x5a5a5a5a;
+}
+
+static
+BOOLEAN
+CheckBlock(
+    IN PVOID Block,
+    IN SIZE_T Size,
+    IN ULONG Tag,
+    IN ULONG Stamp)
+{
+    if (Size >= PAGE_SIZE)
+    {
+        /* Page sized blocks come from the big page table and have no header */
+        if ((ULONG_PTR)Block & (PAGE_SIZE - 1))
+            return FALSE;
+    }
+    else if (KmtGetPoolTag(Block) != Tag)
+    {
+        return FALSE;
+    }
+
+    return RtlCompareMemoryUlong(Block, Size, Stamp) == Size;
+}
+
+static
+VOID
+NTAPI
+AllocThread(
+    IN PVOID Context)
+{
+    PALLOC_THREAD_DATA ThreadData = Context;
+    PVOID Blocks[LIVE_BLOCKS] = { NULL };
+    ULONG Stamps[LIVE_BLOCKS];
+    ULONGLONG Iterations = 0;
+    ULONG Slot;
+
+    while (!*ThreadData->Worker.Stop)
+    {
+        /* Recycle the oldest of the blocks this thread holds */
+        Slot = Iterations % LIVE_BLOCKS;
+        if (Blocks[Slot])
+        {
+            if (!CheckBlock(Blocks[Slot], ThreadData->Size, ThreadData->Tag, Stamps[Slot]))
+                ThreadData->Failures++;
+            ExFreePoolWithTag(Blocks[Slot], ThreadData->Tag);
+            Blocks[Slot] = NULL;
+        }
+
+        Blocks[Slot] = ExAllocatePoolWithTag(NonPagedPool, ThreadData->Size, ThreadData->Tag);
+        if (!Blocks[Slot])
+        {
+            ThreadData->Failures++;
+            break;
+        }
+        Stamps[Slot] = MakeStamp(ThreadData->Number, Iterations);
+        RtlFillMemoryUlong(Blocks[Slot], ThreadData->Size, Stamps[Slot]);
+        Iterations++;
+
+        if (*ThreadData->Worker.Measuring)
+            ThreadData->SeenProcessors |= (KAFFINITY)1 << KeGetCurrentProcessorNumber();
+    }
+
+    for (Slot = 0; Slot < LIVE_BLOCKS; Slot++)
+    {
+        if (!Blocks[Slot])
+            continue;
+        if (!CheckBlock(Blocks[Slot], ThreadData->Size, ThreadData->Tag, Stamps[Slot]))
+            ThreadData->Failures++;
+        ExFreePoolWithTag(Blocks[Slot], ThreadData->Tag);
+    }
+
+    ThreadData->Worker.Iterations = Iterations;
+    PsTerminateSystemThread(STATUS_SUCCESS);
+}
+
+static
+BOOLEAN
+QueryTagCounters(
+    IN ULONG Tag,
+    OUT PTAG_COUNTERS Counters)
+{
+    PSYSTEM_POOLTAG_INFORMATION Information;
+    NTSTATUS Status;
+    ULONG Length = 0x10000;
+    ULONG i;
+
+    RtlZeroMemory(Counters, sizeof(*Counters));
+
+    /* Grow the buffer until every tag fits */
+    do
+    {
+        Information = ExAllocatePoolWithTag(PagedPool, Length, 'IPeK');
+        if (skip(Information != NULL, "Out of memory\n"))
+            return FALSE;
+        Status = ZwQuerySystemInformation(SystemPoolTagInformation, Information, Length, &Length);
+        if (Status == STATUS_INFO_LENGTH_MISMATCH)
+        {
+            ExFreePoolWithTag(Information, 'IPeK');
+            Length += 0x1000;
+        }
+    } while (Status == STATUS_INFO_LENGTH_MISMATCH);
+    ok_eq_hex(Status, STATUS_SUCCESS);
+
+    if (NT_SUCCESS(Status))
+    {
+        /* An unused tag is simply not listed */
+        for (i = 0; i < Information->Count; i++)
+        {
+            if (Information->TagInfo[i].TagUlong != Tag)
+                continue;
+
+            Counters->Allocs = Information->TagInfo[i].NonPagedAllocs;
+            Counters->Frees = Information->TagInfo[i].NonPagedFrees;
+            Counters->Used = Information->TagInfo[i].NonPagedUsed;
+            break;
+        }
+    }
+
+    ExFreePoolWithTag(Information, 'IPeK');
+    return NT_SUCCESS(Status);
+}
+
+/* The counters of all processors must add up to what we did, with nothing outstanding */
+static
+VOID
+CheckTagCounters(
+    IN ULONG Tag,
+    IN PTAG_COUNTERS Before,
+    IN ULONGLONG Allocations)
+{
+    TAG_COUNTERS After;
+
+    if (!QueryTagCounters(Tag, &After))
+        return;
+
+    ok(After.Allocs - Before->Allocs == (ULONG)Allocations,
+       "%.4s: %lu allocations counted, %lu made\n", (PCSTR)&Tag, After.Allocs - Before->Allocs, (ULONG)Allocations);
+    ok(After.Frees - Before->Frees == (ULONG)Allocations,
+       "%.4s: %lu frees counted, %lu made\n", (PCSTR)&Tag, After.Frees - Before->Frees, (ULONG)Allocations);
+    ok_eq_size(After.Used, Before->Used);
+}
+
+static
+ULONGLONG
+RunAllocThreads(
+    IN INT ThreadCount,
+    IN PCSTR Name,
+    IN SIZE_T Size,
+    IN ULONG Tag)
+{
+    ALLOC_THREAD_DATA Threads[MAX_THREADS];
+    ULONGLONG Total;
+    INT i;
+
+    RtlZeroMemory(Threads, sizeof(Threads));
+    for (i = 0; i < ThreadCount; ++i)
+    {
+        Threads[i].Size = Size;
+        Threads[i].Tag = Tag;
+        Threads[i].Number = i;
+        /* Spread the threads over the processors */
+        Threads[i].Worker.Affinity = (KAFFINITY)1 << (i % KeNumberProcessors);
+    }
+
+    Total = KmtRunWorkers(AllocThread, Threads, sizeof(Threads[0]), ThreadCount, RUN_TIME);
+
+    for (i = 0; i < ThreadCount; ++i)
+    {
+        ok(Threads[i].Failures == 0, "%s: thread %d on CPU %d: %lu bad blocks\n",
+           Name, i, i % KeNumberProcessors, Threads[i].Failures);
+        ok(Threads[i].Worker.Iterations != 0, "%s: thread %d on CPU %d made no allocations\n",
+           Name, i, i % KeNumberProcessors);
+        ok((Threads[i].SeenProcessors & ~Threads[i].Worker.Affinity) == 0,
+           "%s: thread %d ran on %lx, expected %lx\n", Name, i,
+           (ULONG)Threads[i].SeenProcessors, (ULONG)Threads[i].Worker.Affinity);
+    }
+
+    return Total;
+}
+
+static
+VOID
+TestThroughput(
+    IN PCSTR Name,
+    IN SIZE_T Size,
+    IN ULONG Tag)
+{
+    ULONGLONG Iterations, Single = 0, Allocations = 0;
+    TAG_COUNTERS Before;
+    INT ThreadCount;
+
+    if (!QueryTagCounters(Tag, &Before))
+        return;
+
+    for (ThreadCount = 1; ThreadCount <= MAX_THREADS; ThreadCount *= 2)
+    {
+        Iterations = RunAllocThreads(ThreadCount, Name, Size, Tag);
+        ok(Iterations != 0, "No %s allocations with %d threads\n", Name, ThreadCount);
+        if (ThreadCount == 1)
+            Single = Iterations;
+        Allocations += Iterations;
+
+        trace("%s: %d threads on %d CPUs: %lu allocations/ms (%lu%% of one thread)\n",
+              Name, ThreadCount, KeNumberProcessors, (ULONG)(Iterations * MILLISECOND / RUN_TIME),
+              Single ? (ULONG)(Iterations * 100 / Single) : 0);
+    }
+
+    CheckTagCounters(Tag, &Before, Allocations);
+}
+
+/* Blocks allocated on one processor and freed on another */
+static
+VOID
+TestCrossProcessor(
+    IN SIZE_T Size)
+{
+    PVOID Blocks[CROSS_BLOCKS];
+    TAG_COUNTERS Before;
+    ULONG Processor, i;
+    ULONG Failures;
+
+    if (!QueryTagCounters(CROSS_TAG, &Before))
+        return;
+
+    for (Processor = 0; Processor < (ULONG)KeNumberProcessors; Processor++)
+    {
+        KeSetSystemAffinityThread((KAFFINITY)1 << Processor);
+        for (i = 0; i < CROSS_BLOCKS; i++)
+        {
+            Blocks[i] = ExAllocatePoolWithTag(NonPagedPool, Size, CROSS_TAG);
+            ok(Blocks[i] != NULL, "CPU %lu: allocation %lu of %lu bytes failed\n", Processor, i, (ULONG)Size);
+            if (Blocks[i])
+                RtlFillMemoryUlong(Blocks[i], Size, MakeStamp(Processor, i));
+        }
+
+        KeSetSystemAffinityThread((KAFFINITY)1 << ((Processor + 1) % KeNumberProcessors));
+        Failures = 0;
+        for (i = 0; i < CROSS_BLOCKS; i++)
+        {
+            if (!Blocks[i])
+                continue;
+            if (!CheckBlock(Blocks[i], Size, CROSS_TAG, MakeStamp(Processor, i)))
+                Failures++;
+            ExFreePoolWithTag(Blocks[i], CROSS_TAG);
+        }
+        ok(Failures == 0, "CPU %lu: %lu of %lu bytes blocks were bad when freed on CPU %lu\n",
+           Processor, Failures, (ULONG)Size, (Processor + 1) % KeNumberProcessors);
+    }
+    KeRevertToUserAffinityThread();
+
+    CheckTagCounters(CROSS_TAG, &Before, (ULONGLONG)KeNumberProcessors * CROSS_BLOCKS);
+}
+
+START_TEST(ExPoolScaling)
+{
+    KPRIORITY Priority;
+
+    TestCrossProcessor(64);
+    TestCrossProcessor(2 * PAGE_SIZE);
+
+    /* Stay above the allocating threads so we can stop them */
+    Priority = KeSetPriorityThread(KeGetCurrentThread(), LOW_REALTIME_PRIORITY);
+
+    TestThroughput("Small", 64, SMALL_TAG);
+
+    /* Page sized blocks go through the big page table */
+    TestThroughput("Big", 2 * PAGE_SIZE, BIG_TAG);
+
+    KeSetPriorityThread(KeGetCurrentThread(), Priority);
+}
@@ -0,0 +1,87 @@
+/*
+ * PROJECT:         ReactOS kernel-mode tests
+ * LICENSE:         LGPLv2+ - See COPYING.LIB in the top level directory
+ * PURPOSE:         Kernel-Mode Test Suite system worker queue test
+ */
+
+#include <kmt_test.h>
+
+#define NDEBUG
+#include <debug.h>
+
+#define BURST_ITEMS     64
+#define ITEM_TIME       (10 * MILLISECOND)
+
+typedef struct _BURST_CONTEXT
+{
+    WORK_QUEUE_ITEM Items[BURST_ITEMS];
+    volatile LONG Remaining;
+    KEVENT Done;
+} BURST_CONTEXT, *PBURST_CONTEXT;
+
+static
+VOID
+NTAPI
+BurstWorker(
+    IN PVOID Parameter)
+{
+    PBURST_CONTEXT Context = Parameter;
+    LARGE_INTEGER Timeout;
+
+    /* Simulate a driver that blocks for a while in its work item */
+    Timeout.QuadPart = -ITEM_TIME;
+    KeDelayExecutionThread(KernelMode, FALSE, &Timeout);
+
+    if (InterlockedDecrement(&Context->Remaining) == 0)
+        KeSetEvent(&Context->Done, IO_NO_INCREMENT, FALSE);
+}
+
+static
+VOID
+TestBurst(
+    IN WORK_QUEUE_TYPE QueueType)
+{
+    PBURST_CONTEXT Context;
+    LARGE_INTEGER Start, End, Timeout;
+    NTSTATUS Status;
+    ULONG i;
+
+    Context = ExAllocatePoolWithTag(NonPagedPool, sizeof(*Context), 'QWeK');
+    if (skip(Context != NULL, "Out of memory\n"))
+        return;
+
+    Context->Remaining = BURST_ITEMS;
+    KeInitializeEvent(&Context->Done, NotificationEvent, FALSE);
+
+    KeQuerySystemTime(&Start);
+    for (i = 0; i < BURST_ITEMS; i++)
+    {
+        ExInitializeWorkItem(&Context->Items[i], BurstWorker, Context);
+        ExQueueWorkItem(&Context->Items[i], QueueType);
+    }
+
+    /* Serialized, the burst would take BURST_ITEMS * ITEM_TIME */
+    Timeout.QuadPart = -60 * 1000 * MILLISECOND;
+    Status = KeWaitForSingleObject(&Context->Done, Executive, KernelMode, FALSE, &Timeout);
+    ok_eq_hex(Status, STATUS_SUCCESS);
+    KeQuerySystemTime(&End);
+
+    if (Status != STATUS_SUCCESS)
+    {
+        /* Work items may still run and touch the context, so leak it */
+        ok(0, "Queue %d still has %ld items outstanding\n", QueueType, Context->Remaining);
+        return;
+    }
+
+    trace("Queue %d: %d items of %lu ms in %lu ms\n",
+          QueueType, BURST_ITEMS, (ULONG)(ITEM_TIME / MILLISECOND),
+          (ULONG)((End.QuadPart - Start.QuadPart) / MILLISECOND));
+
+    ExFreePoolWithTag(Context, 'QWeK');
+}
+
+START_TEST(ExWorkQueue)
+{
+    TestBurst(DelayedWorkQueue);
+    TestBurst(CriticalWorkQueue);
+}
@@ -0,0 +1,204 @@
+/*
+ * PROJECT:         ReactOS kernel-mode tests
+ * LICENSE:         LGPLv2+ - See COPYING.LIB in the top level directory
+ * PURPOSE:         Kernel-Mode Test Suite FsRtl byte range lock test
+ */
+
+#include <kmt_test.h>
+
+#define NDEBUG
+#include <debug.h>
+
+#define BENCH_LOCKS     10000
+#define BENCH_CHECKS    (1024 * 1024)
+
+static FILE_OBJECT FileObject;
+
+static
+BOOLEAN
+LockRange(
+    IN PFILE_LOCK FileLock,
+    IN LONGLONG Offset,
+    IN LONGLONG Length,
+    IN PEPROCESS Process,
+    IN BOOLEAN Exclusive)
+{
+    LARGE_INTEGER FileOffset, LockLength;
+    IO_STATUS_BLOCK IoStatus;
+
+    FileOffset.QuadPart = Offset;
+    LockLength.QuadPart = Length;
+    return FsRtlFastLock(FileLock, &FileObject, &FileOffset, &LockLength, Process, 0, TRUE, Exclusive, &IoStatus, NULL, FALSE);
+}
+
+static
+NTSTATUS
+UnlockRange(
+    IN PFILE_LOCK FileLock,
+    IN LONGLONG Offset,
+    IN LONGLONG Length,
+    IN PEPROCESS Process)
+{
+    LARGE_INTEGER FileOffset, LockLength;
+
+    FileOffset.QuadPart = Offset;
+    LockLength.QuadPart = Length;
+    return FsRtlFastUnlockSingle(FileLock, &FileObject, &FileOffset, &LockLength, Process, 0, NULL, FALSE);
+}
+
+static
+BOOLEAN
+CheckWrite(
+    IN PFILE_LOCK FileLock,
+    IN LONGLONG Offset,
+    IN LONGLONG Length,
+    IN PEPROCESS Process)
+{
+    LARGE_INTEGER FileOffset, CheckLength;
+
+    FileOffset.QuadPart = Offset;
+    CheckLength.QuadPart = Length;
+    return FsRtlFastCheckLockForWrite(FileLock, &FileOffset, &CheckLength, 0, &FileObject, Process);
+}
+
+static
+BOOLEAN
+CheckRead(
+    IN PFILE_LOCK FileLock,
+    IN LONGLONG Offset,
+    IN LONGLONG Length,
+    IN PEPROCESS Process)
+{
+    LARGE_INTEGER FileOffset, CheckLength;
+
+    FileOffset.QuadPart = Offset;
+    CheckLength.QuadPart = Length;
+    return FsRtlFastCheckLockForRead(FileLock, &FileOffset, &CheckLength, 0, &FileObject, Process);
+}
+
+static
+VOID
+TestConflicts(
+    IN PEPROCESS Process,
+    IN PEPROCESS Other)
+{
+    FILE_LOCK FileLock;
+
+    FsRtlInitializeFileLock(&FileLock, NULL, NULL);
+    ok_bool_false(FsRtlAreThereCurrentFileLocks(&FileLock), "FsRtlAreThereCurrentFileLocks returned");
+    ok_bool_true(CheckWrite(&FileLock, 0, 100, Other), "CheckWrite returned");
+
+    ok_bool_true(LockRange(&FileLock, 0, 10, Process, TRUE), "Lock returned");
+    ok_bool_true(LockRange(&FileLock, 20, 10, Other, TRUE), "Lock returned");
+    ok_bool_true(FsRtlAreThereCurrentFileLocks(&FileLock), "FsRtlAreThereCurrentFileLocks returned");
+    ok_bool_false(LockRange(&FileLock, 5, 10, Other, TRUE), "Lock returned");
+
+    /* Every lock in the range counts, not just the first one found */
+    ok_bool_true(CheckWrite(&FileLock, 0, 10, Process), "CheckWrite returned");
+    ok_bool_false(CheckWrite(&FileLock, 0, 30, Process), "CheckWrite returned");
+    ok_bool_false(CheckWrite(&FileLock, 5, 20, Other), "CheckWrite returned");
+    ok_bool_false(CheckRead(&FileLock, 0, 30, Other), "CheckRead returned");
+    ok_bool_true(CheckRead(&FileLock, 10, 10, Other), "CheckRead returned");
+
+    /* Shared locks only conflict with exclusive ones */
+    ok_bool_true(LockRange(&FileLock, 40, 10, Process, FALSE), "Lock returned");
+    ok_bool_true(LockRange(&FileLock, 45, 10, Other, FALSE), "Lock returned");
+    ok_bool_false(LockRange(&FileLock, 25, 20, Process, FALSE), "Lock returned");
+    ok_bool_true(CheckRead(&FileLock, 40, 20, Other), "CheckRead returned");
+
+    ok_eq_hex(UnlockRange(&FileLock, 0, 10, Other), STATUS_RANGE_NOT_LOCKED);
+    ok_eq_hex(UnlockRange(&FileLock, 0, 10, Process), STATUS_SUCCESS);
+    ok_eq_hex(UnlockRange(&FileLock, 20, 10, Other), STATUS_SUCCESS);
+    ok_bool_true(CheckWrite(&FileLock, 0, 30, Other), "CheckWrite returned");
+    ok_eq_hex(UnlockRange(&FileLock, 40, 10, Process), STATUS_SUCCESS);
+    ok_eq_hex(UnlockRange(&FileLock, 45, 10, Other), STATUS_SUCCESS);
+
+    /* Once the last lock is gone, the FSDs can skip the checks again */
+    ok_bool_false(FsRtlAreThereCurrentFileLocks(&FileLock), "FsRtlAreThereCurrentFileLocks returned");
+
+    FsRtlUninitializeFileLock(&FileLock);
+}
+
+static
+VOID
+TestScaling(
+    IN PEPROCESS Process,
+    IN PEPROCESS Other)
+{
+    FILE_LOCK FileLock;
+    LARGE_INTEGER Start, End, Frequency;
+    ULONG Seed = 0x5eed, Errors = 0, Locks, i;
+    LONGLONG Offset;
+
+    FsRtlInitializeFileLock(&FileLock, NULL, NULL);
+
+    /* Without any lock, the checks must not cost anything */
+    Start = KeQueryPerformanceCounter(&Frequency);
+    for (i = 0; i < BENCH_CHECKS; i++)
+    {
+        if (!CheckWrite(&FileLock, (LONGLONG)i * 512, 512, Other))
+            Errors++;
+    }
+    End = KeQueryPerformanceCounter(NULL);
+    ok(Errors == 0, "%lu checks failed without locks\n", Errors);
+    trace("No locks: %lu ns per check\n",
+          (ULONG)((End.QuadPart - Start.QuadPart) * 1000000000 / Frequency.QuadPart / BENCH_CHECKS));
+
+    /* Lock every other 512 byte record, the way databases do */
+    Start = KeQueryPerformanceCounter(&Frequency);
+    for (Locks = 0; Locks < BENCH_LOCKS; Locks++)
+    {
+        if (!LockRange(&FileLock, (LONGLONG)Locks * 1024, 512, Process, TRUE))
+            break;
+    }
+    End = KeQueryPerformanceCounter(NULL);
+    ok_eq_ulong(Locks, BENCH_LOCKS);
+    trace("%lu locks: %lu ns per lock\n", Locks,
+          (ULONG)((End.QuadPart - Start.QuadPart) * 1000000000 / Frequency.QuadPart / max(Locks, 1)));
+
+    Errors = 0;
+    Start = KeQueryPerformanceCounter(&Frequency);
+    for (i = 0; i < BENCH_CHECKS && Locks != 0; i++)
+    {
+        Seed = Seed * 1103515245 + 12345;
+        Offset = (LONGLONG)(Seed % (Locks * 2)) * 512;
+
+        /* Even records are locked by Process, odd ones are free */
+        if (CheckWrite(&FileLock, Offset, 512, Other) != (Offset % 1024 != 0) ||
+            !CheckWrite(&FileLock, Offset, 512, Process))
+        {
+            Errors++;
+        }
+    }
+    End = KeQueryPerformanceCounter(NULL);
+    ok(Errors == 0, "%lu of %u checks failed\n", Errors, BENCH_CHECKS);
+    trace("%lu locks: %lu ns per check\n", Locks,
+          (ULONG)((End.QuadPart - Start.QuadPart) * 1000000000 / Frequency.QuadPart / BENCH_CHECKS / 2));
+
+    Errors = 0;
+    Start = KeQueryPerformanceCounter(&Frequency);
+    for (i = 0; i < Locks; i++)
+    {
+        if (UnlockRange(&FileLock, (LONGLONG)i * 1024, 512, Process) != STATUS_SUCCESS)
+            Errors++;
+    }
+    End = KeQueryPerformanceCounter(NULL);
+    ok(Errors == 0, "%lu of %lu unlocks failed\n", Errors, Locks);
+    trace("%lu locks: %lu ns per unlock\n", Locks,
+          (ULONG)((End.QuadPart - Start.QuadPart) * 1000000000 / Frequency.QuadPart / max(Locks, 1)));
+    ok_bool_false(FsRtlAreThereCurrentFileLocks(&FileLock), "FsRtlAreThereCurrentFileLocks returned");
+
+    FsRtlUninitializeFileLock(&FileLock);
+}
+
+START_TEST(FsRtlFileLock)
+{
+    PEPROCESS Process = PsGetCurrentProcess();
+    /* Locks only compare the process pointers */
+    PEPROCESS Other = (PEPROCESS)((ULONG_PTR)Process + sizeof(PVOID));
+
+    RtlInitUnicodeString(&FileObject.FileName, L"\\FsRtlFileLock");
+
+    TestConflicts(Process, Other);
+    TestScaling(Process, Other);
+}
@@ -0,0 +1,188 @@
+/*
+ * PROJECT:         ReactOS kernel-mode tests
+ * LICENSE:         LGPLv2+ - See COPYING.LIB in the top level directory
+ * PURPOSE:         Kernel-Mode Test Suite MCB scaling test
+ */
+
+#include <kmt_test.h>
+
+#define NDEBUG
+#include <debug.h>
+
+#define BENCH_RUNS      (64 * 1024)
+#define BENCH_LOOKUPS   (1024 * 1024)
+#define RUN_LENGTH      8
+#define TABLE_TAG       'TMeK'
+
+/*
+ * The baseline keeps the runs the way the MCBs used to: one splay tree node
+ * allocated from pool per run.
+ */
+typedef struct _TABLE_RUN
+{
+    LONGLONG StartVbn;
+    LONGLONG EndVbn;
+    LONGLONG Lbn;
+} TABLE_RUN, *PTABLE_RUN;
+
+static
+RTL_GENERIC_COMPARE_RESULTS
+NTAPI
+CompareRuns(
+    IN PRTL_GENERIC_TABLE Table,
+    IN PVOID First,
+    IN PVOID Second)
+{
+    PTABLE_RUN A = First, B = Second;
+
+    if (A->EndVbn <= B->StartVbn)
+        return GenericLessThan;
+    if (A->StartVbn >= B->EndVbn)
+        return GenericGreaterThan;
+    return GenericEqual;
+}
+
+static
+PVOID
+NTAPI
+AllocateRun(
+    IN PRTL_GENERIC_TABLE Table,
+    IN CLONG ByteSize)
+{
+    return ExAllocatePoolWithTag(PagedPool, ByteSize, TABLE_TAG);
+}
+
+static
+VOID
+NTAPI
+FreeRun(
+    IN PRTL_GENERIC_TABLE Table,
+    IN PVOID Buffer)
+{
+    ExFreePoolWithTag(Buffer, TABLE_TAG);
+}
+
+/* Runs are adjacent in the file but not on the disk, so that none of them can be merged */
+static
+LONGLONG
+RunLbn(
+    IN ULONG Run)
+{
+    return (LONGLONG)Run * RUN_LENGTH * 2;
+}
+
+static
+ULONG
+ElapsedUs(
+    IN LARGE_INTEGER Start,
+    IN LARGE_INTEGER Frequency)
+{
+    LARGE_INTEGER End = KeQueryPerformanceCounter(NULL);
+
+    return (ULONG)((End.QuadPart - Start.QuadPart) * 1000000 / Frequency.QuadPart);
+}
+
+static
+VOID
+TestMcb(
+    OUT PULONG InsertTime,
+    OUT PULONG LookupTime)
+{
+    LARGE_MCB Mcb;
+    LARGE_INTEGER Start, Frequency;
+    LONGLONG Vbn, Lbn, SectorCount;
+    ULONG Seed = 0x5eed, Errors = 0, Run, i;
+
+    FsRtlInitializeLargeMcb(&Mcb, PagedPool);
+
+    Start = KeQueryPerformanceCounter(&Frequency);
+    for (Run = 0; Run < BENCH_RUNS; Run++)
+    {
+        if (!FsRtlAddLargeMcbEntry(&Mcb, (LONGLONG)Run * RUN_LENGTH, RunLbn(Run), RUN_LENGTH))
+            break;
+    }
+    *InsertTime = ElapsedUs(Start, Frequency);
+    ok_eq_ulong(Run, BENCH_RUNS);
+    ok_eq_ulong(FsRtlNumberOfRunsInLargeMcb(&Mcb), Run);
+
+    Start = KeQueryPerformanceCounter(&Frequency);
+    for (i = 0; i < BENCH_LOOKUPS && Run != 0; i++)
+    {
+        Seed = Seed * 1103515245 + 12345;
+        Vbn = Seed % ((LONGLONG)Run * RUN_LENGTH);
+        if (!FsRtlLookupLargeMcbEntry(&Mcb, Vbn, &Lbn, &SectorCount, NULL, NULL, NULL) ||
+            Lbn != RunLbn((ULONG)(Vbn / RUN_LENGTH)) + Vbn % RUN_LENGTH ||
+            SectorCount != RUN_LENGTH - Vbn % RUN_LENGTH)
+        {
+            Errors++;
+        }
+    }
+    *LookupTime = ElapsedUs(Start, Frequency);
+    ok(Errors == 0, "%lu of %u lookups failed or returned the wrong LBN\n", Errors, BENCH_LOOKUPS);
+
+    /* Nothing past the last run, and the runs keep their order */
+    ok_bool_false(FsRtlLookupLargeMcbEntry(&Mcb, (LONGLONG)Run * RUN_LENGTH, &Lbn, NULL, NULL, NULL, NULL),
+                  "FsRtlLookupLargeMcbEntry past the end returned");
+    ok(FsRtlGetNextLargeMcbEntry(&Mcb, Run / 2, &Vbn, &Lbn, &SectorCount), "No run %lu\n", Run / 2);
+    ok_eq_longlong(Vbn, (LONGLONG)(Run / 2) * RUN_LENGTH);
+    ok_eq_longlong(Lbn, RunLbn(Run / 2));
+
+    FsRtlUninitializeLargeMcb(&Mcb);
+}
+
+static
+VOID
+TestTable(
+    OUT PULONG InsertTime,
+    OUT PULONG LookupTime)
+{
+    RTL_GENERIC_TABLE Table;
+    LARGE_INTEGER Start, Frequency;
+    TABLE_RUN Key;
+    PTABLE_RUN Found;
+    BOOLEAN NewElement;
+    ULONG Seed = 0x5eed, Errors = 0, Run, i;
+
+    RtlInitializeGenericTable(&Table, CompareRuns, AllocateRun, FreeRun, NULL);
+
+    Start = KeQueryPerformanceCounter(&Frequency);
+    for (Run = 0; Run < BENCH_RUNS; Run++)
+    {
+        Key.StartVbn = (LONGLONG)Run * RUN_LENGTH;
+        Key.EndVbn = Key.StartVbn + RUN_LENGTH;
+        Key.Lbn = RunLbn(Run);
+        if (!RtlInsertElementGenericTable(&Table, &Key, sizeof(Key), &NewElement))
+            break;
+    }
+    *InsertTime = ElapsedUs(Start, Frequency);
+    ok_eq_ulong(Run, BENCH_RUNS);
+
+    Start = KeQueryPerformanceCounter(&Frequency);
+    for (i = 0; i < BENCH_LOOKUPS && Run != 0; i++)
+    {
+        Seed = Seed * 1103515245 + 12345;
+        Key.StartVbn = Seed % ((LONGLONG)Run * RUN_LENGTH);
+        Key.EndVbn = Key.StartVbn + 1;
+        Found = RtlLookupElementGenericTable(&Table, &Key);
+        if (!Found || Found->Lbn + (Key.StartVbn - Found->StartVbn) != RunLbn((ULONG)(Key.StartVbn / RUN_LENGTH)) + Key.StartVbn % RUN_LENGTH)
+            Errors++;
+    }
+    *LookupTime = ElapsedUs(Start, Frequency);
+    ok(Errors == 0, "%lu of %u lookups failed or returned the wrong LBN\n", Errors, BENCH_LOOKUPS);
+
+    while ((Found = RtlGetElementGenericTable(&Table, 0)) != NULL)
+        RtlDeleteElementGenericTable(&Table, Found);
+}
+
+START_TEST(FsRtlMcbScaling)
+{
+    ULONG McbInsert, McbLookup, TableInsert, TableLookup;
+
+    TestMcb(&McbInsert, &McbLookup);
+    TestTable(&TableInsert, &TableLookup);
+
+    trace("%u runs, MCB: %lu ms to add, %lu ns per lookup\n",
+          BENCH_RUNS, McbInsert / 1000, (ULONG)((ULONGLONG)McbLookup * 1000 / BENCH_LOOKUPS));
+    trace("%u runs, splay tree: %lu ms to add, %lu ns per lookup\n",
+          BENCH_RUNS, TableInsert / 1000, (ULONG)((ULONGLONG)TableLookup * 1000 / BENCH_LOOKUPS));
+}
@@ -0,0 +1,116 @@
+/*
+ * PROJECT:         ReactOS kernel-mode tests
+ * LICENSE:         LGPLv2+ - See COPYING.LIB in the top level directory
+ * PURPOSE:         Kernel-Mode Test Suite thread dispatcher test
+ */
+
+#include <kmt_test.h>
+
+#define NDEBUG
+#include <debug.h>
+
+#define MAX_THREADS     8
+#define RUN_TIME        (1000 * MILLISECOND)
+
+typedef struct _SPIN_THREAD_DATA
+{
+    KMT_WORKER Worker;
+    KAFFINITY SeenProcessors;
+} SPIN_THREAD_DATA, *PSPIN_THREAD_DATA;
+
+static
+VOID
+NTAPI
+SpinThread(
+    IN PVOID Context)
+{
+    PSPIN_THREAD_DATA ThreadData = Context;
+    ULONGLONG Iterations = 0;
+
+    while (!*ThreadData->Worker.Stop)
+    {
+        Iterations++;
+        if (!(Iterations & 0xFFF) && *ThreadData->Worker.Measuring)
+            ThreadData->SeenProcessors |= (KAFFINITY)1 << KeGetCurrentProcessorNumber();
+    }
+
+    ThreadData->Worker.Iterations = Iterations;
+    PsTerminateSystemThread(STATUS_SUCCESS);
+}
+
+static
+ULONGLONG
+RunSpinThreads(
+    IN INT ThreadCount,
+    IN KAFFINITY Affinity,
+    OUT PKAFFINITY SeenProcessors)
+{
+    SPIN_THREAD_DATA Threads[MAX_THREADS];
+    ULONGLONG Total;
+    INT i;
+
+    RtlZeroMemory(Threads, sizeof(Threads));
+    for (i = 0; i < ThreadCount; ++i)
+        Threads[i].Worker.Affinity = Affinity;
+
+    Total = KmtRunWorkers(SpinThread, Threads, sizeof(Threads[0]), ThreadCount, RUN_TIME);
+
+    *SeenProcessors = 0;
+    for (i = 0; i < ThreadCount; ++i)
+        *SeenProcessors |= Threads[i].SeenProcessors;
+
+    return Total;
+}
+
+static
+VOID
+TestThroughput(VOID)
+{
+    ULONGLONG Iterations, Single = 0;
+    KAFFINITY SeenProcessors;
+    INT ThreadCount;
+
+    for (ThreadCount = 1; ThreadCount <= MAX_THREADS; ThreadCount *= 2)
+    {
+        Iterations = RunSpinThreads(ThreadCount, 0, &SeenProcessors);
+        ok(Iterations != 0, "No progress with %d threads\n", ThreadCount);
+        if (ThreadCount == 1)
+            Single = Iterations;
+
+        trace("%d threads on %d CPUs: %lu iterations/ms (%lu%% of one thread), processors %lx\n",
+              ThreadCount, KeNumberProcessors, (ULONG)(Iterations * MILLISECOND / RUN_TIME),
+              Single ? (ULONG)(Iterations * 100 / Single) : 0, (ULONG)SeenProcessors);
+
+        /* Runnable threads must spread to the other processors */
+        if (ThreadCount >= KeNumberProcessors)
+            ok(SeenProcessors == KeQueryActiveProcessors(),
+               "%d threads ran on %lx, active %lx\n", ThreadCount,
+               (ULONG)SeenProcessors, (ULONG)KeQueryActiveProcessors());
+    }
+}
+
+static
+VOID
+TestAffinity(VOID)
+{
+    KAFFINITY SeenProcessors, Affinity;
+
+    if (skip(KeNumberProcessors >= 2, "Affinity test requires more than one processor\n"))
+        return;
+
+    /* Threads restricted to the last processor must never run elsewhere */
+    Affinity = (KAFFINITY)1 << (KeNumberProcessors - 1);
+    RunSpinThreads(2, Affinity, &SeenProcessors);
+    ok(SeenProcessors == Affinity, "Threads ran on %lx, expected %lx\n", (ULONG)SeenProcessors, (ULONG)Affinity);
+}
+
+START_TEST(KeScheduler)
+{
+    KPRIORITY Priority;
+
+    /* Stay above the spinning threads so we can stop them */
+    Priority = KeSetPriorityThread(KeGetCurrentThread(), LOW_REALTIME_PRIORITY);
+    TestThroughput();
+    TestAffinity();
+    KeSetPriorityThread(KeGetCurrentThread(), Priority);
+}
@@ -151,7 +151,7 @@ CcRemapBcb (
 }
 
 /*
- * @unimplemented
+ * @implemented
  */
 VOID
 NTAPI
@@ -162,9 +162,11 @@ CcScheduleReadAhead (
 	)
 {
     KIRQL OldIrql;
-    LARGE_INTEGER NewOffset;
+    ULONG Granularity, NewLength;
+    LONGLONG ReadEnd, Frontier, NewOffset, PendingEnd;
     PROS_SHARED_CACHE_MAP SharedCacheMap;
     PPRIVATE_CACHE_MAP PrivateCacheMap;
+    PROS_PRIVATE_CACHE_MAP RosPrivateCacheMap;
 
     SharedCacheMap = FileObject->SectionObjectPointer->SharedCacheMap;
     PrivateCacheMap = FileObject->PrivateCacheMap;
@@ -176,49 +178,102 @@ CcScheduleReadAhead (
         return;
     }
 
-    /* Round read length with read ahead mask */
-    Length = ROUND_UP(Length, PrivateCacheMap->ReadAheadMask + 1);
-    /* Compute the offset we'll reach */
-    NewOffset.QuadPart = FileOffset->QuadPart + Length;
+    RosPrivateCacheMap = CONTAINING_RECORD(PrivateCacheMap, ROS_PRIVATE_CACHE_MAP, Map);
+    Granularity = PrivateCacheMap->ReadAheadMask + 1;
+    ReadEnd = FileOffset->QuadPart + Length;
 
     /* Lock read ahead spin lock */
     KeAcquireSpinLock(&PrivateCacheMap->ReadAheadSpinLock, &OldIrql);
-    /* Easy case: the file is sequentially read */
-    if (BooleanFlagOn(FileObject->Flags, FO_SEQUENTIAL_ONLY))
+
+    /* Account the reads which were served by the current read ahead stream */
+    Frontier = PrivateCacheMap->ReadAheadOffset[1].QuadPart + PrivateCacheMap->ReadAheadLength[1];
+    RosPrivateCacheMap->Reads++;
+    if (PrivateCacheMap->ReadAheadLength[1] != 0 &&
+        FileOffset->QuadPart >= PrivateCacheMap->ReadAheadOffset[0].QuadPart &&
+        ReadEnd <= Frontier)
     {
-        /* If we went backward, this is no go! */
-        if (NewOffset.QuadPart < PrivateCacheMap->ReadAheadOffset[1].QuadPart)
+        RosPrivateCacheMap->ReadAheadHits++;
+    }
+
+    /* Sequential stream: the read starts where the previous one ended, give or
+     * take the read ahead granularity. Grow the window as long as it lasts.
+     */
+    if ((BooleanFlagOn(FileObject->Flags, FO_SEQUENTIAL_ONLY) ||
+         FileOffset->QuadPart <= PrivateCacheMap->BeyondLastByte2.QuadPart + Granularity) &&
+        FileOffset->QuadPart >= PrivateCacheMap->FileOffset2.QuadPart)
+    {
+        /* New stream? Start with twice the read size */
+        if (RosPrivateCacheMap->ReadAheadWindow == 0 || Frontier < FileOffset->QuadPart)
+        {
+            RosPrivateCacheMap->ReadAheadWindow = ROUND_UP(max(2 * Length, CC_MIN_READ_AHEAD), Granularity);
+            RosPrivateCacheMap->ReadAheadWindow = min(RosPrivateCacheMap->ReadAheadWindow,
+                                                      max(CC_MAX_READ_AHEAD, Granularity));
+            PrivateCacheMap->ReadAheadOffset[0].QuadPart = ReadEnd;
+            Frontier = ReadEnd;
+        }
+        Frontier = max(Frontier, ReadEnd);
+
+        /* Don't bother until the reader consumed half of what was read ahead */
+        if (Frontier - ReadEnd >= RosPrivateCacheMap->ReadAheadWindow / 2)
         {
             KeReleaseSpinLock(&PrivateCacheMap->ReadAheadSpinLock, OldIrql);
             return;
         }
 
-        /* FIXME: hackish, but will do the job for now */
-        PrivateCacheMap->ReadAheadOffset[1].QuadPart = NewOffset.QuadPart;
-        PrivateCacheMap->ReadAheadLength[1] = Length;
+        /* Extend the read ahead to a full window past the reader... */
+        NewOffset = Frontier;
+        NewLength = (ULONG)(ReadEnd + RosPrivateCacheMap->ReadAheadWindow - Frontier);
+
+        /* ...and make the next one larger */
+        if (RosPrivateCacheMap->ReadAheadWindow < CC_MAX_READ_AHEAD)
+        {
+            RosPrivateCacheMap->ReadAheadWindow = min(2 * RosPrivateCacheMap->ReadAheadWindow,
+                                                      CC_MAX_READ_AHEAD);
+        }
+    }
+    /* Forward strided reads: read ahead what the next read is likely to need */
+    else if (!BooleanFlagOn(FileObject->Flags, FO_SEQUENTIAL_ONLY) &&
+             PrivateCacheMap->FileOffset2.QuadPart >= PrivateCacheMap->FileOffset1.QuadPart &&
+             FileOffset->QuadPart >= PrivateCacheMap->FileOffset2.QuadPart)
+    {
+        RosPrivateCacheMap->ReadAheadWindow = 0;
+        PrivateCacheMap->ReadAheadOffset[0].QuadPart = ReadEnd;
+        NewOffset = ReadEnd;
+        NewLength = ROUND_UP(Length, Granularity);
     }
-    /* Other cases: try to find some logic in that mess... */
+    /* Random access, or going backward: stop reading ahead */
     else
     {
-        /* Let's check if we always read the same way (like going down in the file)
-         * and pretend it's enough for now
-         */
-        if (PrivateCacheMap->FileOffset2.QuadPart >= PrivateCacheMap->FileOffset1.QuadPart &&
-            FileOffset->QuadPart >= PrivateCacheMap->FileOffset2.QuadPart)
-        {
-            /* FIXME: hackish, but will do the job for now */
-            PrivateCacheMap->ReadAheadOffset[1].QuadPart = NewOffset.QuadPart;
-            PrivateCacheMap->ReadAheadLength[1] = Length;
-        }
-        else
+        RosPrivateCacheMap->ReadAheadWindow = 0;
+        KeReleaseSpinLock(&PrivateCacheMap->ReadAheadSpinLock, OldIrql);
+        return;
+    }
+
+    /* A read ahead in progress only rereads the pending range once it is done
+     * with what it started, so widen that range instead of replacing it, or a
+     * window pushed twice in the meantime loses the part in between. A range
+     * that doesn't touch the pending one supersedes it: the reader moved on.
+     */
+    if (PrivateCacheMap->Flags.ReadAheadActive &&
+        PrivateCacheMap->ReadAheadLength[1] != 0)
+    {
+        PendingEnd = PrivateCacheMap->ReadAheadOffset[1].QuadPart + PrivateCacheMap->ReadAheadLength[1];
+        if (NewOffset <= PendingEnd &&
+            NewOffset + NewLength >= PrivateCacheMap->ReadAheadOffset[1].QuadPart)
         {
-            /* FIXME: handle the other cases */
-            KeReleaseSpinLock(&PrivateCacheMap->ReadAheadSpinLock, OldIrql);
-            UNIMPLEMENTED_ONCE;
-            return;
+            PendingEnd = max(PendingEnd, NewOffset + NewLength);
+            NewOffset = min(NewOffset, PrivateCacheMap->ReadAheadOffset[1].QuadPart);
+
+            /* Only count what the merge added */
+            RosPrivateCacheMap->ReadAheadBytes -= PrivateCacheMap->ReadAheadLength[1];
+            NewLength = (ULONG)(PendingEnd - NewOffset);
         }
     }
 
+    PrivateCacheMap->ReadAheadOffset[1].QuadPart = NewOffset;
+    PrivateCacheMap->ReadAheadLength[1] = NewLength;
+    RosPrivateCacheMap->ReadAheadBytes += NewLength;
+
     /* If read ahead isn't active yet */
     if (!PrivateCacheMap->Flags.ReadAheadActive)
     {
@@ -366,6 +421,17 @@ CcSetReadAheadGranularity (
     CCTRACE(CC_API_DEBUG, "FileObject=%p Granularity=%lu\n",
         FileObject, Granularity);
 
+    /* The granularity must be a power of 2, at least a page */
+    if (Granularity < PAGE_SIZE || (Granularity & (Granularity - 1)) != 0)
+    {
+        DPRINT1("Invalid read ahead granularity %lu\n", Granularity);
+        return;
+    }
+
     PrivateMap = FileObject->PrivateCacheMap;
+    if (PrivateMap == NULL)
+    {
+        return;
+    }
     PrivateMap->ReadAheadMask = Granularity - 1;
 }
@@ -268,7 +268,8 @@ CcCopyData (
     ULONG BytesCopied;
     KIRQL OldIrql;
     PROS_SHARED_CACHE_MAP SharedCacheMap;
-    PLIST_ENTRY ListEntry;
+    PROS_VACB *Slot;
+    ULONG View;
     PROS_VACB Vacb;
     ULONG PartialLength;
     PVOID BaseAddress;
@@ -285,25 +286,18 @@ CcCopyData (
         /* test if the requested data is available */
         KeAcquireSpinLock(&SharedCacheMap->CacheMapLock, &OldIrql);
         /* FIXME: this loop doesn't take into account areas that don't have
-         * a VACB in the list yet */
-        ListEntry = SharedCacheMap->CacheMapVacbListHead.Flink;
-        while (ListEntry != &SharedCacheMap->CacheMapVacbListHead)
+         * a VACB in the index yet */
+        for (View = (ULONG)(CurrentOffset / VACB_MAPPING_GRANULARITY);
+             View <= (ULONG)((CurrentOffset + Length - 1) / VACB_MAPPING_GRANULARITY);
+             View++)
         {
-            Vacb = CONTAINING_RECORD(ListEntry,
-                                     ROS_VACB,
-                                     CacheMapVacbListEntry);
-            ListEntry = ListEntry->Flink;
-            if (!Vacb->Valid &&
-                DoRangesIntersect(Vacb->FileOffset.QuadPart,
-                                  VACB_MAPPING_GRANULARITY,
-                                  CurrentOffset, Length))
+            Slot = CcRosVacbIndexSlot(SharedCacheMap, View);
+            if (Slot != NULL && *Slot != NULL && !(*Slot)->Valid)
             {
                 KeReleaseSpinLock(&SharedCacheMap->CacheMapLock, OldIrql);
                 /* data not available */
                 return FALSE;
             }
-            if (Vacb->FileOffset.QuadPart >= CurrentOffset + Length)
-                break;
         }
         KeReleaseSpinLock(&SharedCacheMap->CacheMapLock, OldIrql);
     }
@@ -387,11 +381,10 @@ CcCopyData (
     /* If that was a successful sync read operation, let's handle read ahead */
     if (Operation == CcOperationRead && Length == 0 && Wait)
     {
-        /* If file isn't random access and next read may get us cross VACB boundary,
-         * schedule next read
+        /* If file isn't random access, let read ahead follow the reader; it
+         * decides itself whether the window needs to be pushed further
          */
-        if (!BooleanFlagOn(FileObject->Flags, FO_RANDOM_ACCESS) &&
-            (CurrentOffset - 1) / VACB_MAPPING_GRANULARITY != (CurrentOffset + BytesCopied - 1) / VACB_MAPPING_GRANULARITY)
+        if (!BooleanFlagOn(FileObject->Flags, FO_RANDOM_ACCESS))
         {
             CcScheduleReadAhead(FileObject, (PLARGE_INTEGER)&FileOffset, BytesCopied);
         }
@@ -497,6 +490,9 @@ CcPerformReadAhead(
     ULONG Length;
     PPRIVATE_CACHE_MAP PrivateCacheMap;
     BOOLEAN Locked;
+    BOOLEAN Done = FALSE;
+    LONGLONG RequestedOffset, PendingOffset, PendingEnd;
+    ULONG RequestedLength;
 
     SharedCacheMap = FileObject->SectionObjectPointer->SharedCacheMap;
 
@@ -519,8 +515,8 @@ CcPerformReadAhead(
     else
     {
         KeAcquireSpinLockAtDpcLevel(&PrivateCacheMap->ReadAheadSpinLock);
-        CurrentOffset = PrivateCacheMap->ReadAheadOffset[1].QuadPart;
-        Length = PrivateCacheMap->ReadAheadLength[1];
+        CurrentOffset = RequestedOffset = PrivateCacheMap->ReadAheadOffset[1].QuadPart;
+        Length = RequestedLength = PrivateCacheMap->ReadAheadLength[1];
         KeReleaseSpinLockFromDpcLevel(&PrivateCacheMap->ReadAheadSpinLock);
     }
     KeReleaseQueuedSpinLock(LockQueueMasterLock, OldIrql);
@@ -537,6 +533,7 @@ CcPerformReadAhead(
     /* Remember it's locked */
     Locked = TRUE;
 
+Next:
     /* Don't read past the end of the file */
     if (CurrentOffset >= SharedCacheMap->FileSize.QuadPart)
     {
@@ -616,14 +613,50 @@ CcPerformReadAhead(
         CurrentOffset += PartialLength;
     }
 
+    /* The whole range was read */
+    Done = TRUE;
+
 Clear:
     /* See previous comment about private cache map */
     OldIrql = KeAcquireQueuedSpinLock(LockQueueMasterLock);
     PrivateCacheMap = FileObject->PrivateCacheMap;
     if (PrivateCacheMap != NULL)
     {
-        /* Mark read ahead as unactive */
         KeAcquireSpinLockAtDpcLevel(&PrivateCacheMap->ReadAheadSpinLock);
+
+        /* If the reader pushed the window further while we were reading,
+         * keep going instead of waiting for another work item. The pending
+         * range was widened to include what we just read, so skip that part.
+         */
+        if (Done &&
+            (PrivateCacheMap->ReadAheadOffset[1].QuadPart != RequestedOffset ||
+             PrivateCacheMap->ReadAheadLength[1] != RequestedLength))
+        {
+            PendingOffset = PrivateCacheMap->ReadAheadOffset[1].QuadPart;
+            PendingEnd = PendingOffset + PrivateCacheMap->ReadAheadLength[1];
+
+            CurrentOffset = PendingOffset;
+            if (PendingOffset >= RequestedOffset &&
+                PendingOffset <= RequestedOffset + RequestedLength)
+            {
+                CurrentOffset = min(RequestedOffset + RequestedLength, PendingEnd);
+            }
+
+            RequestedOffset = PendingOffset;
+            RequestedLength = PrivateCacheMap->ReadAheadLength[1];
+            Length = (ULONG)(PendingEnd - CurrentOffset);
+
+            if (Length != 0)
+            {
+                KeReleaseSpinLockFromDpcLevel(&PrivateCacheMap->ReadAheadSpinLock);
+                KeReleaseQueuedSpinLock(LockQueueMasterLock, OldIrql);
+
+                Done = FALSE;
+                goto Next;
+            }
+        }
+
+        /* Mark read ahead as unactive */
         InterlockedAnd((volatile long *)&PrivateCacheMap->UlongFlags, ~PRIVATE_CACHE_MAP_READ_AHEAD_ACTIVE);
         KeReleaseSpinLockFromDpcLevel(&PrivateCacheMap->ReadAheadSpinLock);
     }
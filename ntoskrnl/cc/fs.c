@@ -168,7 +168,8 @@ CcPurgeCacheSection (
     LONGLONG EndOffset;
     LIST_ENTRY FreeList;
     KIRQL OldIrql;
-    PLIST_ENTRY ListEntry;
+    ULONG View;
+    PROS_VACB *Slot;
     PROS_VACB Vacb;
     LONGLONG ViewEnd;
     BOOLEAN Success;
@@ -203,26 +204,27 @@ CcPurgeCacheSection (
 
     OldIrql = KeAcquireQueuedSpinLock(LockQueueMasterLock);
     KeAcquireSpinLockAtDpcLevel(&SharedCacheMap->CacheMapLock);
-    ListEntry = SharedCacheMap->CacheMapVacbListHead.Flink;
-    while (ListEntry != &SharedCacheMap->CacheMapVacbListHead)
+    /* Walk the views in range, skipping the one only partially in range */
+    for (View = (ULONG)((StartOffset + VACB_MAPPING_GRANULARITY - 1) / VACB_MAPPING_GRANULARITY);
+         View < SharedCacheMap->VacbIndexSize * VACB_INDEX_LEAF_SIZE;
+         View++)
     {
         ULONG Refs;
 
-        Vacb = CONTAINING_RECORD(ListEntry, ROS_VACB, CacheMapVacbListEntry);
-        ListEntry = ListEntry->Flink;
-
-        /* Skip VACBs outside the range, or only partially in range */
-        if (Vacb->FileOffset.QuadPart < StartOffset)
-        {
-            continue;
-        }
-        ViewEnd = min(Vacb->FileOffset.QuadPart + VACB_MAPPING_GRANULARITY,
+        ViewEnd = min((LONGLONG)View * VACB_MAPPING_GRANULARITY + VACB_MAPPING_GRANULARITY,
                       SharedCacheMap->SectionSize.QuadPart);
         if (ViewEnd >= EndOffset)
         {
             break;
         }
 
+        Slot = CcRosVacbIndexSlot(SharedCacheMap, View);
+        if (Slot == NULL || *Slot == NULL)
+        {
+            continue;
+        }
+        Vacb = *Slot;
+
         /* Still in use, it cannot be purged, fail
          * Allow one ref: VACB is supposed to be always 1-referenced
          */
@@ -242,7 +244,7 @@ CcPurgeCacheSection (
         {
             CcRosUnmarkDirtyVacb(Vacb, FALSE);
         }
-        RemoveEntryList(&Vacb->CacheMapVacbListEntry);
+        CcRosRemoveVacbFromCacheMap(Vacb);
         InsertHeadList(&FreeList, &Vacb->CacheMapVacbListEntry);
     }
     KeReleaseSpinLockFromDpcLevel(&SharedCacheMap->CacheMapLock);
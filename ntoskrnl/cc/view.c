@@ -58,6 +58,17 @@ LIST_ENTRY CcDeferredWrites;
 KSPIN_LOCK CcDeferredWriteSpinLock;
 LIST_ENTRY CcCleanSharedCacheMapList;
 
+/* VACB lookup statistics of the shared cache maps which are gone */
+ULONG CcVacbLookups = 0;
+ULONG CcVacbLookupHits = 0;
+ULONGLONG CcVacbLookupLockCycles = 0;
+
+#if defined(_M_IX86) || defined(_M_AMD64)
+#define CcRosReadCycles() __rdtsc()
+#else
+#define CcRosReadCycles() 0ULL
+#endif
+
 #if DBG
 ULONG CcRosVacbIncRefCount_(PROS_VACB vacb, PCSTR file, INT line)
 {
@@ -109,6 +120,153 @@ ULONG CcRosVacbGetRefCount_(PROS_VACB vacb, PCSTR file, INT line)
 
 /* FUNCTIONS *****************************************************************/
 
+/* Returns the index slot of a view, or NULL if the index doesn't cover it yet.
+ * Must be called with the cache map lock held. */
+PROS_VACB*
+CcRosVacbIndexSlot (
+    PROS_SHARED_CACHE_MAP SharedCacheMap,
+    ULONG ViewNumber)
+{
+    ULONG Leaf = ViewNumber / VACB_INDEX_LEAF_SIZE;
+
+    if (Leaf >= SharedCacheMap->VacbIndexSize ||
+        SharedCacheMap->VacbIndex[Leaf] == NULL)
+    {
+        return NULL;
+    }
+
+    return &SharedCacheMap->VacbIndex[Leaf][ViewNumber % VACB_INDEX_LEAF_SIZE];
+}
+
+/* Makes sure the VACB index has a slot for the view at FileOffset */
+static
+NTSTATUS
+CcRosGrowVacbIndex (
+    PROS_SHARED_CACHE_MAP SharedCacheMap,
+    LONGLONG FileOffset)
+{
+    ULONG Leaf, NewSize;
+    BOOLEAN GrowIndex;
+    PROS_VACB **NewIndex = NULL, **OldIndex = NULL;
+    PROS_VACB *NewLeaf = NULL;
+    KIRQL OldIrql;
+
+    Leaf = (ULONG)(FileOffset / VACB_MAPPING_GRANULARITY) / VACB_INDEX_LEAF_SIZE;
+
+    /* The index never shrinks, so once the leaf is there we are done */
+    KeAcquireSpinLock(&SharedCacheMap->CacheMapLock, &OldIrql);
+    GrowIndex = (Leaf >= SharedCacheMap->VacbIndexSize);
+    if (!GrowIndex && SharedCacheMap->VacbIndex[Leaf] != NULL)
+    {
+        KeReleaseSpinLock(&SharedCacheMap->CacheMapLock, OldIrql);
+        return STATUS_SUCCESS;
+    }
+    KeReleaseSpinLock(&SharedCacheMap->CacheMapLock, OldIrql);
+
+    /* Allocate outside of the lock; size the top level for the whole section */
+    NewSize = 0;
+    if (GrowIndex)
+    {
+        NewSize = (ULONG)(SharedCacheMap->SectionSize.QuadPart /
+                          ((LONGLONG)VACB_MAPPING_GRANULARITY * VACB_INDEX_LEAF_SIZE)) + 1;
+        NewSize = max(NewSize, Leaf + 1);
+        NewIndex = ExAllocatePoolWithTag(NonPagedPool, NewSize * sizeof(*NewIndex), TAG_VACB_INDEX);
+        if (NewIndex == NULL)
+        {
+            return STATUS_INSUFFICIENT_RESOURCES;
+        }
+        RtlZeroMemory(NewIndex, NewSize * sizeof(*NewIndex));
+    }
+    NewLeaf = ExAllocatePoolWithTag(NonPagedPool, VACB_INDEX_LEAF_SIZE * sizeof(*NewLeaf), TAG_VACB_INDEX);
+    if (NewLeaf == NULL)
+    {
+        if (NewIndex != NULL)
+        {
+            ExFreePoolWithTag(NewIndex, TAG_VACB_INDEX);
+        }
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+    RtlZeroMemory(NewLeaf, VACB_INDEX_LEAF_SIZE * sizeof(*NewLeaf));
+
+    KeAcquireSpinLock(&SharedCacheMap->CacheMapLock, &OldIrql);
+    if (NewIndex != NULL && NewSize > SharedCacheMap->VacbIndexSize)
+    {
+        if (SharedCacheMap->VacbIndex != NULL)
+        {
+            RtlCopyMemory(NewIndex,
+                          SharedCacheMap->VacbIndex,
+                          SharedCacheMap->VacbIndexSize * sizeof(*NewIndex));
+        }
+        OldIndex = SharedCacheMap->VacbIndex;
+        SharedCacheMap->VacbIndex = NewIndex;
+        SharedCacheMap->VacbIndexSize = NewSize;
+        NewIndex = NULL;
+    }
+    if (SharedCacheMap->VacbIndex[Leaf] == NULL)
+    {
+        SharedCacheMap->VacbIndex[Leaf] = NewLeaf;
+        NewLeaf = NULL;
+    }
+    KeReleaseSpinLock(&SharedCacheMap->CacheMapLock, OldIrql);
+
+    /* Free whatever we lost a race for or replaced */
+    if (OldIndex != NULL)
+    {
+        ExFreePoolWithTag(OldIndex, TAG_VACB_INDEX);
+    }
+    if (NewIndex != NULL)
+    {
+        ExFreePoolWithTag(NewIndex, TAG_VACB_INDEX);
+    }
+    if (NewLeaf != NULL)
+    {
+        ExFreePoolWithTag(NewLeaf, TAG_VACB_INDEX);
+    }
+
+    return STATUS_SUCCESS;
+}
+
+static
+VOID
+CcRosFreeVacbIndex (
+    PROS_SHARED_CACHE_MAP SharedCacheMap)
+{
+    ULONG i;
+
+    if (SharedCacheMap->VacbIndex == NULL)
+    {
+        return;
+    }
+
+    for (i = 0; i < SharedCacheMap->VacbIndexSize; i++)
+    {
+        if (SharedCacheMap->VacbIndex[i] != NULL)
+        {
+            ExFreePoolWithTag(SharedCacheMap->VacbIndex[i], TAG_VACB_INDEX);
+        }
+    }
+    ExFreePoolWithTag(SharedCacheMap->VacbIndex, TAG_VACB_INDEX);
+
+    SharedCacheMap->VacbIndex = NULL;
+    SharedCacheMap->VacbIndexSize = 0;
+}
+
+/* Unlinks a VACB from its shared cache map. Must be called with the cache map
+ * lock held. */
+VOID
+CcRosRemoveVacbFromCacheMap (
+    PROS_VACB Vacb)
+{
+    PROS_VACB *Slot;
+
+    Slot = CcRosVacbIndexSlot(Vacb->SharedCacheMap,
+                              (ULONG)(Vacb->FileOffset.QuadPart / VACB_MAPPING_GRANULARITY));
+    ASSERT(Slot != NULL && *Slot == Vacb);
+    *Slot = NULL;
+
+    RemoveEntryList(&Vacb->CacheMapVacbListEntry);
+}
+
 VOID
 NTAPI
 CcRosTraceCacheMap (
@@ -359,7 +517,7 @@ retry:
             ASSERT(!current->MappedCount);
             ASSERT(Refs == 1);
 
-            RemoveEntryList(&current->CacheMapVacbListEntry);
+            CcRosRemoveVacbFromCacheMap(current);
             RemoveEntryList(&current->VacbLruListEntry);
             InitializeListHead(&current->VacbLruListEntry);
             InsertHeadList(&FreeList, &current->CacheMapVacbListEntry);
@@ -448,15 +606,15 @@ CcRosReleaseVacb (
     return STATUS_SUCCESS;
 }
 
-/* Returns with VACB Lock Held! */
 PROS_VACB
 NTAPI
 CcRosLookupVacb (
     PROS_SHARED_CACHE_MAP SharedCacheMap,
     LONGLONG FileOffset)
 {
-    PLIST_ENTRY current_entry;
-    PROS_VACB current;
+    PROS_VACB *Slot;
+    PROS_VACB current = NULL;
+    ULONGLONG Start;
     KIRQL oldIrql;
 
     ASSERT(SharedCacheMap);
@@ -464,33 +622,26 @@ CcRosLookupVacb (
     DPRINT("CcRosLookupVacb(SharedCacheMap 0x%p, FileOffset %I64u)\n",
            SharedCacheMap, FileOffset);
 
-    oldIrql = KeAcquireQueuedSpinLock(LockQueueMasterLock);
-    KeAcquireSpinLockAtDpcLevel(&SharedCacheMap->CacheMapLock);
+    /* The index is protected by the cache map lock alone, no need for the master lock */
+    KeAcquireSpinLock(&SharedCacheMap->CacheMapLock, &oldIrql);
+    Start = CcRosReadCycles();
 
-    current_entry = SharedCacheMap->CacheMapVacbListHead.Flink;
-    while (current_entry != &SharedCacheMap->CacheMapVacbListHead)
+    Slot = CcRosVacbIndexSlot(SharedCacheMap, (ULONG)(FileOffset / VACB_MAPPING_GRANULARITY));
+    if (Slot != NULL && *Slot != NULL)
     {
-        current = CONTAINING_RECORD(current_entry,
-                                    ROS_VACB,
-                                    CacheMapVacbListEntry);
-        if (IsPointInRange(current->FileOffset.QuadPart,
-                           VACB_MAPPING_GRANULARITY,
-                           FileOffset))
-        {
-            CcRosVacbIncRefCount(current);
-            KeReleaseSpinLockFromDpcLevel(&SharedCacheMap->CacheMapLock);
-            KeReleaseQueuedSpinLock(LockQueueMasterLock, oldIrql);
-            return current;
-        }
-        if (current->FileOffset.QuadPart > FileOffset)
-            break;
-        current_entry = current_entry->Flink;
+        current = *Slot;
+        ASSERT(IsPointInRange(current->FileOffset.QuadPart,
+                              VACB_MAPPING_GRANULARITY,
+                              FileOffset));
+        CcRosVacbIncRefCount(current);
+        SharedCacheMap->VacbLookupHits++;
     }
+    SharedCacheMap->VacbLookups++;
 
-    KeReleaseSpinLockFromDpcLevel(&SharedCacheMap->CacheMapLock);
-    KeReleaseQueuedSpinLock(LockQueueMasterLock, oldIrql);
+    SharedCacheMap->VacbLookupLockCycles += CcRosReadCycles() - Start;
+    KeReleaseSpinLock(&SharedCacheMap->CacheMapLock, oldIrql);
 
-    return NULL;
+    return current;
 }
 
 VOID
@@ -729,7 +880,7 @@ CcRosFreeUnusedVacb (
             ASSERT(Refs == 1);
 
             /* Reset and move to free list */
-            RemoveEntryList(&current->CacheMapVacbListEntry);
+            CcRosRemoveVacbFromCacheMap(current);
             RemoveEntryList(&current->VacbLruListEntry);
             InitializeListHead(&current->VacbLruListEntry);
             InsertHeadList(&FreeList, &current->CacheMapVacbListEntry);
@@ -779,8 +930,7 @@ CcRosCreateVacb (
     PROS_VACB *Vacb)
 {
     PROS_VACB current;
-    PROS_VACB previous;
-    PLIST_ENTRY current_entry;
+    PROS_VACB *Slot;
     NTSTATUS Status;
     KIRQL oldIrql;
     ULONG Refs;
@@ -840,6 +990,16 @@ Retry:
         return Status;
     }
 
+    /* Make room for the VACB in the index before taking the locks */
+    Status = CcRosGrowVacbIndex(SharedCacheMap, FileOffset);
+    if (!NT_SUCCESS(Status))
+    {
+        Refs = CcRosVacbDecRefCount(current);
+        ASSERT(Refs == 0);
+        *Vacb = NULL;
+        return Status;
+    }
+
     oldIrql = KeAcquireQueuedSpinLock(LockQueueMasterLock);
 
     *Vacb = current;
@@ -849,56 +1009,34 @@ Retry:
      * our newly created VACB and return the existing one.
      */
     KeAcquireSpinLockAtDpcLevel(&SharedCacheMap->CacheMapLock);
-    current_entry = SharedCacheMap->CacheMapVacbListHead.Flink;
-    previous = NULL;
-    while (current_entry != &SharedCacheMap->CacheMapVacbListHead)
+    Slot = CcRosVacbIndexSlot(SharedCacheMap, (ULONG)(FileOffset / VACB_MAPPING_GRANULARITY));
+    ASSERT(Slot != NULL);
+    if (*Slot != NULL)
     {
-        current = CONTAINING_RECORD(current_entry,
-                                    ROS_VACB,
-                                    CacheMapVacbListEntry);
-        if (IsPointInRange(current->FileOffset.QuadPart,
-                           VACB_MAPPING_GRANULARITY,
-                           FileOffset))
-        {
-            CcRosVacbIncRefCount(current);
-            KeReleaseSpinLockFromDpcLevel(&SharedCacheMap->CacheMapLock);
+        current = *Slot;
+        CcRosVacbIncRefCount(current);
+        KeReleaseSpinLockFromDpcLevel(&SharedCacheMap->CacheMapLock);
 #if DBG
-            if (SharedCacheMap->Trace)
-            {
-                DPRINT1("CacheMap 0x%p: deleting newly created VACB 0x%p ( found existing one 0x%p )\n",
-                        SharedCacheMap,
-                        (*Vacb),
-                        current);
-            }
+        if (SharedCacheMap->Trace)
+        {
+            DPRINT1("CacheMap 0x%p: deleting newly created VACB 0x%p ( found existing one 0x%p )\n",
+                    SharedCacheMap,
+                    (*Vacb),
+                    current);
+        }
 #endif
-            KeReleaseQueuedSpinLock(LockQueueMasterLock, oldIrql);
+        KeReleaseQueuedSpinLock(LockQueueMasterLock, oldIrql);
 
-            Refs = CcRosVacbDecRefCount(*Vacb);
-            ASSERT(Refs == 0);
+        Refs = CcRosVacbDecRefCount(*Vacb);
+        ASSERT(Refs == 0);
 
-            *Vacb = current;
-            return STATUS_SUCCESS;
-        }
-        if (current->FileOffset.QuadPart < FileOffset)
-        {
-            ASSERT(previous == NULL ||
-                   previous->FileOffset.QuadPart < current->FileOffset.QuadPart);
-            previous = current;
-        }
-        if (current->FileOffset.QuadPart > FileOffset)
-            break;
-        current_entry = current_entry->Flink;
+        *Vacb = current;
+        return STATUS_SUCCESS;
     }
     /* There was no existing VACB. */
     current = *Vacb;
-    if (previous)
-    {
-        InsertHeadList(&previous->CacheMapVacbListEntry, &current->CacheMapVacbListEntry);
-    }
-    else
-    {
-        InsertHeadList(&SharedCacheMap->CacheMapVacbListHead, &current->CacheMapVacbListEntry);
-    }
+    *Slot = current;
+    InsertTailList(&SharedCacheMap->CacheMapVacbListHead, &current->CacheMapVacbListEntry);
     KeReleaseSpinLockFromDpcLevel(&SharedCacheMap->CacheMapLock);
     InsertTailList(&VacbLruListHead, &current->VacbLruListEntry);
     KeReleaseQueuedSpinLock(LockQueueMasterLock, oldIrql);
@@ -1184,10 +1322,11 @@ CcRosDeleteFileCache (
         KeAcquireSpinLockAtDpcLevel(&SharedCacheMap->CacheMapLock);
         while (!IsListEmpty(&SharedCacheMap->CacheMapVacbListHead))
         {
-            current_entry = RemoveTailList(&SharedCacheMap->CacheMapVacbListHead);
+            current_entry = SharedCacheMap->CacheMapVacbListHead.Blink;
+            current = CONTAINING_RECORD(current_entry, ROS_VACB, CacheMapVacbListEntry);
+            CcRosRemoveVacbFromCacheMap(current);
             KeReleaseSpinLockFromDpcLevel(&SharedCacheMap->CacheMapLock);
 
-            current = CONTAINING_RECORD(current_entry, ROS_VACB, CacheMapVacbListEntry);
             RemoveEntryList(&current->VacbLruListEntry);
             InitializeListHead(&current->VacbLruListEntry);
             if (current->Dirty)
@@ -1210,6 +1349,10 @@ CcRosDeleteFileCache (
 #if DBG
         SharedCacheMap->Trace = FALSE;
 #endif
+        /* Keep the lookup statistics of the file in the totals */
+        CcVacbLookups += SharedCacheMap->VacbLookups;
+        CcVacbLookupHits += SharedCacheMap->VacbLookupHits;
+        CcVacbLookupLockCycles += SharedCacheMap->VacbLookupLockCycles;
         KeReleaseSpinLockFromDpcLevel(&SharedCacheMap->CacheMapLock);
 
         KeReleaseQueuedSpinLock(LockQueueMasterLock, *OldIrql);
@@ -1255,6 +1398,7 @@ CcRosDeleteFileCache (
         RemoveEntryList(&SharedCacheMap->SharedCacheMapLinks);
         KeReleaseQueuedSpinLock(LockQueueMasterLock, *OldIrql);
 
+        CcRosFreeVacbIndex(SharedCacheMap);
         ExFreeToNPagedLookasideList(&SharedCacheMapLookasideList, SharedCacheMap);
         *OldIrql = KeAcquireQueuedSpinLock(LockQueueMasterLock);
     }
@@ -1360,7 +1504,7 @@ CcRosReleaseFileCache (
             KeReleaseSpinLockFromDpcLevel(&SharedCacheMap->CacheMapLock);
 
             /* And free it. */
-            if (PrivateMap != &SharedCacheMap->PrivateCacheMap)
+            if (PrivateMap != &SharedCacheMap->PrivateCacheMap.Map)
             {
                 ExFreePoolWithTag(PrivateMap, TAG_PRIVATE_CACHE_MAP);
             }
@@ -1459,13 +1603,13 @@ CcRosInitializeFileCache (
         PPRIVATE_CACHE_MAP PrivateMap;
 
         /* Allocate the private cache map for this handle */
-        if (SharedCacheMap->PrivateCacheMap.NodeTypeCode != 0)
+        if (SharedCacheMap->PrivateCacheMap.Map.NodeTypeCode != 0)
         {
-            PrivateMap = ExAllocatePoolWithTag(NonPagedPool, sizeof(PRIVATE_CACHE_MAP), TAG_PRIVATE_CACHE_MAP);
+            PrivateMap = ExAllocatePoolWithTag(NonPagedPool, sizeof(ROS_PRIVATE_CACHE_MAP), TAG_PRIVATE_CACHE_MAP);
         }
         else
         {
-            PrivateMap = &SharedCacheMap->PrivateCacheMap;
+            PrivateMap = &SharedCacheMap->PrivateCacheMap.Map;
         }
 
         if (PrivateMap == NULL)
@@ -1485,7 +1629,7 @@ CcRosInitializeFileCache (
         }
 
         /* Initialize it */
-        RtlZeroMemory(PrivateMap, sizeof(PRIVATE_CACHE_MAP));
+        RtlZeroMemory(PrivateMap, sizeof(ROS_PRIVATE_CACHE_MAP));
         PrivateMap->NodeTypeCode = NODE_TYPE_PRIVATE_MAP;
         PrivateMap->ReadAheadMask = PAGE_SIZE - 1;
         PrivateMap->FileObject = FileObject;
@@ -1571,16 +1715,20 @@ ExpKdbgExtFileCache(ULONG Argc, PCHAR Argv[])
 {
     PLIST_ENTRY ListEntry;
     UNICODE_STRING NoName = RTL_CONSTANT_STRING(L"No name for File");
+    ULONG Lookups = CcVacbLookups, Hits = CcVacbLookupHits;
+    ULONGLONG LockCycles = CcVacbLookupLockCycles;
 
     KdbpPrint("  Usage Summary (in kb)\n");
-    KdbpPrint("Shared\t\tValid\tDirty\tName\n");
+    KdbpPrint("Shared\t\tValid\tDirty\tLookups\tHits\tReads\tRA hits\tRA kb\tName\n");
     /* No need to lock the spin lock here, we're in DBG */
     for (ListEntry = CcCleanSharedCacheMapList.Flink;
          ListEntry != &CcCleanSharedCacheMapList;
          ListEntry = ListEntry->Flink)
     {
-        PLIST_ENTRY Vacbs;
+        PLIST_ENTRY Vacbs, PrivateMaps;
         ULONG Valid = 0, Dirty = 0;
+        ULONG Reads = 0, ReadAheadHits = 0;
+        ULONGLONG ReadAheadBytes = 0;
         PROS_SHARED_CACHE_MAP SharedCacheMap;
         PUNICODE_STRING FileName;
         PWSTR Extra = L"";
@@ -1604,6 +1752,19 @@ ExpKdbgExtFileCache(ULONG Argc, PCHAR Argv[])
             }
         }
 
+        /* Sum up the read ahead statistics of every handle */
+        for (PrivateMaps = SharedCacheMap->PrivateList.Flink;
+             PrivateMaps != &SharedCacheMap->PrivateList;
+             PrivateMaps = PrivateMaps->Flink)
+        {
+            PROS_PRIVATE_CACHE_MAP PrivateMap;
+
+            PrivateMap = CONTAINING_RECORD(PrivateMaps, ROS_PRIVATE_CACHE_MAP, Map.PrivateLinks);
+            Reads += PrivateMap->Reads;
+            ReadAheadHits += PrivateMap->ReadAheadHits;
+            ReadAheadBytes += PrivateMap->ReadAheadBytes;
+        }
+
         /* Setup name */
         if (SharedCacheMap->FileObject != NULL &&
             SharedCacheMap->FileObject->FileName.Length != 0)
@@ -1625,9 +1786,21 @@ ExpKdbgExtFileCache(ULONG Argc, PCHAR Argv[])
         }
 
         /* And print */
-        KdbpPrint("%p\t%d\t%d\t%wZ%S\n", SharedCacheMap, Valid, Dirty, FileName, Extra);
+        KdbpPrint("%p\t%d\t%d\t%lu\t%lu\t%lu\t%lu\t%I64u\t%wZ%S\n", SharedCacheMap, Valid, Dirty,
+                  SharedCacheMap->VacbLookups, SharedCacheMap->VacbLookupHits,
+                  Reads, ReadAheadHits, ReadAheadBytes / 1024, FileName, Extra);
+
+        Lookups += SharedCacheMap->VacbLookups;
+        Hits += SharedCacheMap->VacbLookupHits;
+        LockCycles += SharedCacheMap->VacbLookupLockCycles;
     }
 
+    /* Totals, including the files which aren't cached anymore */
+    KdbpPrint("\n  VACB lookups: %lu, hits: %lu (%lu%%)\n", Lookups, Hits,
+              Lookups ? (ULONG)(((ULONGLONG)Hits * 100) / Lookups) : 0);
+    KdbpPrint("  Cache map lock held for %I64u cycles, %I64u per lookup\n", LockCycles,
+              Lookups ? LockCycles / Lookups : 0);
+
     return TRUE;
 }
 
@@ -45,14 +45,19 @@ ExpLookupHandleTableEntry(IN PHANDLE_TABLE HandleTable,
     /* Clear the tag bits */
     Handle.TagBits = 0;
 
-    /* Check if the handle is in the allocated range */
-    if (Handle.Value >= HandleTable->NextHandleNeedingPool)
+    /*
+     * This path takes no lock. The table only ever grows: new levels are
+     * published before NextHandleNeedingPool is raised past them, so reading
+     * the limit first guarantees that every pointer we walk below exists.
+     */
+    if (Handle.Value >= *(volatile ULONG *)&HandleTable->NextHandleNeedingPool)
     {
         return NULL;
     }
+    KeMemoryBarrierWithoutFence();
 
     /* Get the table code */
-    TableBase = HandleTable->TableCode;
+    TableBase = *(volatile ULONG_PTR *)&HandleTable->TableCode;
 
     /* Extract the table level and actual table base */
     TableLevel = (ULONG)(TableBase & 3);
@@ -67,14 +72,14 @@ ExpLookupHandleTableEntry(IN PHANDLE_TABLE HandleTable,
         case 2:
 
             /* Get the mid level pointer array */
-            PointerArray = PointerArray[Handle.HighIndex];
+            PointerArray = ((PVOID volatile *)PointerArray)[Handle.HighIndex];
             ASSERT(PointerArray != NULL);
 
             /* Fall through */
         case 1:
 
             /* Get the handle array */
-            HandleArray = PointerArray[Handle.MidIndex];
+            HandleArray = ((PVOID volatile *)PointerArray)[Handle.MidIndex];
             ASSERT(HandleArray != NULL);
 
             /* Fall through */
@@ -96,6 +101,87 @@ ExpLookupHandleTableEntry(IN PHANDLE_TABLE HandleTable,
     return Entry;
 }
 
+C_ASSERT(sizeof(HANDLE_TABLE_FREE_CACHE) == SYSTEM_CACHE_ALIGNMENT_SIZE);
+
+static
+PHANDLE_TABLE_FREE_CACHE
+ExpGetCurrentFreeHandleCache(IN PHANDLE_TABLE HandleTable)
+{
+    PHANDLE_TABLE_PRIVATE PrivateTable = ExpGetPrivateHandleTable(HandleTable);
+    ULONG Processor = KeGetCurrentProcessorNumber();
+    ASSERT(KeGetCurrentIrql() >= DISPATCH_LEVEL);
+
+    /* Processors the table was not sized for just use the table free list */
+    if (Processor >= PrivateTable->FreeHandleCacheCount) return NULL;
+    return &PrivateTable->FreeHandleCache[Processor];
+}
+
+static
+BOOLEAN
+ExpPopCachedFreeHandle(IN PHANDLE_TABLE HandleTable,
+                       OUT PEXHANDLE Handle)
+{
+    PHANDLE_TABLE_FREE_CACHE Cache;
+    BOOLEAN Found = FALSE;
+    KIRQL OldIrql;
+
+    /* Strict FIFO tables must hand out handles in order */
+    if (!(ExpGetFreeHandleCache(HandleTable)) || (HandleTable->StrictFIFO)) return FALSE;
+
+    /* Stay on this processor while we touch its cache */
+    OldIrql = KeRaiseIrqlToDpcLevel();
+    Cache = ExpGetCurrentFreeHandleCache(HandleTable);
+    if (!Cache)
+    {
+        KeLowerIrql(OldIrql);
+        return FALSE;
+    }
+    KeAcquireSpinLockAtDpcLevel(&Cache->Lock);
+    if (Cache->Count)
+    {
+        /* Take the most recently freed handle, its entry is likely still hot */
+        Handle->Value = Cache->Handles[--Cache->Count];
+        Found = TRUE;
+    }
+    KeReleaseSpinLockFromDpcLevel(&Cache->Lock);
+    KeLowerIrql(OldIrql);
+
+    return Found;
+}
+
+static
+BOOLEAN
+ExpPushCachedFreeHandle(IN PHANDLE_TABLE HandleTable,
+                        IN EXHANDLE Handle)
+{
+    PHANDLE_TABLE_FREE_CACHE Cache;
+    BOOLEAN Cached = FALSE;
+    KIRQL OldIrql;
+
+    /* Strict FIFO tables must hand out handles in order */
+    if (!(ExpGetFreeHandleCache(HandleTable)) || (HandleTable->StrictFIFO)) return FALSE;
+
+    /* Stay on this processor while we touch its cache */
+    OldIrql = KeRaiseIrqlToDpcLevel();
+    Cache = ExpGetCurrentFreeHandleCache(HandleTable);
+    if (!Cache)
+    {
+        KeLowerIrql(OldIrql);
+        return FALSE;
+    }
+    KeAcquireSpinLockAtDpcLevel(&Cache->Lock);
+    if (Cache->Count < HANDLE_FREE_CACHE_ENTRIES)
+    {
+        /* Keep it here, the table free list is only used once this fills up */
+        Cache->Handles[Cache->Count++] = Handle.AsULONG;
+        Cached = TRUE;
+    }
+    KeReleaseSpinLockFromDpcLevel(&Cache->Lock);
+    KeLowerIrql(OldIrql);
+
+    return Cached;
+}
+
 PVOID
 NTAPI
 ExpAllocateTablePagedPool(IN PEPROCESS Process OPTIONAL,
@@ -244,34 +330,31 @@ ExpFreeHandleTable(IN PHANDLE_TABLE HandleTable)
                               SizeOfHandle(HIGH_LEVEL_ENTRIES));
     }
 
+    /* Free the per-processor free handle caches */
+    if (ExpGetPrivateHandleTable(HandleTable)->FreeHandleCacheBlock)
+    {
+        ExFreePoolWithTag(ExpGetPrivateHandleTable(HandleTable)->FreeHandleCacheBlock,
+                          TAG_OBJECT_TABLE);
+    }
+
     /* Free the actual table and check if we need to release quota */
-    ExFreePoolWithTag(HandleTable, TAG_OBJECT_TABLE);
+    ExFreePoolWithTag(ExpGetPrivateHandleTable(HandleTable), TAG_OBJECT_TABLE);
     if (Process)
     {
         /* FIXME: TODO */
     }
 }
 
+static
 VOID
-NTAPI
-ExpFreeHandleTableEntry(IN PHANDLE_TABLE HandleTable,
-                        IN EXHANDLE Handle,
-                        IN PHANDLE_TABLE_ENTRY HandleTableEntry)
+ExpInsertFreeHandle(IN PHANDLE_TABLE HandleTable,
+                    IN EXHANDLE Handle,
+                    IN PHANDLE_TABLE_ENTRY HandleTableEntry)
 {
     ULONG OldValue, *Free;
     ULONG LockIndex;
     PAGED_CODE();
 
-    /* Sanity checks */
-    ASSERT(HandleTableEntry->Object == NULL);
-    ASSERT(HandleTableEntry == ExpLookupHandleTableEntry(HandleTable, Handle));
-
-    /* Decrement the handle count */
-    InterlockedDecrement(&HandleTable->HandleCount);
-
-    /* Mark the handle as free */
-    Handle.TagBits = 0;
-
     /* Check if we're FIFO */
     if (!HandleTable->StrictFIFO)
     {
@@ -304,21 +387,90 @@ ExpFreeHandleTableEntry(IN PHANDLE_TABLE HandleTable,
     }
 }
 
+static
+BOOLEAN
+ExpDrainFreeHandleCaches(IN PHANDLE_TABLE HandleTable)
+{
+    PHANDLE_TABLE_PRIVATE PrivateTable = ExpGetPrivateHandleTable(HandleTable);
+    PHANDLE_TABLE_FREE_CACHE Cache = PrivateTable->FreeHandleCache;
+    ULONG Handles[HANDLE_FREE_CACHE_ENTRIES];
+    ULONG Count, i, j;
+    BOOLEAN Drained = FALSE;
+    EXHANDLE Handle;
+    KIRQL OldIrql;
+    PAGED_CODE();
+
+    if (!Cache) return FALSE;
+
+    /* Loop every processor's cache */
+    for (i = 0; i < PrivateTable->FreeHandleCacheCount; i++)
+    {
+        /* Empty it under its lock, the entries themselves are pageable */
+        KeAcquireSpinLock(&Cache[i].Lock, &OldIrql);
+        Count = Cache[i].Count;
+        RtlCopyMemory(Handles, Cache[i].Handles, Count * sizeof(ULONG));
+        Cache[i].Count = 0;
+        KeReleaseSpinLock(&Cache[i].Lock, OldIrql);
+
+        /* Give the handles back to the table free list */
+        for (j = 0; j < Count; j++)
+        {
+            Handle.GenericHandleOverlay = NULL;
+            Handle.Value = Handles[j];
+            ExpInsertFreeHandle(HandleTable,
+                                Handle,
+                                ExpLookupHandleTableEntry(HandleTable, Handle));
+            Drained = TRUE;
+        }
+    }
+
+    return Drained;
+}
+
+VOID
+NTAPI
+ExpFreeHandleTableEntry(IN PHANDLE_TABLE HandleTable,
+                        IN EXHANDLE Handle,
+                        IN PHANDLE_TABLE_ENTRY HandleTableEntry)
+{
+    PAGED_CODE();
+
+    /* Sanity checks */
+    ASSERT(HandleTableEntry->Object == NULL);
+    ASSERT(HandleTableEntry == ExpLookupHandleTableEntry(HandleTable, Handle));
+
+    /* Decrement the handle count */
+    InterlockedDecrement(&HandleTable->HandleCount);
+
+    /* Mark the handle as free */
+    Handle.TagBits = 0;
+
+    /* Keep it on this processor if its cache has room */
+    if (ExpPushCachedFreeHandle(HandleTable, Handle)) return;
+
+    /* Otherwise put it on the table free list */
+    ExpInsertFreeHandle(HandleTable, Handle, HandleTableEntry);
+}
+
 PHANDLE_TABLE
 NTAPI
 ExpAllocateHandleTable(IN PEPROCESS Process OPTIONAL,
                        IN BOOLEAN NewTable)
 {
+    PHANDLE_TABLE_PRIVATE PrivateTable;
     PHANDLE_TABLE HandleTable;
+    PHANDLE_TABLE_FREE_CACHE Cache;
     PHANDLE_TABLE_ENTRY HandleTableTable, HandleEntry;
-    ULONG i;
+    ULONG i, CacheCount;
+    PVOID CacheBlock;
     PAGED_CODE();
 
-    /* Allocate the table */
-    HandleTable = ExAllocatePoolWithTag(PagedPool,
-                                        sizeof(HANDLE_TABLE),
-                                        TAG_OBJECT_TABLE);
-    if (!HandleTable) return NULL;
+    /* Allocate the table along with its private part */
+    PrivateTable = ExAllocatePoolWithTag(PagedPool,
+                                         sizeof(HANDLE_TABLE_PRIVATE),
+                                         TAG_OBJECT_TABLE);
+    if (!PrivateTable) return NULL;
+    HandleTable = &PrivateTable->Table;
 
     /* Check if we have a process */
     if (Process)
@@ -327,14 +479,14 @@ ExpAllocateHandleTable(IN PEPROCESS Process OPTIONAL,
     }
 
     /* Clear the table */
-    RtlZeroMemory(HandleTable, sizeof(HANDLE_TABLE));
+    RtlZeroMemory(PrivateTable, sizeof(HANDLE_TABLE_PRIVATE));
 
     /* Now allocate the first level structures */
     HandleTableTable = ExpAllocateTablePagedPoolNoZero(Process, PAGE_SIZE);
     if (!HandleTableTable)
     {
         /* Failed, free the table */
-        ExFreePoolWithTag(HandleTable, TAG_OBJECT_TABLE);
+        ExFreePoolWithTag(PrivateTable, TAG_OBJECT_TABLE);
         return NULL;
     }
 
@@ -384,6 +536,32 @@ ExpAllocateHandleTable(IN PEPROCESS Process OPTIONAL,
         ExInitializePushLock(&HandleTable->HandleTableLock[i]);
     }
 
+    /*
+     * Allocate the per-processor free handle caches. They are touched at
+     * DISPATCH_LEVEL so they must be nonpaged; the table works without them.
+     * Tables created in phase 0 (the kernel handle table and the CID table)
+     * exist before the other processors are started, so KeNumberProcessors
+     * is still 1 and they get a cache for every possible processor instead.
+     */
+    CacheCount = ExpInitializationPhase ? KeNumberProcessors : MAXIMUM_PROCESSORS;
+    CacheBlock = ExAllocatePoolWithTag(NonPagedPool,
+                                       (CacheCount + 1) * sizeof(HANDLE_TABLE_FREE_CACHE),
+                                       TAG_OBJECT_TABLE);
+    if (CacheBlock)
+    {
+        /* Pool does not honour cache alignment, so align the array ourselves */
+        Cache = (PVOID)ALIGN_UP_BY(CacheBlock, SYSTEM_CACHE_ALIGNMENT_SIZE);
+        RtlZeroMemory(Cache, CacheCount * sizeof(HANDLE_TABLE_FREE_CACHE));
+        for (i = 0; i < CacheCount; i++)
+        {
+            KeInitializeSpinLock(&Cache[i].Lock);
+        }
+
+        PrivateTable->FreeHandleCache = Cache;
+        PrivateTable->FreeHandleCacheCount = CacheCount;
+        PrivateTable->FreeHandleCacheBlock = CacheBlock;
+    }
+
     /* Initialize the contention event lock and return the lock */
     ExInitializePushLock(&HandleTable->HandleContentionEvent);
     return HandleTable;
@@ -653,6 +831,17 @@ ExpAllocateHandleTableEntry(IN PHANDLE_TABLE HandleTable,
     BOOLEAN Result;
     ULONG i;
 
+    /* Try a handle recently freed on this processor first */
+    if (ExpPopCachedFreeHandle(HandleTable, &Handle))
+    {
+        /* No table lock or shared free list is involved on this path */
+        Entry = ExpLookupHandleTableEntry(HandleTable, Handle);
+        ASSERT(Entry->Object == NULL);
+        InterlockedIncrement(&HandleTable->HandleCount);
+        *NewHandle = Handle;
+        return Entry;
+    }
+
     /* Start allocation loop */
     for (;;)
     {
@@ -684,6 +873,20 @@ ExpAllocateHandleTableEntry(IN PHANDLE_TABLE HandleTable,
                 break;
             }
 
+            /* Reuse the handles other processors have cached before growing */
+            if (ExpDrainFreeHandleCaches(HandleTable))
+            {
+                /* They went to either end of the free list, take them from there */
+                OldValue = HandleTable->FirstFree;
+                if (!OldValue) OldValue = ExpMoveFreeHandles(HandleTable);
+                if (OldValue)
+                {
+                    ExReleasePushLockExclusive(&HandleTable->HandleTableLock[0]);
+                    KeLeaveCriticalRegion();
+                    break;
+                }
+            }
+
             /* We're the first one through, so do the actual allocation */
             Result = ExpAllocateHandleTableEntrySlow(HandleTable, TRUE);
 
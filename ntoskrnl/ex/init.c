@@ -658,6 +658,9 @@ BOOLEAN
 NTAPI
 ExpInitSystemPhase1(VOID)
 {
+    /* All processors are up, give them their own pool tag counters */
+    ExpInitializePoolTrackerTables();
+
     /* Initialize worker threads */
     ExpInitializeWorkerThreads();
 
@@ -695,17 +695,21 @@ QSI_DEF(SystemPerformanceInformation)
     Spi->IoReadOperationCount = IoReadOperationCount;
     Spi->IoWriteOperationCount = IoWriteOperationCount;
     Spi->IoOtherOperationCount = IoOtherOperationCount;
+    Spi->DemandZeroCount = 0;
+    Spi->PageFaultCount = 0;
     for (i = 0; i < KeNumberProcessors; i ++)
     {
         Prcb = KiProcessorBlock[i];
         if (Prcb)
         {
+            Spi->PageFaultCount += Prcb->MmPageFaultCount;
             Spi->IoReadTransferCount.QuadPart += Prcb->IoReadTransferCount.QuadPart;
             Spi->IoWriteTransferCount.QuadPart += Prcb->IoWriteTransferCount.QuadPart;
             Spi->IoOtherTransferCount.QuadPart += Prcb->IoOtherTransferCount.QuadPart;
             Spi->IoReadOperationCount += Prcb->IoReadOperationCount;
             Spi->IoWriteOperationCount += Prcb->IoWriteOperationCount;
             Spi->IoOtherOperationCount += Prcb->IoOtherOperationCount;
+            Spi->DemandZeroCount += Prcb->MmDemandZeroCount;
         }
     }
 
@@ -726,17 +730,15 @@ QSI_DEF(SystemPerformanceInformation)
     Spi->CommitLimit = MmNumberOfPhysicalPages + MiFreeSwapPages + MiUsedSwapPages;
 
     Spi->PeakCommitment = 0; /* FIXME */
-    Spi->PageFaultCount = 0; /* FIXME */
     Spi->CopyOnWriteCount = 0; /* FIXME */
     Spi->TransitionCount = 0; /* FIXME */
     Spi->CacheTransitionCount = 0; /* FIXME */
-    Spi->DemandZeroCount = 0; /* FIXME */
-    Spi->PageReadCount = 0; /* FIXME */
-    Spi->PageReadIoCount = 0; /* FIXME */
+    Spi->PageReadCount = MmPageFilePagesRead;
+    Spi->PageReadIoCount = MmPageFileReadIoCount;
     Spi->CacheReadCount = 0; /* FIXME */
     Spi->CacheIoCount = 0; /* FIXME */
-    Spi->DirtyPagesWriteCount = 0; /* FIXME */
-    Spi->DirtyWriteIoCount = 0; /* FIXME */
+    Spi->DirtyPagesWriteCount = MmPageFilePagesWritten;
+    Spi->DirtyWriteIoCount = MmPageFileWriteIoCount;
     Spi->MappedPagesWriteCount = 0; /* FIXME */
     Spi->MappedWriteIoCount = 0; /* FIXME */
 
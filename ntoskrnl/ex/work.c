@@ -22,6 +22,13 @@
 /* Magic flag for dynamic worker threads */
 #define EX_DYNAMIC_WORK_THREAD                      0x80000000
 
+/* Dynamic worker threads allowed per processor, never less than the minimum */
+#define EX_DYNAMIC_WORK_THREADS_PER_CPU             4
+#define EX_MINIMUM_DYNAMIC_WORK_THREADS             16
+
+/* Seconds a dynamic worker thread stays idle before it exits */
+#define EX_DYNAMIC_WORK_THREAD_TIMEOUT              60
+
 /* Worker thread priority increments (added to base priority) */
 #define EX_HYPERCRITICAL_QUEUE_PRIORITY_INCREMENT   7
 #define EX_CRITICAL_QUEUE_PRIORITY_INCREMENT        5
@@ -30,6 +37,23 @@
 /* The actual worker queue array */
 EX_WORK_QUEUE ExWorkerQueue[MaximumWorkQueue];
 
+/* Load and latency accounting for each queue */
+typedef struct _EXP_WORK_QUEUE_STATISTICS
+{
+    LONG WorkItemsQueued;
+    LONG PeakQueueDepth;
+    LONG ThreadsCreated;
+    LONG ThreadsRetired;
+    LONG ThreadsStarting;
+    ULONG AverageLatency;
+    ULONG MaximumLatency;
+} EXP_WORK_QUEUE_STATISTICS, *PEXP_WORK_QUEUE_STATISTICS;
+
+EXP_WORK_QUEUE_STATISTICS ExpWorkQueueStatistics[MaximumWorkQueue];
+
+/* Upper bound of dynamic threads for each queue, scaled by processor count */
+ULONG ExpMaximumDynamicThreads;
+
 /* Accounting of the total threads and registry hacked threads */
 ULONG ExCriticalWorkerThreads;
 ULONG ExDelayedWorkerThreads;
@@ -63,8 +87,9 @@ PETHREAD ExpLastWorkerThread;
  *
  * @return None.
  *
- * @remarks A dynamic thread can timeout after 10 minutes of waiting on a queue
- *          while a static thread will never timeout.
+ * @remarks A dynamic thread times out after EX_DYNAMIC_WORK_THREAD_TIMEOUT
+ *          seconds of waiting on an empty queue while a static thread will
+ *          never timeout.
  *
  *          Worker threads must return at IRQL == PASSIVE_LEVEL, must not have
  *          active impersonation info, and must not have disabled APCs.
@@ -90,8 +115,9 @@ ExpWorkerThreadEntryPoint(IN PVOID Context)
     /* Check if this is a dyamic thread */
     if ((ULONG_PTR)Context & EX_DYNAMIC_WORK_THREAD)
     {
-        /* It is, which means we will eventually time out after 10 minutes */
-        Timeout.QuadPart = Int32x32To64(10, -10000000 * 60);
+        /* It is, which means we will eventually time out when idle */
+        Timeout.QuadPart = Int32x32To64(EX_DYNAMIC_WORK_THREAD_TIMEOUT,
+                                        -10000000);
         TimeoutPointer = &Timeout;
     }
 
@@ -133,6 +159,12 @@ ExpWorkerThreadEntryPoint(IN PVOID Context)
     /* Success, you are now officially a worker thread! */
     Thread->ActiveExWorker = TRUE;
 
+    /* The balance manager can count us as a running thread now */
+    if ((ULONG_PTR)Context & EX_DYNAMIC_WORK_THREAD)
+    {
+        InterlockedDecrement(&ExpWorkQueueStatistics[WorkQueueType].ThreadsStarting);
+    }
+
     /* Loop forever */
 ProcessLoop:
     for (;;)
@@ -213,6 +245,7 @@ ProcessLoop:
 
     /* Decrement dynamic thread count */
     InterlockedDecrement(&WorkQueue->DynamicThreadCount);
+    InterlockedIncrement(&ExpWorkQueueStatistics[WorkQueueType].ThreadsRetired);
 
     /* We're not a worker thread anymore */
     Thread->ActiveExWorker = FALSE;
@@ -254,6 +287,7 @@ ExpCreateWorkerThread(WORK_QUEUE_TYPE WorkQueueType,
     HANDLE hThread;
     ULONG Context;
     KPRIORITY Priority;
+    NTSTATUS Status;
 
     /* Check if this is going to be a dynamic thread */
     Context = WorkQueueType;
@@ -261,14 +295,30 @@ ExpCreateWorkerThread(WORK_QUEUE_TYPE WorkQueueType,
     /* Add the dynamic mask */
     if (Dynamic) Context |= EX_DYNAMIC_WORK_THREAD;
 
+    /* The thread is starting until it takes its first look at the queue */
+    if (Dynamic)
+    {
+        InterlockedIncrement(&ExpWorkQueueStatistics[WorkQueueType].ThreadsStarting);
+    }
+
     /* Create the System Thread */
-    PsCreateSystemThread(&hThread,
-                         THREAD_ALL_ACCESS,
-                         NULL,
-                         NULL,
-                         NULL,
-                         ExpWorkerThreadEntryPoint,
-                         UlongToPtr(Context));
+    Status = PsCreateSystemThread(&hThread,
+                                  THREAD_ALL_ACCESS,
+                                  NULL,
+                                  NULL,
+                                  NULL,
+                                  ExpWorkerThreadEntryPoint,
+                                  UlongToPtr(Context));
+    if (!NT_SUCCESS(Status))
+    {
+        /* Undo the accounting, the balance manager will try again later */
+        DPRINT1("Failed to create worker thread: 0x%lx\n", Status);
+        if (Dynamic)
+        {
+            InterlockedDecrement(&ExpWorkQueueStatistics[WorkQueueType].ThreadsStarting);
+        }
+        return;
+    }
 
     /* If the thread is dynamic */
     if (Dynamic)
@@ -276,6 +326,7 @@ ExpCreateWorkerThread(WORK_QUEUE_TYPE WorkQueueType,
         /* Increase the count */
         InterlockedIncrement(&ExWorkerQueue[WorkQueueType].DynamicThreadCount);
     }
+    InterlockedIncrement(&ExpWorkQueueStatistics[WorkQueueType].ThreadsCreated);
 
     /* Set the priority */
     if (WorkQueueType == DelayedWorkQueue)
@@ -324,6 +375,11 @@ ExpCreateWorkerThread(WORK_QUEUE_TYPE WorkQueueType,
  *          on whether the queue has processed no new items in the last second,
  *          and new items are still enqueued.
  *
+ *          Since this runs once a second, it also samples the queue latency:
+ *          by Little's law the time an item waits is the queue depth divided
+ *          by the number of items processed per second. A queue that made no
+ *          progress has waited at least one more second.
+ *
  *--*/
 VOID
 NTAPI
@@ -331,18 +387,37 @@ ExpDetectWorkerThreadDeadlock(VOID)
 {
     ULONG i;
     PEX_WORK_QUEUE Queue;
+    PEXP_WORK_QUEUE_STATISTICS Statistics;
+    ULONG Depth, Processed, Latency;
 
     /* Loop the 3 queues */
     for (i = 0; i < MaximumWorkQueue; i++)
     {
         /* Get the queue */
         Queue = &ExWorkerQueue[i];
-        ASSERT(Queue->DynamicThreadCount <= 16);
+        Statistics = &ExpWorkQueueStatistics[i];
+        ASSERT(Queue->DynamicThreadCount <= (LONG)ExpMaximumDynamicThreads);
+
+        /* Estimate how long, in milliseconds, queued items wait */
+        Depth = KeReadStateQueue(&Queue->WorkerQueue);
+        Processed = Queue->WorkItemsProcessed - Queue->WorkItemsProcessedLastPass;
+        if (!Depth)
+            Latency = 0;
+        else if (Processed)
+            Latency = (ULONG)min(((ULONGLONG)Depth * 1000) / Processed, MAXULONG);
+        else
+            Latency = min(Statistics->AverageLatency, MAXULONG - 1000) + 1000;
+
+        /* Keep a moving average over the last few seconds and the worst case */
+        Statistics->AverageLatency = (ULONG)(((ULONGLONG)Statistics->AverageLatency * 7 +
+                                              Latency) / 8);
+        if (Latency > Statistics->MaximumLatency)
+            Statistics->MaximumLatency = Latency;
 
         /* Check if stuff is on the queue that still is unprocessed */
         if ((Queue->QueueDepthLastPass) &&
             (Queue->WorkItemsProcessed == Queue->WorkItemsProcessedLastPass) &&
-            (Queue->DynamicThreadCount < 16))
+            (Queue->DynamicThreadCount < (LONG)ExpMaximumDynamicThreads))
         {
             /* Stuff is still on the queue and nobody did anything about it */
             DPRINT1("EX: Work Queue Deadlock detected: %lu\n", i);
@@ -369,6 +444,10 @@ ExpDetectWorkerThreadDeadlock(VOID)
  * @remarks The algorithm for deciding if a new thread must be created is
  *          documented in the ExQueueWorkItem routine.
  *
+ *          A burst of work can need more than one thread: as many are created
+ *          as there are queued items and idle processors, minus the threads
+ *          that were already created but did not start waiting yet.
+ *
  *--*/
 VOID
 NTAPI
@@ -376,6 +455,7 @@ ExpCheckDynamicThreadCount(VOID)
 {
     ULONG i;
     PEX_WORK_QUEUE Queue;
+    LONG Depth, IdleProcessors, Allowed, Needed;
 
     /* Loop the 3 queues */
     for (i = 0; i < MaximumWorkQueue; i++)
@@ -384,14 +464,24 @@ ExpCheckDynamicThreadCount(VOID)
         Queue = &ExWorkerQueue[i];
 
         /* Check if still need a new thread. See ExQueueWorkItem */
-        if ((Queue->Info.MakeThreadsAsNecessary) &&
-            (!IsListEmpty(&Queue->WorkerQueue.EntryListHead)) &&
-            (Queue->WorkerQueue.CurrentCount <
-             Queue->WorkerQueue.MaximumCount) &&
-            (Queue->DynamicThreadCount < 16))
+        if (!(Queue->Info.MakeThreadsAsNecessary) ||
+            (IsListEmpty(&Queue->WorkerQueue.EntryListHead)))
+        {
+            continue;
+        }
+
+        /* Size the burst by the backlog and the processors that could help */
+        Depth = KeReadStateQueue(&Queue->WorkerQueue);
+        IdleProcessors = (LONG)Queue->WorkerQueue.MaximumCount -
+                         (LONG)Queue->WorkerQueue.CurrentCount;
+        Allowed = (LONG)ExpMaximumDynamicThreads - Queue->DynamicThreadCount;
+        Needed = min(min(Depth, IdleProcessors), Allowed) -
+                 ExpWorkQueueStatistics[i].ThreadsStarting;
+
+        /* Create the new threads */
+        while (Needed-- > 0)
         {
-            /* Create a new thread */
-            DPRINT1("EX: Creating new dynamic thread as requested\n");
+            DPRINT("EX: Creating new dynamic thread as requested\n");
             ExpCreateWorkerThread(i, TRUE);
         }
     }
@@ -454,7 +544,8 @@ ExpWorkerThreadBalanceManager(IN PVOID Context)
                                           NULL);
         if (Status == 0)
         {
-            /* Our timer expired. Check for deadlocks */
+            /* Our timer expired. Catch up with the load, then check for deadlocks */
+            ExpCheckDynamicThreadCount();
             ExpDetectWorkerThreadDeadlock();
         }
         else if (Status == 1)
@@ -525,9 +616,13 @@ ExpInitializeWorkerThreads(VOID)
     InitializeListHead(&ExpWorkerListHead);
     ExpWorkersCanSwap = TRUE;
 
-    /* Set the number of critical and delayed threads. We shouldn't hardcode */
-    DelayedThreads = EX_DELAYED_WORK_THREADS;
-    CriticalThreads = EX_CRITICAL_WORK_THREADS;
+    /* Set the number of critical and delayed threads, one more per extra CPU */
+    DelayedThreads = EX_DELAYED_WORK_THREADS + KeNumberProcessors - 1;
+    CriticalThreads = EX_CRITICAL_WORK_THREADS + KeNumberProcessors - 1;
+
+    /* Let bursts use every processor a few times over */
+    ExpMaximumDynamicThreads = max(KeNumberProcessors * EX_DYNAMIC_WORK_THREADS_PER_CPU,
+                                   EX_MINIMUM_DYNAMIC_WORK_THREADS);
 
     /* Protect against greedy registry modifications */
     ExpAdditionalDelayedWorkerThreads =
@@ -544,11 +639,14 @@ ExpInitializeWorkerThreads(VOID)
     {
         /* Clear the structure and initialize the queue */
         RtlZeroMemory(&ExWorkerQueue[WorkQueueType], sizeof(EX_WORK_QUEUE));
+        RtlZeroMemory(&ExpWorkQueueStatistics[WorkQueueType],
+                      sizeof(EXP_WORK_QUEUE_STATISTICS));
         KeInitializeQueue(&ExWorkerQueue[WorkQueueType].WorkerQueue, 0);
     }
 
-    /* Dynamic threads are only used for the critical queue */
+    /* Dynamic threads are used for the critical and delayed queues */
     ExWorkerQueue[CriticalWorkQueue].Info.MakeThreadsAsNecessary = TRUE;
+    ExWorkerQueue[DelayedWorkQueue].Info.MakeThreadsAsNecessary = TRUE;
 
     /* Initialize the balance set manager events */
     KeInitializeEvent(&ExpThreadSetManagerEvent, SynchronizationEvent, FALSE);
@@ -712,6 +810,8 @@ ExQueueWorkItem(IN PWORK_QUEUE_ITEM WorkItem,
                 IN WORK_QUEUE_TYPE QueueType)
 {
     PEX_WORK_QUEUE WorkQueue = &ExWorkerQueue[QueueType];
+    PEXP_WORK_QUEUE_STATISTICS Statistics = &ExpWorkQueueStatistics[QueueType];
+    LONG Depth, PeakDepth;
     ASSERT(QueueType < MaximumWorkQueue);
     ASSERT(WorkItem->List.Flink == NULL);
 
@@ -730,6 +830,18 @@ ExQueueWorkItem(IN PWORK_QUEUE_ITEM WorkItem,
     KeInsertQueue(&WorkQueue->WorkerQueue, &WorkItem->List);
     ASSERT(!WorkQueue->Info.QueueDisabled);
 
+    /* Account for it and remember the deepest backlog */
+    InterlockedIncrement(&Statistics->WorkItemsQueued);
+    Depth = KeReadStateQueue(&WorkQueue->WorkerQueue);
+    do
+    {
+        PeakDepth = Statistics->PeakQueueDepth;
+        if (Depth <= PeakDepth) break;
+    }
+    while (InterlockedCompareExchange(&Statistics->PeakQueueDepth,
+                                      Depth,
+                                      PeakDepth) != PeakDepth);
+
     /*
      * Check if we need a new thread. Our decision is as follows:
      *  - This queue type must support Dynamic Threads (duh!)
@@ -741,14 +853,56 @@ ExQueueWorkItem(IN PWORK_QUEUE_ITEM WorkItem,
         (!IsListEmpty(&WorkQueue->WorkerQueue.EntryListHead)) &&
         (WorkQueue->WorkerQueue.CurrentCount <
          WorkQueue->WorkerQueue.MaximumCount) &&
-        (WorkQueue->DynamicThreadCount < 16))
+        (WorkQueue->DynamicThreadCount < (LONG)ExpMaximumDynamicThreads))
     {
         /* Let the balance manager know about it */
-        DPRINT1("Requesting a new thread. CurrentCount: %lu. MaxCount: %lu\n",
+        DPRINT("Requesting a new thread. CurrentCount: %lu. MaxCount: %lu\n",
                 WorkQueue->WorkerQueue.CurrentCount,
                 WorkQueue->WorkerQueue.MaximumCount);
         KeSetEvent(&ExpThreadSetManagerEvent, 0, FALSE);
     }
 }
 
+#if DBG && defined(KDBG)
+BOOLEAN
+ExpKdbgExtWorkQueues(
+    ULONG Argc,
+    PCHAR Argv[])
+{
+    static const PCSTR QueueNames[MaximumWorkQueue] =
+    {
+        "Critical", "Delayed", "HyperCritical"
+    };
+    ULONG i;
+    PEX_WORK_QUEUE Queue;
+    PEXP_WORK_QUEUE_STATISTICS Statistics;
+
+    for (i = 0; i < MaximumWorkQueue; i++)
+    {
+        Queue = &ExWorkerQueue[i];
+        Statistics = &ExpWorkQueueStatistics[i];
+
+        KdbpPrint("%s queue:\n", QueueNames[i]);
+        KdbpPrint("  Threads: %lu, dynamic %lu of %lu, created %lu, retired %lu\n",
+                  Queue->Info.WorkerCount,
+                  Queue->DynamicThreadCount,
+                  Queue->Info.MakeThreadsAsNecessary ? ExpMaximumDynamicThreads : 0,
+                  Statistics->ThreadsCreated,
+                  Statistics->ThreadsRetired);
+        KdbpPrint("  Items: queued %lu, processed %lu, depth %ld, peak %lu\n",
+                  Statistics->WorkItemsQueued,
+                  Queue->WorkItemsProcessed,
+                  KeReadStateQueue(&Queue->WorkerQueue),
+                  Statistics->PeakQueueDepth);
+
+        /* Estimated once a second by ExpDetectWorkerThreadDeadlock */
+        KdbpPrint("  Latency: %lu ms average, %lu ms maximum\n",
+                  Statistics->AverageLatency,
+                  Statistics->MaximumLatency);
+    }
+
+    return TRUE;
+}
+#endif
+
 /* EOF */
@@ -22,97 +22,179 @@
 PAGED_LOOKASIDE_LIST FsRtlFirstMappingLookasideList;
 NPAGED_LOOKASIDE_LIST FsRtlFastMutexLookasideList;
 
-/* We use only real 'mapping' runs; we do not store 'holes' to our GTree. */
+/*
+ * The runs are kept in an array sorted by VBN and looked up with a binary
+ * search. The array covers all the VBNs from 0 to the end of the last mapped
+ * run: holes are stored as runs mapped to LBN -1, so that the index of a run
+ * in the array is the index the callers see. Adjacent holes, and adjacent
+ * runs that are contiguous on the disk too, are always merged, and the last
+ * run is never a hole. The first MAXIMUM_PAIR_COUNT runs of a paged MCB come
+ * from a lookaside list; past that, the array doubles whenever it is full.
+ */
 typedef struct _LARGE_MCB_MAPPING_ENTRY // run
 {
     LARGE_INTEGER RunStartVbn;
     LARGE_INTEGER RunEndVbn;   /* RunStartVbn+SectorCount; that means +1 after the last sector */
-    LARGE_INTEGER StartingLbn; /* Lbn of 'RunStartVbn' */
+    LARGE_INTEGER StartingLbn; /* Lbn of 'RunStartVbn', -1 for a hole */
 } LARGE_MCB_MAPPING_ENTRY, *PLARGE_MCB_MAPPING_ENTRY;
 
-typedef struct _LARGE_MCB_MAPPING // mcb_priv
-{
-    RTL_GENERIC_TABLE Table;
-} LARGE_MCB_MAPPING, *PLARGE_MCB_MAPPING;
-
 typedef struct _BASE_MCB_INTERNAL {
-    ULONG MaximumPairCount;
-    ULONG PairCount;
+    ULONG MaximumPairCount;     /* Runs the array can hold */
+    ULONG PairCount;            /* Runs in the array, holes included */
     USHORT PoolType;
     USHORT Flags;
-    PLARGE_MCB_MAPPING Mapping;
+    PLARGE_MCB_MAPPING_ENTRY Mapping;
 } BASE_MCB_INTERNAL, *PBASE_MCB_INTERNAL;
 
-/*
-static LARGE_MCB_MAPPING_ENTRY StaticRunBelow0 = {
-    {{-1}}, // ignored
-    {{0}},
-    {{-1}}, // ignored
-};
-*/
-
-static PVOID NTAPI McbMappingAllocate(PRTL_GENERIC_TABLE Table, CLONG Bytes)
+#define McbRunIsHole(Run) ((Run)->StartingLbn.QuadPart == -1)
+
+static VOID McbMappingFree(PBASE_MCB_INTERNAL Mcb)
 {
-    PVOID Result;
-    PBASE_MCB Mcb = (PBASE_MCB)Table->TableContext;
-    Result = ExAllocatePoolWithTag(Mcb->PoolType, Bytes, 'BCML');
-    DPRINT("McbMappingAllocate(%lu) => %p\n", Bytes, Result);
-    return Result;
+    if (Mcb->MaximumPairCount > MAXIMUM_PAIR_COUNT)
+        ExFreePoolWithTag(Mcb->Mapping, 'BCML');
+    else if (Mcb->PoolType == PagedPool)
+        ExFreeToPagedLookasideList(&FsRtlFirstMappingLookasideList, Mcb->Mapping);
+    else
+        ExFreePoolWithTag(Mcb->Mapping, 'CBSF');
 }
 
-static VOID NTAPI McbMappingFree(PRTL_GENERIC_TABLE Table, PVOID Buffer)
+/* Make room for Count more runs */
+static BOOLEAN McbMappingReserve(PBASE_MCB_INTERNAL Mcb, ULONG Count)
 {
-    DPRINT("McbMappingFree(%p)\n", Buffer);
-    ExFreePoolWithTag(Buffer, 'BCML');
+    PLARGE_MCB_MAPPING_ENTRY Mapping;
+    ULONG MaximumPairCount;
+
+    if (Mcb->PairCount + Count <= Mcb->MaximumPairCount)
+        return TRUE;
+
+    MaximumPairCount = MAX(Mcb->MaximumPairCount * 2, Mcb->PairCount + Count);
+    if (MaximumPairCount > MAXULONG / sizeof(LARGE_MCB_MAPPING_ENTRY))
+        return FALSE;
+
+    Mapping = ExAllocatePoolWithTag(Mcb->PoolType, MaximumPairCount * sizeof(LARGE_MCB_MAPPING_ENTRY), 'BCML');
+    if (!Mapping)
+        return FALSE;
+
+    RtlCopyMemory(Mapping, Mcb->Mapping, Mcb->PairCount * sizeof(LARGE_MCB_MAPPING_ENTRY));
+    McbMappingFree(Mcb);
+    Mcb->Mapping = Mapping;
+    Mcb->MaximumPairCount = MaximumPairCount;
+    DPRINT("McbMappingReserve(%p) grew to %lu runs\n", Mcb, MaximumPairCount);
+
+    return TRUE;
 }
 
-static
-RTL_GENERIC_COMPARE_RESULTS
-NTAPI
-McbMappingCompare(PRTL_GENERIC_TABLE Table,
-                  PVOID PtrA,
-                  PVOID PtrB)
+/* Index of the run holding Vbn, or PairCount if nothing is mapped there */
+static ULONG McbMappingFind(PBASE_MCB_INTERNAL Mcb, LONGLONG Vbn)
 {
-    PLARGE_MCB_MAPPING_ENTRY A = PtrA, B = PtrB;
-    RTL_GENERIC_COMPARE_RESULTS Res;
-
-    ASSERT(A);
-    ASSERT(B);
-
-    if (A->RunStartVbn.QuadPart == B->RunStartVbn.QuadPart && A->RunEndVbn.QuadPart == B->RunEndVbn.QuadPart)
-        Res = GenericEqual;
-    else if (A->RunEndVbn.QuadPart <= B->RunStartVbn.QuadPart)
-        Res = GenericLessThan;
-    else if (A->RunEndVbn.QuadPart >= B->RunStartVbn.QuadPart)
-        Res = GenericGreaterThan;
-    else
+    ULONG Low = 0, High = Mcb->PairCount, Middle;
+
+    if (Vbn < 0)
+        return Mcb->PairCount;
+
+    /* The runs have no gaps between them: look for the first one ending past Vbn */
+    while (Low < High)
     {
-        ASSERT(FALSE);
-        Res = GenericEqual;
+        Middle = Low + (High - Low) / 2;
+        if (Mcb->Mapping[Middle].RunEndVbn.QuadPart > Vbn)
+            High = Middle;
+        else
+            Low = Middle + 1;
     }
 
-    return Res;
+    return Low;
 }
 
-static RTL_GENERIC_COMPARE_RESULTS NTAPI McbMappingIntersectCompare(PRTL_GENERIC_TABLE Table, PVOID PtrA, PVOID PtrB)
+/*
+ * Merge the runs from First to Last with their neighbours where they can be,
+ * and drop the holes at the end. The other runs are assumed to be merged already.
+ */
+static VOID McbMappingNormalize(PBASE_MCB_INTERNAL Mcb, ULONG First, ULONG Last)
 {
-    PLARGE_MCB_MAPPING_ENTRY A = PtrA, B = PtrB;
-    RTL_GENERIC_COMPARE_RESULTS Res;
-
-    if (A->RunStartVbn.QuadPart <= B->RunStartVbn.QuadPart && A->RunEndVbn.QuadPart > B->RunStartVbn.QuadPart)
-        Res = GenericEqual;
-    else if (A->RunStartVbn.QuadPart >= B->RunStartVbn.QuadPart && B->RunEndVbn.QuadPart > A->RunStartVbn.QuadPart)
-        Res = GenericEqual;
-    else if (A->RunStartVbn.QuadPart < B->RunStartVbn.QuadPart)
-        Res = GenericLessThan;
-    else if (A->RunStartVbn.QuadPart > B->RunStartVbn.QuadPart)
-        Res = GenericGreaterThan;
-    else
-        Res = GenericEqual;
+    PLARGE_MCB_MAPPING_ENTRY Run, Next;
+    ULONG i;
+
+    i = (First > 0) ? First - 1 : 0;
+    while (i <= Last && i + 1 < Mcb->PairCount)
+    {
+        Run = &Mcb->Mapping[i];
+        Next = Run + 1;
+        if ((McbRunIsHole(Run) && McbRunIsHole(Next)) ||
+            (!McbRunIsHole(Run) && !McbRunIsHole(Next) &&
+             Run->StartingLbn.QuadPart + (Run->RunEndVbn.QuadPart - Run->RunStartVbn.QuadPart) == Next->StartingLbn.QuadPart))
+        {
+            Run->RunEndVbn = Next->RunEndVbn;
+            RtlMoveMemory(Next, Next + 1, (Mcb->PairCount - i - 2) * sizeof(LARGE_MCB_MAPPING_ENTRY));
+            Mcb->PairCount--;
+            if (Last > i)
+                Last--;
+            continue;
+        }
+        i++;
+    }
 
-    return Res;
+    while (Mcb->PairCount > 0 && McbRunIsHole(&Mcb->Mapping[Mcb->PairCount - 1]))
+        Mcb->PairCount--;
 }
 
+/* Map [Vbn, EndVbn) to Lbn, or to nothing if Lbn is -1, whatever was mapped there */
+static BOOLEAN McbMappingSet(PBASE_MCB_INTERNAL Mcb, LONGLONG Vbn, LONGLONG EndVbn, LONGLONG Lbn)
+{
+    LARGE_MCB_MAPPING_ENTRY Runs[3];
+    PLARGE_MCB_MAPPING_ENTRY Run;
+    LONGLONG MappingEnd;
+    ULONG First, Last, Count = 0;
+
+    MappingEnd = Mcb->PairCount ? Mcb->Mapping[Mcb->PairCount - 1].RunEndVbn.QuadPart : 0;
+    if (Lbn == -1 && Vbn >= MappingEnd)
+        return TRUE;
+
+    /* The runs from First to Last - 1 intersect the range */
+    First = McbMappingFind(Mcb, Vbn);
+    Last = McbMappingFind(Mcb, EndVbn - 1);
+    if (Last < Mcb->PairCount)
+        Last++;
+
+    /* Keep what sticks out of the range, or fill the gap up to it */
+    if (First < Mcb->PairCount && Mcb->Mapping[First].RunStartVbn.QuadPart < Vbn)
+    {
+        Runs[Count] = Mcb->Mapping[First];
+        Runs[Count].RunEndVbn.QuadPart = Vbn;
+        Count++;
+    }
+    else if (Vbn > MappingEnd)
+    {
+        Runs[Count].RunStartVbn.QuadPart = MappingEnd;
+        Runs[Count].RunEndVbn.QuadPart = Vbn;
+        Runs[Count].StartingLbn.QuadPart = -1;
+        Count++;
+    }
+
+    Runs[Count].RunStartVbn.QuadPart = Vbn;
+    Runs[Count].RunEndVbn.QuadPart = EndVbn;
+    Runs[Count].StartingLbn.QuadPart = Lbn;
+    Count++;
+
+    if (Last > First && Mcb->Mapping[Last - 1].RunEndVbn.QuadPart > EndVbn)
+    {
+        Run = &Mcb->Mapping[Last - 1];
+        Runs[Count].RunStartVbn.QuadPart = EndVbn;
+        Runs[Count].RunEndVbn = Run->RunEndVbn;
+        Runs[Count].StartingLbn.QuadPart = McbRunIsHole(Run) ? -1 : Run->StartingLbn.QuadPart + (EndVbn - Run->RunStartVbn.QuadPart);
+        Count++;
+    }
+
+    if (Count > Last - First && !McbMappingReserve(Mcb, Count - (Last - First)))
+        return FALSE;
+
+    RtlMoveMemory(&Mcb->Mapping[First + Count], &Mcb->Mapping[Last], (Mcb->PairCount - Last) * sizeof(LARGE_MCB_MAPPING_ENTRY));
+    RtlCopyMemory(&Mcb->Mapping[First], Runs, Count * sizeof(LARGE_MCB_MAPPING_ENTRY));
+    Mcb->PairCount = Mcb->PairCount - (Last - First) + Count;
+
+    McbMappingNormalize(Mcb, First, First + Count - 1);
+
+    return TRUE;
+}
 
 /* PUBLIC FUNCTIONS **********************************************************/
 
@@ -138,142 +220,46 @@ FsRtlAddBaseMcbEntry(IN PBASE_MCB OpaqueMcb,
                      IN LONGLONG SectorCount)
 {
     BOOLEAN Result = TRUE;
-    BOOLEAN IntResult;
     PBASE_MCB_INTERNAL Mcb = (PBASE_MCB_INTERNAL)OpaqueMcb;
-    LARGE_MCB_MAPPING_ENTRY Node, NeedleRun;
-    PLARGE_MCB_MAPPING_ENTRY LowerRun, HigherRun;
-    BOOLEAN NewElement;
-    LONGLONG IntLbn;
+    PLARGE_MCB_MAPPING_ENTRY Run;
+    ULONG i;
 
     DPRINT("FsRtlAddBaseMcbEntry(%p, %I64d, %I64d, %I64d)\n", OpaqueMcb, Vbn, Lbn, SectorCount);
 
-    if (Vbn < 0)
+    if (Vbn < 0 || Lbn < 0)
     {
         Result = FALSE;
         goto quit;
     }
 
-    if (SectorCount <= 0)
+    if (SectorCount <= 0 || Vbn + SectorCount <= Vbn)
     {
         Result = FALSE;
         goto quit;
     }
 
-    IntResult = FsRtlLookupBaseMcbEntry(OpaqueMcb, Vbn, &IntLbn, NULL, NULL, NULL, NULL);
-    if (IntResult)
+    /* Overwriting an existing mapping with a different one is not possible */
+    for (i = McbMappingFind(Mcb, Vbn);
+         i < Mcb->PairCount && Mcb->Mapping[i].RunStartVbn.QuadPart < Vbn + SectorCount;
+         i++)
     {
-        if (IntLbn != -1 && IntLbn != Lbn)
+        Run = &Mcb->Mapping[i];
+        if (!McbRunIsHole(Run) &&
+            Run->StartingLbn.QuadPart - Run->RunStartVbn.QuadPart != Lbn - Vbn)
         {
             Result = FALSE;
             goto quit;
         }
     }
 
-    /* clean any possible previous entries in our range */
-    FsRtlRemoveBaseMcbEntry(OpaqueMcb, Vbn, SectorCount);
-
-    // We need to map [Vbn, Vbn+SectorCount) to [Lbn, Lbn+SectorCount),
-    // taking in account the fact that we need to merge these runs if
-    // they are adjacent or overlap, but fail if new run fully fits into another run
-
-    /* initially we think we will be inserted as a separate run */
-    Node.RunStartVbn.QuadPart = Vbn;
-    Node.RunEndVbn.QuadPart = Vbn + SectorCount;
-    Node.StartingLbn.QuadPart = Lbn;
-
-    /* optionally merge with lower run */
-    NeedleRun.RunStartVbn.QuadPart = Node.RunStartVbn.QuadPart - 1;
-    NeedleRun.RunEndVbn.QuadPart = NeedleRun.RunStartVbn.QuadPart + 1;
-    NeedleRun.StartingLbn.QuadPart = ~0ULL;
-    Mcb->Mapping->Table.CompareRoutine = McbMappingIntersectCompare;
-    if ((LowerRun = RtlLookupElementGenericTable(&Mcb->Mapping->Table, &NeedleRun)) &&
-        (LowerRun->StartingLbn.QuadPart + (LowerRun->RunEndVbn.QuadPart - LowerRun->RunStartVbn.QuadPart) == Node.StartingLbn.QuadPart))
-    {
-        ASSERT(LowerRun->RunEndVbn.QuadPart == Node.RunStartVbn.QuadPart);
-        Node.RunStartVbn.QuadPart = LowerRun->RunStartVbn.QuadPart;
-        Node.StartingLbn.QuadPart = LowerRun->StartingLbn.QuadPart;
-        Mcb->Mapping->Table.CompareRoutine = McbMappingCompare;
-        RtlDeleteElementGenericTable(&Mcb->Mapping->Table, LowerRun);
-        --Mcb->PairCount;
-        DPRINT("Intersecting lower run found (%I64d,%I64d) Lbn: %I64d\n", LowerRun->RunStartVbn.QuadPart, LowerRun->RunEndVbn.QuadPart, LowerRun->StartingLbn.QuadPart);
-    }
-
-    /* optionally merge with higher run */
-    NeedleRun.RunStartVbn.QuadPart = Node.RunEndVbn.QuadPart;
-    NeedleRun.RunEndVbn.QuadPart = NeedleRun.RunStartVbn.QuadPart + 1;
-    Mcb->Mapping->Table.CompareRoutine = McbMappingIntersectCompare;
-    if ((HigherRun = RtlLookupElementGenericTable(&Mcb->Mapping->Table, &NeedleRun)) &&
-        (Node.StartingLbn.QuadPart <= HigherRun->StartingLbn.QuadPart))
-    {
-        ASSERT(HigherRun->RunStartVbn.QuadPart == Node.RunEndVbn.QuadPart);
-        Node.RunEndVbn.QuadPart = HigherRun->RunEndVbn.QuadPart;
-        Mcb->Mapping->Table.CompareRoutine = McbMappingCompare;
-        RtlDeleteElementGenericTable(&Mcb->Mapping->Table, HigherRun);
-        --Mcb->PairCount;
-        DPRINT("Intersecting higher run found (%I64d,%I64d) Lbn: %I64d\n", HigherRun->RunStartVbn.QuadPart, HigherRun->RunEndVbn.QuadPart, HigherRun->StartingLbn.QuadPart);
-    }
-    Mcb->Mapping->Table.CompareRoutine = McbMappingCompare;
-
-    /* finally insert the resulting run */
-    RtlInsertElementGenericTable(&Mcb->Mapping->Table, &Node, sizeof(Node), &NewElement);
-    ++Mcb->PairCount;
-    ASSERT(NewElement);
-
-    // NB: Two consecutive runs can only be merged, if actual LBNs also match!
-
-    /* 1.
-            Existing->RunStartVbn
-            |
-            |///////|
-                |/////////////|
-                |
-                Node->RunStartVbn
-
-        2.
-            Existing->RunStartVbn
-            |
-            |///////|
-        |//////|
-        |
-        Node->RunStartVbn
-
-        3.
-            Existing->RunStartVbn
-            |
-            |///////|
-                |///|
-                |
-                Node->RunStartVbn
-
-        4.
-            Existing->RunStartVbn
-            |
-            |///////|
-        |///////////////|
-        |
-        Node->RunStartVbn
-
-
-    Situation with holes:
-    1. Holes at both ends
-    2. Hole at the right, new run merged with the previous run
-    3. Hole at the right, new run is not merged with the previous run
-    4. Hole at the left, new run merged with the next run
-    5. Hole at the left, new run is not merged with the next run
-    6. No holes, exact fit to merge with both previous and next runs
-    7. No holes, merges only with the next run
-    8. No holes, merges only with the previous run
-    9. No holes, does not merge with next or prev runs
-
-
-    Overwriting existing mapping is not possible and results in FALSE being returned
-    */
+    Result = McbMappingSet(Mcb, Vbn, Vbn + SectorCount, Lbn);
 
 quit:
     DPRINT("FsRtlAddBaseMcbEntry(%p, %I64d, %I64d, %I64d) = %d\n", Mcb, Vbn, Lbn, SectorCount, Result);
     return Result;
 }
 
+
 /*
  * @implemented
  */
@@ -331,58 +317,29 @@ FsRtlGetNextBaseMcbEntry(IN PBASE_MCB OpaqueMcb,
 {
     BOOLEAN Result = FALSE;
     PBASE_MCB_INTERNAL Mcb = (PBASE_MCB_INTERNAL)OpaqueMcb;
-    PLARGE_MCB_MAPPING_ENTRY Run = NULL;
-    ULONG CurrentIndex = 0;
-    ULONGLONG LastVbn = 0;
-    ULONGLONG LastSectorCount = 0;
-
-    // Traverse the tree 
-    for (Run = (PLARGE_MCB_MAPPING_ENTRY)RtlEnumerateGenericTable(&Mcb->Mapping->Table, TRUE);
-    Run;
-        Run = (PLARGE_MCB_MAPPING_ENTRY)RtlEnumerateGenericTable(&Mcb->Mapping->Table, FALSE))
-    {
-        // is the current index a hole?
-        if (Run->RunStartVbn.QuadPart > (LastVbn + LastSectorCount))
-        {
-            // Is this the index we're looking for?
-            if (RunIndex == CurrentIndex)
-            {
-                *Vbn = LastVbn + LastSectorCount;
-                *Lbn = -1;
-                *SectorCount = Run->RunStartVbn.QuadPart - *Vbn;
-
-                Result = TRUE;
-                goto quit;
-            }
+    PLARGE_MCB_MAPPING_ENTRY Run;
 
-            CurrentIndex++;
-        }
-
-        if (RunIndex == CurrentIndex)
-        {
-            *Vbn = Run->RunStartVbn.QuadPart;
-            *Lbn = Run->StartingLbn.QuadPart;
-            *SectorCount = Run->RunEndVbn.QuadPart - Run->RunStartVbn.QuadPart;
-
-            Result = TRUE;
-            goto quit;
-        }
-
-        CurrentIndex++;
-        LastVbn = Run->RunStartVbn.QuadPart;
-        LastSectorCount = Run->RunEndVbn.QuadPart - Run->RunStartVbn.QuadPart;
+    if (RunIndex < Mcb->PairCount)
+    {
+        Run = &Mcb->Mapping[RunIndex];
+        *Vbn = Run->RunStartVbn.QuadPart;
+        *Lbn = Run->StartingLbn.QuadPart;
+        *SectorCount = Run->RunEndVbn.QuadPart - Run->RunStartVbn.QuadPart;
+        Result = TRUE;
+    }
+    else
+    {
+        // these values are meaningless when returning false (but setting them can be helpful for debugging purposes)
+        *Vbn = 0xdeadbeef;
+        *Lbn = 0xdeadbeef;
+        *SectorCount = 0xdeadbeef;
     }
 
-    // these values are meaningless when returning false (but setting them can be helpful for debugging purposes)
-    *Vbn = 0xdeadbeef;
-    *Lbn = 0xdeadbeef;
-    *SectorCount = 0xdeadbeef;
-
-quit:
     DPRINT("FsRtlGetNextBaseMcbEntry(%p, %d, %p, %p, %p) = %d (%I64d, %I64d, %I64d)\n", Mcb, RunIndex, Vbn, Lbn, SectorCount, Result, *Vbn, *Lbn, *SectorCount);
     return Result;
 }
 
+
 /*
  * @implemented
  */
@@ -428,20 +385,16 @@ FsRtlInitializeBaseMcb(IN PBASE_MCB OpaqueMcb,
     else
     {
         Mcb->Mapping = ExAllocatePoolWithTag(PoolType | POOL_RAISE_IF_ALLOCATION_FAILURE,
-                                             sizeof(LARGE_MCB_MAPPING),
+                                             MAXIMUM_PAIR_COUNT * sizeof(LARGE_MCB_MAPPING_ENTRY),
                                              'CBSF');
     }
 
     Mcb->PoolType = PoolType;
     Mcb->PairCount = 0;
     Mcb->MaximumPairCount = MAXIMUM_PAIR_COUNT;
-    RtlInitializeGenericTable(&Mcb->Mapping->Table,
-                              McbMappingCompare,
-                              McbMappingAllocate,
-                              McbMappingFree,
-                              Mcb);
 }
 
+
 /*
  * @implemented
  */
@@ -482,7 +435,7 @@ FsRtlInitializeLargeMcbs(VOID)
                                    NULL,
                                    NULL,
                                    POOL_RAISE_IF_ALLOCATION_FAILURE,
-                                   sizeof(LARGE_MCB_MAPPING),
+                                   MAXIMUM_PAIR_COUNT * sizeof(LARGE_MCB_MAPPING_ENTRY),
                                    IFS_POOL_TAG,
                                    0); /* FIXME: Should be 4 */
 
@@ -510,36 +463,35 @@ FsRtlLookupBaseMcbEntry(IN PBASE_MCB OpaqueMcb,
     OUT PULONG Index OPTIONAL)
 {
     BOOLEAN Result = FALSE;
+    PBASE_MCB_INTERNAL Mcb = (PBASE_MCB_INTERNAL)OpaqueMcb;
+    PLARGE_MCB_MAPPING_ENTRY Run;
     ULONG i;
-    LONGLONG LastVbn = 0, LastLbn = 0, Count = 0;   // the last values we've found during traversal
 
     DPRINT("FsRtlLookupBaseMcbEntry(%p, %I64d, %p, %p, %p, %p, %p)\n", OpaqueMcb, Vbn, Lbn, SectorCountFromLbn, StartingLbn, SectorCountFromStartingLbn, Index);
 
-    for (i = 0; FsRtlGetNextBaseMcbEntry(OpaqueMcb, i, &LastVbn, &LastLbn, &Count); i++)
+    i = McbMappingFind(Mcb, Vbn);
+    if (i < Mcb->PairCount)
     {
-        // have we reached the target mapping?
-        if (Vbn < LastVbn + Count)
+        Run = &Mcb->Mapping[i];
+        if (Lbn)
         {
-            if (Lbn)
-            {
-                if (LastLbn == -1)
-                    *Lbn = -1;
-                else
-                    *Lbn = LastLbn + (Vbn - LastVbn);
-            }
-
-            if (SectorCountFromLbn)
-                *SectorCountFromLbn = LastVbn + Count - Vbn;
-            if (StartingLbn)
-                *StartingLbn = LastLbn;
-            if (SectorCountFromStartingLbn)
-                *SectorCountFromStartingLbn = LastVbn + Count - LastVbn;
-            if (Index)
-                *Index = i;
-
-            Result = TRUE;
-            goto quit;
+            if (McbRunIsHole(Run))
+                *Lbn = -1;
+            else
+                *Lbn = Run->StartingLbn.QuadPart + (Vbn - Run->RunStartVbn.QuadPart);
         }
+
+        if (SectorCountFromLbn)
+            *SectorCountFromLbn = Run->RunEndVbn.QuadPart - Vbn;
+        if (StartingLbn)
+            *StartingLbn = Run->StartingLbn.QuadPart;
+        if (SectorCountFromStartingLbn)
+            *SectorCountFromStartingLbn = Run->RunEndVbn.QuadPart - Run->RunStartVbn.QuadPart;
+        if (Index)
+            *Index = i;
+
+        Result = TRUE;
+        goto quit;
     }
 
     if (Lbn)
@@ -556,6 +508,7 @@ quit:
     return Result;
 }
 
+
 /*
  * @implemented
  */
@@ -598,47 +551,28 @@ FsRtlLookupLastLargeMcbEntryAndIndex_internal(IN PBASE_MCB_INTERNAL Mcb,
                                               OUT PLONGLONG Lbn,
                                               OUT PULONG Index OPTIONAL)
 {
-    ULONG RunIndex = 0;
-    PLARGE_MCB_MAPPING_ENTRY Run, RunFound = NULL;
-    LONGLONG LastVbn = 0;
-
-    for (Run = (PLARGE_MCB_MAPPING_ENTRY)RtlEnumerateGenericTable(&Mcb->Mapping->Table, TRUE);
-        Run;
-        Run = (PLARGE_MCB_MAPPING_ENTRY)RtlEnumerateGenericTable(&Mcb->Mapping->Table, FALSE))
-    {
-        /* Take care when we must emulate missing 'hole' runs. */
-        if (Run->RunStartVbn.QuadPart > LastVbn)
-        {
-            RunIndex++;
-        }
-        LastVbn = Run->RunEndVbn.QuadPart;
-        RunIndex++;
-        RunFound = Run;
-    }
+    PLARGE_MCB_MAPPING_ENTRY Run;
 
-    if (!RunFound)
+    if (Mcb->PairCount == 0)
     {
         return FALSE;
     }
 
+    /* The last run is never a hole */
+    Run = &Mcb->Mapping[Mcb->PairCount - 1];
+    ASSERT(!McbRunIsHole(Run));
+
     if (Vbn)
     {
-        *Vbn = RunFound->RunEndVbn.QuadPart - 1;
+        *Vbn = Run->RunEndVbn.QuadPart - 1;
     }
     if (Lbn)
     {
-        if (1)
-        {
-            *Lbn = RunFound->StartingLbn.QuadPart + (RunFound->RunEndVbn.QuadPart - RunFound->RunStartVbn.QuadPart) - 1;
-        }
-        else
-        {
-            *Lbn = ~0ULL;
-        }
+        *Lbn = Run->StartingLbn.QuadPart + (Run->RunEndVbn.QuadPart - Run->RunStartVbn.QuadPart) - 1;
     }
     if (Index)
     {
-        *Index = RunIndex - 1;
+        *Index = Mcb->PairCount - 1;
     }
 
     return TRUE;
@@ -745,22 +679,13 @@ ULONG
 NTAPI
 FsRtlNumberOfRunsInBaseMcb(IN PBASE_MCB OpaqueMcb)
 {
-    ULONG NumberOfRuns = 0;
-    LONGLONG Vbn, Lbn, Count;
-    int i;
-
-    DPRINT("FsRtlNumberOfRunsInBaseMcb(%p)\n", OpaqueMcb);
-
-    // Count how many Mcb entries there are
-    for (i = 0; FsRtlGetNextBaseMcbEntry(OpaqueMcb, i, &Vbn, &Lbn, &Count); i++)
-    {
-        NumberOfRuns++;
-    }
+    PBASE_MCB_INTERNAL Mcb = (PBASE_MCB_INTERNAL)OpaqueMcb;
 
-    DPRINT("FsRtlNumberOfRunsInBaseMcb(%p) = %d\n", OpaqueMcb, NumberOfRuns);
-    return NumberOfRuns;
+    DPRINT("FsRtlNumberOfRunsInBaseMcb(%p) = %d\n", OpaqueMcb, Mcb->PairCount);
+    return Mcb->PairCount;
 }
 
+
 /*
  * @implemented
  */
@@ -801,8 +726,6 @@ FsRtlRemoveBaseMcbEntry(IN PBASE_MCB OpaqueMcb,
                         IN LONGLONG SectorCount)
 {
     PBASE_MCB_INTERNAL Mcb = (PBASE_MCB_INTERNAL)OpaqueMcb;
-    LARGE_MCB_MAPPING_ENTRY NeedleRun;
-    PLARGE_MCB_MAPPING_ENTRY HaystackRun;
     BOOLEAN Result = TRUE;
 
     DPRINT("FsRtlRemoveBaseMcbEntry(%p, %I64d, %I64d)\n", OpaqueMcb, Vbn, SectorCount);
@@ -819,41 +742,15 @@ FsRtlRemoveBaseMcbEntry(IN PBASE_MCB OpaqueMcb,
         goto quit;
     }
 
-    NeedleRun.RunStartVbn.QuadPart = Vbn;
-    NeedleRun.RunEndVbn.QuadPart = Vbn + SectorCount;
-    NeedleRun.StartingLbn.QuadPart = ~0ULL;
-
-    /* adjust/destroy all intersecting ranges */
-    Mcb->Mapping->Table.CompareRoutine = McbMappingIntersectCompare;
-    while ((HaystackRun = RtlLookupElementGenericTable(&Mcb->Mapping->Table, &NeedleRun)))
-    {
-        if (HaystackRun->RunStartVbn.QuadPart < NeedleRun.RunStartVbn.QuadPart)
-        {
-            ASSERT(HaystackRun->RunEndVbn.QuadPart > NeedleRun.RunStartVbn.QuadPart);
-            HaystackRun->RunEndVbn.QuadPart = NeedleRun.RunStartVbn.QuadPart;
-        }
-        else if (HaystackRun->RunEndVbn.QuadPart > NeedleRun.RunEndVbn.QuadPart)
-        {
-            ASSERT(HaystackRun->RunStartVbn.QuadPart < NeedleRun.RunEndVbn.QuadPart);
-            HaystackRun->RunStartVbn.QuadPart = NeedleRun.RunEndVbn.QuadPart;
-        }
-        else
-        {
-            //ASSERT(NeedleRun.RunStartVbn.QuadPart >= HaystackRun->RunStartVbn.QuadPart);
-            //ASSERT(NeedleRun.RunEndVbn.QuadPart <= HaystackRun->RunEndVbn.QuadPart);
-            Mcb->Mapping->Table.CompareRoutine = McbMappingCompare;
-            RtlDeleteElementGenericTable(&Mcb->Mapping->Table, HaystackRun);
-            --Mcb->PairCount;
-            Mcb->Mapping->Table.CompareRoutine = McbMappingIntersectCompare;
-        }
-    }
-    Mcb->Mapping->Table.CompareRoutine = McbMappingCompare;
+    /* This can only fail when a hole is made in the middle of a run */
+    Result = McbMappingSet(Mcb, Vbn, Vbn + SectorCount, -1);
 
 quit:
     DPRINT("FsRtlRemoveBaseMcbEntry(%p, %I64d, %I64d) = %d\n", OpaqueMcb, Vbn, SectorCount, Result);
     return Result;
 }
 
+
 /*
  * @implemented
  */
@@ -878,20 +775,14 @@ NTAPI
 FsRtlResetBaseMcb(IN PBASE_MCB OpaqueMcb)
 {
     PBASE_MCB_INTERNAL Mcb = (PBASE_MCB_INTERNAL)OpaqueMcb;
-    PLARGE_MCB_MAPPING_ENTRY Element;
 
     DPRINT("FsRtlResetBaseMcb(%p)\n", OpaqueMcb);
 
-    while (RtlNumberGenericTableElements(&Mcb->Mapping->Table) &&
-           (Element = (PLARGE_MCB_MAPPING_ENTRY)RtlGetElementGenericTable(&Mcb->Mapping->Table, 0)))
-    {
-        RtlDeleteElementGenericTable(&Mcb->Mapping->Table, Element);
-    }
-
+    /* Keep the array for the next runs */
     Mcb->PairCount = 0;
-    Mcb->MaximumPairCount = 0;
 }
 
+
 /*
  * @implemented
  */
@@ -912,7 +803,7 @@ FsRtlResetLargeMcb(IN PLARGE_MCB Mcb,
 }
 
 /*
- * @unimplemented
+ * @implemented
  */
 BOOLEAN
 NTAPI
@@ -921,56 +812,62 @@ FsRtlSplitBaseMcb(IN PBASE_MCB OpaqueMcb,
                   IN LONGLONG Amount)
 {
     PBASE_MCB_INTERNAL Mcb = (PBASE_MCB_INTERNAL)OpaqueMcb;
-    PLARGE_MCB_MAPPING_ENTRY Run, InsertLowerRun = NULL, ExistingRun = NULL;
-    BOOLEAN NewElement;
+    PLARGE_MCB_MAPPING_ENTRY Run;
+    BOOLEAN Result = TRUE;
+    ULONG i, j;
 
     DPRINT("FsRtlSplitBaseMcb(%p, %I64d, %I64d)\n", OpaqueMcb, Vbn, Amount);
 
-    /* Traverse the tree */
-    for (Run = (PLARGE_MCB_MAPPING_ENTRY)RtlEnumerateGenericTable(&Mcb->Mapping->Table, TRUE);
-        Run;
-        Run = (PLARGE_MCB_MAPPING_ENTRY)RtlEnumerateGenericTable(&Mcb->Mapping->Table, FALSE))
+    /* Nothing to move if nothing is mapped from Vbn on */
+    i = McbMappingFind(Mcb, Vbn);
+    if (i == Mcb->PairCount || Amount <= 0)
     {
-        /* unaffected run? */
-        /* FIXME: performance: effective skip of all 'lower' runs without traversing them */
-        if (Vbn >= Run->RunEndVbn.QuadPart) { DPRINT("Skipping it\n"); continue; }
-
-        /* crossing run to be split?
-        * 'lower_run' is created on the original place; just shortened.
-        * current 'run' is shifted up later
-        */
-        if (Vbn < Run->RunEndVbn.QuadPart)
-        {
-            /* FIXME: shift 'run->Lbn_start' ? */
-            Run->RunStartVbn.QuadPart = Vbn;
-
-            InsertLowerRun = NULL;
-        }
+        goto quit;
+    }
 
-        /* Shift the current 'run'.
-        * Ordering is not changed in Generic Tree so I hope I do not need to reinsert it.
-        */
-        Run->RunStartVbn.QuadPart += Amount;
-        ASSERT(Run->RunEndVbn.QuadPart + Amount > Run->RunEndVbn.QuadPart); /* overflow? */
-        Run->RunEndVbn.QuadPart += Amount;
-        /* FIXME: shift 'run->Lbn_start' ? */
+    Run = &Mcb->Mapping[Mcb->PairCount - 1];
+    if (Run->RunEndVbn.QuadPart + Amount <= Run->RunEndVbn.QuadPart ||
+        !McbMappingReserve(Mcb, 2))
+    {
+        Result = FALSE;
+        goto quit;
+    }
 
-        /* continue the traversal */
+    /* Cut the run crossing Vbn, so that its upper part moves with the next runs */
+    Run = &Mcb->Mapping[i];
+    if (Run->RunStartVbn.QuadPart < Vbn)
+    {
+        RtlMoveMemory(Run + 1, Run, (Mcb->PairCount - i) * sizeof(LARGE_MCB_MAPPING_ENTRY));
+        Mcb->PairCount++;
+        Run[0].RunEndVbn.QuadPart = Vbn;
+        Run[1].RunStartVbn.QuadPart = Vbn;
+        if (!McbRunIsHole(&Run[1]))
+            Run[1].StartingLbn.QuadPart += Vbn - Run[0].RunStartVbn.QuadPart;
+        i++;
     }
 
-    if (InsertLowerRun)
+    /* Shift the runs up, and put a hole in the room made */
+    for (j = i; j < Mcb->PairCount; j++)
     {
-        ExistingRun = RtlInsertElementGenericTable(&Mcb->Mapping->Table, InsertLowerRun, sizeof(*InsertLowerRun), &NewElement);
-        ++Mcb->PairCount;
+        Mcb->Mapping[j].RunStartVbn.QuadPart += Amount;
+        Mcb->Mapping[j].RunEndVbn.QuadPart += Amount;
     }
 
-    ASSERT(ExistingRun == NULL);
+    RtlMoveMemory(&Mcb->Mapping[i + 1], &Mcb->Mapping[i], (Mcb->PairCount - i) * sizeof(LARGE_MCB_MAPPING_ENTRY));
+    Mcb->PairCount++;
+    Mcb->Mapping[i].RunStartVbn.QuadPart = Vbn;
+    Mcb->Mapping[i].RunEndVbn.QuadPart = Vbn + Amount;
+    Mcb->Mapping[i].StartingLbn.QuadPart = -1;
 
-    DPRINT("FsRtlSplitBaseMcb(%p, %I64d, %I64d) = %d\n", OpaqueMcb, Vbn, Amount, TRUE);
+    McbMappingNormalize(Mcb, i, i);
 
-    return TRUE;
+quit:
+    DPRINT("FsRtlSplitBaseMcb(%p, %I64d, %I64d) = %d\n", OpaqueMcb, Vbn, Amount, Result);
+
+    return Result;
 }
 
+
 /*
  * @implemented
  */
@@ -996,18 +893,34 @@ FsRtlSplitLargeMcb(IN PLARGE_MCB Mcb,
 }
 
 /*
- * @unimplemented
+ * @implemented
  */
 VOID
 NTAPI
 FsRtlTruncateBaseMcb(IN PBASE_MCB OpaqueMcb,
                      IN LONGLONG Vbn)
 {
+    PBASE_MCB_INTERNAL Mcb = (PBASE_MCB_INTERNAL)OpaqueMcb;
+    ULONG i;
+
     DPRINT("FsRtlTruncateBaseMcb(%p, %I64d)\n", OpaqueMcb, Vbn);
 
-    FsRtlRemoveBaseMcbEntry(OpaqueMcb, Vbn, MAXLONG - Vbn + 1);
+    i = McbMappingFind(Mcb, Vbn);
+    if (i < Mcb->PairCount)
+    {
+        if (Mcb->Mapping[i].RunStartVbn.QuadPart < Vbn)
+        {
+            Mcb->Mapping[i].RunEndVbn.QuadPart = Vbn;
+            i++;
+        }
+        Mcb->PairCount = i;
+
+        /* Don't leave a hole at the end */
+        McbMappingNormalize(Mcb, i, i);
+    }
 }
 
+
 /*
  * @implemented
  */
@@ -1032,19 +945,10 @@ FsRtlUninitializeBaseMcb(IN PBASE_MCB Mcb)
 {
     DPRINT("FsRtlUninitializeBaseMcb(%p)\n", Mcb);
 
-    FsRtlResetBaseMcb(Mcb);
-
-    if ((Mcb->PoolType == PagedPool)/* && (Mcb->MaximumPairCount == MAXIMUM_PAIR_COUNT)*/)
-    {
-        ExFreeToPagedLookasideList(&FsRtlFirstMappingLookasideList,
-                                   Mcb->Mapping);
-    }
-    else
-    {
-        ExFreePoolWithTag(Mcb->Mapping, 'CBSF');
-    }
+    McbMappingFree((PBASE_MCB_INTERNAL)Mcb);
 }
 
+
 /*
  * @implemented
  */
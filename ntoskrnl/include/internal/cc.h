@@ -65,6 +65,9 @@ extern ULONG CcPinReadNoWait;
 extern ULONG CcPinMappedDataCount;
 extern ULONG CcDataPages;
 extern ULONG CcDataFlushes;
+extern ULONG CcVacbLookups;
+extern ULONG CcVacbLookupHits;
+extern ULONGLONG CcVacbLookupLockCycles;
 
 typedef struct _PF_SCENARIO_ID
 {
@@ -167,6 +170,21 @@ typedef struct _PFSN_PREFETCHER_GLOBALS
     LONG ActivePrefetches;
 } PFSN_PREFETCHER_GLOBALS, *PPFSN_PREFETCHER_GLOBALS;
 
+typedef struct _ROS_PRIVATE_CACHE_MAP
+{
+    PRIVATE_CACHE_MAP Map;
+
+    /* ROS specific, protected by Map.ReadAheadSpinLock */
+    ULONG ReadAheadWindow; /* Current read ahead size of the sequential stream, in bytes */
+    ULONG Reads;
+    ULONG ReadAheadHits; /* Reads which fell in data already read ahead */
+    ULONGLONG ReadAheadBytes;
+} ROS_PRIVATE_CACHE_MAP, *PROS_PRIVATE_CACHE_MAP;
+
+/* Bounds of the adaptive read ahead window */
+#define CC_MIN_READ_AHEAD (64 * 1024)
+#define CC_MAX_READ_AHEAD (4 * 1024 * 1024)
+
 typedef struct _ROS_SHARED_CACHE_MAP
 {
     CSHORT NodeTypeCode;
@@ -184,17 +202,27 @@ typedef struct _ROS_SHARED_CACHE_MAP
     LIST_ENTRY PrivateList;
     ULONG DirtyPageThreshold;
     KSPIN_LOCK BcbSpinLock;
-    PRIVATE_CACHE_MAP PrivateCacheMap;
+    ROS_PRIVATE_CACHE_MAP PrivateCacheMap;
 
     /* ROS specific */
     LIST_ENTRY CacheMapVacbListHead;
     BOOLEAN PinAccess;
     KSPIN_LOCK CacheMapLock;
+    /* Two-level index of the VACBs by view number, protected by CacheMapLock */
+    struct _ROS_VACB ***VacbIndex;
+    ULONG VacbIndexSize;
+    /* VACB lookup statistics, protected by CacheMapLock */
+    ULONG VacbLookups;
+    ULONG VacbLookupHits;
+    ULONGLONG VacbLookupLockCycles;
 #if DBG
     BOOLEAN Trace; /* enable extra trace output for this cache map and it's VACBs */
 #endif
 } ROS_SHARED_CACHE_MAP, *PROS_SHARED_CACHE_MAP;
 
+/* Number of VACBs covered by one leaf of the VACB index */
+#define VACB_INDEX_LEAF_SIZE 128
+
 #define READAHEAD_DISABLED 0x1
 #define WRITEBEHIND_DISABLED 0x2
 
@@ -357,6 +385,17 @@ CcRosLookupVacb(
     LONGLONG FileOffset
 );
 
+PROS_VACB*
+CcRosVacbIndexSlot(
+    PROS_SHARED_CACHE_MAP SharedCacheMap,
+    ULONG ViewNumber
+);
+
+VOID
+CcRosRemoveVacbFromCacheMap(
+    PROS_VACB Vacb
+);
+
 VOID
 NTAPI
 CcInitCacheZeroPage(VOID);
@@ -153,6 +153,36 @@ typedef struct _HARDERROR_USER_PARAMETERS
 #define MAX_MID_INDEX       (MID_LEVEL_ENTRIES * LOW_LEVEL_ENTRIES)
 #define MAX_HIGH_INDEX      (MID_LEVEL_ENTRIES * MID_LEVEL_ENTRIES * LOW_LEVEL_ENTRIES)
 
+//
+// Per-processor stack of free handles kept in front of the table free list,
+// sized to fill exactly one cache line together with its lock
+//
+#define HANDLE_FREE_CACHE_ENTRIES \
+    ((SYSTEM_CACHE_ALIGNMENT_SIZE - sizeof(KSPIN_LOCK) - sizeof(ULONG)) / sizeof(ULONG))
+
+typedef struct _HANDLE_TABLE_FREE_CACHE
+{
+    KSPIN_LOCK Lock;
+    ULONG Count;
+    ULONG Handles[HANDLE_FREE_CACHE_ENTRIES];
+} HANDLE_TABLE_FREE_CACHE, *PHANDLE_TABLE_FREE_CACHE;
+
+//
+// Kernel-private part of a handle table, allocated around the NDK structure
+//
+typedef struct _HANDLE_TABLE_PRIVATE
+{
+    HANDLE_TABLE Table;
+    PHANDLE_TABLE_FREE_CACHE FreeHandleCache;
+    ULONG FreeHandleCacheCount;
+    PVOID FreeHandleCacheBlock;
+} HANDLE_TABLE_PRIVATE, *PHANDLE_TABLE_PRIVATE;
+
+#define ExpGetPrivateHandleTable(t) \
+    CONTAINING_RECORD((t), HANDLE_TABLE_PRIVATE, Table)
+#define ExpGetFreeHandleCache(t) \
+    (ExpGetPrivateHandleTable(t)->FreeHandleCache)
+
 #define ExpChangeRundown(x, y, z) (ULONG_PTR)InterlockedCompareExchangePointer(&x->Ptr, (PVOID)y, (PVOID)z)
 #define ExpChangePushlock(x, y, z) InterlockedCompareExchangePointer((PVOID*)x, (PVOID)y, (PVOID)z)
 #define ExpSetRundown(x, y) InterlockedExchangePointer(&x->Ptr, (PVOID)y)
@@ -221,6 +251,10 @@ VOID
 NTAPI
 ExpInitLookasideLists(VOID);
 
+VOID
+NTAPI
+ExpInitializePoolTrackerTables(VOID);
+
 VOID
 NTAPI
 ExInitializeSystemLookasideList(
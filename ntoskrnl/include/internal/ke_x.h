@@ -207,6 +207,28 @@ KiSetThreadSwapBusy(IN PKTHREAD Thread)
     UNREFERENCED_PARAMETER(Thread);
 }
 
+//
+// This routine clears the swap busy state once the thread is switched out,
+// it's meaningless on UP.
+//
+FORCEINLINE
+VOID
+KiClearThreadSwapBusy(IN PKTHREAD Thread)
+{
+    UNREFERENCED_PARAMETER(Thread);
+}
+
+//
+// This routine waits until a thread is switched out by another CPU, it's
+// meaningless on UP.
+//
+FORCEINLINE
+VOID
+KiWaitForThreadSwapBusy(IN PKTHREAD Thread)
+{
+    UNREFERENCED_PARAMETER(Thread);
+}
+
 //
 // This routine protects against multiple CPU acquires, it's meaningless on UP.
 //
@@ -423,6 +445,35 @@ KiSetThreadSwapBusy(IN PKTHREAD Thread)
     Thread->SwapBusy = TRUE;
 }
 
+//
+// This routine clears the swap busy state of a thread once its context is
+// completely saved and its stack is no longer in use, so that another CPU
+// may switch to it.
+//
+FORCEINLINE
+VOID
+KiClearThreadSwapBusy(IN PKTHREAD Thread)
+{
+    /* Make sure the context is written out before anyone sees the flag */
+    KeMemoryBarrier();
+    Thread->SwapBusy = FALSE;
+}
+
+//
+// This routine waits until a thread that was just switched out on another CPU
+// can be switched to on this one.
+//
+FORCEINLINE
+VOID
+KiWaitForThreadSwapBusy(IN PKTHREAD Thread)
+{
+    /* Spin until the other CPU is off the thread's stack */
+    while (Thread->SwapBusy) YieldProcessor();
+
+    /* Don't read the saved context before the flag */
+    KeMemoryBarrier();
+}
+
 //
 // This routine acquires the PRCB lock so that only one caller can touch
 // volatile PRCB data.
@@ -1235,7 +1286,7 @@ KxSetTimerForThreadWait(IN PKTIMER Timer,
     }                                                                       \
                                                                             \
     /* Set wait settings */                                                 \
-    Thread->Alertable = FALSE;                                              \
+    Thread->Alertable = Alertable;                                          \
     Thread->WaitMode = WaitMode;                                            \
     Thread->WaitReason = WrQueue;                                           \
                                                                             \
@@ -440,12 +440,18 @@ typedef struct _MMPAGING_FILE
     PFILE_OBJECT FileObject;
     UNICODE_STRING PageFileName;
     PRTL_BITMAP Bitmap;
+    ULONG HintIndex;
     HANDLE FileHandle;
 }
 MMPAGING_FILE, *PMMPAGING_FILE;
 
 extern PMMPAGING_FILE MmPagingFile[MAX_PAGING_FILES];
 
+extern ULONG MmPageFileWriteIoCount;
+extern ULONG MmPageFilePagesWritten;
+extern ULONG MmPageFileReadIoCount;
+extern ULONG MmPageFilePagesRead;
+
 typedef VOID
 (*PMM_ALTER_REGION_FUNC)(
     PMMSUPPORT AddressSpace,
@@ -653,6 +659,10 @@ MmWriteToSwapPage(
     PFN_NUMBER Page
 );
 
+VOID
+NTAPI
+MmFlushSwapPages(VOID);
+
 VOID
 NTAPI
 MmShowOutOfSpaceMessagePagingFile(VOID);
@@ -889,6 +899,13 @@ BOOLEAN
 NTAPI
 MmIsDirtyPageRmap(PFN_NUMBER Page);
 
+BOOLEAN
+NTAPI
+MmIsAccessedAndResetAccessRmaps(
+    PFN_NUMBER Page,
+    PBOOLEAN InMinimumWorkingSet
+);
+
 NTSTATUS
 NTAPI
 MmPageOutPhysicalAddress(PFN_NUMBER Page);
@@ -1011,7 +1028,8 @@ MiUnmapPageInHyperSpace(IN PEPROCESS Process,
 
 PVOID
 NTAPI
-MiMapPagesInZeroSpace(IN PMMPFN Pfn1,
+MiMapPagesInZeroSpace(IN PMMPTE ZeroingPte,
+                      IN PMMPFN Pfn1,
                       IN PFN_NUMBER NumberOfPages);
 
 VOID
@@ -1221,6 +1239,13 @@ MmIsDirtyPage(
     PVOID Address
 );
 
+BOOLEAN
+NTAPI
+MmIsAccessedAndResetAccessPage(
+    struct _EPROCESS *Process,
+    PVOID Address
+);
+
 /* wset.c ********************************************************************/
 
 NTSTATUS
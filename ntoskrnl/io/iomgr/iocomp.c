@@ -25,6 +25,9 @@ GENERIC_MAPPING IopCompletionMapping =
     IO_COMPLETION_ALL_ACCESS
 };
 
+/* Packets NtRemoveIoCompletionEx takes off the queue per KeRemoveQueueEx call */
+#define IOP_COMPLETION_BATCH 16
+
 static const INFORMATION_CLASS_INFO IoCompletionInfoClass[] =
 {
      /* IoCompletionBasicInformation */
@@ -95,6 +98,63 @@ IopFreeMiniPacket(PIOP_MINI_COMPLETION_PACKET Packet)
     InterlockedPushEntrySList(&List->L.ListHead, (PSLIST_ENTRY)Packet);
 }
 
+/*
+ * Returns whether KeRemoveQueue gave us a packet and not a wait status
+ */
+FORCEINLINE
+BOOLEAN
+IopIsCompletionPacket(IN PLIST_ENTRY ListEntry)
+{
+    return (((NTSTATUS)(ULONG_PTR)ListEntry != STATUS_TIMEOUT) &&
+            ((NTSTATUS)(ULONG_PTR)ListEntry != STATUS_USER_APC) &&
+            ((NTSTATUS)(ULONG_PTR)ListEntry != STATUS_ALERTED));
+}
+
+/*
+ * Captures a dequeued packet and recycles it, or the IRP carrying it
+ */
+static
+VOID
+IopCaptureCompletionPacket(IN PLIST_ENTRY ListEntry,
+                           OUT PFILE_IO_COMPLETION_INFORMATION Information)
+{
+    PIOP_MINI_COMPLETION_PACKET Packet;
+    PIRP Irp;
+
+    /* Get the Packet Data */
+    Packet = CONTAINING_RECORD(ListEntry,
+                               IOP_MINI_COMPLETION_PACKET,
+                               ListEntry);
+
+    /* Check if this is piggybacked on an IRP */
+    if (Packet->PacketType == IopCompletionPacketIrp)
+    {
+        /* Get the IRP */
+        Irp = CONTAINING_RECORD(ListEntry,
+                                IRP,
+                                Tail.Overlay.ListEntry);
+
+        /* Save values */
+        Information->KeyContext = Irp->Tail.CompletionKey;
+        Information->ApcContext = Irp->Overlay.AsynchronousParameters.UserApcContext;
+        Information->IoStatusBlock = Irp->IoStatus;
+
+        /* Free the IRP */
+        IoFreeIrp(Irp);
+    }
+    else
+    {
+        /* Save values */
+        Information->KeyContext = Packet->KeyContext;
+        Information->ApcContext = Packet->ApcContext;
+        Information->IoStatusBlock.Status = Packet->IoStatus;
+        Information->IoStatusBlock.Information = Packet->IoStatusInformation;
+
+        /* Free the packet */
+        IopFreeMiniPacket(Packet);
+    }
+}
+
 VOID
 NTAPI
 IopDeleteIoCompletion(PVOID ObjectBody)
@@ -449,13 +509,10 @@ NtRemoveIoCompletion(IN HANDLE IoCompletionHandle,
 {
     LARGE_INTEGER SafeTimeout;
     PKQUEUE Queue;
-    PIOP_MINI_COMPLETION_PACKET Packet;
     PLIST_ENTRY ListEntry;
     KPROCESSOR_MODE PreviousMode = ExGetPreviousMode();
     NTSTATUS Status;
-    PIRP Irp;
-    PVOID Apc, Key;
-    IO_STATUS_BLOCK IoStatus;
+    FILE_IO_COMPLETION_INFORMATION Information;
     PAGED_CODE();
 
     /* Check if the call was from user mode */
@@ -498,54 +555,23 @@ NtRemoveIoCompletion(IN HANDLE IoCompletionHandle,
         ListEntry = KeRemoveQueue(Queue, PreviousMode, Timeout);
 
         /* If we got a timeout or user_apc back, return the status */
-        if (((NTSTATUS)(ULONG_PTR)ListEntry == STATUS_TIMEOUT) ||
-            ((NTSTATUS)(ULONG_PTR)ListEntry == STATUS_USER_APC))
+        if (!IopIsCompletionPacket(ListEntry))
         {
             /* Set this as the status */
             Status = (NTSTATUS)(ULONG_PTR)ListEntry;
         }
         else
         {
-            /* Get the Packet Data */
-            Packet = CONTAINING_RECORD(ListEntry,
-                                       IOP_MINI_COMPLETION_PACKET,
-                                       ListEntry);
-
-            /* Check if this is piggybacked on an IRP */
-            if (Packet->PacketType == IopCompletionPacketIrp)
-            {
-                /* Get the IRP */
-                Irp = CONTAINING_RECORD(ListEntry,
-                                        IRP,
-                                        Tail.Overlay.ListEntry);
-
-                /* Save values */
-                Key = Irp->Tail.CompletionKey;
-                Apc = Irp->Overlay.AsynchronousParameters.UserApcContext;
-                IoStatus = Irp->IoStatus;
-
-                /* Free the IRP */
-                IoFreeIrp(Irp);
-            }
-            else
-            {
-                /* Save values */
-                Key = Packet->KeyContext;
-                Apc = Packet->ApcContext;
-                IoStatus.Status = Packet->IoStatus;
-                IoStatus.Information = Packet->IoStatusInformation;
-
-                /* Free the packet */
-                IopFreeMiniPacket(Packet);
-            }
+            /* Get the packet values and recycle it */
+            IopCaptureCompletionPacket(ListEntry, &Information);
 
             /* Enter SEH to write back the values */
             _SEH2_TRY
             {
                 /* Write the values to caller */
-                *ApcContext = Apc;
-                *KeyContext = Key;
-                *IoStatusBlock = IoStatus;
+                *ApcContext = Information.ApcContext;
+                *KeyContext = Information.KeyContext;
+                *IoStatusBlock = Information.IoStatusBlock;
             }
             _SEH2_EXCEPT(ExSystemExceptionFilter())
             {
@@ -563,6 +589,129 @@ NtRemoveIoCompletion(IN HANDLE IoCompletionHandle,
     return Status;
 }
 
+NTSTATUS
+NTAPI
+NtRemoveIoCompletionEx(IN HANDLE IoCompletionHandle,
+                       OUT PFILE_IO_COMPLETION_INFORMATION IoCompletionInformation,
+                       IN ULONG Count,
+                       OUT PULONG NumEntriesRemoved,
+                       IN PLARGE_INTEGER Timeout OPTIONAL,
+                       IN BOOLEAN Alertable)
+{
+    LARGE_INTEGER SafeTimeout, ZeroTimeout;
+    PKQUEUE Queue;
+    PLIST_ENTRY ListEntries[IOP_COMPLETION_BATCH];
+    FILE_IO_COMPLETION_INFORMATION Information[IOP_COMPLETION_BATCH];
+    KPROCESSOR_MODE PreviousMode = ExGetPreviousMode();
+    NTSTATUS Status;
+    ULONG Removed = 0, Batch, i;
+    PAGED_CODE();
+
+    /* Validate the entry count */
+    if ((Count == 0) ||
+        (Count > MAXULONG / sizeof(FILE_IO_COMPLETION_INFORMATION)))
+    {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    /* Check if the call was from user mode */
+    if (PreviousMode != KernelMode)
+    {
+        /* Protect probes in SEH */
+        _SEH2_TRY
+        {
+            /* Probe the output array and count */
+            ProbeForWrite(IoCompletionInformation,
+                          Count * sizeof(FILE_IO_COMPLETION_INFORMATION),
+                          sizeof(PVOID));
+            ProbeForWriteUlong(NumEntriesRemoved);
+            if (Timeout)
+            {
+                /* Probe and capture the timeout */
+                SafeTimeout = ProbeForReadLargeInteger(Timeout);
+                Timeout = &SafeTimeout;
+            }
+        }
+        _SEH2_EXCEPT(EXCEPTION_EXECUTE_HANDLER)
+        {
+            /* Return the exception code */
+            _SEH2_YIELD(return _SEH2_GetExceptionCode());
+        }
+        _SEH2_END;
+    }
+
+    /* Open the Object */
+    Status = ObReferenceObjectByHandle(IoCompletionHandle,
+                                       IO_COMPLETION_MODIFY_STATE,
+                                       IoCompletionType,
+                                       PreviousMode,
+                                       (PVOID*)&Queue,
+                                       NULL);
+    if (!NT_SUCCESS(Status)) return Status;
+
+    /* Only the first batch waits, the next ones take what is already queued */
+    ZeroTimeout.QuadPart = 0;
+    do
+    {
+        Batch = KeRemoveQueueEx(Queue,
+                                PreviousMode,
+                                Alertable,
+                                Removed ? &ZeroTimeout : Timeout,
+                                ListEntries,
+                                min(Count - Removed, IOP_COMPLETION_BATCH));
+
+        /* If we got a timeout, alert or user_apc back, we are done */
+        if (!IopIsCompletionPacket(ListEntries[0]))
+        {
+            /* It is only the status if nothing was removed */
+            if (!Removed) Status = (NTSTATUS)(ULONG_PTR)ListEntries[0];
+            break;
+        }
+
+        /* Get the packet values and recycle the packets */
+        for (i = 0; i < Batch; i++)
+        {
+            IopCaptureCompletionPacket(ListEntries[i], &Information[i]);
+        }
+
+        /* Enter SEH to write back the values */
+        _SEH2_TRY
+        {
+            RtlCopyMemory(&IoCompletionInformation[Removed],
+                          Information,
+                          Batch * sizeof(FILE_IO_COMPLETION_INFORMATION));
+        }
+        _SEH2_EXCEPT(ExSystemExceptionFilter())
+        {
+            /* Get the exception code */
+            Status = _SEH2_GetExceptionCode();
+        }
+        _SEH2_END;
+
+        Removed += Batch;
+    } while (NT_SUCCESS(Status) &&
+             (Batch == IOP_COMPLETION_BATCH) &&
+             (Removed < Count));
+
+    /* Dereference the Object */
+    ObDereferenceObject(Queue);
+
+    /* Return the number of entries */
+    _SEH2_TRY
+    {
+        *NumEntriesRemoved = Removed;
+    }
+    _SEH2_EXCEPT(ExSystemExceptionFilter())
+    {
+        /* Get the exception code */
+        Status = _SEH2_GetExceptionCode();
+    }
+    _SEH2_END;
+
+    /* Return status */
+    return Status;
+}
+
 NTSTATUS
 NTAPI
 NtSetIoCompletion(IN HANDLE IoCompletionPortHandle,
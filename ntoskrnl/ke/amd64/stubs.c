@@ -95,6 +95,28 @@ KeZeroPages(IN PVOID Address,
     RtlZeroMemory(Address, Size);
 }
 
+VOID
+FASTCALL
+KeZeroPagesFromIdleThread(IN PVOID Address,
+                          IN ULONG Size)
+{
+    PULONG64 Pointer, End;
+
+    /* Nobody is going to read these pages soon, so write around the caches */
+    ASSERT((Size % (4 * sizeof(ULONG64))) == 0);
+    End = (PULONG64)((ULONG_PTR)Address + Size);
+    for (Pointer = Address; Pointer < End; Pointer += 4)
+    {
+        _mm_stream_si64x((LONG64 *)&Pointer[0], 0);
+        _mm_stream_si64x((LONG64 *)&Pointer[1], 0);
+        _mm_stream_si64x((LONG64 *)&Pointer[2], 0);
+        _mm_stream_si64x((LONG64 *)&Pointer[3], 0);
+    }
+
+    /* Order the streaming stores before the pages are handed out */
+    _mm_sfence();
+}
+
 PVOID
 KiSwitchKernelStackHelper(
     LONG_PTR StackOffset,
@@ -195,31 +217,48 @@ KiIdleLoop(VOID)
             KiRetireDpcList(Prcb);
         }
 
+        /* Look for work on the other processors if we just went idle */
+        if (Prcb->IdleSchedule) KiIdleSchedule(Prcb);
+
         /* Check if a new thread is scheduled for execution */
         if (Prcb->NextThread)
         {
             /* Enable interrupts */
             _enable();
 
+            /* Other CPUs may change the next thread until we own the PRCB */
+            KiAcquirePrcbLock(Prcb);
+
             /* Capture current thread data */
             OldThread = Prcb->CurrentThread;
             NewThread = Prcb->NextThread;
-
-            /* Set new thread data */
-            Prcb->NextThread = NULL;
-            Prcb->CurrentThread = NewThread;
-
-            /* The thread is now running */
-            NewThread->State = Running;
-
-            /* Do the swap at SYNCH_LEVEL */
-            KfRaiseIrql(SYNCH_LEVEL);
-
-            /* Switch away from the idle thread */
-            KiSwapContext(APC_LEVEL, OldThread);
-
-            /* Go back to DISPATCH_LEVEL */
-            KeLowerIrql(DISPATCH_LEVEL);
+            if (NewThread)
+            {
+                /* Set new thread data */
+                Prcb->NextThread = NULL;
+                Prcb->CurrentThread = NewThread;
+
+                /* The thread is now running */
+                NewThread->State = Running;
+
+                /* The idle thread is being swapped out */
+                KiSetThreadSwapBusy(OldThread);
+                KiReleasePrcbLock(Prcb);
+
+                /* Do the swap at SYNCH_LEVEL */
+                KfRaiseIrql(SYNCH_LEVEL);
+
+                /* Switch away from the idle thread */
+                KiSwapContext(APC_LEVEL, OldThread);
+
+                /* Go back to DISPATCH_LEVEL */
+                KeLowerIrql(DISPATCH_LEVEL);
+            }
+            else
+            {
+                /* It was taken away again, keep idling */
+                KiReleasePrcbLock(Prcb);
+            }
         }
         else
         {
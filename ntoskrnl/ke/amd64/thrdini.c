@@ -184,6 +184,9 @@ KiSwapContextResume(
                      0);
     }
 
+    /* We are off the old thread's stack, other CPUs may switch to it now */
+    KiClearThreadSwapBusy(OldThread);
+
     /* Kernel APCs may be pending */
     if (NewThread->ApcState.KernelApcPending)
     {
@@ -1138,6 +1138,35 @@ KeZeroPages(IN PVOID Address,
     RtlZeroMemory(Address, Size);
 }
 
+VOID
+FASTCALL
+KeZeroPagesFromIdleThread(IN PVOID Address,
+                          IN ULONG Size)
+{
+    PULONG Pointer, End;
+
+    /* Non-temporal stores need SSE2 */
+    if (!(KeFeatureBits & KF_XMMI64))
+    {
+        RtlZeroMemory(Address, Size);
+        return;
+    }
+
+    /* Nobody is going to read these pages soon, so write around the caches */
+    ASSERT((Size % (4 * sizeof(ULONG))) == 0);
+    End = (PULONG)((ULONG_PTR)Address + Size);
+    for (Pointer = Address; Pointer < End; Pointer += 4)
+    {
+        _mm_stream_si32((int *)&Pointer[0], 0);
+        _mm_stream_si32((int *)&Pointer[1], 0);
+        _mm_stream_si32((int *)&Pointer[2], 0);
+        _mm_stream_si32((int *)&Pointer[3], 0);
+    }
+
+    /* Order the streaming stores before the pages are handed out */
+    _mm_sfence();
+}
+
 VOID
 NTAPI
 KiSaveProcessorState(IN PKTRAP_FRAME TrapFrame,
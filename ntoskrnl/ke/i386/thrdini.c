@@ -294,25 +294,42 @@ KiIdleLoop(VOID)
             KiRetireDpcList(Prcb);
         }
 
+        /* Look for work on the other processors if we just went idle */
+        if (Prcb->IdleSchedule) KiIdleSchedule(Prcb);
+
         /* Check if a new thread is scheduled for execution */
         if (Prcb->NextThread)
         {
             /* Enable interrupts */
             _enable();
 
+            /* Other CPUs may change the next thread until we own the PRCB */
+            KiAcquirePrcbLock(Prcb);
+
             /* Capture current thread data */
             OldThread = Prcb->CurrentThread;
             NewThread = Prcb->NextThread;
+            if (NewThread)
+            {
+                /* Set new thread data */
+                Prcb->NextThread = NULL;
+                Prcb->CurrentThread = NewThread;
 
-            /* Set new thread data */
-            Prcb->NextThread = NULL;
-            Prcb->CurrentThread = NewThread;
+                /* The thread is now running */
+                NewThread->State = Running;
 
-            /* The thread is now running */
-            NewThread->State = Running;
+                /* The idle thread is being swapped out */
+                KiSetThreadSwapBusy(OldThread);
+                KiReleasePrcbLock(Prcb);
 
-            /* Switch away from the idle thread */
-            KiSwapContext(APC_LEVEL, OldThread);
+                /* Switch away from the idle thread */
+                KiSwapContext(APC_LEVEL, OldThread);
+            }
+            else
+            {
+                /* It was taken away again, keep idling */
+                KiReleasePrcbLock(Prcb);
+            }
         }
         else
         {
@@ -391,6 +408,9 @@ KiSwapContextExit(IN PKTHREAD OldThread,
                      0);
     }
 
+    /* We are off the old thread's stack, other CPUs may switch to it now */
+    KiClearThreadSwapBusy(OldThread);
+
     /* Kernel APCs may be pending */
     if (NewThread->ApcState.KernelApcPending)
     {
@@ -438,6 +458,9 @@ KiSwapContextEntry(IN PKSWITCHFRAME SwitchFrame,
     /* Get the old thread and set its kernel stack */
     OldThread->KernelStack = SwitchFrame;
 
+    /* The new thread may still be switching out on another CPU */
+    KiWaitForThreadSwapBusy(NewThread);
+
     /* ISRs can change FPU state, so disable interrupts while checking */
     _disable();
 
@@ -34,8 +34,25 @@ FASTCALL
 KiIpiSend(IN KAFFINITY TargetProcessors,
           IN ULONG IpiRequest)
 {
-    /* FIXME: TODO */
-    ASSERTMSG("Not yet implemented\n", FALSE);
+#ifdef CONFIG_SMP
+    LONG i;
+    PKPRCB Prcb;
+    KAFFINITY Current;
+
+    for (i = 0, Current = 1; i < KeNumberProcessors; i++, Current <<= 1)
+    {
+        if (TargetProcessors & Current)
+        {
+            /* Flag the request for KiIpiServiceRoutine and interrupt the CPU */
+            Prcb = KiProcessorBlock[i];
+            InterlockedBitTestAndSet((PLONG)&Prcb->IpiFrozen, IpiRequest);
+            HalRequestIpi(i);
+        }
+    }
+#else
+    /* There is nobody to interrupt on UP */
+    ASSERT(FALSE);
+#endif
 }
 
 VOID
@@ -62,6 +62,59 @@ KiActivateWaiterQueue(IN PKQUEUE Queue)
     }
 }
 
+/*
+ * Tells a removed entry apart from a wait status passed in its place
+ */
+FORCEINLINE
+BOOLEAN
+KiIsQueueEntry(IN LONG_PTR Status)
+{
+    return ((Status != STATUS_TIMEOUT) &&
+            (Status != STATUS_USER_APC) &&
+            (Status != STATUS_ALERTED));
+}
+
+/*
+ * Takes the entries already queued, without waiting, until EntryArray is
+ * full. Called with the dispatcher lock held; returns the new entry count.
+ */
+static
+ULONG
+KiRemoveQueueEntries(IN PKQUEUE Queue,
+                     IN OUT PLIST_ENTRY *EntryArray,
+                     IN ULONG Entries,
+                     IN ULONG Count)
+{
+    PLIST_ENTRY QueueEntry;
+
+    while (Entries < Count)
+    {
+        /* Stop when the queue is empty */
+        QueueEntry = Queue->EntryListHead.Flink;
+        if (QueueEntry == &Queue->EntryListHead) break;
+
+        /* Check if the entry is valid. If not, bugcheck */
+        if (!(QueueEntry->Flink) || !(QueueEntry->Blink))
+        {
+            /* Invalid item */
+            KeBugCheckEx(INVALID_WORK_QUEUE_ITEM,
+                         (ULONG_PTR)QueueEntry,
+                         (ULONG_PTR)Queue,
+                         (ULONG_PTR)NULL,
+                         (ULONG_PTR)((PWORK_QUEUE_ITEM)QueueEntry)->
+                                     WorkerRoutine);
+        }
+
+        /* Remove the Entry, the thread is already counted as running */
+        Queue->Header.SignalState--;
+        RemoveEntryList(QueueEntry);
+        QueueEntry->Flink = NULL;
+        EntryArray[Entries++] = QueueEntry;
+    }
+
+    return Entries;
+}
+
 /*
  * Returns the previous number of entries in the queue
  */
@@ -232,15 +285,24 @@ KeReadStateQueue(IN PKQUEUE Queue)
 
 /*
  * @implemented
+ *
+ * Waits for an entry like KeRemoveQueue, then takes the entries already
+ * queued behind it up to Count without waiting again. Returns the number
+ * of entries written to EntryArray; a timeout, alert or user APC is
+ * returned as the only entry, cast to a PLIST_ENTRY as KeRemoveQueue does.
  */
-PLIST_ENTRY
+ULONG
 NTAPI
-KeRemoveQueue(IN PKQUEUE Queue,
-              IN KPROCESSOR_MODE WaitMode,
-              IN PLARGE_INTEGER Timeout OPTIONAL)
+KeRemoveQueueEx(IN PKQUEUE Queue,
+                IN KPROCESSOR_MODE WaitMode,
+                IN BOOLEAN Alertable,
+                IN PLARGE_INTEGER Timeout OPTIONAL,
+                OUT PLIST_ENTRY *EntryArray,
+                IN ULONG Count)
 {
     PLIST_ENTRY QueueEntry;
     LONG_PTR Status;
+    ULONG Entries;
     PKTHREAD Thread = KeGetCurrentThread();
     PKQUEUE PreviousQueue;
     PKWAIT_BLOCK WaitBlock = &Thread->WaitBlock[0];
@@ -252,6 +314,7 @@ KeRemoveQueue(IN PKQUEUE Queue,
     ULONG Hand = 0;
     ASSERT_QUEUE(Queue);
     ASSERT_IRQL_LESS_OR_EQUAL(DISPATCH_LEVEL);
+    ASSERT(Count != 0);
 
     /* Check if the Lock is already held */
     if (Thread->WaitNext)
@@ -344,12 +407,12 @@ KeRemoveQueue(IN PKQUEUE Queue,
             }
             else
             {
-                /* Fail if there's a User APC Pending */
-                if ((WaitMode != KernelMode) &&
-                    (Thread->ApcState.UserApcPending))
+                /* Fail if we were alerted or there's a User APC Pending */
+                Status = KiCheckAlertability(Thread, Alertable, WaitMode);
+                if (Status != STATUS_WAIT_0)
                 {
                     /* Return the status and increase the pending threads */
-                    QueueEntry = (PLIST_ENTRY)STATUS_USER_APC;
+                    QueueEntry = (PLIST_ENTRY)Status;
                     Queue->CurrentCount++;
                     break;
                 }
@@ -404,7 +467,20 @@ KeRemoveQueue(IN PKQUEUE Queue,
                 Thread->WaitReason = 0;
 
                 /* Check if we were executing an APC */
-                if (Status != STATUS_KERNEL_APC) return (PLIST_ENTRY)Status;
+                if (Status != STATUS_KERNEL_APC)
+                {
+                    /* Check if an entry was handed to us */
+                    EntryArray[0] = (PLIST_ENTRY)Status;
+                    if ((Count == 1) || !KiIsQueueEntry(Status)) return 1;
+
+                    /* Pick up what was queued behind it */
+                    Thread->WaitIrql = KeRaiseIrqlToSynchLevel();
+                    KiAcquireDispatcherLockAtSynchLevel();
+                    Entries = KiRemoveQueueEntries(Queue, EntryArray, 1, Count);
+                    KiReleaseDispatcherLockFromSynchLevel();
+                    KiExitDispatcher(Thread->WaitIrql);
+                    return Entries;
+                }
 
                 /* Check if we had a timeout */
                 if (Timeout)
@@ -424,9 +500,32 @@ KeRemoveQueue(IN PKQUEUE Queue,
         }
     }
 
+    /* Take whatever else is already queued */
+    EntryArray[0] = QueueEntry;
+    Entries = 1;
+    if ((Count > 1) && KiIsQueueEntry((LONG_PTR)QueueEntry))
+    {
+        Entries = KiRemoveQueueEntries(Queue, EntryArray, 1, Count);
+    }
+
     /* Unlock Database and return */
     KiReleaseDispatcherLockFromSynchLevel();
     KiExitDispatcher(Thread->WaitIrql);
+    return Entries;
+}
+
+/*
+ * @implemented
+ */
+PLIST_ENTRY
+NTAPI
+KeRemoveQueue(IN PKQUEUE Queue,
+              IN KPROCESSOR_MODE WaitMode,
+              IN PLARGE_INTEGER Timeout OPTIONAL)
+{
+    PLIST_ENTRY QueueEntry;
+
+    KeRemoveQueueEx(Queue, WaitMode, FALSE, Timeout, &QueueEntry, 1);
     return QueueEntry;
 }
 
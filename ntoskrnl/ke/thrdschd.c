@@ -15,9 +15,13 @@
 #ifdef _WIN64
 # define InterlockedOrSetMember(Destination, SetMember) \
     InterlockedOr64((PLONG64)Destination, SetMember);
+# define InterlockedAndSetMember(Destination, SetMember) \
+    InterlockedAnd64((PLONG64)Destination, SetMember);
 #else
 # define InterlockedOrSetMember(Destination, SetMember) \
     InterlockedOr((PLONG)Destination, SetMember);
+# define InterlockedAndSetMember(Destination, SetMember) \
+    InterlockedAnd((PLONG)Destination, SetMember);
 #endif
 
 /* GLOBALS *******************************************************************/
@@ -27,13 +31,228 @@ ULONG_PTR KiIdleSMTSummary;
 
 /* FUNCTIONS *****************************************************************/
 
+#ifdef CONFIG_SMP
+//
+// Idle summary maintenance. A processor is in KiIdleSummary while it runs its
+// idle thread without a thread on standby, and its SMT set is in
+// KiIdleSMTSummary while every logical processor of the core is idle.
+//
+FORCEINLINE
+VOID
+KiSetProcessorIdle(IN PKPRCB Prcb)
+{
+    InterlockedOrSetMember(&KiIdleSummary, Prcb->SetMember);
+
+    /* Check if the whole physical core went idle */
+    if ((KiIdleSummary & Prcb->MultiThreadProcessorSet) ==
+        Prcb->MultiThreadProcessorSet)
+    {
+        InterlockedOrSetMember(&KiIdleSMTSummary,
+                               Prcb->MultiThreadProcessorSet);
+    }
+}
+
+FORCEINLINE
+VOID
+KiClearProcessorIdle(IN PKPRCB Prcb)
+{
+    InterlockedAndSetMember(&KiIdleSummary, ~Prcb->SetMember);
+    InterlockedAndSetMember(&KiIdleSMTSummary,
+                            ~Prcb->MultiThreadProcessorSet);
+}
+
+//
+// Acquires the locks of two PRCBs in processor order, so that two processors
+// looking at each other's ready queues cannot deadlock.
+//
+FORCEINLINE
+VOID
+KiAcquireTwoPrcbLocks(IN PKPRCB FirstPrcb,
+                      IN PKPRCB SecondPrcb)
+{
+    if (FirstPrcb->Number < SecondPrcb->Number)
+    {
+        KiAcquirePrcbLock(FirstPrcb);
+        KiAcquirePrcbLock(SecondPrcb);
+    }
+    else
+    {
+        KiAcquirePrcbLock(SecondPrcb);
+        KiAcquirePrcbLock(FirstPrcb);
+    }
+}
+
+FORCEINLINE
+VOID
+KiReleaseTwoPrcbLocks(IN PKPRCB FirstPrcb,
+                      IN PKPRCB SecondPrcb)
+{
+    KiReleasePrcbLock(FirstPrcb);
+    KiReleasePrcbLock(SecondPrcb);
+}
+
+//
+// Picks the processor a ready thread should be queued on when no allowed
+// processor is idle: the ideal processor, then the one it last ran on (its
+// cache is probably still warm), then any processor in its affinity.
+//
+FORCEINLINE
+ULONG
+KiSelectReadyProcessor(IN PKTHREAD Thread)
+{
+    KAFFINITY Affinity = Thread->Affinity & KeActiveProcessors;
+    ULONG Processor;
+
+    ASSERT(Affinity != 0);
+
+    Processor = Thread->IdealProcessor;
+    if (Affinity & AFFINITY_MASK(Processor)) return Processor;
+
+    Processor = Thread->NextProcessor;
+    if (Affinity & AFFINITY_MASK(Processor)) return Processor;
+
+    BitScanForward(&Processor, (ULONG)Affinity);
+    return Processor;
+}
+
+//
+// Picks an idle processor from the given set, preferring a processor whose
+// whole core is idle, then the ideal processor, then the last one used.
+//
+FORCEINLINE
+ULONG
+KiSelectIdleProcessor(IN PKTHREAD Thread,
+                      IN KAFFINITY IdleSet)
+{
+    ULONG Processor;
+
+    ASSERT(IdleSet != 0);
+
+    /* Don't share a core with a busy sibling if a whole core is free */
+    if (IdleSet & KiIdleSMTSummary) IdleSet &= KiIdleSMTSummary;
+
+    Processor = Thread->IdealProcessor;
+    if (IdleSet & AFFINITY_MASK(Processor)) return Processor;
+
+    Processor = Thread->NextProcessor;
+    if (IdleSet & AFFINITY_MASK(Processor)) return Processor;
+
+    BitScanForward(&Processor, (ULONG)IdleSet);
+    return Processor;
+}
+
+//
+// Removes the highest priority thread that may run on Prcb from the ready
+// queues of another processor. Both PRCB locks must be held.
+//
+static
+PKTHREAD
+KiStealReadyThread(IN PKPRCB Prcb,
+                   IN PKPRCB Victim)
+{
+    ULONG Summary, Priority;
+    PLIST_ENTRY ListHead, ListEntry;
+    PKTHREAD Thread;
+
+    Summary = Victim->ReadySummary;
+    while (Summary)
+    {
+        /* Scan the ready queues from the highest priority down */
+        BitScanReverse(&Priority, Summary);
+        Summary ^= PRIORITY_MASK(Priority);
+
+        ListHead = &Victim->DispatcherReadyListHead[Priority];
+        for (ListEntry = ListHead->Flink;
+             ListEntry != ListHead;
+             ListEntry = ListEntry->Flink)
+        {
+            Thread = CONTAINING_RECORD(ListEntry, KTHREAD, WaitListEntry);
+            ASSERT(Thread->State == Ready);
+            ASSERT(Thread->NextProcessor == Victim->Number);
+
+            /* Skip threads that can't run here */
+            if (!(Thread->Affinity & Prcb->SetMember)) continue;
+
+            /* Take it off the other processor's queue */
+            if (RemoveEntryList(&Thread->WaitListEntry))
+            {
+                Victim->ReadySummary ^= PRIORITY_MASK(Priority);
+            }
+
+            Thread->NextProcessor = Prcb->Number;
+            return Thread;
+        }
+    }
+
+    return NULL;
+}
+#endif
+
 PKTHREAD
 FASTCALL
 KiIdleSchedule(IN PKPRCB Prcb)
 {
-    /* FIXME: TODO */
-    ASSERTMSG("SMP: Not yet implemented\n", FALSE);
+#ifdef CONFIG_SMP
+    PKTHREAD Thread = NULL;
+    PKPRCB Victim;
+    ULONG i, Number;
+#endif
+
+    /* Called from the idle loop, which runs at DISPATCH_LEVEL */
+    ASSERT(KeGetCurrentIrql() >= DISPATCH_LEVEL);
+    ASSERT(Prcb == KeGetCurrentPrcb());
+
+    /* This is a one-shot request */
+    Prcb->IdleSchedule = FALSE;
+
+#ifdef CONFIG_SMP
+
+    /* Look at our own queue first, it may have been filled while going idle */
+    KiAcquirePrcbLock(Prcb);
+    if (!Prcb->NextThread)
+    {
+        Thread = KiSelectReadyThread(0, Prcb);
+        if (Thread)
+        {
+            Thread->State = Standby;
+            Prcb->NextThread = Thread;
+            KiClearProcessorIdle(Prcb);
+        }
+    }
+    KiReleasePrcbLock(Prcb);
+    if (Prcb->NextThread) return Prcb->NextThread;
+
+    /* Then steal a waiting thread from a busy processor, starting after us */
+    for (i = 1; i < (ULONG)KeNumberProcessors; i++)
+    {
+        Number = (Prcb->Number + i) % KeNumberProcessors;
+        Victim = KiProcessorBlock[Number];
+
+        /* Unlocked peek, rechecked below */
+        if (!Victim->ReadySummary) continue;
+
+        KiAcquireTwoPrcbLocks(Prcb, Victim);
+        if (!Prcb->NextThread)
+        {
+            Thread = KiStealReadyThread(Prcb, Victim);
+            if (Thread)
+            {
+                Thread->State = Standby;
+                Prcb->NextThread = Thread;
+                KiClearProcessorIdle(Prcb);
+            }
+        }
+        KiReleaseTwoPrcbLocks(Prcb, Victim);
+
+        /* Stop once we have something to run */
+        if (Prcb->NextThread) break;
+    }
+
+    return Prcb->NextThread;
+#else
+    /* There is nothing to steal from on UP */
     return NULL;
+#endif
 }
 
 VOID
@@ -83,6 +302,9 @@ KiDeferredReadyThread(IN PKTHREAD Thread)
     ULONG Processor = 0;
     KPRIORITY OldPriority;
     PKTHREAD NextThread;
+#ifdef CONFIG_SMP
+    KAFFINITY IdleSet;
+#endif
 
     /* Sanity checks */
     ASSERT(Thread->State == DeferredReady);
@@ -228,6 +450,43 @@ KiDeferredReadyThread(IN PKTHREAD Thread)
     OldPriority = Thread->Priority;
     Thread->Preempted = FALSE;
 
+#ifdef CONFIG_SMP
+    /* Check if any processor this thread may run on is idle */
+    IdleSet = KiIdleSummary & Thread->Affinity;
+    if (IdleSet)
+    {
+        /* Pick one and lock it */
+        Processor = KiSelectIdleProcessor(Thread, IdleSet);
+        Prcb = KiProcessorBlock[Processor];
+        KiAcquirePrcbLock(Prcb);
+
+        /* Make sure it is still idle now that we own its PRCB */
+        if ((KiIdleSummary & Prcb->SetMember) && !(Prcb->NextThread))
+        {
+            /* Take it out of the idle set and hand it this thread */
+            KiClearProcessorIdle(Prcb);
+            Thread->NextProcessor = (UCHAR)Processor;
+            Thread->State = Standby;
+            Prcb->NextThread = Thread;
+
+            /* Unlock the PRCB and wake up the processor if it isn't us */
+            KiReleasePrcbLock(Prcb);
+            if (KeGetCurrentProcessorNumber() != Processor)
+            {
+                KiIpiSend(AFFINITY_MASK(Processor), IPI_DPC);
+            }
+            return;
+        }
+
+        /* Somebody beat us to it, fall back to a ready queue */
+        KiReleasePrcbLock(Prcb);
+    }
+
+    /* Queue the thread on its preferred CPU and get the PRCB and lock it */
+    Processor = KiSelectReadyProcessor(Thread);
+    Prcb = KiProcessorBlock[Processor];
+    KiAcquirePrcbLock(Prcb);
+#else
     /* Queue the thread on CPU 0 and get the PRCB and lock it */
     Thread->NextProcessor = 0;
     Prcb = KiProcessorBlock[0];
@@ -245,6 +504,7 @@ KiDeferredReadyThread(IN PKTHREAD Thread)
         KiReleasePrcbLock(Prcb);
         return;
     }
+#endif
 
     /* Set the CPU number */
     Thread->NextProcessor = (UCHAR)Processor;
@@ -256,6 +516,19 @@ KiDeferredReadyThread(IN PKTHREAD Thread)
         /* Sanity check */
         ASSERT(NextThread->State == Standby);
 
+#ifdef CONFIG_SMP
+        /* The idle thread only stands in for a thread that had to move away */
+        if (NextThread == Prcb->IdleThread)
+        {
+            /* Take this thread instead, the idle thread is never readied */
+            KiClearProcessorIdle(Prcb);
+            Thread->State = Standby;
+            Prcb->NextThread = Thread;
+            KiReleasePrcbLock(Prcb);
+            return;
+        }
+#endif
+
         /* Check if priority changed */
         if (OldPriority > NextThread->Priority)
         {
@@ -278,11 +551,17 @@ KiDeferredReadyThread(IN PKTHREAD Thread)
     {
         /* Set the next thread as the current thread */
         NextThread = Prcb->CurrentThread;
-        if (OldPriority > NextThread->Priority)
+        if ((OldPriority > NextThread->Priority) ||
+            (NextThread == Prcb->IdleThread))
         {
             /* Preempt it if it's already running */
             if (NextThread->State == Running) NextThread->Preempted = TRUE;
 
+#ifdef CONFIG_SMP
+            /* An idle processor is no longer idle once it has a thread */
+            if (NextThread == Prcb->IdleThread) KiClearProcessorIdle(Prcb);
+#endif
+
             /* Set the thread on standby and as the next thread */
             Thread->State = Standby;
             Prcb->NextThread = Thread;
@@ -337,11 +616,12 @@ KiSelectNextThread(IN PKPRCB Prcb)
         Thread = Prcb->IdleThread;
 
         /* Enable idle scheduling */
+#ifdef CONFIG_SMP
+        KiSetProcessorIdle(Prcb);
+#else
         InterlockedOrSetMember(&KiIdleSummary, Prcb->SetMember);
+#endif
         Prcb->IdleSchedule = TRUE;
-
-        /* FIXME: SMT support */
-        ASSERTMSG("SMP: Not yet implemented\n", FALSE);
     }
 
     /* Sanity checks and return the thread */
@@ -386,7 +666,14 @@ KiSwapThread(IN PKTHREAD CurrentThread,
         else
         {
             /* Set the idle summary */
+#ifdef CONFIG_SMP
+            KiSetProcessorIdle(Prcb);
+
+            /* Let the idle loop look for work on the other processors */
+            Prcb->IdleSchedule = TRUE;
+#else
             InterlockedOrSetMember(&KiIdleSummary, Prcb->SetMember);
+#endif
 
             /* Schedule the idle thread */
             NextThread = Prcb->IdleThread;
@@ -705,8 +992,115 @@ KiSetAffinityThread(IN PKTHREAD Thread,
     if (!Thread->SystemAffinityActive)
     {
 #ifdef CONFIG_SMP
-        /* FIXME: TODO */
-        DPRINT1("Affinity support disabled!\n");
+        PKPRCB Prcb;
+        ULONG Processor;
+        BOOLEAN RequestInterrupt = FALSE;
+
+        /* Update the effective affinity and keep the ideal CPU inside it */
+        Thread->Affinity = Affinity;
+        if (!(Affinity & AFFINITY_MASK(Thread->IdealProcessor)))
+        {
+            BitScanForward(&Processor, (ULONG)(Affinity & KeActiveProcessors));
+            Thread->IdealProcessor = (UCHAR)Processor;
+        }
+
+        /* Move the thread if it is queued or running on a CPU it left */
+        for (;;)
+        {
+            Processor = Thread->NextProcessor;
+            if (Affinity & AFFINITY_MASK(Processor)) break;
+            Prcb = KiProcessorBlock[Processor];
+
+            if (Thread->State == Ready)
+            {
+                if (Thread->ProcessReadyQueue) break;
+
+                /* Make sure the thread is still ready and on this CPU */
+                KiAcquirePrcbLock(Prcb);
+                if ((Thread->State != Ready) ||
+                    (Thread->NextProcessor != Prcb->Number))
+                {
+                    KiReleasePrcbLock(Prcb);
+                    continue;
+                }
+
+                /* Pull it off the queue and ready it again somewhere else */
+                if (RemoveEntryList(&Thread->WaitListEntry))
+                {
+                    Prcb->ReadySummary ^= PRIORITY_MASK(Thread->Priority);
+                }
+                KiReleasePrcbLock(Prcb);
+
+                Thread->State = DeferredReady;
+                Thread->DeferredProcessor = Prcb->Number;
+                KiDeferredReadyThread(Thread);
+            }
+            else if (Thread->State == Standby)
+            {
+                /* Make sure it is still the next thread of that CPU */
+                KiAcquirePrcbLock(Prcb);
+                if (Thread != Prcb->NextThread)
+                {
+                    KiReleasePrcbLock(Prcb);
+                    continue;
+                }
+
+                /*
+                 * Give that CPU something else and ready this one again. If
+                 * nothing is ready it just keeps running its current thread;
+                 * an idle CPU goes back to the idle summary.
+                 */
+                Prcb->NextThread = KiSelectReadyThread(0, Prcb);
+                if (Prcb->NextThread)
+                {
+                    Prcb->NextThread->State = Standby;
+                }
+                else if (Prcb->CurrentThread == Prcb->IdleThread)
+                {
+                    KiSetProcessorIdle(Prcb);
+                    Prcb->IdleSchedule = TRUE;
+                }
+                KiReleasePrcbLock(Prcb);
+
+                Thread->State = DeferredReady;
+                Thread->DeferredProcessor = Prcb->Number;
+                KiDeferredReadyThread(Thread);
+            }
+            else if (Thread->State == Running)
+            {
+                /* Make sure it is still running there */
+                KiAcquirePrcbLock(Prcb);
+                if (Thread != Prcb->CurrentThread)
+                {
+                    KiReleasePrcbLock(Prcb);
+                    continue;
+                }
+
+                /* Schedule a replacement; requeueing the thread moves it */
+                if (!Prcb->NextThread)
+                {
+                    Prcb->NextThread = KiSelectNextThread(Prcb);
+                    Prcb->NextThread->State = Standby;
+                    RequestInterrupt = TRUE;
+                }
+                KiReleasePrcbLock(Prcb);
+
+                if (RequestInterrupt)
+                {
+                    if (KeGetCurrentProcessorNumber() != Processor)
+                    {
+                        KiIpiSend(AFFINITY_MASK(Processor), IPI_DPC);
+                    }
+                    else
+                    {
+                        HalRequestSoftwareInterrupt(DISPATCH_LEVEL);
+                    }
+                }
+            }
+
+            /* Any other state picks a processor when it becomes ready */
+            break;
+        }
 #endif
     }
 
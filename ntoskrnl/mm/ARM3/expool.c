@@ -30,6 +30,18 @@ typedef struct _POOL_DPC_CONTEXT
     SIZE_T PoolTrackTableSizeExpansion;
 } POOL_DPC_CONTEXT, *PPOOL_DPC_CONTEXT;
 
+//
+// Per-processor state of the big page table. Readers counts the processor's
+// lock-free operations in progress, and EntriesInUse its share of the entries
+// (which can be negative when blocks are freed on another processor)
+//
+typedef struct _POOL_BIG_PAGES_PROCESSOR
+{
+    volatile LONG Readers;
+    LONG EntriesInUse;
+    UCHAR Padding[SYSTEM_CACHE_ALIGNMENT_SIZE - 2 * sizeof(LONG)];
+} POOL_BIG_PAGES_PROCESSOR, *PPOOL_BIG_PAGES_PROCESSOR;
+
 ULONG ExpNumberOfPagedPools;
 POOL_DESCRIPTOR NonPagedPoolDescriptor;
 PPOOL_DESCRIPTOR ExpPagedPoolDescriptor[16 + 1];
@@ -39,12 +51,14 @@ SIZE_T PoolTrackTableSize, PoolTrackTableMask;
 SIZE_T PoolBigPageTableSize, PoolBigPageTableHash;
 ULONG ExpBigTableExpansionFailed;
 PPOOL_TRACKER_TABLE PoolTrackTable;
+PPOOL_TRACKER_TABLE ExpPoolTrackTables[MAXIMUM_PROCESSORS];
 PPOOL_TRACKER_BIG_PAGES PoolBigPageTable;
 KSPIN_LOCK ExpTaggedPoolLock;
 ULONG PoolHitTag;
 BOOLEAN ExStopBadTags;
 KSPIN_LOCK ExpLargePoolTableLock;
-ULONG ExpPoolBigEntriesInUse;
+volatile LONG ExpBigPageTableExpanding;
+POOL_BIG_PAGES_PROCESSOR ExpBigPagesProcessor[MAXIMUM_PROCESSORS];
 ULONG ExpPoolFlags;
 ULONG ExPoolFailures;
 ULONGLONG MiLastPoolDumpTime;
@@ -462,6 +476,51 @@ ExpComputePartialHashForAddress(IN PVOID BaseAddress)
     return (Result >> 24) ^ (Result >> 16) ^ (Result >> 8) ^ Result;
 }
 
+FORCEINLINE
+PPOOL_TRACKER_TABLE
+ExpGetProcessorTrackTable(VOID)
+{
+    PPOOL_TRACKER_TABLE Table;
+
+    //
+    // PoolTrackTable owns the tags and holds the counters of the boot
+    // processor. Every other processor counts into its own copy indexed the
+    // same way, so that allocations don't bounce the same cache lines between
+    // processors. A thread that moves to another processor in between only
+    // costs us a remote interlocked operation.
+    //
+    // Processors whose table couldn't be allocated share the boot one
+    //
+    Table = ExpPoolTrackTables[KeGetCurrentProcessorNumber()];
+    return Table ? Table : PoolTrackTable;
+}
+
+static
+VOID
+ExpSumPoolTracker(IN SIZE_T Index,
+                  OUT PPOOL_TRACKER_TABLE Entry)
+{
+    PPOOL_TRACKER_TABLE Table;
+    ULONG i;
+
+    //
+    // Start from the tag and boot processor counters, and add everybody else's
+    //
+    *Entry = PoolTrackTable[Index];
+    for (i = 1; i < (ULONG)KeNumberProcessors; i++)
+    {
+        Table = ExpPoolTrackTables[i];
+        if (!Table) continue;
+
+        Entry->NonPagedAllocs += Table[Index].NonPagedAllocs;
+        Entry->NonPagedFrees += Table[Index].NonPagedFrees;
+        Entry->NonPagedBytes += Table[Index].NonPagedBytes;
+        Entry->PagedAllocs += Table[Index].PagedAllocs;
+        Entry->PagedFrees += Table[Index].PagedFrees;
+        Entry->PagedBytes += Table[Index].PagedBytes;
+    }
+}
+
 #if DBG
 /*
  * FORCEINLINE
@@ -526,9 +585,11 @@ MiDumpPoolConsumers(BOOLEAN CalledFromDbg, ULONG Tag, ULONG Mask, ULONG Flags)
     //
     for (i = 0; i < PoolTrackTableSize; ++i)
     {
+        POOL_TRACKER_TABLE Summed;
         PPOOL_TRACKER_TABLE TableEntry;
 
-        TableEntry = &PoolTrackTable[i];
+        ExpSumPoolTracker(i, &Summed);
+        TableEntry = &Summed;
 
         //
         // We only care about tags which have allocated memory
@@ -750,7 +811,7 @@ ExpRemovePoolTracker(IN ULONG Key,
                      IN POOL_TYPE PoolType)
 {
     ULONG Hash, Index;
-    PPOOL_TRACKER_TABLE Table, TableEntry;
+    PPOOL_TRACKER_TABLE Table, TableEntry, Counters;
     SIZE_T TableMask, TableSize;
 
     //
@@ -792,17 +853,18 @@ ExpRemovePoolTracker(IN ULONG Key,
         {
             //
             // Decrement the counters depending on if this was paged or nonpaged
-            // pool
+            // pool, in this processor's copy of the entry
             //
+            Counters = &ExpGetProcessorTrackTable()[Hash];
             if ((PoolType & BASE_POOL_TYPE_MASK) == NonPagedPool)
             {
-                InterlockedIncrement(&TableEntry->NonPagedFrees);
-                InterlockedExchangeAddSizeT(&TableEntry->NonPagedBytes,
+                InterlockedIncrement(&Counters->NonPagedFrees);
+                InterlockedExchangeAddSizeT(&Counters->NonPagedBytes,
                                             -(SSIZE_T)NumberOfBytes);
                 return;
             }
-            InterlockedIncrement(&TableEntry->PagedFrees);
-            InterlockedExchangeAddSizeT(&TableEntry->PagedBytes,
+            InterlockedIncrement(&Counters->PagedFrees);
+            InterlockedExchangeAddSizeT(&Counters->PagedBytes,
                                         -(SSIZE_T)NumberOfBytes);
             return;
         }
@@ -842,7 +904,7 @@ ExpInsertPoolTracker(IN ULONG Key,
 {
     ULONG Hash, Index;
     KIRQL OldIrql;
-    PPOOL_TRACKER_TABLE Table, TableEntry;
+    PPOOL_TRACKER_TABLE Table, TableEntry, Counters;
     SIZE_T TableMask, TableSize;
 
     //
@@ -865,7 +927,6 @@ ExpInsertPoolTracker(IN ULONG Key,
     // ASSERT on ReactOS features not yet supported
     //
     ASSERT(!(PoolType & SESSION_POOL_MASK));
-    ASSERT(KeGetCurrentProcessorNumber() == 0);
 
     //
     // Why the double indirection? Because normally this function is also used
@@ -895,16 +956,17 @@ ExpInsertPoolTracker(IN ULONG Key,
         {
             //
             // Increment the counters depending on if this was paged or nonpaged
-            // pool
+            // pool, in this processor's copy of the entry
             //
+            Counters = &ExpGetProcessorTrackTable()[Hash];
             if ((PoolType & BASE_POOL_TYPE_MASK) == NonPagedPool)
             {
-                InterlockedIncrement(&TableEntry->NonPagedAllocs);
-                InterlockedExchangeAddSizeT(&TableEntry->NonPagedBytes, NumberOfBytes);
+                InterlockedIncrement(&Counters->NonPagedAllocs);
+                InterlockedExchangeAddSizeT(&Counters->NonPagedBytes, NumberOfBytes);
                 return;
             }
-            InterlockedIncrement(&TableEntry->PagedAllocs);
-            InterlockedExchangeAddSizeT(&TableEntry->PagedBytes, NumberOfBytes);
+            InterlockedIncrement(&Counters->PagedAllocs);
+            InterlockedExchangeAddSizeT(&Counters->PagedBytes, NumberOfBytes);
             return;
         }
 
@@ -1096,6 +1158,7 @@ InitializePool(IN POOL_TYPE PoolType,
         //
         PoolTrackTableSize++;
         PoolTrackTableMask = PoolTrackTableSize - 2;
+        ExpPoolTrackTables[0] = PoolTrackTable;
 
         RtlZeroMemory(PoolTrackTable,
                       PoolTrackTableSize * sizeof(POOL_TRACKER_TABLE));
@@ -1257,6 +1320,39 @@ InitializePool(IN POOL_TYPE PoolType,
     }
 }
 
+CODE_SEG("INIT")
+VOID
+NTAPI
+ExpInitializePoolTrackerTables(VOID)
+{
+    PPOOL_TRACKER_TABLE Table;
+    SIZE_T TableSize;
+    ULONG i;
+
+    //
+    // Now that all processors are running, give each of them its own copy of
+    // the tag counters. The boot processor keeps using PoolTrackTable
+    //
+    TableSize = PoolTrackTableSize * sizeof(POOL_TRACKER_TABLE);
+    for (i = 1; i < (ULONG)KeNumberProcessors; i++)
+    {
+        //
+        // If we can't get the memory, this processor just keeps sharing the
+        // boot processor's table
+        //
+        Table = MiAllocatePoolPages(NonPagedPool, TableSize);
+        if (!Table)
+        {
+            DPRINT1("EXPOOL: No pool tracker table for processor %lu\n", i);
+            continue;
+        }
+
+        RtlZeroMemory(Table, TableSize);
+        InterlockedExchangePointer((PVOID*)&ExpPoolTrackTables[i], Table);
+        ExpInsertPoolTracker('looP', ROUND_TO_PAGES(TableSize), NonPagedPool);
+    }
+}
+
 FORCEINLINE
 KIRQL
 ExLockPool(IN PPOOL_DESCRIPTOR Descriptor)
@@ -1313,17 +1409,20 @@ ExpGetPoolTagInfoTarget(IN PKDPC Dpc,
                         IN PVOID SystemArgument2)
 {
     PPOOL_DPC_CONTEXT Context = DeferredContext;
+    SIZE_T i;
     UNREFERENCED_PARAMETER(Dpc);
     ASSERT(KeGetCurrentIrql() == DISPATCH_LEVEL);
 
     //
-    // Make sure we win the race, and if we did, copy the data atomically
+    // Make sure we win the race, and if we did, gather the data of every
+    // processor atomically
     //
     if (KeSignalCallDpcSynchronize(SystemArgument2))
     {
-        RtlCopyMemory(Context->PoolTrackTable,
-                      PoolTrackTable,
-                      Context->PoolTrackTableSize * sizeof(POOL_TRACKER_TABLE));
+        for (i = 0; i < Context->PoolTrackTableSize; i++)
+        {
+            ExpSumPoolTracker(i, &Context->PoolTrackTable[i]);
+        }
 
         //
         // This is here because ReactOS does not yet support expansion
@@ -1445,14 +1544,77 @@ ExGetPoolTagInfo(IN PSYSTEM_POOLTAG_INFORMATION SystemInformation,
     return Status;
 }
 
-_IRQL_requires_(DISPATCH_LEVEL)
+FORCEINLINE
+KIRQL
+ExpEnterBigPageTable(VOID)
+{
+    KIRQL OldIrql;
+    PPOOL_BIG_PAGES_PROCESSOR Processor;
+
+    while (TRUE)
+    {
+        //
+        // Announce that this processor is looking at the table. Staying at
+        // DISPATCH_LEVEL keeps us on the processor until we leave again
+        //
+        OldIrql = KeRaiseIrqlToDpcLevel();
+        Processor = &ExpBigPagesProcessor[KeGetCurrentProcessorNumber()];
+        Processor->Readers++;
+        KeMemoryBarrier();
+
+        //
+        // If nobody is expanding the table, we can use it without a lock:
+        // entries are claimed and released with interlocked operations only
+        //
+        if (!ExpBigPageTableExpanding) return OldIrql;
+
+        //
+        // Otherwise back off and wait for the expansion, which holds the
+        // lock, to complete
+        //
+        Processor->Readers--;
+        KeAcquireSpinLockAtDpcLevel(&ExpLargePoolTableLock);
+        KeReleaseSpinLockFromDpcLevel(&ExpLargePoolTableLock);
+        KeLowerIrql(OldIrql);
+    }
+}
+
+FORCEINLINE
+VOID
+ExpLeaveBigPageTable(IN KIRQL OldIrql)
+{
+    //
+    // Make our changes to the table visible before an expansion can copy it
+    //
+    KeMemoryBarrier();
+    ExpBigPagesProcessor[KeGetCurrentProcessorNumber()].Readers--;
+    KeLowerIrql(OldIrql);
+}
+
+static
+ULONG
+ExpGetBigEntriesInUse(VOID)
+{
+    LONG EntriesInUse = 0;
+    ULONG i;
+
+    //
+    // Only the sum of all processors makes sense
+    //
+    for (i = 0; i < (ULONG)KeNumberProcessors; i++)
+    {
+        EntriesInUse += ExpBigPagesProcessor[i].EntriesInUse;
+    }
+
+    return (ULONG)max(EntriesInUse, 0);
+}
+
 BOOLEAN
 NTAPI
 ExpExpandBigPageTable(
-    _In_ _IRQL_restores_ KIRQL OldIrql)
+    _In_ SIZE_T OldSize)
 {
-    ULONG OldSize = PoolBigPageTableSize;
-    ULONG NewSize = 2 * OldSize;
+    ULONG NewSize = 2 * (ULONG)OldSize;
     ULONG NewSizeInBytes;
     PPOOL_TRACKER_BIG_PAGES NewTable;
     PPOOL_TRACKER_BIG_PAGES OldTable;
@@ -1460,16 +1622,23 @@ ExpExpandBigPageTable(
     ULONG PagesFreed;
     ULONG Hash;
     ULONG HashMask;
+    KIRQL OldIrql;
 
-    /* Must be holding ExpLargePoolTableLock */
-    ASSERT(KeGetCurrentIrql() == DISPATCH_LEVEL);
+    KeAcquireSpinLock(&ExpLargePoolTableLock, &OldIrql);
+
+    /* Somebody else might have expanded it while we were waiting */
+    if (PoolBigPageTableSize != OldSize)
+    {
+        KeReleaseSpinLock(&ExpLargePoolTableLock, OldIrql);
+        return TRUE;
+    }
 
     /* Make sure we don't overflow */
     if (!NT_SUCCESS(RtlULongMult(2,
-                                 OldSize * sizeof(POOL_TRACKER_BIG_PAGES),
+                                 (ULONG)OldSize * sizeof(POOL_TRACKER_BIG_PAGES),
                                  &NewSizeInBytes)))
     {
-        DPRINT1("Overflow expanding big page table. Size=%lu\n", OldSize);
+        DPRINT1("Overflow expanding big page table. Size=%lu\n", (ULONG)OldSize);
         KeReleaseSpinLock(&ExpLargePoolTableLock, OldIrql);
         return FALSE;
     }
@@ -1491,6 +1660,13 @@ ExpExpandBigPageTable(
         NewTable[i].Va = (PVOID)POOL_BIG_TABLE_ENTRY_FREE;
     }
 
+    /* Keep new lock-free users out and wait for the current ones to leave */
+    InterlockedExchange(&ExpBigPageTableExpanding, TRUE);
+    for (i = 0; i < (ULONG)KeNumberProcessors; i++)
+    {
+        while (ExpBigPagesProcessor[i].Readers) YieldProcessor();
+    }
+
     /* Copy over all items */
     OldTable = PoolBigPageTable;
     HashMask = NewSize - 1;
@@ -1518,15 +1694,17 @@ ExpExpandBigPageTable(
         NewTable[Hash] = OldTable[i];
     }
 
-    /* Activate the new table */
+    /* Activate the new table and let the lock-free users back in */
     PoolBigPageTable = NewTable;
     PoolBigPageTableSize = NewSize;
     PoolBigPageTableHash = PoolBigPageTableSize - 1;
+    KeMemoryBarrier();
+    InterlockedExchange(&ExpBigPageTableExpanding, FALSE);
 
     /* Release the lock, we're done changing global state */
     KeReleaseSpinLock(&ExpLargePoolTableLock, OldIrql);
 
-    /* Free the old table and update our tracker */
+    /* Nobody can still be looking at the old table: free it and update our tracker */
     PagesFreed = MiFreePoolPages(OldTable);
     ExpRemovePoolTracker('looP', PagesFreed << PAGE_SHIFT, 0);
     ExpInsertPoolTracker('looP', ALIGN_UP_BY(NewSizeInBytes, PAGE_SIZE), 0);
@@ -1550,14 +1728,15 @@ ExpAddTagForBigPages(IN PVOID Va,
     ASSERT(!(PoolType & SESSION_POOL_MASK));
 
     //
-    // As the table is expandable, these values must only be read after acquiring
-    // the lock to avoid a teared access during an expansion
-    // NOTE: Windows uses a special reader/writer SpinLock to improve
-    // performance in the common case (add/remove a tracker entry)
+    // As the table is expandable, these values must only be read after entering
+    // the table to avoid a teared access during an expansion.
+    // NOTE: Windows uses a special reader/writer SpinLock for this. We don't
+    // take any lock in the common case (add/remove a tracker entry): only
+    // expansion is exclusive, and waits for the processors using the table
     //
 Retry:
     Hash = ExpComputePartialHashForAddress(Va);
-    KeAcquireSpinLock(&ExpLargePoolTableLock, &OldIrql);
+    OldIrql = ExpEnterBigPageTable();
     Hash &= PoolBigPageTableHash;
     TableSize = PoolBigPageTableSize;
 
@@ -1572,12 +1751,12 @@ Retry:
     {
         //
         // Make sure that this is a free entry and attempt to atomically make the
-        // entry busy now
-        // NOTE: the Interlocked operation cannot fail with an exclusive SpinLock
+        // entry busy now. Another processor may beat us to it, in which case
+        // we keep looking
         //
         OldVa = Entry->Va;
         if (((ULONG_PTR)OldVa & POOL_BIG_TABLE_ENTRY_FREE) &&
-            (NT_VERIFY(InterlockedCompareExchangePointer(&Entry->Va, Va, OldVa) == OldVa)))
+            (InterlockedCompareExchangePointer(&Entry->Va, Va, OldVa) == OldVa))
         {
             //
             // We now own this entry, write down the size and the pool tag
@@ -1594,20 +1773,20 @@ Retry:
             // keep losing the race or that we are not finding a free entry anymore,
             // which implies a massive number of concurrent big pool allocations.
             //
-            InterlockedIncrementUL(&ExpPoolBigEntriesInUse);
-            if ((i >= 16) && (ExpPoolBigEntriesInUse > (TableSize / 4)))
+            ExpBigPagesProcessor[KeGetCurrentProcessorNumber()].EntriesInUse++;
+            if ((i >= 16) && (ExpGetBigEntriesInUse() > (TableSize / 4)))
             {
                 DPRINT("Attempting expansion since we now have %lu entries\n",
-                        ExpPoolBigEntriesInUse);
-                ASSERT(TableSize == PoolBigPageTableSize);
-                ExpExpandBigPageTable(OldIrql);
+                        ExpGetBigEntriesInUse());
+                ExpLeaveBigPageTable(OldIrql);
+                ExpExpandBigPageTable(TableSize);
                 return TRUE;
             }
 
             //
             // We have our entry, return
             //
-            KeReleaseSpinLock(&ExpLargePoolTableLock, OldIrql);
+            ExpLeaveBigPageTable(OldIrql);
             return TRUE;
         }
 
@@ -1625,8 +1804,8 @@ Retry:
     // This means there's no free hash buckets whatsoever, so we now have
     // to attempt expanding the table
     //
-    ASSERT(TableSize == PoolBigPageTableSize);
-    if (ExpExpandBigPageTable(OldIrql))
+    ExpLeaveBigPageTable(OldIrql);
+    if (ExpExpandBigPageTable(TableSize))
     {
         goto Retry;
     }
@@ -1650,11 +1829,11 @@ ExpFindAndRemoveTagBigPages(IN PVOID Va,
     ASSERT(!(PoolType & SESSION_POOL_MASK));
 
     //
-    // As the table is expandable, these values must only be read after acquiring
-    // the lock to avoid a teared access during an expansion
+    // As the table is expandable, these values must only be read after entering
+    // the table to avoid a teared access during an expansion
     //
     Hash = ExpComputePartialHashForAddress(Va);
-    KeAcquireSpinLock(&ExpLargePoolTableLock, &OldIrql);
+    OldIrql = ExpEnterBigPageTable();
     Hash &= PoolBigPageTableHash;
     TableSize = PoolBigPageTableSize;
 
@@ -1678,7 +1857,7 @@ ExpFindAndRemoveTagBigPages(IN PVOID Va,
                 // received the special "BIG" tag -- return that and return 0
                 // so that the code can ask Mm for the page count instead
                 //
-                KeReleaseSpinLock(&ExpLargePoolTableLock, OldIrql);
+                ExpLeaveBigPageTable(OldIrql);
                 *BigPages = 0;
                 return ' GIB';
             }
@@ -1693,19 +1872,19 @@ ExpFindAndRemoveTagBigPages(IN PVOID Va,
 
     //
     // Now capture all the information we need from the entry, since after we
-    // release the lock, the data can change
+    // release it, the data can change
     //
     Entry = &PoolBigPageTable[Hash];
     *BigPages = Entry->NumberOfPages;
     PoolTag = Entry->Key;
 
     //
-    // Set the free bit, and decrement the number of allocations. Finally, release
-    // the lock and return the tag that was located
+    // Set the free bit, and decrement the number of allocations. Finally, leave
+    // the table and return the tag that was located
     //
     InterlockedIncrement((PLONG)&Entry->Va);
-    InterlockedDecrementUL(&ExpPoolBigEntriesInUse);
-    KeReleaseSpinLock(&ExpLargePoolTableLock, OldIrql);
+    ExpBigPagesProcessor[KeGetCurrentProcessorNumber()].EntriesInUse--;
+    ExpLeaveBigPageTable(OldIrql);
     return PoolTag;
 }
 
@@ -620,6 +620,26 @@ ExpKdbgExtIrpFind(
     return TRUE;
 }
 
+BOOLEAN
+ExpKdbgExtZeroPages(
+    ULONG Argc,
+    PCHAR Argv[])
+{
+    ULONG Total;
+
+    KdbpPrint("Free pages:   %Iu\n", (ULONG_PTR)MmFreePageListHead.Total);
+    KdbpPrint("Zeroed pages: %Iu\n", (ULONG_PTR)MmZeroedPageListHead.Total);
+
+    /* How often a demand zero fault found a page that was zeroed ahead of time */
+    Total = MmZeroedPageListHits + MmZeroedPageListMisses;
+    KdbpPrint("Zeroed list hits: %lu, misses: %lu (%lu%% hits)\n",
+              MmZeroedPageListHits,
+              MmZeroedPageListMisses,
+              Total ? (ULONG)((ULONGLONG)MmZeroedPageListHits * 100 / Total) : 0);
+
+    return TRUE;
+}
+
 #endif // DBG && KDBG
 
 /* EOF */
@@ -640,6 +640,8 @@ extern PFN_NUMBER MmSystemPageDirectory[PPE_PER_PAGE];
 extern PMMPTE MmSharedUserDataPte;
 extern LIST_ENTRY MmProcessList;
 extern KEVENT MmZeroingPageEvent;
+extern ULONG MmZeroedPageListHits;
+extern ULONG MmZeroedPageListMisses;
 extern ULONG MmSystemPageColor;
 extern ULONG MmProcessColorSeed;
 extern PMMWSL MmWorkingSetList;
@@ -1996,6 +1998,16 @@ MiInsertPageInFreeList(
     IN PFN_NUMBER PageFrameIndex
 );
 
+BOOLEAN
+NTAPI
+MiReleaseStandbyPage(VOID);
+
+PFN_COUNT
+NTAPI
+MiReleaseStandbyPages(
+    IN PFN_COUNT PageCount
+);
+
 PFN_COUNT
 NTAPI
 MiDeleteSystemPageableVm(
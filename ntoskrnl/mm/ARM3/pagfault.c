@@ -673,6 +673,11 @@ MiResolveDemandZeroFault(IN PVOID Address,
             /* We'll need a free page and zero it manually */
             PageFrameNumber = MiRemoveAnyPage(Color);
             NeedZero = TRUE;
+            MmZeroedPageListMisses++;
+        }
+        else
+        {
+            MmZeroedPageListHits++;
         }
     }
     else
@@ -2364,6 +2369,7 @@ UserFault:
                 /* Grab a page out of there. Later we should grab a colored zero page */
                 PageFrameIndex = MiRemoveAnyPage(Color);
                 ASSERT(PageFrameIndex);
+                MmZeroedPageListMisses++;
 
                 /* Release the lock since we need to do some zeroing */
                 MiReleasePfnLock(OldIrql);
@@ -2374,6 +2380,10 @@ UserFault:
                 /* Grab the lock again so we can initialize the PFN entry */
                 OldIrql = MiAcquirePfnLock();
             }
+            else
+            {
+                MmZeroedPageListHits++;
+            }
 
             /* Initialize the PFN entry now */
             MiInitializePfn(PageFrameIndex, PointerPte, 1);
@@ -715,10 +715,11 @@ MiInsertPageInFreeList(IN PFN_NUMBER PageFrameIndex)
 
 VOID
 FASTCALL
-MiInsertStandbyListAtFront(IN PFN_NUMBER PageFrameIndex)
+MiInsertStandbyList(IN PFN_NUMBER PageFrameIndex,
+                    IN BOOLEAN AtFront)
 {
     PMMPFNLIST ListHead;
-    PFN_NUMBER Flink;
+    PFN_NUMBER Flink, Blink;
     PMMPFN Pfn1, Pfn2;
 
     /* Make sure the lock is held */
@@ -745,26 +746,57 @@ MiInsertStandbyListAtFront(IN PFN_NUMBER PageFrameIndex)
     ASSERT_LIST_INVARIANT(ListHead);
     ListHead->Total++;
 
-    /* Make the head of the list point to this page now */
-    Flink = ListHead->Flink;
-    ListHead->Flink = PageFrameIndex;
+    /*
+     * Pages are repurposed from the head of the list, so the head holds the
+     * oldest pages. Only pages that should be reused first go to the front.
+     */
+    if (AtFront)
+    {
+        /* Make the head of the list point to this page now */
+        Flink = ListHead->Flink;
+        ListHead->Flink = PageFrameIndex;
 
-    /* Make the page point to the previous head, and back to the list */
-    Pfn1->u1.Flink = Flink;
-    Pfn1->u2.Blink = LIST_HEAD;
+        /* Make the page point to the previous head, and back to the list */
+        Pfn1->u1.Flink = Flink;
+        Pfn1->u2.Blink = LIST_HEAD;
 
-    /* Was the list empty? */
-    if (Flink != LIST_HEAD)
-    {
-        /* It wasn't, so update the backlink of the previous head page */
-        Pfn2 = MI_PFN_ELEMENT(Flink);
-        Pfn2->u2.Blink = PageFrameIndex;
+        /* Was the list empty? */
+        if (Flink != LIST_HEAD)
+        {
+            /* It wasn't, so update the backlink of the previous head page */
+            Pfn2 = MI_PFN_ELEMENT(Flink);
+            Pfn2->u2.Blink = PageFrameIndex;
+        }
+        else
+        {
+            /* It was empty, so have it loop back around to this new page */
+            ListHead->Blink = PageFrameIndex;
+        }
     }
     else
     {
-        /* It was empty, so have it loop back around to this new page */
+        /* Get the last page on the list */
+        Blink = ListHead->Blink;
         ListHead->Blink = PageFrameIndex;
+
+        /* Make the page point to the previous tail, and forward to the list */
+        Pfn1->u1.Flink = LIST_HEAD;
+        Pfn1->u2.Blink = Blink;
+
+        /* Was the list empty? */
+        if (Blink != LIST_HEAD)
+        {
+            /* It wasn't, so link the previous tail page to us */
+            Pfn2 = MI_PFN_ELEMENT(Blink);
+            Pfn2->u1.Flink = PageFrameIndex;
+        }
+        else
+        {
+            /* It was empty, so we are the first page too */
+            ListHead->Flink = PageFrameIndex;
+        }
     }
+    ASSERT_LIST_INVARIANT(ListHead);
 
     /* Move the page onto its new location */
     Pfn1->u3.e1.PageLocation = StandbyPageList;
@@ -773,6 +805,87 @@ MiInsertStandbyListAtFront(IN PFN_NUMBER PageFrameIndex)
     MiIncrementAvailablePages();
 }
 
+BOOLEAN
+NTAPI
+MiReleaseStandbyPage(VOID)
+{
+    PFN_NUMBER PageIndex = LIST_HEAD;
+    PMMPFN Pfn1;
+    PMMPTE PointerPte;
+    MMPTE OriginalPte;
+    USHORT OldColor, OldCache;
+    ULONG Priority;
+
+    /* Make sure PFN lock is held */
+    MI_ASSERT_PFN_LOCK_HELD();
+
+    /* Repurpose the oldest page of the lowest priority list */
+    for (Priority = 0; Priority < RTL_NUMBER_OF(MmStandbyPageListByPriority); Priority++)
+    {
+        PageIndex = MmStandbyPageListByPriority[Priority].Flink;
+        if (PageIndex != LIST_HEAD) break;
+    }
+    if (PageIndex == LIST_HEAD) return FALSE;
+
+    /* Only prototype pages end up on the standby list for now */
+    Pfn1 = MI_PFN_ELEMENT(PageIndex);
+    ASSERT(Pfn1->u3.e1.PrototypePte == 1);
+    ASSERT(Pfn1->u3.e1.Modified == 0);
+    ASSERT(Pfn1->u3.e2.ReferenceCount == 0);
+
+    /* Unlinking clears the original PTE, so grab it first */
+    OriginalPte = Pfn1->OriginalPte;
+    OldColor = Pfn1->u3.e1.PageColor;
+    OldCache = Pfn1->u3.e1.CacheAttribute;
+    MiUnlinkPageFromList(Pfn1);
+
+    /*
+     * The prototype PTE still refers to the page in transition. The page is
+     * clean, so its original contents can be recreated from the original PTE.
+     */
+    PointerPte = Pfn1->PteAddress;
+    ASSERT(MiAddressToPte(PointerPte)->u.Hard.Valid == 1);
+    ASSERT(PointerPte->u.Trans.Transition == 1);
+    ASSERT(PointerPte->u.Trans.PageFrameNumber == PageIndex);
+    MI_WRITE_INVALID_PTE(PointerPte, OriginalPte);
+
+    /* Drop the reference we held on the page containing the prototype PTE */
+    MiDecrementShareCount(MI_PFN_ELEMENT(Pfn1->u4.PteFrame), Pfn1->u4.PteFrame);
+
+    /* Zero flags but restore color and cache, like for a free page */
+    Pfn1->u3.e2.ShortFlags = 0;
+    Pfn1->u3.e1.PageColor = OldColor;
+    Pfn1->u3.e1.CacheAttribute = OldCache;
+    Pfn1->u4.PteFrame = 0;
+    Pfn1->PteAddress = NULL;
+
+    /* The page can now be handed out like any other free page */
+    MiInsertPageInFreeList(PageIndex);
+    return TRUE;
+}
+
+PFN_COUNT
+NTAPI
+MiReleaseStandbyPages(IN PFN_COUNT PageCount)
+{
+    PFN_COUNT Released;
+    BOOLEAN Result;
+    KIRQL OldIrql;
+
+    for (Released = 0; Released < PageCount; Released++)
+    {
+        /* Take the PFN lock for one page at a time */
+        OldIrql = MiAcquirePfnLock();
+        Result = MiReleaseStandbyPage();
+        MiReleasePfnLock(OldIrql);
+
+        /* Stop once the standby list is empty */
+        if (!Result) break;
+    }
+
+    return Released;
+}
+
 VOID
 NTAPI
 MiInsertPageInList(IN PMMPFNLIST ListHead,
@@ -1269,9 +1382,9 @@ MiDecrementReferenceCount(IN PMMPFN Pfn1,
     }
     else
     {
-        /* Otherwise, insert this page into the standby list */
+        /* Otherwise, insert this page into the standby list, behind the older ones */
         ASSERT(Pfn1->u3.e1.RemovalRequested == 0);
-        MiInsertStandbyListAtFront(PageFrameIndex);
+        MiInsertStandbyList(PageFrameIndex, FALSE);
     }
 }
 
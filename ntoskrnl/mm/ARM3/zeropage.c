@@ -19,6 +19,25 @@
 
 KEVENT MmZeroingPageEvent;
 
+/* Demand zero faults served from the zeroed list, and those zeroing a page themselves */
+ULONG MmZeroedPageListHits;
+ULONG MmZeroedPageListMisses;
+
+/* The memory bus saturates quickly, more threads would only burn CPU time */
+#define MI_MAX_ZERO_PAGE_THREADS    4
+
+/* Period in ms at which the zero page threads look at the free list on their own */
+#define MI_ZERO_PAGE_IDLE_PERIOD    1000
+
+typedef struct _MI_ZERO_PAGE_THREAD
+{
+    PMMPTE ZeroingPte;
+    KAFFINITY Affinity;
+    KTIMER IdleTimer;
+} MI_ZERO_PAGE_THREAD, *PMI_ZERO_PAGE_THREAD;
+
+static MI_ZERO_PAGE_THREAD MiZeroPageThreads[MI_MAX_ZERO_PAGE_THREADS];
+
 /* PRIVATE FUNCTIONS **********************************************************/
 
 VOID
@@ -31,52 +50,31 @@ NTAPI
 MiFreeInitializationCode(IN PVOID StartVa,
 IN PVOID EndVa);
 
+static
 VOID
-NTAPI
-MmZeroPageThread(VOID)
+MiZeroFreePages(IN PMMPTE ZeroingPte)
 {
-    PKTHREAD Thread = KeGetCurrentThread();
-    PVOID StartAddress, EndAddress;
-    PVOID WaitObjects[2];
     KIRQL OldIrql;
     PVOID ZeroAddress;
-    PFN_NUMBER PageIndex, FreePage;
-    PMMPFN Pfn1;
-
-    /* Get the discardable sections to free them */
-    MiFindInitializationCode(&StartAddress, &EndAddress);
-    if (StartAddress) MiFreeInitializationCode(StartAddress, EndAddress);
-    DPRINT("Free non-cache pages: %lx\n", MmAvailablePages + MiMemoryConsumers[MC_CACHE].PagesUsed);
-
-    /* Set our priority to 0 */
-    Thread->BasePriority = 0;
-    KeSetPriorityThread(Thread, 0);
+    PFN_NUMBER PageIndex, FreePage, PageCount;
+    PMMPFN Pfn1, FirstPfn, NextPfn;
 
-    /* Setup the wait objects */
-    WaitObjects[0] = &MmZeroingPageEvent;
-//    WaitObjects[1] = &PoSystemIdleTimer; FIXME: Implement idle timer
+    OldIrql = MiAcquirePfnLock();
 
     while (TRUE)
     {
-        KeWaitForMultipleObjects(1, // 2
-                                 WaitObjects,
-                                 WaitAny,
-                                 WrFreePage,
-                                 KernelMode,
-                                 FALSE,
-                                 NULL,
-                                 NULL);
-        OldIrql = MiAcquirePfnLock();
-
-        while (TRUE)
+        if (!MmFreePageListHead.Total)
         {
-            if (!MmFreePageListHead.Total)
-            {
-                KeClearEvent(&MmZeroingPageEvent);
-                MiReleasePfnLock(OldIrql);
-                break;
-            }
+            KeClearEvent(&MmZeroingPageEvent);
+            MiReleasePfnLock(OldIrql);
+            break;
+        }
 
+        /* Take a run of free pages, chained through their Flink for the mapping */
+        FirstPfn = (PMMPFN)LIST_HEAD;
+        PageCount = 0;
+        while ((PageCount < MI_ZERO_PTES) && (MmFreePageListHead.Total))
+        {
             PageIndex = MmFreePageListHead.Flink;
             ASSERT(PageIndex != LIST_HEAD);
             Pfn1 = MiGetPfnEntry(PageIndex);
@@ -94,19 +92,135 @@ MmZeroPageThread(VOID)
                              0);
             }
 
-            Pfn1->u1.Flink = LIST_HEAD;
-            MiReleasePfnLock(OldIrql);
+            Pfn1->u1.Flink = (PFN_NUMBER)FirstPfn;
+            FirstPfn = Pfn1;
+            PageCount++;
+        }
+
+        MiReleasePfnLock(OldIrql);
+
+        ZeroAddress = MiMapPagesInZeroSpace(ZeroingPte, FirstPfn, PageCount);
+        ASSERT(ZeroAddress);
+        KeZeroPagesFromIdleThread(ZeroAddress, (ULONG)(PageCount * PAGE_SIZE));
+        MiUnmapPagesInZeroSpace(ZeroAddress, PageCount);
+
+        OldIrql = MiAcquirePfnLock();
+
+        for (Pfn1 = FirstPfn; Pfn1 != (PMMPFN)LIST_HEAD; Pfn1 = NextPfn)
+        {
+            NextPfn = (PMMPFN)Pfn1->u1.Flink;
+            MiInsertPageInList(&MmZeroedPageListHead, MiGetPfnEntryIndex(Pfn1));
+        }
+    }
+}
+
+static
+VOID
+MiZeroPageLoop(IN PMI_ZERO_PAGE_THREAD ZeroThread)
+{
+    PKTHREAD Thread = KeGetCurrentThread();
+    PVOID WaitObjects[2];
+    LARGE_INTEGER DueTime;
+
+    /* Stay on one processor, stale zeroing PTEs are only flushed from its TLB */
+    KeSetAffinityThread(Thread, ZeroThread->Affinity);
+
+    /* Set our priority to 0, we only run when the processor is otherwise idle */
+    Thread->BasePriority = 0;
+    KeSetPriorityThread(Thread, 0);
+
+    /*
+     * Wake up periodically to zero what is on the free list below the event
+     * threshold. Each thread has its own timer, a synchronization timer only
+     * releases one waiter.
+     */
+    KeInitializeTimerEx(&ZeroThread->IdleTimer, SynchronizationTimer);
+    DueTime.QuadPart = Int32x32To64(MI_ZERO_PAGE_IDLE_PERIOD, -10000);
+    KeSetTimerEx(&ZeroThread->IdleTimer, DueTime, MI_ZERO_PAGE_IDLE_PERIOD, NULL);
+
+    /* Setup the wait objects */
+    WaitObjects[0] = &MmZeroingPageEvent;
+    WaitObjects[1] = &ZeroThread->IdleTimer;
 
-            ZeroAddress = MiMapPagesInZeroSpace(Pfn1, 1);
-            ASSERT(ZeroAddress);
-            RtlZeroMemory(ZeroAddress, PAGE_SIZE);
-            MiUnmapPagesInZeroSpace(ZeroAddress, 1);
+    while (TRUE)
+    {
+        KeWaitForMultipleObjects(2,
+                                 WaitObjects,
+                                 WaitAny,
+                                 WrFreePage,
+                                 KernelMode,
+                                 FALSE,
+                                 NULL,
+                                 NULL);
 
-            OldIrql = MiAcquirePfnLock();
+        MiZeroFreePages(ZeroThread->ZeroingPte);
+    }
+}
 
-            MiInsertPageInList(&MmZeroedPageListHead, PageIndex);
+static
+VOID
+NTAPI
+MiZeroPageWorkerThread(IN PVOID Context)
+{
+    MiZeroPageLoop(Context);
+}
+
+static
+VOID
+MiCreateZeroPageThreads(VOID)
+{
+    NTSTATUS Status;
+    HANDLE ThreadHandle;
+    PMMPTE PointerPte;
+    ULONG i, Count;
+
+    /* One zeroing thread per processor, each with its own zeroing PTEs */
+    Count = min((ULONG)KeNumberProcessors, MI_MAX_ZERO_PAGE_THREADS);
+    for (i = 1; i < Count; i++)
+    {
+        PointerPte = MiReserveSystemPtes(MI_ZERO_PTES + 1, SystemPteSpace);
+        if (!PointerPte) break;
+
+        RtlZeroMemory(PointerPte, (MI_ZERO_PTES + 1) * sizeof(MMPTE));
+        PointerPte->u.Hard.PageFrameNumber = MI_ZERO_PTES;
+
+        MiZeroPageThreads[i].ZeroingPte = PointerPte;
+        MiZeroPageThreads[i].Affinity = AFFINITY_MASK(i);
+
+        Status = PsCreateSystemThread(&ThreadHandle,
+                                      THREAD_ALL_ACCESS,
+                                      NULL,
+                                      NULL,
+                                      NULL,
+                                      MiZeroPageWorkerThread,
+                                      &MiZeroPageThreads[i]);
+        if (!NT_SUCCESS(Status))
+        {
+            MiReleaseSystemPtes(PointerPte, MI_ZERO_PTES + 1, SystemPteSpace);
+            break;
         }
+
+        ZwClose(ThreadHandle);
     }
 }
 
+VOID
+NTAPI
+MmZeroPageThread(VOID)
+{
+    PVOID StartAddress, EndAddress;
+
+    /* Get the discardable sections to free them */
+    MiFindInitializationCode(&StartAddress, &EndAddress);
+    if (StartAddress) MiFreeInitializationCode(StartAddress, EndAddress);
+    DPRINT("Free non-cache pages: %lx\n", MmAvailablePages + MiMemoryConsumers[MC_CACHE].PagesUsed);
+
+    MiCreateZeroPageThreads();
+
+    /* This thread zeroes on the boot processor using the boot zeroing PTEs */
+    MiZeroPageThreads[0].ZeroingPte = MiFirstReservedZeroingPte;
+    MiZeroPageThreads[0].Affinity = AFFINITY_MASK(0);
+    MiZeroPageLoop(&MiZeroPageThreads[0]);
+}
+
 /* EOF */
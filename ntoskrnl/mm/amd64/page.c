@@ -393,6 +393,40 @@ MmSetCleanPage(PEPROCESS Process, PVOID Address)
     MiFlushTlb(Pte, Address);
 }
 
+BOOLEAN
+NTAPI
+MmIsAccessedAndResetAccessPage(PEPROCESS Process, PVOID Address)
+{
+    PMMPTE Pte;
+    BOOLEAN Accessed = FALSE;
+    BOOLEAN Attached = FALSE;
+    KAPC_STATE ApcState;
+
+    /* The page tables of another process are only reachable from inside it */
+    if ((Address < MmSystemRangeStart) && (Process != PsGetCurrentProcess()))
+    {
+        KeStackAttachProcess(&Process->Pcb, &ApcState);
+        Attached = TRUE;
+    }
+
+    /*
+     * The balancer samples pages without the address space lock, so the
+     * mapping may already be gone while its rmap entry still exists.
+     * Like MmIsDirtyPage, report such a page as not accessed.
+     */
+    Pte = MiGetPteForProcess(Process, Address, FALSE);
+    if (Pte && Pte->u.Hard.Valid)
+    {
+        /* Clear the accessed bit */
+        Accessed = InterlockedBitTestAndReset64((PVOID)Pte, 5);
+
+        MiFlushTlb(Pte, Address);
+    }
+
+    if (Attached) KeUnstackDetachProcess(&ApcState);
+    return Accessed;
+}
+
 VOID
 NTAPI
 MmSetDirtyPage(PEPROCESS Process, PVOID Address)
@@ -227,6 +227,15 @@ MmSetCleanPage(IN PEPROCESS Process,
     UNIMPLEMENTED_DBGBREAK();
 }
 
+BOOLEAN
+NTAPI
+MmIsAccessedAndResetAccessPage(IN PEPROCESS Process,
+                               IN PVOID Address)
+{
+    UNIMPLEMENTED_DBGBREAK();
+    return FALSE;
+}
+
 VOID
 NTAPI
 MmSetDirtyPage(IN PEPROCESS Process,
@@ -24,6 +24,13 @@ typedef struct _MM_ALLOCATION_REQUEST
     KEVENT Event;
 }
 MM_ALLOCATION_REQUEST, *PMM_ALLOCATION_REQUEST;
+
+/* User pages age up to the width of MMWSLENTRY.Age */
+#define MI_MAXIMUM_PAGE_AGE 3
+
+/* User pages looked at per aging run or trim pass */
+#define MI_USER_PAGE_SCAN_BATCH 1024
+
 /* GLOBALS ******************************************************************/
 
 MM_MEMORY_CONSUMER MiMemoryConsumers[MC_MAXIMUM];
@@ -32,6 +39,9 @@ static ULONG MiNrTotalPages;
 static LIST_ENTRY AllocationListHead;
 static KSPIN_LOCK AllocationListLock;
 static ULONG MiMinimumPagesPerRun;
+static ULONG MiAgingThreshold;
+static PFN_NUMBER MiAgingCursor;
+static PFN_NUMBER MiTrimCursor;
 
 static CLIENT_ID MiBalancerThreadId;
 static HANDLE MiBalancerThreadHandle = NULL;
@@ -54,6 +64,9 @@ MmInitializeBalancer(ULONG NrAvailablePages, ULONG NrSystemPages)
     /* Set up targets. */
     MiMinimumAvailablePages = 256;
     MiMinimumPagesPerRun = 256;
+
+    /* Start aging user pages well before we have to trim them */
+    MiAgingThreshold = MiMinimumAvailablePages * 4;
     if ((NrAvailablePages + NrSystemPages) >= 8192)
     {
         MiMemoryConsumers[MC_CACHE].PagesTarget = NrAvailablePages / 4 * 3;
@@ -167,34 +180,117 @@ MiTrimMemoryConsumer(ULONG Consumer, ULONG InitialTarget)
     }
 }
 
+static
+ULONG
+MiSampleUserPage(
+    PFN_NUMBER Page,
+    BOOLEAN Age,
+    PBOOLEAN Locked,
+    PBOOLEAN InMinimumWorkingSet)
+{
+    PMMWSLE Wsle;
+    BOOLEAN Accessed;
+    ULONG PageAge;
+    KIRQL OldIrql;
+
+    /* Walking the rmaps takes the rmap lock, so do it before the PFN lock */
+    Accessed = MmIsAccessedAndResetAccessRmaps(Page, InMinimumWorkingSet);
+
+    /* HACK until WS lists are supported */
+    OldIrql = MiAcquirePfnLock();
+    Wsle = &MiGetPfnEntry(Page)->Wsle;
+    if (Accessed)
+    {
+        /* Referenced since the last sample, so it is young again */
+        Wsle->u1.e1.Age = 0;
+    }
+    else if (Age && (Wsle->u1.e1.Age < MI_MAXIMUM_PAGE_AGE))
+    {
+        Wsle->u1.e1.Age++;
+    }
+    PageAge = (ULONG)Wsle->u1.e1.Age;
+    *Locked = (Wsle->u1.e1.LockedInWs || Wsle->u1.e1.LockedInMemory);
+    MiReleasePfnLock(OldIrql);
+
+    return PageAge;
+}
+
+static
+VOID
+MiAgeUserPages(VOID)
+{
+    PFN_NUMBER FirstPage, CurrentPage;
+    ULONG Scanned;
+    BOOLEAN Locked, InMinimumWorkingSet;
+
+    /*
+     * Every page that wasn't referenced since it was last looked at grows
+     * older. Only a batch is looked at per run, the next run continues after
+     * it and wraps around at the end of the user pages.
+     */
+    FirstPage = CurrentPage = MmGetLRUNextUserPage(MiAgingCursor);
+    for (Scanned = 0; (CurrentPage != 0) && (Scanned < MI_USER_PAGE_SCAN_BATCH); Scanned++)
+    {
+        MiSampleUserPage(CurrentPage, TRUE, &Locked, &InMinimumWorkingSet);
+        MiAgingCursor = CurrentPage;
+
+        /* Don't age a page twice in one run */
+        CurrentPage = MmGetLRUNextUserPage(CurrentPage);
+        if (CurrentPage == FirstPage) break;
+    }
+}
+
 NTSTATUS
 MmTrimUserMemory(ULONG Target, ULONG Priority, PULONG NrFreedPages)
 {
-    PFN_NUMBER CurrentPage;
-    PFN_NUMBER NextPage;
+    PFN_NUMBER FirstPage, CurrentPage, LastPage;
     NTSTATUS Status;
+    ULONG MinimumAge, PageAge, Scanned;
+    BOOLEAN Locked, InMinimumWorkingSet;
 
     (*NrFreedPages) = 0;
 
-    CurrentPage = MmGetLRUFirstUserPage();
-    while (CurrentPage != 0 && Target > 0)
+    /*
+     * Page out the oldest pages first. Each pass lowers the age a page must
+     * have reached, and leaves processes at their working set minimum alone.
+     * The last pass takes anything that isn't locked, so we still make
+     * progress when nothing has aged yet.
+     * A pass only looks at a batch of pages starting after the trim cursor,
+     * and the next call continues after the pages of the last pass.
+     */
+    LastPage = MiTrimCursor;
+    for (MinimumAge = MI_MAXIMUM_PAGE_AGE; Target > 0; MinimumAge--)
     {
-        Status = MmPageOutPhysicalAddress(CurrentPage);
-        if (NT_SUCCESS(Status))
+        FirstPage = CurrentPage = MmGetLRUNextUserPage(MiTrimCursor);
+        for (Scanned = 0;
+             (CurrentPage != 0) && (Target > 0) && (Scanned < MI_USER_PAGE_SCAN_BATCH);
+             Scanned++)
         {
-            DPRINT("Succeeded\n");
-            Target--;
-            (*NrFreedPages)++;
-        }
+            PageAge = MiSampleUserPage(CurrentPage, FALSE, &Locked, &InMinimumWorkingSet);
+            if (!Locked &&
+                ((MinimumAge == 0) || ((PageAge >= MinimumAge) && !InMinimumWorkingSet)))
+            {
+                Status = MmPageOutPhysicalAddress(CurrentPage);
+                if (NT_SUCCESS(Status))
+                {
+                    DPRINT("Succeeded\n");
+                    Target--;
+                    (*NrFreedPages)++;
+                }
+            }
+            LastPage = CurrentPage;
 
-        NextPage = MmGetLRUNextUserPage(CurrentPage);
-        if (NextPage <= CurrentPage)
-        {
-            /* We wrapped around, so we're done */
-            break;
+            /* Stop once we are back where the pass started */
+            CurrentPage = MmGetLRUNextUserPage(CurrentPage);
+            if (CurrentPage == FirstPage) break;
         }
-        CurrentPage = NextPage;
+
+        if (MinimumAge == 0) break;
     }
+    MiTrimCursor = LastPage;
+
+    /* Don't leave the last pages of this pass staged */
+    MmFlushSwapPages();
 
     return STATUS_SUCCESS;
 }
@@ -342,6 +438,21 @@ MiBalancerThread(PVOID Unused)
         {
             ULONG InitialTarget = 0;
 
+            /* Age the user pages periodically once memory starts to get tight */
+            if ((Status == STATUS_WAIT_1) && (MmAvailablePages < MiAgingThreshold))
+            {
+                MiAgeUserPages();
+            }
+
+            /*
+             * Page allocations only take free and zeroed pages, so turn the
+             * oldest standby pages into free ones before those run out
+             */
+            if ((MmFreePageListHead.Total + MmZeroedPageListHead.Total) < MiMinimumAvailablePages)
+            {
+                MiReleaseStandbyPages(MiMinimumPagesPerRun);
+            }
+
 #if (_MI_PAGING_LEVELS == 2)
             if (!MiIsBalancerThread())
             {
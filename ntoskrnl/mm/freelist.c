@@ -89,6 +89,9 @@ MmInsertLRULastUserPage(PFN_NUMBER Pfn)
     ASSERT(!RtlCheckBit(&MiUserPfnBitMap, (ULONG)Pfn));
     OldIrql = MiAcquirePfnLock();
     RtlSetBit(&MiUserPfnBitMap, (ULONG)Pfn);
+
+    /* A new page starts out young. HACK until WS lists are supported */
+    MiGetPfnEntry(Pfn)->Wsle.u1.e1.Age = 0;
     MiReleasePfnLock(OldIrql);
 }
 
@@ -574,6 +577,12 @@ MmAllocPage(ULONG Type)
 
     OldIrql = MiAcquirePfnLock();
 
+    /* The balancer keeps free pages around, but it may not have caught up */
+    if ((MmFreePageListHead.Total == 0) && (MmZeroedPageListHead.Total == 0))
+    {
+        MiReleaseStandbyPage();
+    }
+
     PfnOffset = MiRemoveZeroPage(MI_GET_NEXT_COLOR());
     if (!PfnOffset)
     {
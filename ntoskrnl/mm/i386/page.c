@@ -529,6 +529,51 @@ MmSetCleanPage(PEPROCESS Process, PVOID Address)
     }
 }
 
+BOOLEAN
+NTAPI
+MmIsAccessedAndResetAccessPage(PEPROCESS Process, PVOID Address)
+{
+    PULONG Pt;
+    ULONG Pte;
+
+    if (Address < MmSystemRangeStart && Process == NULL)
+    {
+        DPRINT1("MmIsAccessedAndResetAccessPage is called for user space without a process.\n");
+        KeBugCheck(MEMORY_MANAGEMENT);
+    }
+
+    /*
+     * The balancer samples pages without the address space lock, so the
+     * mapping may already be gone while its rmap entry still exists.
+     * Like MmIsDirtyPage, report such a page as not accessed.
+     */
+    Pt = MmGetPageTableForProcess(Process, Address, FALSE);
+    if (Pt == NULL)
+    {
+        return FALSE;
+    }
+
+    do
+    {
+        Pte = *Pt;
+        if (!(Pte & PA_PRESENT))
+        {
+            MmUnmapPageTable(Pt);
+            return FALSE;
+        }
+    } while (Pte != InterlockedCompareExchangePte(Pt, Pte & ~PA_ACCESSED, Pte));
+
+    if (Pte & PA_ACCESSED)
+    {
+        /* Flush so the processor sets the bit again on the next access */
+        MiFlushTlb(Pt, Address);
+        return TRUE;
+    }
+
+    MmUnmapPageTable(Pt);
+    return FALSE;
+}
+
 VOID
 NTAPI
 MmSetDirtyPage(PEPROCESS Process, PVOID Address)
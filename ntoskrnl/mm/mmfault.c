@@ -208,6 +208,13 @@ MmAccessFault(IN ULONG FaultCode,
 {
     PMEMORY_AREA MemoryArea = NULL;
 
+    /* Account the fault to this processor, and to the process for user addresses */
+    KeGetCurrentPrcb()->MmPageFaultCount++;
+    if (Address <= MM_HIGHEST_USER_ADDRESS)
+    {
+        InterlockedIncrementUL(&PsGetCurrentProcess()->Vm.PageFaultCount);
+    }
+
     /* Cute little hack for ROS */
     if ((ULONG_PTR)Address >= (ULONG_PTR)MmSystemRangeStart)
     {
@@ -83,6 +83,38 @@ static PFN_COUNT MiReservedSwapPages;
 /* Make sure there can be only 16 paging files */
 C_ASSERT(FILE_FROM_ENTRY(0xffffffff) < MAX_PAGING_FILES);
 
+/*
+ * Pages written to consecutive slots of a paging file are staged in the write
+ * cluster and reach the disk with a single I/O. A read fetches the aligned run
+ * of slots around the faulting one into the read cluster, so that faults on
+ * its neighbours are satisfied without I/O.
+ * MiSwapClusterLock only guards the cluster bookkeeping. A cluster under I/O
+ * has a non-zero IoCount, and must not be changed until the thread doing the
+ * I/O clears it and signals IoDone. The lock is not held across the I/O.
+ */
+#define MI_SWAP_CLUSTER_PAGES (0x10000 / PAGE_SIZE)
+
+typedef struct _MI_SWAP_CLUSTER
+{
+    PVOID Buffer;
+    ULONG PageFileIndex;
+    ULONG_PTR FirstOffset;
+    ULONG Count;
+    ULONG IoCount;
+    BOOLEAN Discard;
+    KEVENT IoDone;
+} MI_SWAP_CLUSTER, *PMI_SWAP_CLUSTER;
+
+static KGUARDED_MUTEX MiSwapClusterLock;
+static MI_SWAP_CLUSTER MiSwapWriteCluster;
+static MI_SWAP_CLUSTER MiSwapReadCluster;
+
+/* Paging file I/O statistics */
+ULONG MmPageFileWriteIoCount;
+ULONG MmPageFilePagesWritten;
+ULONG MmPageFileReadIoCount;
+ULONG MmPageFilePagesRead;
+
 static BOOLEAN MmSwapSpaceMessage = FALSE;
 
 static BOOLEAN MmSystemPageFileLocated = FALSE;
@@ -128,19 +160,248 @@ MmShowOutOfSpaceMessagePagingFile(VOID)
     }
 }
 
+static
 NTSTATUS
-NTAPI
-MmWriteToSwapPage(SWAPENTRY SwapEntry, PFN_NUMBER Page)
+MiPageFileIo(
+    _In_ ULONG PageFileIndex,
+    _In_ ULONG_PTR PageFileOffset,
+    _In_ PMDL Mdl,
+    _In_ BOOLEAN Write)
 {
-    ULONG i;
-    ULONG_PTR offset;
     LARGE_INTEGER file_offset;
     IO_STATUS_BLOCK Iosb;
     NTSTATUS Status;
     KEVENT Event;
-    UCHAR MdlBase[sizeof(MDL) + sizeof(ULONG)];
+    ULONG PageCount = BYTES_TO_PAGES(Mdl->ByteCount);
+    PMMPAGING_FILE PagingFile = MmPagingFile[PageFileIndex];
+
+    file_offset.QuadPart = (LONGLONG)PageFileOffset * PAGE_SIZE;
+
+    KeInitializeEvent(&Event, NotificationEvent, FALSE);
+    if (Write)
+    {
+        Status = IoSynchronousPageWrite(PagingFile->FileObject,
+                                        Mdl,
+                                        &file_offset,
+                                        &Event,
+                                        &Iosb);
+    }
+    else
+    {
+        Status = IoPageRead(PagingFile->FileObject,
+                            Mdl,
+                            &file_offset,
+                            &Event,
+                            &Iosb);
+    }
+    if (Status == STATUS_PENDING)
+    {
+        KeWaitForSingleObject(&Event, Executive, KernelMode, FALSE, NULL);
+        Status = Iosb.Status;
+    }
+
+    if (Mdl->MdlFlags & MDL_MAPPED_TO_SYSTEM_VA)
+    {
+        MmUnmapLockedPages (Mdl->MappedSystemVa, Mdl);
+    }
+
+    if (NT_SUCCESS(Status))
+    {
+        if (Write)
+        {
+            InterlockedIncrementUL(&MmPageFileWriteIoCount);
+            InterlockedExchangeAddUL(&MmPageFilePagesWritten, PageCount);
+        }
+        else
+        {
+            InterlockedIncrementUL(&MmPageFileReadIoCount);
+            InterlockedExchangeAddUL(&MmPageFilePagesRead, PageCount);
+        }
+    }
+
+    return(Status);
+}
+
+static
+NTSTATUS
+MiPageFileIoPage(
+    _In_ ULONG PageFileIndex,
+    _In_ ULONG_PTR PageFileOffset,
+    _In_ PFN_NUMBER Page,
+    _In_ BOOLEAN Write)
+{
+    UCHAR MdlBase[sizeof(MDL) + sizeof(PFN_NUMBER)];
     PMDL Mdl = (PMDL)MdlBase;
 
+    MmInitializeMdl(Mdl, NULL, PAGE_SIZE);
+    MmBuildMdlFromPages(Mdl, &Page);
+    Mdl->MdlFlags |= MDL_PAGES_LOCKED;
+
+    return MiPageFileIo(PageFileIndex, PageFileOffset, Mdl, Write);
+}
+
+static
+NTSTATUS
+MiSwapClusterIo(
+    _In_ PMI_SWAP_CLUSTER Cluster,
+    _In_ ULONG PageCount,
+    _In_ BOOLEAN Write)
+{
+    UCHAR MdlBase[sizeof(MDL) + MI_SWAP_CLUSTER_PAGES * sizeof(PFN_NUMBER)];
+    PMDL Mdl = (PMDL)MdlBase;
+
+    ASSERT(PageCount != 0 && PageCount <= MI_SWAP_CLUSTER_PAGES);
+
+    MmInitializeMdl(Mdl, Cluster->Buffer, PageCount * PAGE_SIZE);
+    MmBuildMdlForNonPagedPool(Mdl);
+    if (!Write)
+    {
+        Mdl->MdlFlags |= MDL_IO_PAGE_READ;
+    }
+
+    return MiPageFileIo(Cluster->PageFileIndex, Cluster->FirstOffset, Mdl, Write);
+}
+
+static
+BOOLEAN
+MiSwapClusterContains(
+    _In_ PMI_SWAP_CLUSTER Cluster,
+    _In_ ULONG PageFileIndex,
+    _In_ ULONG_PTR PageFileOffset)
+{
+    return (Cluster->Count != 0 &&
+            Cluster->PageFileIndex == PageFileIndex &&
+            PageFileOffset - Cluster->FirstOffset < Cluster->Count);
+}
+
+static
+VOID
+MiWaitForSwapClusterIo(
+    _In_ PMI_SWAP_CLUSTER Cluster)
+{
+    /* Entered and left with the cluster lock held */
+    KeReleaseGuardedMutex(&MiSwapClusterLock);
+    KeWaitForSingleObject(&Cluster->IoDone, Executive, KernelMode, FALSE, NULL);
+    KeAcquireGuardedMutex(&MiSwapClusterLock);
+}
+
+static
+VOID
+MiInvalidateSwapReadCluster(
+    _In_ ULONG PageFileIndex,
+    _In_ ULONG_PTR PageFileOffset)
+{
+    /* The slot gets new contents, forget what was read ahead of it */
+    if (MiSwapClusterContains(&MiSwapReadCluster, PageFileIndex, PageFileOffset))
+    {
+        MiSwapReadCluster.Count = 0;
+    }
+
+    /* A read of it that is still in flight must not be kept either */
+    if (MiSwapReadCluster.IoCount != 0 &&
+        MiSwapReadCluster.PageFileIndex == PageFileIndex &&
+        PageFileOffset - MiSwapReadCluster.FirstOffset < MiSwapReadCluster.IoCount)
+    {
+        MiSwapReadCluster.Discard = TRUE;
+    }
+}
+
+static
+VOID
+MiCopySwapClusterPage(
+    _In_ PMI_SWAP_CLUSTER Cluster,
+    _In_ ULONG_PTR PageFileOffset,
+    _In_ PFN_NUMBER Page,
+    _In_ BOOLEAN ToCluster)
+{
+    PEPROCESS Process = PsGetCurrentProcess();
+    PUCHAR ClusterPage;
+    PVOID Address;
+    KIRQL Irql;
+
+    ClusterPage = (PUCHAR)Cluster->Buffer + (PageFileOffset - Cluster->FirstOffset) * PAGE_SIZE;
+
+    Address = MiMapPageInHyperSpace(Process, Page, &Irql);
+    ASSERT(Address != NULL);
+    if (ToCluster)
+    {
+        RtlCopyMemory(ClusterPage, Address, PAGE_SIZE);
+    }
+    else
+    {
+        RtlCopyMemory(Address, ClusterPage, PAGE_SIZE);
+    }
+    MiUnmapPageInHyperSpace(Process, Address, Irql);
+}
+
+/*
+ * Called with the cluster lock held and the write cluster idle. The lock is
+ * dropped for the write, so the caller must recheck the clusters afterwards.
+ */
+static
+NTSTATUS
+MiFlushSwapWriteCluster(VOID)
+{
+    NTSTATUS Status;
+    ULONG Count = MiSwapWriteCluster.Count;
+
+    ASSERT(MiSwapWriteCluster.IoCount == 0);
+    if (Count == 0)
+    {
+        return STATUS_SUCCESS;
+    }
+
+    /* Readers may still copy the staged pages out while they are written */
+    MiSwapWriteCluster.IoCount = Count;
+    KeClearEvent(&MiSwapWriteCluster.IoDone);
+    KeReleaseGuardedMutex(&MiSwapClusterLock);
+
+    Status = MiSwapClusterIo(&MiSwapWriteCluster, Count, TRUE);
+
+    KeAcquireGuardedMutex(&MiSwapClusterLock);
+    ASSERT(MiSwapWriteCluster.Count == Count);
+    if (NT_SUCCESS(Status))
+    {
+        MiSwapWriteCluster.Count = 0;
+    }
+    else
+    {
+        /* The cluster holds the only copy of these pages, keep it for a retry */
+        DPRINT1("MM: Failed to write %lu pages to paging file %lu (Status was 0x%.8X)\n",
+                Count, MiSwapWriteCluster.PageFileIndex, Status);
+    }
+    MiSwapWriteCluster.IoCount = 0;
+    KeSetEvent(&MiSwapWriteCluster.IoDone, IO_NO_INCREMENT, FALSE);
+
+    return Status;
+}
+
+VOID
+NTAPI
+MmFlushSwapPages(VOID)
+{
+    if (MiSwapWriteCluster.Buffer == NULL)
+    {
+        return;
+    }
+
+    KeAcquireGuardedMutex(&MiSwapClusterLock);
+    while (MiSwapWriteCluster.IoCount != 0)
+    {
+        MiWaitForSwapClusterIo(&MiSwapWriteCluster);
+    }
+    MiFlushSwapWriteCluster();
+    KeReleaseGuardedMutex(&MiSwapClusterLock);
+}
+
+NTSTATUS
+NTAPI
+MmWriteToSwapPage(SWAPENTRY SwapEntry, PFN_NUMBER Page)
+{
+    ULONG i;
+    ULONG_PTR offset;
+    NTSTATUS Status;
+
     DPRINT("MmWriteToSwapPage\n");
 
     if (SwapEntry == 0)
@@ -159,29 +420,72 @@ MmWriteToSwapPage(SWAPENTRY SwapEntry, PFN_NUMBER Page)
         KeBugCheck(MEMORY_MANAGEMENT);
     }
 
-    MmInitializeMdl(Mdl, NULL, PAGE_SIZE);
-    MmBuildMdlFromPages(Mdl, &Page);
-    Mdl->MdlFlags |= MDL_PAGES_LOCKED;
+    if (MiSwapWriteCluster.Buffer == NULL)
+    {
+        return MiPageFileIoPage(i, offset, Page, TRUE);
+    }
 
-    file_offset.QuadPart = offset * PAGE_SIZE;
+    KeAcquireGuardedMutex(&MiSwapClusterLock);
 
-    KeInitializeEvent(&Event, NotificationEvent, FALSE);
-    Status = IoSynchronousPageWrite(MmPagingFile[i]->FileObject,
-                                    Mdl,
-                                    &file_offset,
-                                    &Event,
-                                    &Iosb);
-    if (Status == STATUS_PENDING)
+    for (;;)
     {
-        KeWaitForSingleObject(&Event, Executive, KernelMode, FALSE, NULL);
-        Status = Iosb.Status;
+        MiInvalidateSwapReadCluster(i, offset);
+
+        /* The staged pages must not change while they are written out */
+        if (MiSwapWriteCluster.IoCount != 0)
+        {
+            MiWaitForSwapClusterIo(&MiSwapWriteCluster);
+            continue;
+        }
+
+        /* A slot that is still staged only needs its copy refreshed */
+        if (MiSwapClusterContains(&MiSwapWriteCluster, i, offset))
+        {
+            MiCopySwapClusterPage(&MiSwapWriteCluster, offset, Page, TRUE);
+            KeReleaseGuardedMutex(&MiSwapClusterLock);
+            return(STATUS_SUCCESS);
+        }
+
+        /* Done unless the staged pages must be written out first */
+        if (MiSwapWriteCluster.Count != MI_SWAP_CLUSTER_PAGES &&
+            (MiSwapWriteCluster.Count == 0 ||
+             (MiSwapWriteCluster.PageFileIndex == i &&
+              MiSwapWriteCluster.FirstOffset + MiSwapWriteCluster.Count == offset)))
+        {
+            break;
+        }
+
+        Status = MiFlushSwapWriteCluster();
+        if (!NT_SUCCESS(Status))
+        {
+            /* The staged pages wait for the next flush, write this one alone */
+            KeReleaseGuardedMutex(&MiSwapClusterLock);
+            Status = MiPageFileIoPage(i, offset, Page, TRUE);
+
+            /* Someone may have read the old contents ahead in the meantime */
+            KeAcquireGuardedMutex(&MiSwapClusterLock);
+            MiInvalidateSwapReadCluster(i, offset);
+            KeReleaseGuardedMutex(&MiSwapClusterLock);
+            return(Status);
+        }
     }
 
-    if (Mdl->MdlFlags & MDL_MAPPED_TO_SYSTEM_VA)
+    if (MiSwapWriteCluster.Count == 0)
     {
-        MmUnmapLockedPages (Mdl->MappedSystemVa, Mdl);
+        MiSwapWriteCluster.PageFileIndex = i;
+        MiSwapWriteCluster.FirstOffset = offset;
     }
-    return(Status);
+    MiSwapWriteCluster.Count++;
+    MiCopySwapClusterPage(&MiSwapWriteCluster, offset, Page, TRUE);
+
+    /* The page is safe in the cluster even if writing it out fails now */
+    if (MiSwapWriteCluster.Count == MI_SWAP_CLUSTER_PAGES)
+    {
+        MiFlushSwapWriteCluster();
+    }
+
+    KeReleaseGuardedMutex(&MiSwapClusterLock);
+    return(STATUS_SUCCESS);
 }
 
 
@@ -199,13 +503,9 @@ MiReadPageFile(
     _In_ ULONG PageFileIndex,
     _In_ ULONG_PTR PageFileOffset)
 {
-    LARGE_INTEGER file_offset;
-    IO_STATUS_BLOCK Iosb;
     NTSTATUS Status;
-    KEVENT Event;
-    UCHAR MdlBase[sizeof(MDL) + sizeof(ULONG)];
-    PMDL Mdl = (PMDL)MdlBase;
     PMMPAGING_FILE PagingFile;
+    ULONG_PTR First, Last;
 
     DPRINT("MiReadSwapFile\n");
 
@@ -225,28 +525,90 @@ MiReadPageFile(
         KeBugCheck(MEMORY_MANAGEMENT);
     }
 
-    MmInitializeMdl(Mdl, NULL, PAGE_SIZE);
-    MmBuildMdlFromPages(Mdl, &Page);
-    Mdl->MdlFlags |= MDL_PAGES_LOCKED;
-
-    file_offset.QuadPart = PageFileOffset * PAGE_SIZE;
-
-    KeInitializeEvent(&Event, NotificationEvent, FALSE);
-    Status = IoPageRead(PagingFile->FileObject,
-                        Mdl,
-                        &file_offset,
-                        &Event,
-                        &Iosb);
-    if (Status == STATUS_PENDING)
+    if (MiSwapReadCluster.Buffer == NULL || PageFileOffset >= PagingFile->Size)
     {
-        KeWaitForSingleObject(&Event, Executive, KernelMode, FALSE, NULL);
-        Status = Iosb.Status;
+        return MiPageFileIoPage(PageFileIndex, PageFileOffset, Page, FALSE);
     }
-    if (Mdl->MdlFlags & MDL_MAPPED_TO_SYSTEM_VA)
+
+    /* Read the aligned run of slots around the faulting one, skipping the header */
+    First = max(PageFileOffset & ~(ULONG_PTR)(MI_SWAP_CLUSTER_PAGES - 1), 1);
+    Last = min((PageFileOffset | (MI_SWAP_CLUSTER_PAGES - 1)) + 1, PagingFile->Size);
+
+    KeAcquireGuardedMutex(&MiSwapClusterLock);
+
+    for (;;)
     {
-        MmUnmapLockedPages (Mdl->MappedSystemVa, Mdl);
+        /* Pages not written out yet, or read along with a previous fault */
+        if (MiSwapClusterContains(&MiSwapWriteCluster, PageFileIndex, PageFileOffset))
+        {
+            MiCopySwapClusterPage(&MiSwapWriteCluster, PageFileOffset, Page, FALSE);
+            KeReleaseGuardedMutex(&MiSwapClusterLock);
+            return(STATUS_SUCCESS);
+        }
+        if (MiSwapClusterContains(&MiSwapReadCluster, PageFileIndex, PageFileOffset))
+        {
+            MiCopySwapClusterPage(&MiSwapReadCluster, PageFileOffset, Page, FALSE);
+            KeReleaseGuardedMutex(&MiSwapClusterLock);
+            return(STATUS_SUCCESS);
+        }
+
+        /* Another fault is filling the read cluster, it may bring this slot in too */
+        if (MiSwapReadCluster.IoCount != 0)
+        {
+            MiWaitForSwapClusterIo(&MiSwapReadCluster);
+            continue;
+        }
+
+        /* The disk must not be older than the staged pages we are about to read */
+        if (MiSwapWriteCluster.Count != 0 &&
+            MiSwapWriteCluster.PageFileIndex == PageFileIndex &&
+            MiSwapWriteCluster.FirstOffset < Last &&
+            MiSwapWriteCluster.FirstOffset + MiSwapWriteCluster.Count > First)
+        {
+            if (MiSwapWriteCluster.IoCount != 0)
+            {
+                MiWaitForSwapClusterIo(&MiSwapWriteCluster);
+                continue;
+            }
+
+            Status = MiFlushSwapWriteCluster();
+            if (!NT_SUCCESS(Status))
+            {
+                break;
+            }
+            continue;
+        }
+
+        /* Claim the read cluster and fill it without holding the lock */
+        MiSwapReadCluster.Count = 0;
+        MiSwapReadCluster.PageFileIndex = PageFileIndex;
+        MiSwapReadCluster.FirstOffset = First;
+        MiSwapReadCluster.IoCount = (ULONG)(Last - First);
+        MiSwapReadCluster.Discard = FALSE;
+        KeClearEvent(&MiSwapReadCluster.IoDone);
+        KeReleaseGuardedMutex(&MiSwapClusterLock);
+
+        Status = MiSwapClusterIo(&MiSwapReadCluster, (ULONG)(Last - First), FALSE);
+
+        KeAcquireGuardedMutex(&MiSwapClusterLock);
+        if (NT_SUCCESS(Status) && !MiSwapReadCluster.Discard)
+        {
+            MiSwapReadCluster.Count = MiSwapReadCluster.IoCount;
+        }
+        MiSwapReadCluster.IoCount = 0;
+        KeSetEvent(&MiSwapReadCluster.IoDone, IO_NO_INCREMENT, FALSE);
+
+        /* On success the slot is now found in one of the clusters */
+        if (!NT_SUCCESS(Status))
+        {
+            break;
+        }
     }
-    return(Status);
+
+    KeReleaseGuardedMutex(&MiSwapClusterLock);
+
+    /* Fall back to reading the faulting page alone */
+    return MiPageFileIoPage(PageFileIndex, PageFileOffset, Page, FALSE);
 }
 
 CODE_SEG("INIT")
@@ -257,6 +619,9 @@ MmInitPagingFile(VOID)
     ULONG i;
 
     KeInitializeGuardedMutex(&MmPageFileCreationLock);
+    KeInitializeGuardedMutex(&MiSwapClusterLock);
+    KeInitializeEvent(&MiSwapWriteCluster.IoDone, NotificationEvent, TRUE);
+    KeInitializeEvent(&MiSwapReadCluster.IoDone, NotificationEvent, TRUE);
 
     MiFreeSwapPages = 0;
     MiUsedSwapPages = 0;
@@ -288,7 +653,7 @@ MmFreeSwapPage(SWAPENTRY Entry)
         KeBugCheck(MEMORY_MANAGEMENT);
     }
 
-    RtlClearBit(PagingFile->Bitmap, off >> 5);
+    RtlClearBit(PagingFile->Bitmap, (ULONG)off);
 
     PagingFile->FreeSpace++;
     PagingFile->CurrentUsage--;
@@ -320,13 +685,18 @@ MmAllocSwapPage(VOID)
         if (MmPagingFile[i] != NULL &&
                 MmPagingFile[i]->FreeSpace >= 1)
         {
-            off = RtlFindClearBitsAndSet(MmPagingFile[i]->Bitmap, 1, 0);
+            /* Continue after the last slot handed out, so that pages paged
+             * out together get consecutive slots and can be clustered */
+            off = RtlFindClearBitsAndSet(MmPagingFile[i]->Bitmap, 1, MmPagingFile[i]->HintIndex);
             if (off == 0xFFFFFFFF)
             {
                 KeBugCheck(MEMORY_MANAGEMENT);
                 KeReleaseGuardedMutex(&MmPageFileCreationLock);
                 return(STATUS_UNSUCCESSFUL);
             }
+            MmPagingFile[i]->HintIndex = off + 1;
+            MmPagingFile[i]->FreeSpace--;
+            MmPagingFile[i]->CurrentUsage++;
             MiUsedSwapPages++;
             MiFreeSwapPages--;
             KeReleaseGuardedMutex(&MmPageFileCreationLock);
@@ -784,6 +1154,32 @@ NtCreatePagingFile(IN PUNICODE_STRING FileName,
                         (ULONG)(PagingFile->MaximumSize));
     RtlClearAllBits(PagingFile->Bitmap);
 
+    /* Keep the header and the space beyond the end of the file out of reach */
+    RtlSetBit(PagingFile->Bitmap, 0);
+    if (PagingFile->MaximumSize > PagingFile->Size)
+    {
+        RtlSetBits(PagingFile->Bitmap,
+                   (ULONG)PagingFile->Size,
+                   (ULONG)(PagingFile->MaximumSize - PagingFile->Size));
+    }
+    PagingFile->HintIndex = 1;
+
+    /* Set up the I/O clusters with the first paging file */
+    KeAcquireGuardedMutex(&MiSwapClusterLock);
+    if (MiSwapWriteCluster.Buffer == NULL)
+    {
+        MiSwapWriteCluster.Buffer = ExAllocatePoolWithTag(NonPagedPool,
+                                                          MI_SWAP_CLUSTER_PAGES * PAGE_SIZE,
+                                                          TAG_MM);
+    }
+    if (MiSwapReadCluster.Buffer == NULL)
+    {
+        MiSwapReadCluster.Buffer = ExAllocatePoolWithTag(NonPagedPool,
+                                                         MI_SWAP_CLUSTER_PAGES * PAGE_SIZE,
+                                                         TAG_MM);
+    }
+    KeReleaseGuardedMutex(&MiSwapClusterLock);
+
     /* FIXME: should be calling unsafe instead,
      * we should already be in a guarded region
      */
@@ -230,6 +230,56 @@ MmSetDirtyAllRmaps(PFN_NUMBER Page)
     ExReleaseFastMutex(&RmapListLock);
 }
 
+BOOLEAN
+NTAPI
+MmIsAccessedAndResetAccessRmaps(PFN_NUMBER Page, PBOOLEAN InMinimumWorkingSet)
+{
+    PMM_RMAP_ENTRY current_entry;
+    PEPROCESS Process;
+    BOOLEAN Accessed = FALSE, Mapped = FALSE, AboveMinimum = FALSE;
+
+    ExAcquireFastMutex(&RmapListLock);
+    current_entry = MmGetRmapListHeadPage(Page);
+    while (current_entry != NULL)
+    {
+        if (!RMAP_IS_SEGMENT(current_entry->Address))
+        {
+            /*
+             * Reset every mapping, so the next sample only sees new accesses.
+             * Nothing stops the owner from exiting, so keep its address space
+             * alive while we look at its page tables.
+             */
+            Process = current_entry->Process;
+            if (!Process)
+            {
+                if (MmIsAccessedAndResetAccessPage(NULL, current_entry->Address))
+                    Accessed = TRUE;
+            }
+            else if (ExAcquireRundownProtection(&Process->RundownProtect))
+            {
+                if (MmIsAccessedAndResetAccessPage(Process, current_entry->Address))
+                    Accessed = TRUE;
+                ExReleaseRundownProtection(&Process->RundownProtect);
+            }
+
+            /* Vm.WorkingSetSize is counted in bytes, the minimum in pages */
+            Process = current_entry->Process ? current_entry->Process : PsInitialSystemProcess;
+            Mapped = TRUE;
+            if (!Process ||
+                Process->Vm.WorkingSetSize > (Process->Vm.MinimumWorkingSetSize << PAGE_SHIFT))
+            {
+                AboveMinimum = TRUE;
+            }
+        }
+        current_entry = current_entry->Next;
+    }
+    ExReleaseFastMutex(&RmapListLock);
+
+    /* Only pages every owner needs to stay at its minimum are protected */
+    *InMinimumWorkingSet = Mapped && !AboveMinimum;
+    return Accessed;
+}
+
 BOOLEAN
 NTAPI
 MmIsDirtyPageRmap(PFN_NUMBER Page)
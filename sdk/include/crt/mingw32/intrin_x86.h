@@ -120,6 +120,20 @@ __INTRIN_INLINE void _mm_sfence(void)
 }
 #endif
 
+#if !HAS_BUILTIN(_mm_stream_si32)
+__INTRIN_INLINE void _mm_stream_si32(int * Destination, int Value)
+{
+	__asm__ __volatile__("movnti %k1, %0" : "=m"(*Destination) : "r"(Value));
+}
+#endif
+
+#if defined(__x86_64__) && !HAS_BUILTIN(_mm_stream_si64x)
+__INTRIN_INLINE void _mm_stream_si64x(long long * Destination, long long Value)
+{
+	__asm__ __volatile__("movnti %q1, %0" : "=m"(*Destination) : "r"(Value));
+}
+#endif
+
 #ifdef __x86_64__
 __INTRIN_INLINE void __faststorefence(void)
 {
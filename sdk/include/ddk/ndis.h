@@ -2885,14 +2885,12 @@ NTAPI
 NdisFreeBufferPool(
   _In_ NDIS_HANDLE PoolHandle);
 
-/*
+_IRQL_requires_max_(DISPATCH_LEVEL)
 NDISAPI
 VOID
 NTAPI
 NdisFreeBuffer(
-  IN PNDIS_BUFFER Buffer);
-*/
-#define NdisFreeBuffer IoFreeMdl
+  _In_ PNDIS_BUFFER Buffer);
 
 _IRQL_requires_max_(DISPATCH_LEVEL)
 NDISAPI
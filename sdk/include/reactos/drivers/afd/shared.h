@@ -114,6 +114,30 @@ typedef struct _AFD_SEND_INFO_UDP {
 
 C_ASSERT(sizeof(AFD_RECV_INFO) == sizeof(AFD_SEND_INFO));
 
+/* Maximum number of datagrams moved by one IOCTL_AFD_RECV_DATAGRAMS or
+ * IOCTL_AFD_SEND_DATAGRAMS request */
+#define AFD_MAX_DATAGRAM_BATCH          64
+/* Maximum sockaddr length accepted for a batched send */
+#define AFD_MAX_DATAGRAM_ADDRESS        128
+
+/* Datagram was truncated to the buffer length (same value as MSG_PARTIAL) */
+#define AFD_DATAGRAM_PARTIAL            0x8000
+
+typedef struct _AFD_DATAGRAM_MSG {
+    AFD_WSABUF				Buffer;
+    PVOID				Address;
+    INT					AddressLength;
+    ULONG				Length;
+    ULONG				Flags;
+} AFD_DATAGRAM_MSG, *PAFD_DATAGRAM_MSG;
+
+typedef struct _AFD_DATAGRAMS_INFO {
+    PAFD_DATAGRAM_MSG			Messages;
+    ULONG				MessageCount;
+    ULONG				AfdFlags;
+    ULONG				TdiFlags;
+} AFD_DATAGRAMS_INFO, *PAFD_DATAGRAMS_INFO;
+
 typedef struct  _AFD_CONNECT_INFO {
     BOOLEAN				UseSAN;
     ULONG				Root;
@@ -186,6 +210,8 @@ typedef struct _AFD_TDI_HANDLE_DATA
 #define AFD_INFO_SEND_WINDOW_SIZE	0x07L
 #define AFD_INFO_GROUP_ID_TYPE	        0x10L
 #define AFD_INFO_RECEIVE_CONTENT_SIZE   0x11L
+#define AFD_INFO_RECEIVE_DIRECT_BYTES   0x12L
+#define AFD_INFO_RECEIVE_BUFFERED_BYTES 0x13L
 
 /* AFD Share Flags */
 #define AFD_SHARE_UNIQUE		0x0L
@@ -261,6 +287,8 @@ typedef struct _AFD_TDI_HANDLE_DATA
 #define AFD_DEFER_ACCEPT		35
 #define AFD_GET_PENDING_CONNECT_DATA	41
 #define AFD_VALIDATE_GROUP		42
+#define AFD_RECV_DATAGRAMS		43
+#define AFD_SEND_DATAGRAMS		44
 
 /* AFD IOCTLs */
 
@@ -336,6 +364,10 @@ typedef struct _AFD_TDI_HANDLE_DATA
   _AFD_CONTROL_CODE(AFD_ENUM_NETWORK_EVENTS, METHOD_NEITHER)
 #define IOCTL_AFD_VALIDATE_GROUP \
   _AFD_CONTROL_CODE(AFD_VALIDATE_GROUP, METHOD_NEITHER)
+#define IOCTL_AFD_RECV_DATAGRAMS \
+  _AFD_CONTROL_CODE(AFD_RECV_DATAGRAMS, METHOD_NEITHER)
+#define IOCTL_AFD_SEND_DATAGRAMS \
+  _AFD_CONTROL_CODE(AFD_SEND_DATAGRAMS, METHOD_NEITHER)
 
 typedef struct _AFD_SOCKET_INFORMATION {
     BOOL CommandChannel;
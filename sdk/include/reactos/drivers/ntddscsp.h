@@ -0,0 +1,59 @@
+/*
+ * PROJECT:     ReactOS Storage Stack / SCSIPORT storage port library
+ * LICENSE:     GPL-2.0-or-later (https://spdx.org/licenses/GPL-2.0-or-later)
+ * PURPOSE:     ReactOS specific SCSI port IOCTLs
+ */
+
+#ifndef _NTDDSCSP_H_
+#define _NTDDSCSP_H_
+
+#include <ntddscsi.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//
+// Returns a SCSI_ADAPTER_STATISTICS with the statistics of every LUN of a SCSI port
+//
+#define IOCTL_SCSI_GET_LUN_STATISTICS \
+    CTL_CODE(IOCTL_SCSI_BASE, 0x0800, METHOD_BUFFERED, FILE_ANY_ACCESS)
+
+//
+// The 64-bit members come first and the padding is explicit, so that the layout
+// doesn't depend on how the compiler aligns them (GCC on i386 only uses 4 bytes)
+//
+typedef struct _SCSI_LUN_STATISTICS
+{
+    ULONGLONG RequestCount;
+    ULONGLONG TotalLatency;
+    ULONGLONG MaxLatency;
+    ULONG QueueCount;
+    ULONG PeakQueueCount;
+    UCHAR PathId;
+    UCHAR TargetId;
+    UCHAR Lun;
+    UCHAR Reserved[5];
+} SCSI_LUN_STATISTICS, *PSCSI_LUN_STATISTICS;
+
+typedef struct _SCSI_ADAPTER_STATISTICS
+{
+    // Frequency of the counter the latencies are measured with
+    LARGE_INTEGER LatencyFrequency;
+    // Number of LUNs on the port, even if not all of them fit in the buffer
+    ULONG NumberOfLuns;
+    ULONG Reserved;
+    SCSI_LUN_STATISTICS Luns[ANYSIZE_ARRAY];
+} SCSI_ADAPTER_STATISTICS, *PSCSI_ADAPTER_STATISTICS;
+
+C_ASSERT(FIELD_OFFSET(SCSI_LUN_STATISTICS, QueueCount) == 0x18);
+C_ASSERT(FIELD_OFFSET(SCSI_LUN_STATISTICS, PathId) == 0x20);
+C_ASSERT(sizeof(SCSI_LUN_STATISTICS) == 0x28);
+C_ASSERT(FIELD_OFFSET(SCSI_ADAPTER_STATISTICS, NumberOfLuns) == 0x08);
+C_ASSERT(FIELD_OFFSET(SCSI_ADAPTER_STATISTICS, Luns) == 0x10);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _NTDDSCSP_H_ */
@@ -15,5 +15,35 @@ typedef struct _NS_ROUTINE {
     DWORD        dwPriority;
 } NS_ROUTINE, *PNS_ROUTINE, * FAR LPNS_ROUTINE;
 
+/* Batched datagram I/O, queried through SIO_GET_EXTENSION_FUNCTION_POINTER.
+ * Both functions return the number of messages transferred or SOCKET_ERROR. */
+typedef struct _WSAMMSG {
+    WSABUF buf;          /* Datagram payload */
+    LPSOCKADDR name;     /* Peer address, NULL for a connected socket */
+    INT namelen;         /* Size of name; receive updates it */
+    DWORD dwBytes;       /* Bytes sent or received */
+    DWORD dwFlags;       /* MSG_PARTIAL if a received datagram was truncated */
+} WSAMMSG, *PWSAMMSG, FAR *LPWSAMMSG;
+
+typedef INT
+(PASCAL FAR *LPFN_WSARECVMMSG)(
+    SOCKET s,
+    LPWSAMMSG lpMessages,
+    DWORD dwMessageCount,
+    DWORD dwFlags);
+
+#define WSAID_WSARECVMMSG \
+  {0x0cb8d731,0x2673,0x4d96,{0xaa,0x04,0xa2,0xb1,0x61,0x3d,0x20,0x85}}
+
+typedef INT
+(PASCAL FAR *LPFN_WSASENDMMSG)(
+    SOCKET s,
+    LPWSAMMSG lpMessages,
+    DWORD dwMessageCount,
+    DWORD dwFlags);
+
+#define WSAID_WSASENDMMSG \
+  {0x0b0f41c6,0x4331,0x4360,{0x95,0xc8,0xff,0x4e,0xa0,0xf9,0xd6,0x84}}
+
 #endif
 
@@ -78,7 +78,9 @@ VOID LoopTransmit(
 
             IPPacket->MappedHeader = TRUE;
 
-            if (!ChewCreate(LoopPassiveWorker, IPPacket))
+            if (!IPQueueReceiveWork(IPHashPacketFlow(XmitPacket, 0, TRUE),
+                                    LoopPassiveWorker,
+                                    IPPacket))
             {
                 IPPacket->Free(IPPacket);
                 ExFreePool(IPPacket);
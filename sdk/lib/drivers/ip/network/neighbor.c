@@ -10,7 +10,40 @@
 
 #include "precomp.h"
 
-NEIGHBOR_CACHE_TABLE NeighborCache[NB_HASHMASK + 1];
+NEIGHBOR_CACHE_TABLE NeighborCache;
+
+/* Buckets used until the table first grows */
+static PNEIGHBOR_CACHE_ENTRY NBInitialBuckets[NB_INITIAL_HASH_SIZE];
+
+C_ASSERT(NB_LOCK_COUNT <= NB_INITIAL_HASH_SIZE);
+
+/* Lock protecting the bucket of a hash value */
+#define NB_LOCK(HashValue) \
+    (&NeighborCache.Lock[(HashValue) & (NB_LOCK_COUNT - 1)])
+
+/* Bucket of a hash value, the bucket lock must be held */
+#define NB_BUCKET(HashValue) \
+    (&NeighborCache.Buckets[(HashValue) & NeighborCache.HashMask])
+
+static ULONG NBHashAddress(PIP_ADDRESS Address)
+/*
+ * FUNCTION: Computes the hash value of an IP address
+ * ARGUMENTS:
+ *   Address = Pointer to IP address
+ * RETURNS:
+ *   Hash value, mask it with the table hash mask to get a bucket
+ */
+{
+    ULONG HashValue = *(PULONG)&Address->Address;
+
+    /* Mix all bytes into the low bits, neighbors usually share the
+     * network part of their address */
+    HashValue ^= HashValue >> 16;
+    HashValue *= 0x9E3779B1;
+    HashValue ^= HashValue >> 16;
+
+    return HashValue;
+}
 
 VOID NBCompleteSend( PVOID Context,
 		     PNDIS_PACKET NdisPacket,
@@ -28,20 +61,29 @@ VOID NBCompleteSend( PVOID Context,
 VOID NBSendPackets( PNEIGHBOR_CACHE_ENTRY NCE ) {
     PLIST_ENTRY PacketEntry;
     PNEIGHBOR_PACKET Packet;
-    UINT HashValue;
+    PKSPIN_LOCK Lock;
+    KIRQL OldIrql;
 
     ASSERT(!(NCE->State & NUD_INCOMPLETE));
 
-    HashValue  = *(PULONG)(&NCE->Address.Address);
-    HashValue ^= HashValue >> 16;
-    HashValue ^= HashValue >> 8;
-    HashValue ^= HashValue >> 4;
-    HashValue &= NB_HASHMASK;
+    Lock = NB_LOCK(NBHashAddress(&NCE->Address));
 
     /* Send any waiting packets */
-    while ((PacketEntry = ExInterlockedRemoveHeadList(&NCE->PacketQueue,
-                                              &NeighborCache[HashValue].Lock)) != NULL)
+    for (;;)
     {
+        TcpipAcquireSpinLock(Lock, &OldIrql);
+
+        if (IsListEmpty(&NCE->PacketQueue))
+        {
+            TcpipReleaseSpinLock(Lock, OldIrql);
+            break;
+        }
+
+        PacketEntry = RemoveHeadList(&NCE->PacketQueue);
+        NCE->PacketCount--;
+
+        TcpipReleaseSpinLock(Lock, OldIrql);
+
 	Packet = CONTAINING_RECORD( PacketEntry, NEIGHBOR_PACKET, Next );
 
 	TI_DbgPrint
@@ -86,6 +128,124 @@ VOID NBFlushPacketQueue( PNEIGHBOR_CACHE_ENTRY NCE,
 
 	ExFreePoolWithTag( Packet, NEIGHBOR_PACKET_TAG );
     }
+
+    NCE->PacketCount = 0;
+}
+
+static BOOLEAN NBAgeNeighbor(
+    PNEIGHBOR_CACHE_ENTRY NCE,
+    PNDIS_STATUS Status)
+/*
+ * FUNCTION: Ages a neighbor cache entry
+ * ARGUMENTS:
+ *   NCE    = Pointer to NCE to age
+ *   Status = Address of buffer for the status to fail queued packets with
+ * RETURNS:
+ *   TRUE if the NCE timed out and must be destroyed, FALSE otherwise
+ * NOTES:
+ *   Must be called with the lock of the NCE's bucket held. The age is
+ *   derived from time stamps, so the NCE doesn't need to be visited on
+ *   every tick
+ */
+{
+    ULONG Age = NeighborCache.CurrentTime - NCE->LastEvent;
+
+    if (NCE->State & NUD_INCOMPLETE)
+    {
+        /* Solicit for an address */
+        NBSendSolicit(NCE);
+        if (NCE->EventTimer == 0 && Age >= ARP_INCOMPLETE_TIMEOUT)
+        {
+            NBFlushPacketQueue(NCE, NDIS_STATUS_NETWORK_UNREACHABLE);
+            NCE->LastEvent = NeighborCache.CurrentTime;
+        }
+    }
+
+    /* Check if event timer is running */
+    if (NCE->EventTimer > 0)
+    {
+        ASSERT(!(NCE->State & NUD_PERMANENT));
+
+        if (Age >= NCE->EventTimer)
+        {
+            /* Choose the proper failure status */
+            if (NCE->State & NUD_INCOMPLETE)
+            {
+                /* We couldn't get an address to this IP at all */
+                *Status = NDIS_STATUS_HOST_UNREACHABLE;
+            }
+            else
+            {
+                /* This guy was stale for way too long */
+                *Status = NDIS_STATUS_REQUEST_ABORTED;
+            }
+
+            return TRUE;
+        }
+
+        if (Age >= ARP_RATE)
+        {
+            /* We haven't gotten a packet from them in
+             * Age seconds so we mark them as stale
+             * and solicit now */
+            NCE->State |= NUD_STALE;
+            NBSendSolicit(NCE);
+        }
+    }
+
+    return FALSE;
+}
+
+static VOID NBGrowTable(VOID)
+/*
+ * FUNCTION: Doubles the number of buckets of the neighbor cache
+ * NOTES:
+ *   Must be called at DISPATCH_LEVEL. The table is left untouched
+ *   if there is not enough free resources
+ */
+{
+    PNEIGHBOR_CACHE_ENTRY *NewBuckets, *OldBuckets;
+    PNEIGHBOR_CACHE_ENTRY NCE;
+    ULONG NewHashMask, HashValue, i;
+
+    NewHashMask = (NeighborCache.HashMask << 1) | 1;
+
+    NewBuckets = ExAllocatePoolWithTag(NonPagedPool,
+                                       (NewHashMask + 1) * sizeof(PNEIGHBOR_CACHE_ENTRY),
+                                       NCE_HASH_TAG);
+    if (NewBuckets == NULL)
+        return;
+
+    RtlZeroMemory(NewBuckets, (NewHashMask + 1) * sizeof(PNEIGHBOR_CACHE_ENTRY));
+
+    /* Owning all bucket locks gives us the table for ourselves */
+    for (i = 0; i < NB_LOCK_COUNT; i++)
+        TcpipAcquireSpinLockAtDpcLevel(&NeighborCache.Lock[i]);
+
+    for (i = 0; i <= NeighborCache.HashMask; i++)
+    {
+        while ((NCE = NeighborCache.Buckets[i]) != NULL)
+        {
+            NeighborCache.Buckets[i] = NCE->Next;
+
+            HashValue = NBHashAddress(&NCE->Address) & NewHashMask;
+            NCE->Next = NewBuckets[HashValue];
+            NewBuckets[HashValue] = NCE;
+        }
+    }
+
+    OldBuckets = NeighborCache.Buckets;
+    NeighborCache.Buckets = NewBuckets;
+    NeighborCache.HashMask = NewHashMask;
+    NeighborCache.SweepIndex = 0;
+
+    for (i = NB_LOCK_COUNT; i > 0; i--)
+        TcpipReleaseSpinLockFromDpcLevel(&NeighborCache.Lock[i - 1]);
+
+    TI_DbgPrint(MID_TRACE, ("Neighbor cache grown to %d buckets\n", NewHashMask + 1));
+
+    if (OldBuckets != NBInitialBuckets)
+        ExFreePoolWithTag(OldBuckets, NCE_HASH_TAG);
 }
 
 VOID NBTimeout(VOID)
@@ -93,76 +253,53 @@ VOID NBTimeout(VOID)
  * FUNCTION: Neighbor address cache timeout handler
  * NOTES:
  *     This routine is called by IPTimeout to remove outdated cache
- *     entries.
+ *     entries. Only a slice of the table is aged on each call, so
+ *     every entry is visited once every NB_SWEEP_PERIOD seconds
  */
 {
-    UINT i;
     PNEIGHBOR_CACHE_ENTRY *PrevNCE;
     PNEIGHBOR_CACHE_ENTRY NCE;
     NDIS_STATUS Status;
+    PKSPIN_LOCK Lock;
+    ULONG Bucket, Count;
 
-    for (i = 0; i <= NB_HASHMASK; i++) {
-        TcpipAcquireSpinLockAtDpcLevel(&NeighborCache[i].Lock);
+    NeighborCache.CurrentTime++;
 
-        for (PrevNCE = &NeighborCache[i].Cache;
+    /* Keep the average chain short */
+    if (NeighborCache.EntryCount > (LONG)((NeighborCache.HashMask + 1) * NB_MAX_LOAD) &&
+        NeighborCache.HashMask + 1 < NB_MAX_HASH_SIZE)
+    {
+        NBGrowTable();
+    }
+
+    for (Count = (NeighborCache.HashMask + NB_SWEEP_PERIOD) / NB_SWEEP_PERIOD;
+         Count > 0;
+         Count--)
+    {
+        Lock = NB_LOCK(NeighborCache.SweepIndex);
+        TcpipAcquireSpinLockAtDpcLevel(Lock);
+
+        Bucket = NeighborCache.SweepIndex & NeighborCache.HashMask;
+        NeighborCache.SweepIndex = (Bucket + 1) & NeighborCache.HashMask;
+
+        for (PrevNCE = &NeighborCache.Buckets[Bucket];
              (NCE = *PrevNCE) != NULL;) {
-            if (NCE->State & NUD_INCOMPLETE)
+            if (NBAgeNeighbor(NCE, &Status))
             {
-                /* Solicit for an address */
-                NBSendSolicit(NCE);
-                if (NCE->EventTimer == 0)
-                {
-                    NCE->EventCount++;
-                    if (NCE->EventCount == ARP_INCOMPLETE_TIMEOUT)
-                    {
-                        NBFlushPacketQueue(NCE, NDIS_STATUS_NETWORK_UNREACHABLE);
-                        NCE->EventCount = 0;
-                    }
-                }
-            }
+                /* Unlink and destroy the NCE */
+                *PrevNCE = NCE->Next;
+                InterlockedDecrement(&NeighborCache.EntryCount);
 
-            /* Check if event timer is running */
-            if (NCE->EventTimer > 0)  {
-                ASSERT(!(NCE->State & NUD_PERMANENT));
-                NCE->EventCount++;
+                NBFlushPacketQueue(NCE, Status);
 
-                if ((NCE->EventCount > ARP_RATE &&
-                     NCE->EventCount % ARP_TIMEOUT_RETRANSMISSION == 0) ||
-                    (NCE->EventCount == ARP_RATE))
-                {
-                    /* We haven't gotten a packet from them in
-                     * EventCount seconds so we mark them as stale
-                     * and solicit now */
-                    NCE->State |= NUD_STALE;
-                    NBSendSolicit(NCE);
-                }
-                if (NCE->EventTimer - NCE->EventCount == 0) {
-                    /* Unlink and destroy the NCE */
-                    *PrevNCE = NCE->Next;
-                    
-                    /* Choose the proper failure status */
-                    if (NCE->State & NUD_INCOMPLETE)
-                    {
-                        /* We couldn't get an address to this IP at all */
-                        Status = NDIS_STATUS_HOST_UNREACHABLE;
-                    }
-                    else
-                    {
-                        /* This guy was stale for way too long */
-                        Status = NDIS_STATUS_REQUEST_ABORTED;
-                    }
-                    
-                    NBFlushPacketQueue(NCE, Status);
-
-                    ExFreePoolWithTag(NCE, NCE_TAG);
+                ExFreePoolWithTag(NCE, NCE_TAG);
 
-                    continue;
-                }
+                continue;
             }
             PrevNCE = &NCE->Next;
         }
 
-        TcpipReleaseSpinLockFromDpcLevel(&NeighborCache[i].Lock);
+        TcpipReleaseSpinLockFromDpcLevel(Lock);
     }
 }
 
@@ -175,10 +312,17 @@ VOID NBStartup(VOID)
 
     TI_DbgPrint(DEBUG_NCACHE, ("Called.\n"));
 
-    for (i = 0; i <= NB_HASHMASK; i++) {
-	NeighborCache[i].Cache = NULL;
-	TcpipInitializeSpinLock(&NeighborCache[i].Lock);
-    }
+    RtlZeroMemory(NBInitialBuckets, sizeof(NBInitialBuckets));
+
+    NeighborCache.Buckets = NBInitialBuckets;
+    NeighborCache.HashMask = NB_INITIAL_HASH_SIZE - 1;
+    NeighborCache.EntryCount = 0;
+    NeighborCache.SweepIndex = 0;
+    NeighborCache.CurrentTime = 0;
+    NeighborCache.DroppedPackets = 0;
+
+    for (i = 0; i < NB_LOCK_COUNT; i++)
+	TcpipInitializeSpinLock(&NeighborCache.Lock[i]);
 }
 
 VOID NBShutdown(VOID)
@@ -189,31 +333,43 @@ VOID NBShutdown(VOID)
   PNEIGHBOR_CACHE_ENTRY NextNCE;
   PNEIGHBOR_CACHE_ENTRY CurNCE;
   KIRQL OldIrql;
-  UINT i;
+  UINT i, Bucket;
 
   TI_DbgPrint(DEBUG_NCACHE, ("Called.\n"));
 
   /* Remove possible entries from the cache */
-  for (i = 0; i <= NB_HASHMASK; i++)
+  for (i = 0; i < NB_LOCK_COUNT; i++)
     {
-      TcpipAcquireSpinLock(&NeighborCache[i].Lock, &OldIrql);
+      TcpipAcquireSpinLock(&NeighborCache.Lock[i], &OldIrql);
 
-      CurNCE = NeighborCache[i].Cache;
-      while (CurNCE) {
-          NextNCE = CurNCE->Next;
+      for (Bucket = i; Bucket <= NeighborCache.HashMask; Bucket += NB_LOCK_COUNT)
+        {
+          CurNCE = NeighborCache.Buckets[Bucket];
+          while (CurNCE) {
+              NextNCE = CurNCE->Next;
 
-          /* Flush wait queue */
-	  NBFlushPacketQueue( CurNCE, NDIS_STATUS_NOT_ACCEPTED );
+              /* Flush wait queue */
+	      NBFlushPacketQueue( CurNCE, NDIS_STATUS_NOT_ACCEPTED );
 
-          ExFreePoolWithTag(CurNCE, NCE_TAG);
+              ExFreePoolWithTag(CurNCE, NCE_TAG);
 
-	  CurNCE = NextNCE;
-      }
+	      CurNCE = NextNCE;
+          }
 
-    NeighborCache[i].Cache = NULL;
+          NeighborCache.Buckets[Bucket] = NULL;
+        }
 
-    TcpipReleaseSpinLock(&NeighborCache[i].Lock, OldIrql);
-  }
+      TcpipReleaseSpinLock(&NeighborCache.Lock[i], OldIrql);
+    }
+
+  NeighborCache.EntryCount = 0;
+
+  if (NeighborCache.Buckets != NBInitialBuckets)
+    {
+      ExFreePoolWithTag(NeighborCache.Buckets, NCE_HASH_TAG);
+      NeighborCache.Buckets = NBInitialBuckets;
+      NeighborCache.HashMask = NB_INITIAL_HASH_SIZE - 1;
+    }
 
   TI_DbgPrint(MAX_TRACE, ("Leaving.\n"));
 }
@@ -229,6 +385,8 @@ VOID NBSendSolicit(PNEIGHBOR_CACHE_ENTRY NCE)
 {
     TI_DbgPrint(DEBUG_NCACHE, ("Called. NCE (0x%X).\n", NCE));
 
+    NCE->LastSolicit = NeighborCache.CurrentTime;
+
     ARPTransmit(&NCE->Address,
                 (NCE->State & NUD_INCOMPLETE) ? NULL : NCE->LinkAddress,
                 NCE->Interface);
@@ -239,33 +397,37 @@ VOID NBDestroyNeighborsForInterface(PIP_INTERFACE Interface)
     KIRQL OldIrql;
     PNEIGHBOR_CACHE_ENTRY *PrevNCE;
     PNEIGHBOR_CACHE_ENTRY NCE;
-    ULONG i;
+    ULONG i, Bucket;
 
     KeRaiseIrql(DISPATCH_LEVEL, &OldIrql);
-    for (i = 0; i <= NB_HASHMASK; i++)
+    for (i = 0; i < NB_LOCK_COUNT; i++)
     {
-        TcpipAcquireSpinLockAtDpcLevel(&NeighborCache[i].Lock);
-        
-        for (PrevNCE = &NeighborCache[i].Cache;
-             (NCE = *PrevNCE) != NULL;)
+        TcpipAcquireSpinLockAtDpcLevel(&NeighborCache.Lock[i]);
+
+        for (Bucket = i; Bucket <= NeighborCache.HashMask; Bucket += NB_LOCK_COUNT)
         {
-            if (NCE->Interface == Interface)
+            for (PrevNCE = &NeighborCache.Buckets[Bucket];
+                 (NCE = *PrevNCE) != NULL;)
             {
-                /* Unlink and destroy the NCE */
-                *PrevNCE = NCE->Next;
+                if (NCE->Interface == Interface)
+                {
+                    /* Unlink and destroy the NCE */
+                    *PrevNCE = NCE->Next;
+                    InterlockedDecrement(&NeighborCache.EntryCount);
 
-                NBFlushPacketQueue(NCE, NDIS_STATUS_REQUEST_ABORTED);
-                ExFreePoolWithTag(NCE, NCE_TAG);
+                    NBFlushPacketQueue(NCE, NDIS_STATUS_REQUEST_ABORTED);
+                    ExFreePoolWithTag(NCE, NCE_TAG);
 
-                continue;
-            }
-            else
-            {
-                PrevNCE = &NCE->Next;
+                    continue;
+                }
+                else
+                {
+                    PrevNCE = &NCE->Next;
+                }
             }
         }
-        
-        TcpipReleaseSpinLockFromDpcLevel(&NeighborCache[i].Lock);
+
+        TcpipReleaseSpinLockFromDpcLevel(&NeighborCache.Lock[i]);
     }
     KeLowerIrql(OldIrql);
 }
@@ -322,23 +484,23 @@ PNEIGHBOR_CACHE_ENTRY NBAddNeighbor(
       memset(NCE->LinkAddress, 0xff, LinkAddressLength);
   NCE->State = State;
   NCE->EventTimer = EventTimer;
-  NCE->EventCount = 0;
+  NCE->LastEvent = NeighborCache.CurrentTime;
+  NCE->LastSolicit = NeighborCache.CurrentTime;
   InitializeListHead( &NCE->PacketQueue );
+  NCE->PacketCount = 0;
 
   TI_DbgPrint(MID_TRACE,("NCE: %x\n", NCE));
 
-  HashValue = *(PULONG)&Address->Address;
-  HashValue ^= HashValue >> 16;
-  HashValue ^= HashValue >> 8;
-  HashValue ^= HashValue >> 4;
-  HashValue &= NB_HASHMASK;
+  HashValue = NBHashAddress(Address);
+
+  TcpipAcquireSpinLock(NB_LOCK(HashValue), &OldIrql);
 
-  TcpipAcquireSpinLock(&NeighborCache[HashValue].Lock, &OldIrql);
+  NCE->Next = *NB_BUCKET(HashValue);
+  *NB_BUCKET(HashValue) = NCE;
 
-  NCE->Next = NeighborCache[HashValue].Cache;
-  NeighborCache[HashValue].Cache = NCE;
+  TcpipReleaseSpinLock(NB_LOCK(HashValue), OldIrql);
 
-  TcpipReleaseSpinLock(&NeighborCache[HashValue].Lock, OldIrql);
+  InterlockedIncrement(&NeighborCache.EntryCount);
 
   return NCE;
 }
@@ -362,19 +524,15 @@ VOID NBUpdateNeighbor(
 
     TI_DbgPrint(DEBUG_NCACHE, ("Called. NCE (0x%X)  LinkAddress (0x%X)  State (0x%X).\n", NCE, LinkAddress, State));
 
-    HashValue  = *(PULONG)(&NCE->Address.Address);
-    HashValue ^= HashValue >> 16;
-    HashValue ^= HashValue >> 8;
-    HashValue ^= HashValue >> 4;
-    HashValue &= NB_HASHMASK;
+    HashValue = NBHashAddress(&NCE->Address);
 
-    TcpipAcquireSpinLock(&NeighborCache[HashValue].Lock, &OldIrql);
+    TcpipAcquireSpinLock(NB_LOCK(HashValue), &OldIrql);
 
     RtlCopyMemory(NCE->LinkAddress, LinkAddress, NCE->LinkAddressLength);
     NCE->State = State;
-    NCE->EventCount = 0;
+    NCE->LastEvent = NeighborCache.CurrentTime;
 
-    TcpipReleaseSpinLock(&NeighborCache[HashValue].Lock, OldIrql);
+    TcpipReleaseSpinLock(NB_LOCK(HashValue), OldIrql);
 
     if( !(NCE->State & NUD_INCOMPLETE) )
     {
@@ -392,26 +550,22 @@ NBResetNeighborTimeout(PIP_ADDRESS Address)
 
     TI_DbgPrint(DEBUG_NCACHE, ("Resetting NCE timout for 0x%s\n", A2S(Address)));
 
-    HashValue  = *(PULONG)(&Address->Address);
-    HashValue ^= HashValue >> 16;
-    HashValue ^= HashValue >> 8;
-    HashValue ^= HashValue >> 4;
-    HashValue &= NB_HASHMASK;
+    HashValue = NBHashAddress(Address);
 
-    TcpipAcquireSpinLock(&NeighborCache[HashValue].Lock, &OldIrql);
+    TcpipAcquireSpinLock(NB_LOCK(HashValue), &OldIrql);
 
-    for (NCE = NeighborCache[HashValue].Cache;
+    for (NCE = *NB_BUCKET(HashValue);
          NCE != NULL;
          NCE = NCE->Next)
     {
          if (AddrIsEqual(Address, &NCE->Address))
          {
-             NCE->EventCount = 0;
+             NCE->LastEvent = NeighborCache.CurrentTime;
              break;
          }
     }
 
-    TcpipReleaseSpinLock(&NeighborCache[HashValue].Lock, OldIrql);
+    TcpipReleaseSpinLock(NB_LOCK(HashValue), OldIrql);
 }
 
 PNEIGHBOR_CACHE_ENTRY NBLocateNeighbor(
@@ -436,13 +590,9 @@ PNEIGHBOR_CACHE_ENTRY NBLocateNeighbor(
 
   TI_DbgPrint(DEBUG_NCACHE, ("Called. Address (0x%X).\n", Address));
 
-  HashValue = *(PULONG)&Address->Address;
-  HashValue ^= HashValue >> 16;
-  HashValue ^= HashValue >> 8;
-  HashValue ^= HashValue >> 4;
-  HashValue &= NB_HASHMASK;
+  HashValue = NBHashAddress(Address);
 
-  TcpipAcquireSpinLock(&NeighborCache[HashValue].Lock, &OldIrql);
+  TcpipAcquireSpinLock(NB_LOCK(HashValue), &OldIrql);
 
   /* If there's no adapter specified, we'll look for a match on
    * each one. */
@@ -458,7 +608,7 @@ PNEIGHBOR_CACHE_ENTRY NBLocateNeighbor(
 
   do
   {
-      NCE = NeighborCache[HashValue].Cache;
+      NCE = *NB_BUCKET(HashValue);
       while (NCE != NULL)
       {
          if (NCE->Interface == Interface &&
@@ -479,7 +629,7 @@ PNEIGHBOR_CACHE_ENTRY NBLocateNeighbor(
   if ((NCE == NULL) && (FirstInterface != NULL))
   {
       /* This time we'll even match loopback NCEs */
-      NCE = NeighborCache[HashValue].Cache;
+      NCE = *NB_BUCKET(HashValue);
       while (NCE != NULL)
       {
          if (AddrIsEqual(Address, &NCE->Address))
@@ -491,7 +641,7 @@ PNEIGHBOR_CACHE_ENTRY NBLocateNeighbor(
       }
   }
 
-  TcpipReleaseSpinLock(&NeighborCache[HashValue].Lock, OldIrql);
+  TcpipReleaseSpinLock(NB_LOCK(HashValue), OldIrql);
 
   TI_DbgPrint(MAX_TRACE, ("Leaving.\n"));
 
@@ -550,11 +700,15 @@ BOOLEAN NBQueuePacket(
  *   NdisPacket = Pointer to NDIS packet to queue
  * RETURNS:
  *   TRUE if the packet was successfully queued, FALSE if not
+ * NOTES:
+ *   At most NB_MAX_QUEUED_PACKETS packets are queued on an unresolved
+ *   NCE, further packets are dropped
  */
 {
   KIRQL OldIrql;
   PNEIGHBOR_PACKET Packet;
   UINT HashValue;
+  BOOLEAN Solicit;
 
   TI_DbgPrint
       (DEBUG_NCACHE,
@@ -564,24 +718,38 @@ BOOLEAN NBQueuePacket(
                                   NEIGHBOR_PACKET_TAG );
   if( !Packet ) return FALSE;
 
-  /* FIXME: Should we limit the number of queued packets? */
+  HashValue = NBHashAddress(&NCE->Address);
+
+  TcpipAcquireSpinLock(NB_LOCK(HashValue), &OldIrql);
 
-  HashValue  = *(PULONG)(&NCE->Address.Address);
-  HashValue ^= HashValue >> 16;
-  HashValue ^= HashValue >> 8;
-  HashValue ^= HashValue >> 4;
-  HashValue &= NB_HASHMASK;
+  if( (NCE->State & NUD_INCOMPLETE) &&
+      NCE->PacketCount >= NB_MAX_QUEUED_PACKETS ) {
+      InterlockedIncrement((PLONG)&NeighborCache.DroppedPackets);
+      NCE->Interface->Stats.OutDiscarded++;
 
-  TcpipAcquireSpinLock(&NeighborCache[HashValue].Lock, &OldIrql);
+      TcpipReleaseSpinLock(NB_LOCK(HashValue), OldIrql);
+
+      TI_DbgPrint(MID_TRACE, ("Queue of NCE (0x%X) is full, dropping packet\n", NCE));
+      ExFreePoolWithTag( Packet, NEIGHBOR_PACKET_TAG );
+      return FALSE;
+  }
 
   Packet->Complete = PacketComplete;
   Packet->Context = PacketContext;
   Packet->Packet = NdisPacket;
   InsertTailList( &NCE->PacketQueue, &Packet->Next );
+  NCE->PacketCount++;
 
-  TcpipReleaseSpinLock(&NeighborCache[HashValue].Lock, OldIrql);
+  /* Solicit again on traffic rather than waiting for NBTimeout to
+   * visit this NCE */
+  Solicit = (NCE->State & NUD_INCOMPLETE) &&
+            NeighborCache.CurrentTime != NCE->LastSolicit;
 
-  if( !(NCE->State & NUD_INCOMPLETE) )
+  TcpipReleaseSpinLock(NB_LOCK(HashValue), OldIrql);
+
+  if( Solicit )
+      NBSendSolicit( NCE );
+  else if( !(NCE->State & NUD_INCOMPLETE) )
       NBSendPackets( NCE );
 
   return TRUE;
@@ -604,16 +772,12 @@ VOID NBRemoveNeighbor(
 
   TI_DbgPrint(DEBUG_NCACHE, ("Called. NCE (0x%X).\n", NCE));
 
-  HashValue  = *(PULONG)(&NCE->Address.Address);
-  HashValue ^= HashValue >> 16;
-  HashValue ^= HashValue >> 8;
-  HashValue ^= HashValue >> 4;
-  HashValue &= NB_HASHMASK;
+  HashValue = NBHashAddress(&NCE->Address);
 
-  TcpipAcquireSpinLock(&NeighborCache[HashValue].Lock, &OldIrql);
+  TcpipAcquireSpinLock(NB_LOCK(HashValue), &OldIrql);
 
   /* Search the list and remove the NCE from the list if found */
-  for (PrevNCE = &NeighborCache[HashValue].Cache;
+  for (PrevNCE = NB_BUCKET(HashValue);
     (CurNCE = *PrevNCE) != NULL;
     PrevNCE = &CurNCE->Next)
     {
@@ -621,6 +785,7 @@ VOID NBRemoveNeighbor(
         {
           /* Found it, now unlink it from the list */
           *PrevNCE = CurNCE->Next;
+          InterlockedDecrement(&NeighborCache.EntryCount);
 
 	  NBFlushPacketQueue( CurNCE, NDIS_STATUS_REQUEST_ABORTED );
           ExFreePoolWithTag(CurNCE, NCE_TAG);
@@ -629,7 +794,7 @@ VOID NBRemoveNeighbor(
         }
     }
 
-  TcpipReleaseSpinLock(&NeighborCache[HashValue].Lock, OldIrql);
+  TcpipReleaseSpinLock(NB_LOCK(HashValue), OldIrql);
 }
 
 ULONG NBCopyNeighbors
@@ -638,11 +803,12 @@ ULONG NBCopyNeighbors
 {
   PNEIGHBOR_CACHE_ENTRY CurNCE;
   KIRQL OldIrql;
-  UINT Size = 0, i;
+  UINT Size = 0, i, Bucket;
 
-  for (i = 0; i <= NB_HASHMASK; i++) {
-      TcpipAcquireSpinLock(&NeighborCache[i].Lock, &OldIrql);
-      for( CurNCE = NeighborCache[i].Cache;
+  for (i = 0; i < NB_LOCK_COUNT; i++) {
+      TcpipAcquireSpinLock(&NeighborCache.Lock[i], &OldIrql);
+      for (Bucket = i; Bucket <= NeighborCache.HashMask; Bucket += NB_LOCK_COUNT) {
+      for( CurNCE = NeighborCache.Buckets[Bucket];
 	   CurNCE;
 	   CurNCE = CurNCE->Next ) {
 	  if( CurNCE->Interface == Interface &&
@@ -665,7 +831,8 @@ ULONG NBCopyNeighbors
 	      Size++;
 	  }
       }
-      TcpipReleaseSpinLock(&NeighborCache[i].Lock, OldIrql);
+      }
+      TcpipReleaseSpinLock(&NeighborCache.Lock[i], OldIrql);
   }
   
   return Size;
@@ -17,6 +17,11 @@ KSPIN_LOCK ReassemblyListLock;
 NPAGED_LOOKASIDE_LIST IPDRList;
 NPAGED_LOOKASIDE_LIST IPFragmentList;
 NPAGED_LOOKASIDE_LIST IPHoleList;
+NPAGED_LOOKASIDE_LIST IPReceiveWorkList;
+IP_RECEIVE_QUEUE IPReceiveQueue[IP_MAX_RECEIVE_QUEUES];
+ULONG IPReceiveQueueCount = 0;
+BOOLEAN IPReceiveQueuesStarted = FALSE;
+BOOLEAN IPReceiveQueuesStopping = FALSE;
 
 PIPDATAGRAM_HOLE CreateHoleDescriptor(
   ULONG First,
@@ -678,4 +683,259 @@ VOID IPReceive( PIP_INTERFACE IF, PIP_PACKET IPPacket )
     IPPacket->Free(IPPacket);
 }
 
+static VOID NTAPI IPReceiveQueueThread(
+    PVOID Context)
+/*
+ * FUNCTION: Processes the packets queued on a receive queue
+ * ARGUMENTS:
+ *     Context = Pointer to the receive queue (IP_RECEIVE_QUEUE)
+ */
+{
+    PIP_RECEIVE_QUEUE Queue = Context;
+    PIP_RECEIVE_WORK Work;
+    PLIST_ENTRY ListEntry;
+
+    KeSetSystemAffinityThread((KAFFINITY)1 << Queue->Processor);
+    KeSetPriorityThread(KeGetCurrentThread(), IP_RECEIVE_QUEUE_PRIORITY);
+
+    for (;;) {
+        KeWaitForSingleObject(&Queue->Event, Executive, KernelMode, FALSE, NULL);
+
+        while ((ListEntry = ExInterlockedRemoveHeadList(&Queue->WorkListHead,
+                                                        &Queue->Lock)) != NULL) {
+            InterlockedDecrement(&Queue->Depth);
+
+            Work = CONTAINING_RECORD(ListEntry, IP_RECEIVE_WORK, ListEntry);
+            Work->Worker(Work->Context);
+            ExFreeToNPagedLookasideList(&IPReceiveWorkList, Work);
+
+            Queue->Packets++;
+        }
+
+        if (IPReceiveQueuesStopping)
+            break;
+    }
+
+    PsTerminateSystemThread(STATUS_SUCCESS);
+}
+
+
+NTSTATUS IPStartReceiveQueues(
+    VOID)
+/*
+ * FUNCTION: Creates one receive queue per processor
+ * RETURNS:
+ *     Status of operation
+ * NOTES:
+ *     If no queue could be created, IPQueueReceiveWork falls back
+ *     to system worker threads
+ */
+{
+    PIP_RECEIVE_QUEUE Queue;
+    HANDLE ThreadHandle;
+    NTSTATUS Status;
+    ULONG i, Count;
+
+    ExInitializeNPagedLookasideList(
+      &IPReceiveWorkList,             /* Lookaside list */
+	    NULL,                           /* Allocate routine */
+	    NULL,                           /* Free routine */
+	    0,                              /* Flags */
+	    sizeof(IP_RECEIVE_WORK),        /* Size of each entry */
+	    RECEIVE_WORK_TAG,               /* Tag */
+	    0);                             /* Depth */
+
+    IPReceiveQueuesStarted = TRUE;
+    IPReceiveQueuesStopping = FALSE;
+
+    Count = MIN((ULONG)KeNumberProcessors, IP_MAX_RECEIVE_QUEUES);
+    for (i = 0; i < Count; i++) {
+        Queue = &IPReceiveQueue[i];
+
+        RtlZeroMemory(Queue, sizeof(IP_RECEIVE_QUEUE));
+        InitializeListHead(&Queue->WorkListHead);
+        KeInitializeSpinLock(&Queue->Lock);
+        KeInitializeEvent(&Queue->Event, SynchronizationEvent, FALSE);
+        Queue->Processor = (CCHAR)i;
+
+        Status = PsCreateSystemThread(&ThreadHandle,
+                                      THREAD_ALL_ACCESS,
+                                      NULL,
+                                      NULL,
+                                      NULL,
+                                      IPReceiveQueueThread,
+                                      Queue);
+        if (!NT_SUCCESS(Status)) {
+            TI_DbgPrint(MIN_TRACE, ("Failed to create receive queue thread. Status (0x%X).\n", Status));
+            break;
+        }
+
+        ObReferenceObjectByHandle(ThreadHandle,
+                                  THREAD_ALL_ACCESS,
+                                  *PsThreadType,
+                                  KernelMode,
+                                  (PVOID*)&Queue->Thread,
+                                  NULL);
+        ZwClose(ThreadHandle);
+    }
+
+    IPReceiveQueueCount = i;
+
+    TI_DbgPrint(MID_TRACE, ("Started %d receive queues.\n", IPReceiveQueueCount));
+
+    return (IPReceiveQueueCount != 0) ? STATUS_SUCCESS : STATUS_INSUFFICIENT_RESOURCES;
+}
+
+
+VOID IPStopReceiveQueues(
+    VOID)
+/*
+ * FUNCTION: Processes the remaining packets and destroys the receive queues
+ * NOTES:
+ *     Must be called once no adapter can deliver packets anymore
+ */
+{
+    PIP_RECEIVE_QUEUE Queue;
+    ULONG i, Count;
+
+    if (!IPReceiveQueuesStarted)
+        return;
+
+    Count = IPReceiveQueueCount;
+
+    /* New work goes to the system worker threads from now on */
+    IPReceiveQueueCount = 0;
+    IPReceiveQueuesStopping = TRUE;
+
+    for (i = 0; i < Count; i++) {
+        Queue = &IPReceiveQueue[i];
+
+        KeSetEvent(&Queue->Event, IO_NO_INCREMENT, FALSE);
+        KeWaitForSingleObject(Queue->Thread, Executive, KernelMode, FALSE, NULL);
+        ObDereferenceObject(Queue->Thread);
+        Queue->Thread = NULL;
+
+        TI_DbgPrint(MID_TRACE, ("Receive queue %d: %d packets, %d dropped, max depth %d.\n",
+                                i, Queue->Packets, Queue->Dropped, Queue->MaxDepth));
+    }
+
+    ExDeleteNPagedLookasideList(&IPReceiveWorkList);
+
+    IPReceiveQueuesStarted = FALSE;
+}
+
+
+ULONG IPHashPacketFlow(
+    PNDIS_PACKET NdisPacket,
+    UINT Offset,
+    BOOLEAN Local)
+/*
+ * FUNCTION: Computes the flow hash of a received packet
+ * ARGUMENTS:
+ *     NdisPacket = Pointer to an NDIS packet
+ *     Offset     = Offset of the IP header in the packet
+ *     Local      = TRUE if the packet was sent by this host
+ * RETURNS:
+ *     Hash of the addresses, protocol and ports of the packet
+ * NOTES:
+ *     The hash is symmetric so both directions of a connection map
+ *     to the same value.
+ *     Fragments after the first one carry no ports, and a flow may mix
+ *     fragmented and whole datagrams. Ports are therefore only hashed
+ *     for flows that are never fragmented: packets with the DF bit set,
+ *     and TCP segments sent by this host, which never exceed TCP_MSS.
+ *     Everything else of a flow uses the addresses and protocol only.
+ *     Anything that is not IPv4 hashes to 0
+ */
+{
+    PIPv4_HEADER Header;
+    PCHAR Data = NULL;
+    UINT Size = 0;
+    UINT HeaderSize;
+    USHORT FlagsFragOfs;
+    USHORT UNALIGNED *Ports;
+    ULONG Hash;
+
+    /* Only look at the first buffer, the headers are almost always there */
+    GetDataPtr(NdisPacket, Offset, &Data, &Size);
+    if (!Data || Size < sizeof(IPv4_HEADER))
+        return 0;
+
+    Header = (PIPv4_HEADER)Data;
+    if ((Header->VerIHL >> 4) != 4)
+        return 0;
+
+    Hash = Header->SrcAddr ^ Header->DstAddr ^ Header->Protocol;
+
+    HeaderSize = (Header->VerIHL & 0x0F) << 2;
+    FlagsFragOfs = WN2H(Header->FlagsFragOfs);
+    if ((Header->Protocol == IPPROTO_TCP || Header->Protocol == IPPROTO_UDP) &&
+        ((FlagsFragOfs & IPv4_DF_MASK) ||
+         (Local && Header->Protocol == IPPROTO_TCP)) &&
+        (FlagsFragOfs & (IPv4_MF_MASK | IPv4_FRAGOFS_MASK)) == 0 &&
+        Size >= HeaderSize + 2 * sizeof(USHORT)) {
+        /* Source and destination ports, in either order */
+        Ports = (USHORT UNALIGNED *)(Data + HeaderSize);
+        Hash ^= ((ULONG)(Ports[0] ^ Ports[1])) << 8;
+    }
+
+    Hash *= 0x9E3779B1;
+    return Hash ^ (Hash >> 16);
+}
+
+
+BOOLEAN IPQueueReceiveWork(
+    ULONG FlowHash,
+    VOID (*Worker)(PVOID Context),
+    PVOID Context)
+/*
+ * FUNCTION: Queues the processing of a received packet
+ * ARGUMENTS:
+ *     FlowHash = Flow hash of the packet (see IPHashPacketFlow)
+ *     Worker   = Routine processing the packet
+ *     Context  = Argument for the routine
+ * RETURNS:
+ *     TRUE if the work was queued, FALSE if the packet must be dropped
+ * NOTES:
+ *     May be called at DISPATCH_LEVEL
+ */
+{
+    PIP_RECEIVE_QUEUE Queue;
+    PIP_RECEIVE_WORK Work;
+    ULONG Count;
+    LONG Depth;
+
+    Count = IPReceiveQueueCount;
+    if (Count == 0)
+        return ChewCreate(Worker, Context);
+
+    Queue = &IPReceiveQueue[FlowHash % Count];
+
+    if (Queue->Depth >= IP_MAX_RECEIVE_QUEUE_DEPTH) {
+        TI_DbgPrint(MID_TRACE, ("Receive queue %d is full.\n", Queue->Processor));
+        InterlockedIncrement((PLONG)&Queue->Dropped);
+        return FALSE;
+    }
+
+    Work = ExAllocateFromNPagedLookasideList(&IPReceiveWorkList);
+    if (!Work) {
+        TI_DbgPrint(MIN_TRACE, ("Insufficient resources.\n"));
+        InterlockedIncrement((PLONG)&Queue->Dropped);
+        return FALSE;
+    }
+
+    Work->Worker = Worker;
+    Work->Context = Context;
+
+    Depth = InterlockedIncrement(&Queue->Depth);
+    if ((ULONG)Depth > Queue->MaxDepth)
+        Queue->MaxDepth = Depth;
+
+    /* Only wake the thread up if the queue was empty */
+    if (!ExInterlockedInsertTailList(&Queue->WorkListHead, &Work->ListEntry, &Queue->Lock))
+        KeSetEvent(&Queue->Event, IO_NETWORK_INCREMENT, FALSE);
+
+    return TRUE;
+}
+
 /* EOF */